@@ -0,0 +1,122 @@
+/*
+ altimeter_bench.cpp - MS561101BA samples per second at every OSR, the
+ blocking style getPressure() against the asynchronous D2/D1 pipeline of
+ start() and poll(), on a SimulatedMS5611 on the host I2C bus at 400 kHz.
+
+ A sketch's loop() calls the driver once per pass and does other work in
+ between, here LOOP_US microseconds of virtual time. Each way runs for
+ RUN_US of virtual time:
+
+ getPressure - called every pass, a sample is a result other than 0
+ poll        - start(OSR) once, poll() every pass, a sample is one queued
+ poll 1:4    - start(OSR, 4), the temperature converted before every
+               fourth pressure only
+
+ Besides samples per second the table shows the share of the time the
+ device was converting, the I2C transfers per sample and the pressure of
+ the last sample, which is 1000.09 mbar for the datasheet example the
+ device plays back.
+
+ Build and run from the repository root:
+
+   cmake -S . -B build && cmake --build build --target altimeter_bench
+   ./build/altimeter_bench
+*/
+
+#include <stdio.h>
+
+#include "Arduino.h"
+#include "Wire.h"
+#include "MS561101BA.h"
+#include "SimulatedMS5611.h"
+
+#define LOOP_US 100
+#define RUN_US 2000000UL
+#define I2C_CLOCK 400000
+
+enum { GET_PRESSURE, POLL, POLL_TEMP_4, WAYS };
+
+static const char *ways[] = { "getPressure", "poll", "poll 1:4" };
+
+static const uint8_t osrs[] = { MS561101BA_OSR_256, MS561101BA_OSR_512, MS561101BA_OSR_1024,
+                                MS561101BA_OSR_2048, MS561101BA_OSR_4096 };
+
+struct Result
+{
+  double samplesPerSecond;
+  double busy; // share of the time the device converted
+  double transfersPerSample;
+  float pressure; // of the last sample
+};
+
+static Result run(unsigned int way, uint8_t OSR)
+{
+  Result result = Result();
+  SimulatedMS5611 device;
+  MS561101BA baro;
+
+  hal::reset();
+  Wire.begin();
+  Wire.setClock(I2C_CLOCK);
+  Wire.attach(MS561101BA_ADDR_CSB_LOW, &device);
+  baro.init(MS561101BA_ADDR_CSB_LOW);
+
+  if (way == POLL)
+    baro.start(OSR);
+  else if (way == POLL_TEMP_4)
+    baro.start(OSR, 4);
+
+  unsigned long samples = 0;
+  unsigned long transfers = Wire.transfers;
+  unsigned long long start = hal::now();
+
+  while (hal::now() - start < RUN_US)
+  {
+    if (way == GET_PRESSURE)
+    {
+      float pressure = baro.getPressure(OSR);
+      if (pressure != 0)
+      {
+        result.pressure = pressure;
+        samples++;
+      }
+    }
+    else
+    {
+      baro.poll();
+      MS561101BA_Sample sample;
+      while (baro.read(&sample))
+      {
+        result.pressure = sample.pressure;
+        samples++;
+      }
+    }
+    hal::advance(LOOP_US);
+  }
+
+  double seconds = (hal::now() - start) / 1e6;
+  result.samplesPerSecond = samples / seconds;
+  result.busy = device.conversions * (double)SimulatedMS5611::conversionTime(OSR) / (hal::now() - start);
+  if (result.busy > 1)
+    result.busy = 1;
+  result.transfersPerSample = samples ? (double)(Wire.transfers - transfers) / samples : 0;
+  Wire.attach(MS561101BA_ADDR_CSB_LOW, 0);
+  return result;
+}
+
+int main()
+{
+  printf("%-5s %-12s %9s %9s %6s %15s %11s\n", "OSR", "driver", "conv(us)", "samples/s", "busy",
+         "transfers/smpl", "mbar");
+
+  for (unsigned int o = 0; o < sizeof(osrs); o++)
+    for (unsigned int w = 0; w < WAYS; w++)
+    {
+      Result result = run(w, osrs[o]);
+      printf("%-5u %-12s %9lu %9.1f %5.0f%% %15.1f %11.2f\n", 256u << (osrs[o] >> 1), ways[w],
+             MS561101BA::conversionTime(osrs[o]), result.samplesPerSecond, result.busy * 100,
+             result.transfersPerSample, result.pressure);
+    }
+
+  return 0;
+}
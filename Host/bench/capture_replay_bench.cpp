@@ -0,0 +1,197 @@
+/*
+ capture_replay_bench.cpp - what capturing a master's frames costs and how
+ fast a capture is analysed and replayed.
+
+ Sixteen slaves share a 115200 baud line, one packet of 10 registers
+ each. Slave 3 takes 0 to 20 ms to answer, slave 5 always 30 ms, slave
+ 7 misses one request in ten and slave 12 is also asked for registers it
+ doesn't have, which it answers with exception 2 while the master backs
+ off. The master polls them for 20 minutes of virtual time with a
+ CaptureWriter recording the line. What capturing a frame costs is timed
+ separately, writing a million responses to a capture and closing it.
+
+ The capture is then mapped with a CaptureReader, analysed and replayed
+ through SimpleModbusMaster and SimpleModbusSlave. For every slave the
+ response times from the capture are printed next to the master's
+ counters of the live run and the verdicts of the replay, which have to
+ agree.
+
+ Build and run from the repository root:
+
+   cmake -S . -B build && cmake --build build --target capture_replay_bench
+   ./build/capture_replay_bench
+*/
+
+#include <stdio.h>
+
+#include <chrono>
+
+#include "Arduino.h"
+#include "CaptureFile.h"
+#include "CaptureReplay.h"
+#include "SimpleModbusMaster.h"
+#include "SimulatedSlave.h"
+
+#define BAUD 115200
+#define TIMEOUT_MS 100
+#define TURNAROUND_US 1000
+#define LOOP_WORK_US 50
+#define RUN_TIME_US 1200000000ULL
+#define SLAVES 16
+#define BACKOFF_MIN_MS 1000
+#define BACKOFF_MAX_MS 10000
+#define COST_FRAMES 1000000
+#define CAPTURE_PATH "capture_replay_bench.mbcp"
+
+static Packet packets[SLAVES + 1];
+static unsigned int regs[SLAVES + 1][10];
+static ModbusPort port;
+
+static void run(CaptureWriter &writer)
+{
+  SimulatedSlave slave;
+
+  hal::reset();
+  slave.begin(BAUD);
+  slave.turnaround = TURNAROUND_US;
+  for (unsigned int s = 0; s < SLAVES; s++)
+  {
+    slave.addUnit(s + 1, 32);
+    packets[s] = Packet();
+    packets[s].id = s + 1;
+    packets[s].function = READ_HOLDING_REGISTERS;
+    packets[s].no_of_registers = 10;
+    packets[s].register_array = regs[s];
+  }
+  slave.setDelay(5, 30000);
+
+  // past the end of slave 12's registers
+  packets[SLAVES] = packets[11];
+  packets[SLAVES].address = 40;
+  packets[SLAVES].register_array = regs[SLAVES];
+
+  modbusSerial.begin(BAUD);
+  modbus_port_configure(&port, &modbusSerial, BAUD, TIMEOUT_MS, 0, 10, 2, packets, SLAVES + 1);
+  modbus_port_background_tx(&port, 1);
+  modbus_port_backoff(&port, BACKOFF_MIN_MS, BACKOFF_MAX_MS);
+  SimSerial::connect(modbusSerial, slave.port);
+
+  remove(CAPTURE_PATH);
+  writer.open(CAPTURE_PATH);
+
+  unsigned long seed = 1;
+  unsigned int seen = 0;
+
+  // stop between transactions so every request in the capture is complete
+  while (hal::now() < RUN_TIME_US || !port.transmission_ready_Flag)
+  {
+    // a new request to slave 3 or 7 decides how they behave
+    if (packets[2].requests + packets[6].requests != seen)
+    {
+      seen = packets[2].requests + packets[6].requests;
+      seed = seed * 1103515245 + 12345;
+      slave.setDelay(3, (seed >> 16) % 20000);
+      slave.setAlive(7, (seed >> 8) % 10 != 0);
+    }
+
+    slave.poll();
+    modbus_port_update(&port);
+    hal::advance(LOOP_WORK_US);
+  }
+
+  writer.close();
+  modbusSerial.disconnect();
+}
+
+// nanoseconds the hook takes to write a 25 byte response to a capture
+static double captureCost()
+{
+  static const unsigned char response[25] = { 1, 3, 20 };
+  CaptureWriter writer;
+  remove(CAPTURE_PATH);
+  writer.open(CAPTURE_PATH);
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (unsigned long i = 0; i < COST_FRAMES; i++)
+    modbus_capture_hook(&modbusSerial, MODBUS_CAPTURE_MASTER, i, response, sizeof(response));
+  writer.close();
+  double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  remove(CAPTURE_PATH);
+  return elapsed * 1e9 / COST_FRAMES;
+}
+
+static double timed(CaptureReplay &capture, CaptureReader &reader, bool replay)
+{
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  if (replay)
+    capture.replay(reader);
+  else
+    capture.analyse(reader);
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main()
+{
+  CaptureWriter writer;
+  run(writer);
+  unsigned long frames = writer.frames;
+
+  CaptureReader reader;
+  if (!reader.open(CAPTURE_PATH))
+  {
+    printf("capture %s could not be read\n", CAPTURE_PATH);
+    return 1;
+  }
+  size_t bytes = reader.size();
+
+  CaptureReplay capture;
+  double analysed = timed(capture, reader, false);
+  std::vector<CaptureSlave> times = capture.slaves();
+  double replayed = timed(capture, reader, true);
+  std::vector<CaptureSlave> replay = capture.slaves();
+  reader.close();
+  remove(CAPTURE_PATH);
+  double cost = captureCost();
+
+  printf("%lu frames captured in %.1f MB, %.1f bytes a frame, capturing cost %.0f ns a frame\n",
+         frames, bytes / 1e6, (double)bytes / frames, cost);
+  printf("analysed at %.1f M frames/s, replayed at %.2f M frames/s\n\n",
+         capture.frames / analysed / 1e6, capture.frames / replayed / 1e6);
+
+  printf("%5s %9s %9s %9s %9s   %-23s   %-23s %6s\n", "slave", "requests", "p50(ms)", "p99(ms)",
+         "max(ms)", "live ok/timeout/exc", "replay ok/timeout/exc", "");
+  bool allMatch = capture.frames == frames && replay.size() == SLAVES;
+  for (size_t i = 0; i < replay.size(); i++)
+  {
+    const CaptureSlave &slave = replay[i];
+    unsigned long ok = 0, timeouts = 0, exceptions = 0;
+    for (unsigned int p = 0; p <= SLAVES; p++)
+      if (packets[p].id == slave.id)
+      {
+        ok += packets[p].successful_requests;
+        timeouts += packets[p].timeout;
+        exceptions += packets[p].illegal_function + packets[p].illegal_data_address +
+                      packets[p].illegal_data_value + packets[p].misc_exceptions;
+      }
+
+    bool match = slave.verdicts[MODBUS_TRACE_OK] == ok &&
+                 slave.verdicts[MODBUS_TRACE_TIMEOUT] == timeouts &&
+                 slave.verdicts[MODBUS_TRACE_EXCEPTION] == exceptions &&
+                 slave.requests == ok + timeouts + exceptions;
+    allMatch = allMatch && match;
+
+    char live[32], again[32];
+    snprintf(live, sizeof(live), "%lu/%lu/%lu", ok, timeouts, exceptions);
+    snprintf(again, sizeof(again), "%lu/%lu/%lu", slave.verdicts[MODBUS_TRACE_OK],
+             slave.verdicts[MODBUS_TRACE_TIMEOUT], slave.verdicts[MODBUS_TRACE_EXCEPTION]);
+    const ModbusHistogram &histogram = times[i].times;
+    printf("%5u %9lu %9.2f %9.2f %9.2f   %-23s   %-23s %6s\n", slave.id, slave.requests,
+           modbus_histogram_percentile(&histogram, 500) / 1000.0,
+           modbus_histogram_percentile(&histogram, 990) / 1000.0, histogram.max / 1000.0,
+           live, again, match ? "ok" : "WRONG");
+  }
+
+  printf("\nreplay %s the live master\n", allMatch ? "agrees with" : "DIFFERS FROM");
+  return 0;
+}
@@ -0,0 +1,219 @@
+/*
+ floor_bench.cpp - frames per second and memory per slave of a
+ BreweryFloor of SimpleModbusSlave devices.
+
+ Floors of 1 to 247 slaves with TMP36 scripts are served on modbusSerial
+ at 1 Mbaud with the low latency frame delay. A master on the other end
+ of the line reads all the registers of a random unit, frame after frame,
+ and every response is checked against that unit's registers. Time on the
+ line is virtual, so frames per second is the CPU cost of the simulator:
+ frame reception, the unit lookup, the script and the response. The
+ single slave row is modbus_update() with no lookup installed, the cost
+ the floor's dispatch is measured against.
+
+ Memory per slave is the heap the floor allocates for its units divided
+ by their number, with malloc's per allocation overhead. The floor itself adds a fixed 256 entry table of unit
+ pointers, about 2 KB, on top.
+
+ Build and run from the repository root:
+
+   cmake -S . -B build && cmake --build build --target floor_bench
+   ./build/floor_bench
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <new>
+
+#include "Arduino.h"
+#include "BreweryFloor.h"
+#include "SimpleModbusSlave.h"
+
+#define BAUD 1000000
+#define T3_5 10 // SimpleModbusSlave's low latency frame delay at 1 Mbaud
+#define FRAMES 200000
+#define MAX_FRAME 260
+
+static SimSerial line; // the master's end of modbusSerial
+
+// heap in use, counted the way glibc rounds its chunks: 8 bytes of header
+// and a multiple of 16, at least 32
+static size_t heapInUse;
+
+static size_t chunkSize(size_t size)
+{
+  size_t chunk = (size + 8 + 15) & ~(size_t)15;
+  return chunk < 32 ? 32 : chunk;
+}
+
+void *operator new(size_t size)
+{
+  size_t *block = (size_t *)malloc(sizeof(size_t) * 2 + size);
+  if (!block)
+    throw std::bad_alloc();
+  block[0] = size;
+  heapInUse += chunkSize(size);
+  return block + 2;
+}
+
+void operator delete(void *pointer) noexcept
+{
+  if (!pointer)
+    return;
+  size_t *block = (size_t *)pointer - 2;
+  heapInUse -= chunkSize(block[0]);
+  free(block);
+}
+
+void operator delete(void *pointer, size_t) noexcept
+{
+  operator delete(pointer);
+}
+
+// Sends a function 3 request for all the registers of id and returns the
+// number of response bytes that match regs.
+static bool transact(unsigned char id, unsigned int *regs, unsigned int size)
+{
+  unsigned char frame[MAX_FRAME] = { id, 3, 0, 0, (unsigned char)(size >> 8), (unsigned char)size };
+  unsigned int crc16 = modbus_crc16(frame, 6);
+  frame[6] = crc16 >> 8;
+  frame[7] = crc16 & 0xFF;
+
+  line.write(frame, 8);
+  hal::advance(line.txDoneAt() - hal::now());
+  modbus_update(regs);
+  hal::advance(T3_5);
+  modbus_update(regs);
+  while (!modbusSerial.txIdle())
+  {
+    hal::advance(modbusSerial.txDoneAt() - hal::now());
+    modbus_update(regs);
+  }
+
+  unsigned int length = 0;
+  while (line.available())
+  {
+    unsigned char value = line.read();
+    if (length < MAX_FRAME)
+      frame[length++] = value;
+  }
+
+  if (length != 5 + size * 2 || frame[0] != id ||
+      modbus_crc16(frame, length - 2) != (unsigned int)((frame[length - 2] << 8) | frame[length - 1]))
+    return false;
+  return true;
+}
+
+static void begin()
+{
+  hal::reset();
+  modbus_configure(BAUD, 1, 0, 0, 1);
+  modbusSerial.rxBufferSize = MAX_FRAME;
+  line.rxBufferSize = MAX_FRAME;
+  line.txBufferSize = MAX_FRAME;
+  line.begin(BAUD);
+  SimSerial::connect(line, modbusSerial);
+}
+
+struct Result
+{
+  double framesPerSecond;
+  double bytesPerSlave;
+  bool correct;
+};
+
+static Result runFloor(unsigned int units, unsigned int size)
+{
+  Result result = Result();
+  begin();
+
+  BreweryFloor *floor = new BreweryFloor;
+  size_t heap = heapInUse;
+  for (unsigned int id = 1; id <= units; id++)
+    floor->addUnit(id, size, new TMP36Script(19, 1, 120, id * 0.7f, 23));
+  result.bytesPerSlave = (double)(heapInUse - heap) / units;
+  floor->attach();
+
+  // a fixed pseudo random order of units, so every run polls the same
+  unsigned long seed = 1;
+  result.correct = true;
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (unsigned int n = 0; n < FRAMES; n++)
+  {
+    seed = seed * 1103515245 + 12345;
+    unsigned char id = 1 + (seed >> 16) % units;
+    if (!transact(id, 0, size))
+      result.correct = false;
+  }
+  std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+  result.framesPerSecond = FRAMES / std::chrono::duration<double>(end - start).count();
+  if (floor->dispatched != FRAMES || floor->unknown)
+    result.correct = false;
+
+  // the registers last read match what the script computes now
+  unsigned int *regs = floor->registers(1);
+  TMP36Script check(19, 1, 120, 0.7f, 23);
+  check.update(regs, size, hal::now());
+  if (!transact(1, 0, size) || regs[TMP36Script::TEMP_STATE] < 640 || regs[TMP36Script::TEMP_STATE] > 690)
+    result.correct = false;
+
+  delete floor;
+  return result;
+}
+
+static Result runSingle(unsigned int size)
+{
+  Result result = Result();
+  begin();
+  modbus_configure(BAUD, 1, 0, size, 1);
+
+  unsigned int *regs = new unsigned int[size]();
+  TMP36Script script(19, 1, 120, 0.7f, 23);
+  result.correct = true;
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (unsigned int n = 0; n < FRAMES; n++)
+  {
+    // the sketch's loop() runs once per request here
+    script.update(regs, size, hal::now());
+    if (!transact(1, regs, size))
+      result.correct = false;
+  }
+  std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+  result.framesPerSecond = FRAMES / std::chrono::duration<double>(end - start).count();
+  result.bytesPerSlave = size * sizeof(unsigned int);
+  delete[] regs;
+  return result;
+}
+
+int main()
+{
+  static const unsigned int sizes[] = { TMP36Script::TOTAL_REGS_SIZE, 61 };
+  static const unsigned int floors[] = { 1, 16, 64, 247 };
+
+  printf("%-8s %6s %10s %12s %14s %8s\n", "slaves", "regs", "frames/s",
+         "us/frame", "bytes/slave", "values");
+
+  for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+  {
+    Result single = runSingle(sizes[s]);
+    printf("%-8s %6u %10.0f %12.2f %14.0f %8s\n", "single", sizes[s],
+           single.framesPerSecond, 1e6 / single.framesPerSecond, single.bytesPerSlave,
+           single.correct ? "ok" : "WRONG");
+
+    for (size_t f = 0; f < sizeof(floors) / sizeof(floors[0]); f++)
+    {
+      Result result = runFloor(floors[f], sizes[s]);
+      printf("%-8u %6u %10.0f %12.2f %14.0f %8s\n", floors[f], sizes[s],
+             result.framesPerSecond, 1e6 / result.framesPerSecond, result.bytesPerSlave,
+             result.correct ? "ok" : "WRONG");
+    }
+  }
+
+  return 0;
+}
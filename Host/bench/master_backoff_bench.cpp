@@ -0,0 +1,157 @@
+/*
+ master_backoff_bench.cpp - how long healthy slaves wait for an update
+ while some of the other slaves on the line are dead.
+
+ Ten slaves share a 19200 baud line, each polled with one function 3
+ packet, a 1500 ms time out, a 20 ms polling delay and 10 retries. The
+ dead slaves come back to life after two minutes.
+
+ The master runs twice. Once the way the example sketch handles a failing
+ packet, setting connection back to true as soon as it is reported so the
+ slave is found again when it returns. Once with modbus_backoff() and no
+ help from the sketch. For every share of dead slaves the mean and worst
+ time between two updates of a healthy slave is reported, leaving out the
+ first minute while the backoff intervals grow, and how long it
+ took after the revival until every dead slave had been read again.
+
+ Build and run from the repository root:
+
+   cmake -S . -B build && cmake --build build --target master_backoff_bench
+   ./build/master_backoff_bench
+*/
+
+#include <stdio.h>
+
+#include "Arduino.h"
+#include "SimpleModbusMaster.h"
+#include "SimulatedSlave.h"
+
+#define BAUD 19200
+#define SLAVES 10
+#define REGS 8
+#define TIMEOUT_MS 1500
+#define POLLING_MS 20
+#define RETRY_COUNT 10
+#define MIN_BACKOFF_MS 1000
+#define MAX_BACKOFF_MS 30000
+#define LOOP_WORK_US 500
+#define WARMUP_US 60000000ULL
+#define RUN_TIME_US 300000000ULL
+#define REVIVE_TIME_US 120000000ULL
+
+static unsigned int regs[SLAVES][REGS];
+
+struct Result
+{
+  double meanUpdate; // milliseconds between updates of a healthy slave
+  double worstUpdate;
+  double reconnect; // milliseconds from revival until every slave answered
+};
+
+static Result run(unsigned int dead, bool backoff)
+{
+  SimulatedSlave slave;
+  Packet packets[SLAVES];
+  Result result = Result();
+
+  hal::reset();
+  for (unsigned int i = 0; i < SLAVES; i++)
+  {
+    packets[i] = Packet();
+    packets[i].id = i + 1;
+    packets[i].function = READ_HOLDING_REGISTERS;
+    packets[i].address = 0;
+    packets[i].no_of_registers = REGS;
+    packets[i].register_array = regs[i];
+  }
+
+  modbus_configure(BAUD, TIMEOUT_MS, POLLING_MS, RETRY_COUNT, 2, packets, SLAVES);
+  modbus_background_tx(1);
+  if (backoff)
+    modbus_backoff(MIN_BACKOFF_MS, MAX_BACKOFF_MS);
+  slave.begin(BAUD);
+  for (unsigned int i = 0; i < SLAVES; i++)
+  {
+    slave.addUnit(i + 1, REGS);
+    // the dead slaves are the last ones on the line
+    slave.setAlive(i + 1, i < SLAVES - dead);
+  }
+  SimSerial::connect(modbusSerial, slave.port);
+
+  unsigned int seen[SLAVES] = { 0 };
+  unsigned long long lastUpdate[SLAVES] = { 0 };
+  unsigned long long gapSum = 0, gapWorst = 0;
+  unsigned long gaps = 0;
+  unsigned int revived = 0;
+  bool alive = false;
+
+  while (hal::now() < RUN_TIME_US)
+  {
+    if (!alive && hal::now() >= REVIVE_TIME_US)
+    {
+      for (unsigned int i = SLAVES - dead; i < SLAVES; i++)
+      {
+        slave.setAlive(i + 1, true);
+        seen[i] = packets[i].successful_requests;
+      }
+      alive = true;
+    }
+
+    slave.poll();
+    unsigned int connection_status = modbus_update(packets);
+    if (!backoff && connection_status != SLAVES)
+      packets[connection_status].connection = 1;
+
+    for (unsigned int i = 0; i < SLAVES; i++)
+    {
+      if (packets[i].successful_requests == seen[i])
+        continue;
+      seen[i] = packets[i].successful_requests;
+
+      if (i < SLAVES - dead && !alive)
+      {
+        if (lastUpdate[i] && hal::now() >= WARMUP_US)
+        {
+          unsigned long long gap = hal::now() - lastUpdate[i];
+          gapSum += gap;
+          gaps++;
+          if (gap > gapWorst)
+            gapWorst = gap;
+        }
+        lastUpdate[i] = hal::now();
+      }
+      else if (i >= SLAVES - dead && alive && ++revived == dead)
+        result.reconnect = (hal::now() - REVIVE_TIME_US) / 1000.0;
+    }
+
+    hal::advance(LOOP_WORK_US);
+  }
+
+  if (gaps)
+  {
+    result.meanUpdate = gapSum / 1000.0 / gaps;
+    result.worstUpdate = gapWorst / 1000.0;
+  }
+  if (revived < dead)
+    result.reconnect = -1;
+  return result;
+}
+
+int main()
+{
+  printf("%5s | %-30s | %-30s\n", "", "sketch re-enables", "modbus_backoff()");
+  printf("%5s | %9s %9s %10s | %9s %9s %10s\n", "dead",
+         "mean(ms)", "worst(ms)", "reconn(ms)", "mean(ms)", "worst(ms)", "reconn(ms)");
+
+  for (unsigned int dead = 0; dead < SLAVES; dead++)
+  {
+    Result before = run(dead, false);
+    Result after = run(dead, true);
+
+    printf("%4u%% | %9.0f %9.0f %10.0f | %9.0f %9.0f %10.0f\n", dead * 100 / SLAVES,
+           before.meanUpdate, before.worstUpdate, before.reconnect,
+           after.meanUpdate, after.worstUpdate, after.reconnect);
+  }
+
+  return 0;
+}
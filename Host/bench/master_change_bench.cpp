@@ -0,0 +1,255 @@
+/*
+ master_change_bench.cpp - downstream work per scan of a historian fed by
+ a mostly static 1000 register map, with and without change detection.
+
+ A brewhouse slave has 900 configuration and status registers that never
+ change, 80 analog readings (temperatures, pressures, levels) that drift
+ slowly with +-1 count of noise and 20 counters ticking every few seconds.
+ The master reads them in 18 packets at 115200 baud and a historian
+ records the values in loop():
+
+ every     - the historian records every register after every poll, it
+             has no way of knowing what changed
+ diff      - the historian keeps its own copy of the map and compares
+             every register after every poll
+ on_change - the master reports changed registers through
+             modbus_on_change() into a queue the historian drains
+ deadband  - as on_change with a deadband of 2 on the analog packets, the
+             noise is no longer recorded
+
+ Reported per scan are the records written, the registers the sketch
+ itself looks at, and the extra RAM an AVR master needs for it. At the
+ end every value the historian holds is checked against the slave.
+
+ Build and run from the repository root:
+
+   cmake -S . -B build && cmake --build build --target master_change_bench
+   ./build/master_change_bench
+*/
+
+#include <stdio.h>
+
+#include "Arduino.h"
+#include "SimpleModbusMaster.h"
+#include "SimulatedSlave.h"
+
+#define BAUD 115200
+#define TIMEOUT_MS 1000
+#define POLLING_MS 10
+#define TURNAROUND_US 500
+#define LOOP_WORK_US 50
+#define RUN_TIME_US 60000000ULL
+#define SETTLE_US 2000000ULL // the signals stop moving this long before the end
+#define SIGNAL_PERIOD_US 100000ULL
+
+#define REGISTERS 1000
+#define STATIC_REGS 900
+#define ANALOG_REGS 80
+#define COUNTER_REGS 20
+#define PACKETS 18
+#define DEADBAND 2
+#define QUEUE_SIZE 64
+
+enum Mode { EVERY, DIFF, ON_CHANGE, DEADBAND_MODE };
+
+// the changes the master reported and the historian has not recorded yet
+struct Change
+{
+  Packet *packet;
+  unsigned int index;
+};
+
+static Change queue[QUEUE_SIZE];
+static unsigned int queueHead, queueTail;
+static unsigned long queueOverflows;
+
+static void changed(Packet *packet, unsigned int index, unsigned int previous)
+{
+  (void)previous;
+  unsigned int next = (queueHead + 1) % QUEUE_SIZE;
+  if (next == queueTail)
+  {
+    queueOverflows++;
+    return;
+  }
+  queue[queueHead].packet = packet;
+  queue[queueHead].index = index;
+  queueHead = next;
+}
+
+struct Historian
+{
+  unsigned int values[REGISTERS];
+  unsigned int shadow[REGISTERS]; // diff mode's own copy of the map
+  unsigned long records;
+  unsigned long examined;
+
+  void record(unsigned int address, unsigned int value)
+  {
+    values[address] = value;
+    records++;
+  }
+};
+
+static Packet packets[PACKETS];
+static unsigned int regs[REGISTERS];
+static Historian historian;
+
+static void slaveSignals(unsigned int *slaveRegs, unsigned long long now, unsigned long *seed)
+{
+  for (unsigned int i = 0; i < ANALOG_REGS; i++)
+  {
+    *seed = *seed * 1103515245 + 12345;
+    int noise = (int)((*seed >> 16) % 3) - 1;
+    slaveRegs[STATIC_REGS + i] = 2000 + i * 10 + (unsigned int)(now / 10000000ULL) + noise;
+  }
+  for (unsigned int i = 0; i < COUNTER_REGS; i++)
+    slaveRegs[STATIC_REGS + ANALOG_REGS + i] = (unsigned int)((now + i * 150000ULL) / 3000000ULL);
+}
+
+struct Result
+{
+  double records; // per scan
+  double examined; // per scan
+  unsigned int avrBytes;
+  bool correct;
+};
+
+static Result run(Mode mode)
+{
+  SimulatedSlave slave;
+  Result result = Result();
+
+  hal::reset();
+  slave.begin(BAUD);
+  slave.turnaround = TURNAROUND_US;
+  slave.addUnit(1, REGISTERS);
+  unsigned int *slaveRegs = slave.registers(1);
+  for (unsigned int i = 0; i < STATIC_REGS; i++)
+    slaveRegs[i] = (i * 2654435761u) >> 20;
+
+  // 15 packets of 60 static registers, 2 of 40 analog readings, 1 of 20 counters
+  unsigned int address = 0;
+  for (unsigned int p = 0; p < PACKETS; p++)
+  {
+    Packet *packet = &packets[p];
+    *packet = Packet();
+    packet->id = 1;
+    packet->function = READ_HOLDING_REGISTERS;
+    packet->address = address;
+    packet->no_of_registers = p < 15 ? 60 : p < 17 ? 40 : 20;
+    packet->register_array = &regs[address];
+    if (mode == DEADBAND_MODE && p >= 15 && p < 17)
+      packet->deadband = DEADBAND;
+    address += packet->no_of_registers;
+  }
+  for (unsigned int i = 0; i < REGISTERS; i++)
+    regs[i] = historian.values[i] = historian.shadow[i] = 0;
+  historian.records = historian.examined = 0;
+  queueHead = queueTail = 0;
+  queueOverflows = 0;
+
+  modbus_configure(BAUD, TIMEOUT_MS, POLLING_MS, 10, 2, packets, PACKETS);
+  modbus_background_tx(1);
+  if (mode >= ON_CHANGE)
+    modbus_on_change(changed);
+  SimSerial::connect(modbusSerial, slave.port);
+
+  unsigned long seed = 1;
+  unsigned long long nextSignal = 0;
+  unsigned int seen[PACKETS] = { 0 };
+
+  while (hal::now() < RUN_TIME_US)
+  {
+    if (hal::now() >= nextSignal && hal::now() < RUN_TIME_US - SETTLE_US)
+    {
+      slaveSignals(slaveRegs, hal::now(), &seed);
+      nextSignal += SIGNAL_PERIOD_US;
+    }
+
+    slave.poll();
+    modbus_update(packets);
+
+    // the historian's share of loop()
+    if (mode == EVERY || mode == DIFF)
+    {
+      for (unsigned int p = 0; p < PACKETS; p++)
+      {
+        Packet *packet = &packets[p];
+        if (packet->successful_requests == seen[p])
+          continue;
+        seen[p] = packet->successful_requests;
+
+        unsigned int first = packet->address;
+        for (unsigned int i = 0; i < packet->no_of_registers; i++)
+        {
+          unsigned int value = packet->register_array[i];
+          historian.examined++;
+          if (mode == EVERY)
+            historian.record(first + i, value);
+          else if (historian.shadow[first + i] != value)
+          {
+            historian.shadow[first + i] = value;
+            historian.record(first + i, value);
+          }
+        }
+      }
+    }
+    else
+    {
+      while (queueTail != queueHead)
+      {
+        Change &change = queue[queueTail];
+        unsigned int i = change.index;
+        historian.record(change.packet->address + i, change.packet->register_array[i]);
+        queueTail = (queueTail + 1) % QUEUE_SIZE;
+      }
+    }
+
+    hal::advance(LOOP_WORK_US);
+  }
+
+  unsigned int scans = ~0u;
+  result.correct = queueOverflows == 0;
+  for (unsigned int p = 0; p < PACKETS; p++)
+  {
+    if (packets[p].successful_requests < scans)
+      scans = packets[p].successful_requests;
+    if (packets[p].total_errors)
+      result.correct = false;
+  }
+
+  // with a deadband the historian may lag the slave by up to the deadband
+  for (unsigned int i = 0; i < REGISTERS; i++)
+  {
+    int difference = (int)historian.values[i] - (int)slaveRegs[i];
+    int allowed = (mode == DEADBAND_MODE && i >= STATIC_REGS && i < STATIC_REGS + ANALOG_REGS) ? DEADBAND : 0;
+    if (difference > allowed || difference < -allowed)
+      result.correct = false;
+  }
+
+  if (scans)
+  {
+    result.records = (double)historian.records / scans;
+    result.examined = (double)historian.examined / scans;
+  }
+  result.avrBytes = mode == DIFF ? REGISTERS * 2 : mode >= ON_CHANGE ? sizeof(unsigned int) * 2 * QUEUE_SIZE : 0;
+  return result;
+}
+
+int main()
+{
+  static const char *names[] = { "every", "diff", "on_change", "deadband" };
+
+  printf("%-10s %13s %14s %14s %8s\n", "historian", "records/scan",
+         "examined/scan", "AVR RAM(B)", "values");
+
+  for (int mode = EVERY; mode <= DEADBAND_MODE; mode++)
+  {
+    Result result = run((Mode)mode);
+    printf("%-10s %13.1f %14.1f %14u %8s\n", names[mode], result.records,
+           result.examined, result.avrBytes, result.correct ? "ok" : "WRONG");
+  }
+
+  return 0;
+}
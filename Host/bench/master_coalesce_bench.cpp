@@ -0,0 +1,178 @@
+/*
+ master_coalesce_bench.cpp - wire bytes and round trips modbus_coalesce()
+ saves when polling a fermenter cellar.
+
+ Eight fermenters, a bright tank and a glycol chiller share a 19200 baud
+ line. Every fermenter is read the way a sketch would do it, one packet
+ per quantity: temperature and setpoint, gravity, pressure, valves, level,
+ alarms and batch data, plus a function 16 packet writing the setpoint.
+ The bright tank has six packets of four sensors each, the chiller three
+ packets with holes between them.
+
+ The master scans the packets for a minute without coalescing and with a
+ maximum gap of 0, 2, 4 and 8 registers. For each the requests and the
+ bytes on the line per scan are reported with the scan time, and every
+ packet's register_array is checked against the slave's registers.
+
+ Build and run from the repository root:
+
+   cmake -S . -B build && cmake --build build --target master_coalesce_bench
+   ./build/master_coalesce_bench
+*/
+
+#include <stdio.h>
+
+#include "Arduino.h"
+#include "SimpleModbusMaster.h"
+#include "SimulatedSlave.h"
+
+#define BAUD 19200
+#define TIMEOUT_MS 1000
+#define POLLING_MS 10
+#define TURNAROUND_US 1000
+#define LOOP_WORK_US 200
+#define RUN_TIME_US 60000000ULL
+#define MAX_PACKETS 96
+
+struct Read
+{
+  unsigned char id;
+  unsigned char function;
+  unsigned int address;
+  unsigned int no_of_registers;
+};
+
+// one fermenter, the setpoint write goes to register 1
+static const Read fermenter[] = {
+  { 0, READ_HOLDING_REGISTERS, 0, 2 },  // temperature, setpoint
+  { 0, READ_HOLDING_REGISTERS, 2, 1 },  // gravity
+  { 0, READ_HOLDING_REGISTERS, 3, 1 },  // pressure
+  { 0, READ_HOLDING_REGISTERS, 4, 2 },  // glycol and CO2 valves
+  { 0, READ_HOLDING_REGISTERS, 8, 2 },  // level, volume
+  { 0, READ_HOLDING_REGISTERS, 12, 4 }, // alarm words
+  { 0, READ_HOLDING_REGISTERS, 20, 4 }, // batch number and start time
+  { 0, PRESET_MULTIPLE_REGISTERS, 1, 1 } // setpoint
+};
+
+static const Read chiller[] = {
+  { 10, READ_HOLDING_REGISTERS, 0, 3 }, // supply, return, tank temperature
+  { 10, READ_HOLDING_REGISTERS, 5, 2 }, // compressor state and hours
+  { 10, READ_HOLDING_REGISTERS, 9, 1 }  // fault code
+};
+
+static Packet packets[MAX_PACKETS];
+static unsigned int regs[MAX_PACKETS][4];
+static unsigned int total;
+
+static void addPacket(const Read &read, unsigned char id)
+{
+  Packet *packet = &packets[total];
+  *packet = Packet();
+  packet->id = id;
+  packet->function = read.function;
+  packet->address = read.address;
+  packet->no_of_registers = read.no_of_registers;
+  packet->register_array = regs[total];
+  total++;
+}
+
+struct Result
+{
+  double requests; // per scan
+  double bytes; // per scan, both directions
+  double scanTime; // milliseconds
+  bool correct;
+};
+
+static Result run(int max_gap)
+{
+  SimulatedSlave slave;
+  Result result = Result();
+
+  total = 0;
+  for (unsigned char id = 1; id <= 8; id++)
+    for (size_t i = 0; i < sizeof(fermenter) / sizeof(fermenter[0]); i++)
+      addPacket(fermenter[i], id);
+  for (unsigned int i = 0; i < 6; i++)
+  {
+    Read read = { 9, READ_HOLDING_REGISTERS, i * 4, 4 };
+    addPacket(read, 9);
+  }
+  for (size_t i = 0; i < sizeof(chiller) / sizeof(chiller[0]); i++)
+    addPacket(chiller[i], 10);
+
+  hal::reset();
+  modbus_configure(BAUD, TIMEOUT_MS, POLLING_MS, 10, 2, packets, total);
+  modbus_background_tx(1);
+  if (max_gap >= 0)
+    modbus_coalesce(max_gap);
+
+  slave.begin(BAUD);
+  slave.turnaround = TURNAROUND_US;
+  for (unsigned char id = 1; id <= 10; id++)
+  {
+    slave.addUnit(id, 32);
+    for (unsigned int r = 0; r < 32; r++)
+      slave.registers(id)[r] = id * 100 + r;
+  }
+  SimSerial::connect(modbusSerial, slave.port);
+
+  while (hal::now() < RUN_TIME_US)
+  {
+    slave.poll();
+    modbus_update(packets);
+    hal::advance(LOOP_WORK_US);
+  }
+
+  unsigned int scans = ~0u;
+  unsigned long requests = 0;
+  result.correct = true;
+  for (unsigned int i = 0; i < total; i++)
+  {
+    Packet *packet = &packets[i];
+    if (packet->successful_requests < scans)
+      scans = packet->successful_requests;
+    if (!packet->merged_into)
+      requests += packet->requests;
+    if (packet->function == READ_HOLDING_REGISTERS)
+      for (unsigned int r = 0; r < packet->no_of_registers; r++)
+        if (packet->register_array[r] != slave.registers(packet->id)[packet->address + r])
+          result.correct = false;
+    if (packet->total_errors)
+      result.correct = false;
+  }
+
+  if (scans)
+  {
+    result.requests = (double)requests / scans;
+    result.bytes = (double)(modbusSerial.bytesSent + slave.port.bytesSent) / scans;
+    result.scanTime = RUN_TIME_US / 1000.0 / scans;
+  }
+  return result;
+}
+
+int main()
+{
+  static const int gaps[] = { -1, 0, 2, 4, 8 };
+  Result none = Result();
+
+  printf("%8s %14s %14s %14s %11s %11s %8s\n", "max_gap", "requests/scan",
+         "bytes/scan", "scan(ms)", "requests", "bytes", "values");
+
+  for (size_t g = 0; g < sizeof(gaps) / sizeof(gaps[0]); g++)
+  {
+    Result result = run(gaps[g]);
+    if (gaps[g] < 0)
+      none = result;
+
+    char label[8];
+    snprintf(label, sizeof(label), gaps[g] < 0 ? "off" : "%d", gaps[g]);
+    printf("%8s %14.1f %14.1f %14.1f %10.0f%% %10.0f%% %8s\n", label,
+           result.requests, result.bytes, result.scanTime,
+           100.0 * (none.requests - result.requests) / none.requests,
+           100.0 * (none.bytes - result.bytes) / none.bytes,
+           result.correct ? "ok" : "WRONG");
+  }
+
+  return 0;
+}
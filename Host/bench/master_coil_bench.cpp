@@ -0,0 +1,179 @@
+/*
+ master_coil_bench.cpp - bytes on the line and scan time for 512 alarm
+ points read as holding registers against coils.
+
+ A cellar controller on a 19200 baud line has 512 alarm points, level
+ switches, door contacts and glycol flow switches. The master reads them
+ three ways:
+
+ registers - one holding register per alarm like ALARM_STATE in
+             ModbusSlaveSimulation.ino, 9 function 3 packets of at most
+             61 registers
+ packed    - 16 alarms packed into every holding register by hand, one
+             function 3 packet of 32 registers
+ coils     - one function 1 packet of 512 coils
+
+ For each the requests and the bytes on the line per scan are reported
+ with the scan time, and the memory the alarm map takes on an AVR, where
+ a register is 2 bytes. Every alarm the master holds at the end is checked
+ against the slave.
+
+ Build and run from the repository root:
+
+   cmake -S . -B build && cmake --build build --target master_coil_bench
+   ./build/master_coil_bench
+*/
+
+#include <stdio.h>
+
+#include "Arduino.h"
+#include "SimpleModbusMaster.h"
+#include "SimulatedSlave.h"
+
+#define BAUD 19200
+#define TIMEOUT_MS 1000
+#define POLLING_MS 10
+#define TURNAROUND_US 1000
+#define LOOP_WORK_US 200
+#define RUN_TIME_US 60000000ULL
+#define ALARMS 512
+#define MAX_READ 61 // registers in one function 3 response
+
+enum Layout { REGISTERS, PACKED, COILS };
+
+struct Result
+{
+  double requests; // per scan
+  double bytes; // per scan, both directions
+  double scanTime; // milliseconds
+  unsigned int avrBytes; // of the alarm map on an AVR slave
+  bool correct;
+};
+
+static bool alarm(unsigned int i)
+{
+  // a fixed scattering of raised alarms
+  return (i * 7919) % 13 < 3;
+}
+
+static Result run(Layout layout)
+{
+  SimulatedSlave slave;
+  Packet packets[(ALARMS + MAX_READ - 1) / MAX_READ];
+  static unsigned int regs[ALARMS];
+  static unsigned char bits[ALARMS / 8];
+  unsigned int total = 0;
+  Result result = Result();
+
+  hal::reset();
+  slave.begin(BAUD);
+  slave.turnaround = TURNAROUND_US;
+
+  if (layout == REGISTERS)
+  {
+    slave.addUnit(1, ALARMS);
+    for (unsigned int i = 0; i < ALARMS; i++)
+      slave.registers(1)[i] = alarm(i);
+    for (unsigned int address = 0; address < ALARMS; address += MAX_READ)
+    {
+      Packet *packet = &packets[total++];
+      *packet = Packet();
+      packet->id = 1;
+      packet->function = READ_HOLDING_REGISTERS;
+      packet->address = address;
+      packet->no_of_registers = ALARMS - address < MAX_READ ? ALARMS - address : MAX_READ;
+      packet->register_array = &regs[address];
+    }
+    result.avrBytes = ALARMS * 2;
+  }
+  else if (layout == PACKED)
+  {
+    slave.addUnit(1, ALARMS / 16);
+    for (unsigned int i = 0; i < ALARMS; i++)
+      if (alarm(i))
+        slave.registers(1)[i / 16] |= 1 << (i % 16);
+    packets[0] = Packet();
+    packets[0].id = 1;
+    packets[0].function = READ_HOLDING_REGISTERS;
+    packets[0].no_of_registers = ALARMS / 16;
+    packets[0].register_array = regs;
+    total = 1;
+    result.avrBytes = ALARMS / 8;
+  }
+  else
+  {
+    slave.addUnit(1, 0);
+    slave.addBits(1, ALARMS, 0);
+    for (unsigned int i = 0; i < ALARMS; i++)
+      modbus_set_bit(slave.coils(1), i, alarm(i));
+    packets[0] = Packet();
+    packets[0].id = 1;
+    packets[0].function = READ_COIL_STATUS;
+    packets[0].no_of_registers = ALARMS;
+    packets[0].bit_array = bits;
+    total = 1;
+    result.avrBytes = ALARMS / 8;
+  }
+
+  modbus_configure(BAUD, TIMEOUT_MS, POLLING_MS, 10, 2, packets, total);
+  modbus_background_tx(1);
+  SimSerial::connect(modbusSerial, slave.port);
+
+  while (hal::now() < RUN_TIME_US)
+  {
+    slave.poll();
+    modbus_update(packets);
+    hal::advance(LOOP_WORK_US);
+  }
+
+  unsigned int scans = ~0u;
+  unsigned long requests = 0;
+  result.correct = true;
+  for (unsigned int i = 0; i < total; i++)
+  {
+    if (packets[i].successful_requests < scans)
+      scans = packets[i].successful_requests;
+    requests += packets[i].requests;
+    if (packets[i].total_errors)
+      result.correct = false;
+  }
+
+  for (unsigned int i = 0; i < ALARMS; i++)
+  {
+    bool value;
+    if (layout == REGISTERS)
+      value = regs[i];
+    else if (layout == PACKED)
+      value = (regs[i / 16] >> (i % 16)) & 1;
+    else
+      value = modbus_get_bit(bits, i);
+    if (value != alarm(i))
+      result.correct = false;
+  }
+
+  if (scans)
+  {
+    result.requests = (double)requests / scans;
+    result.bytes = (double)(modbusSerial.bytesSent + slave.port.bytesSent) / scans;
+    result.scanTime = RUN_TIME_US / 1000.0 / scans;
+  }
+  return result;
+}
+
+int main()
+{
+  static const char *names[] = { "registers", "packed", "coils" };
+
+  printf("%-10s %14s %12s %10s %12s %8s\n", "layout", "requests/scan",
+         "bytes/scan", "scan(ms)", "AVR bytes", "values");
+
+  for (int layout = REGISTERS; layout <= COILS; layout++)
+  {
+    Result result = run((Layout)layout);
+    printf("%-10s %14.1f %12.1f %10.1f %12u %8s\n", names[layout],
+           result.requests, result.bytes, result.scanTime, result.avrBytes,
+           result.correct ? "ok" : "WRONG");
+  }
+
+  return 0;
+}
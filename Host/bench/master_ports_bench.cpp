@@ -0,0 +1,136 @@
+/*
+ master_ports_bench.cpp - Aggregate transactions per second of
+ SimpleModbusMaster polling several serial lines from one loop().
+
+ Every line runs at 115200 baud with 4 simulated slaves, each read with
+ function 3 for 10 registers and answered 500 us after the request. Each
+ line has its own ModbusPort and packet array and loop() calls
+ modbus_port_update() for every port followed by LOOP_WORK_US of other
+ work. The single port figures use modbus_configure()/modbus_update().
+
+ Build and run from the repository root:
+
+   cmake -S . -B build && cmake --build build --target master_ports_bench
+   ./build/master_ports_bench
+*/
+
+#include <stdio.h>
+
+#include "Arduino.h"
+#include "SimpleModbusMaster.h"
+#include "SimulatedSlave.h"
+
+#define BAUD 115200
+#define LOOP_WORK_US 100
+#define TURNAROUND_US 500
+#define RUN_TIME_US 10000000ULL
+#define SLAVES_PER_LINE 4
+#define REGS_PER_PACKET 10
+#define MAX_PORTS 8
+
+struct Line
+{
+  SimSerial master;
+  SimulatedSlave slaves;
+  ModbusPort port;
+  Packet packets[SLAVES_PER_LINE];
+  unsigned int regs[SLAVES_PER_LINE][REGS_PER_PACKET];
+};
+
+static Line lines[MAX_PORTS];
+
+static void setupPackets(Line &line)
+{
+  for (unsigned char i = 0; i < SLAVES_PER_LINE; i++)
+  {
+    Packet &packet = line.packets[i];
+    packet = Packet();
+    packet.id = i + 1;
+    packet.function = READ_HOLDING_REGISTERS;
+    packet.address = 0;
+    packet.no_of_registers = REGS_PER_PACKET;
+    packet.register_array = line.regs[i];
+  }
+
+  line.slaves.begin(BAUD);
+  line.slaves.turnaround = TURNAROUND_US;
+  for (unsigned char i = 0; i < SLAVES_PER_LINE; i++)
+    line.slaves.addUnit(i + 1, REGS_PER_PACKET);
+}
+
+static unsigned long transactions(Line &line)
+{
+  unsigned long total = 0;
+  for (unsigned int i = 0; i < SLAVES_PER_LINE; i++)
+    total += line.packets[i].successful_requests;
+  return total;
+}
+
+// the original single port api on modbusSerial
+static double runSinglePort()
+{
+  Line &line = lines[0];
+
+  hal::reset();
+  setupPackets(line);
+  modbus_configure(BAUD, 1000, 0, 10, 2, line.packets, SLAVES_PER_LINE);
+  modbus_background_tx(1);
+  SimSerial::connect(modbusSerial, line.slaves.port);
+
+  while (hal::now() < RUN_TIME_US)
+  {
+    line.slaves.poll();
+    modbus_update(line.packets);
+    hal::advance(LOOP_WORK_US);
+  }
+
+  return transactions(line) * 1e6 / hal::now();
+}
+
+static double runPorts(unsigned int no_of_ports)
+{
+  hal::reset();
+  for (unsigned int p = 0; p < no_of_ports; p++)
+  {
+    Line &line = lines[p];
+    setupPackets(line);
+    line.master.begin(BAUD);
+    SimSerial::connect(line.master, line.slaves.port);
+    modbus_port_configure(&line.port, &line.master, BAUD, 1000, 0, 10, 2 + p,
+                          line.packets, SLAVES_PER_LINE);
+    modbus_port_background_tx(&line.port, 1);
+  }
+
+  while (hal::now() < RUN_TIME_US)
+  {
+    for (unsigned int p = 0; p < no_of_ports; p++)
+    {
+      lines[p].slaves.poll();
+      modbus_port_update(&lines[p].port);
+    }
+    hal::advance(LOOP_WORK_US);
+  }
+
+  unsigned long total = 0;
+  for (unsigned int p = 0; p < no_of_ports; p++)
+    total += transactions(lines[p]);
+  return total * 1e6 / hal::now();
+}
+
+int main()
+{
+  double single = runSinglePort();
+
+  printf("%-14s %14s %10s\n", "", "transactions/s", "scaling");
+  printf("%-14s %14.0f %10.2f\n", "modbus_update", single, 1.0);
+
+  for (unsigned int n = 1; n <= MAX_PORTS; n *= 2)
+  {
+    double rate = runPorts(n);
+    char label[16];
+    snprintf(label, sizeof(label), "%u port%s", n, n > 1 ? "s" : "");
+    printf("%-14s %14.0f %10.2f\n", label, rate, rate / single);
+  }
+
+  return 0;
+}
@@ -0,0 +1,203 @@
+/*
+ master_priority_bench.cpp - how long an urgent write waits behind a full
+ poll list, in turns with the routine packets and as an urgent packet
+ queued with modbus_request().
+
+ 64 fermenters on a 19200 baud line are polled for 8 registers each, one
+ routine packet per fermenter. A glycol valve controller has to close its
+ valve now and then, at random times 0.2 to 2 s apart, which the
+ master does by writing register 0 of the controller with function 16.
+ Each way runs for a minute:
+
+ in turn    - the valve packet is one more routine packet, written on
+              every scan with the value the sketch last put into it
+ urgent     - the valve packet is MODBUS_PRIORITY_URGENT and queued when
+              the valve has to close
+ high 20ms  - urgent, and 8 pump packets of MODBUS_PRIORITY_HIGH with an
+              interval of 20 ms, more than the line can carry
+ share 0    - the same with modbus_priority(0), routine packets have to
+              wait until the high ones leave the line free
+ dead slave - high 20ms with a fermenter that doesn't answer
+
+ Reported are the worst and mean time from the valve having to close to
+ the controller holding the write, the 99th percentile queueing delay of
+ the urgent and high classes as modbus_priority() counts it and the
+ longest a routine packet went without a request after the first scan.
+
+ Build and run from the repository root:
+
+   cmake -S . -B build && cmake --build build --target master_priority_bench
+   ./build/master_priority_bench
+*/
+
+#include <stdio.h>
+
+#include "Arduino.h"
+#include "SimpleModbusMaster.h"
+#include "SimulatedSlave.h"
+
+#define BAUD 19200
+#define TIMEOUT_MS 100
+#define POLLING_MS 5
+#define TURNAROUND_US 1000
+#define LOOP_WORK_US 200
+#define RUN_TIME_US 60000000ULL
+#define WARM_UP_US 5000000ULL // the first scan, routine gaps are measured after it
+
+#define FERMENTERS 64
+#define PUMPS 8
+#define REGISTERS 8
+#define VALVE_ID 100
+#define DEAD_ID 33
+
+enum { IN_TURN, URGENT, HIGH_20MS, SHARE_0, DEAD_SLAVE, WAYS };
+
+static const char *ways[] = { "in turn", "urgent", "high 20ms", "share 0", "dead slave" };
+
+static Packet packets[FERMENTERS + PUMPS + 1];
+static unsigned int regs[FERMENTERS + PUMPS][REGISTERS];
+static unsigned int valveValue;
+static ModbusHistogram delays[MODBUS_PRIORITIES];
+
+struct Result
+{
+  double worstMs, meanMs; // from having to close until the controller holds it
+  double urgentUs, highUs; // 99th percentile queueing delay
+  double routineGapMs; // longest a fermenter went without a request
+};
+
+static Result run(unsigned int way)
+{
+  SimulatedSlave slave;
+  Result result = Result();
+  bool high = way >= HIGH_20MS;
+  unsigned int total = 0;
+
+  for (unsigned int i = 0; i < FERMENTERS; i++)
+  {
+    Packet *packet = &packets[total++];
+    *packet = Packet();
+    packet->id = i + 1;
+    packet->function = READ_HOLDING_REGISTERS;
+    packet->no_of_registers = REGISTERS;
+    packet->register_array = regs[i];
+  }
+  for (unsigned int i = 0; high && i < PUMPS; i++)
+  {
+    Packet *packet = &packets[total++];
+    *packet = Packet();
+    packet->id = FERMENTERS + 1 + i;
+    packet->function = READ_HOLDING_REGISTERS;
+    packet->no_of_registers = REGISTERS;
+    packet->register_array = regs[FERMENTERS + i];
+    packet->interval = 20;
+    packet->priority = MODBUS_PRIORITY_HIGH;
+  }
+  Packet *valve = &packets[total++];
+  *valve = Packet();
+  valve->id = VALVE_ID;
+  valve->function = PRESET_MULTIPLE_REGISTERS;
+  valve->no_of_registers = 1;
+  valve->register_array = &valveValue;
+  if (way != IN_TURN)
+    valve->priority = MODBUS_PRIORITY_URGENT;
+
+  valveValue = 0;
+  hal::reset();
+  modbus_configure(BAUD, TIMEOUT_MS, POLLING_MS, 3, 2, packets, total);
+  modbus_background_tx(1);
+  modbus_priority(way == SHARE_0 ? 0 : MODBUS_PRIORITY_SHARE, delays);
+  slave.begin(BAUD);
+  slave.turnaround = TURNAROUND_US;
+  for (unsigned char id = 1; id <= FERMENTERS + PUMPS; id++)
+    slave.addUnit(id, REGISTERS);
+  slave.addUnit(VALVE_ID, 1);
+  if (way == DEAD_SLAVE)
+    slave.setAlive(DEAD_ID, false);
+  SimSerial::connect(modbusSerial, slave.port);
+
+  unsigned long seed = 1;
+  unsigned long long nextClose = 1000000ULL, closing = 0;
+  bool pending = false;
+  unsigned long closes = 0;
+  double sumMs = 0;
+
+  unsigned int lastRequests[FERMENTERS];
+  unsigned long long lastRequestAt[FERMENTERS];
+  for (unsigned int i = 0; i < FERMENTERS; i++)
+  {
+    lastRequests[i] = 0;
+    lastRequestAt[i] = WARM_UP_US;
+  }
+
+  while (hal::now() < RUN_TIME_US)
+  {
+    unsigned long long now = hal::now();
+
+    if (!pending && now >= nextClose)
+    {
+      // the valve has to close, the value tells the closes apart
+      valveValue++;
+      if (way != IN_TURN)
+        modbus_request(valve);
+      closing = now;
+      pending = true;
+    }
+
+    slave.poll();
+    modbus_update(packets);
+    hal::advance(LOOP_WORK_US);
+
+    now = hal::now();
+    if (pending && slave.registers(VALVE_ID)[0] == valveValue)
+    {
+      double ms = (now - closing) / 1000.0;
+      if (ms > result.worstMs)
+        result.worstMs = ms;
+      sumMs += ms;
+      closes++;
+      pending = false;
+      seed = seed * 1103515245 + 12345;
+      nextClose = now + 200000ULL + ((seed >> 16) % 1800) * 1000ULL;
+    }
+
+    for (unsigned int i = 0; i < FERMENTERS; i++)
+    {
+      if (i + 1 == DEAD_ID && way == DEAD_SLAVE)
+        continue;
+      if (packets[i].requests != lastRequests[i])
+      {
+        lastRequests[i] = packets[i].requests;
+        if (now >= WARM_UP_US)
+        {
+          double gap = (now - lastRequestAt[i]) / 1000.0;
+          if (gap > result.routineGapMs)
+            result.routineGapMs = gap;
+          lastRequestAt[i] = now;
+        }
+      }
+      else if (now >= WARM_UP_US && (now - lastRequestAt[i]) / 1000.0 > result.routineGapMs)
+        result.routineGapMs = (now - lastRequestAt[i]) / 1000.0;
+    }
+  }
+
+  result.meanMs = closes ? sumMs / closes : 0;
+  result.urgentUs = modbus_histogram_percentile(&delays[MODBUS_PRIORITY_URGENT], 990);
+  result.highUs = modbus_histogram_percentile(&delays[MODBUS_PRIORITY_HIGH], 990);
+  return result;
+}
+
+int main()
+{
+  printf("%-10s %9s %8s %11s %9s %14s\n", "valve", "worst(ms)", "mean(ms)",
+         "urgent(us)", "high(us)", "routine gap(ms)");
+
+  for (unsigned int w = 0; w < WAYS; w++)
+  {
+    Result result = run(w);
+    printf("%-10s %9.1f %8.1f %11.0f %9.0f %14.0f\n", ways[w], result.worstMs, result.meanMs,
+           result.urgentUs, result.highUs, result.routineGapMs);
+  }
+
+  return 0;
+}
@@ -0,0 +1,131 @@
+/*
+ master_rw_bench.cpp - cycle time of a setpoint write plus state readback
+ with function 23 against a function 16 write followed by a function 3 read.
+
+ A glycol valve controller is written one setpoint register and read back
+ five registers, the setpoint and four state registers, every cycle. The
+ simulated slave answers 1 ms after the end of request silence and the
+ master polls without a polling delay, so the cycle time is made of the
+ wire time, the turnaround and the frame delays alone. The sketch changes
+ the setpoint after every completed cycle and checks that the readback
+ holds the value it wrote.
+
+ Build and run from the repository root:
+
+   cmake -S . -B build && cmake --build build --target master_rw_bench
+   ./build/master_rw_bench
+*/
+
+#include <stdio.h>
+
+#include "Arduino.h"
+#include "SimpleModbusMaster.h"
+#include "SimulatedSlave.h"
+
+#define TURNAROUND_US 1000
+#define LOOP_WORK_US 100
+#define RUN_TIME_US 10000000ULL
+#define STATE_REGS 5
+
+struct Result
+{
+  double cycleTime; // microseconds per setpoint write and readback
+  double bytes; // on the line per cycle, both directions
+  bool correct;
+};
+
+static Result run(long baud, bool readWrite)
+{
+  SimulatedSlave slave;
+  Packet packets[2];
+  unsigned int setpoint[1] = { 0 };
+  unsigned int state[STATE_REGS];
+  Result result = Result();
+
+  packets[0] = Packet();
+  packets[1] = Packet();
+  Packet *read = &packets[0];
+
+  if (readWrite)
+  {
+    read->id = 1;
+    read->function = READ_WRITE_MULTIPLE_REGISTERS;
+    read->address = 0;
+    read->no_of_registers = STATE_REGS;
+    read->register_array = state;
+    read->write_address = 0;
+    read->no_of_write_registers = 1;
+    read->write_array = setpoint;
+  }
+  else
+  {
+    packets[0].id = 1;
+    packets[0].function = PRESET_MULTIPLE_REGISTERS;
+    packets[0].address = 0;
+    packets[0].no_of_registers = 1;
+    packets[0].register_array = setpoint;
+
+    read = &packets[1];
+    read->id = 1;
+    read->function = READ_HOLDING_REGISTERS;
+    read->address = 0;
+    read->no_of_registers = STATE_REGS;
+    read->register_array = state;
+  }
+
+  hal::reset();
+  modbus_configure(baud, 1000, 0, 10, 2, packets, readWrite ? 1 : 2);
+  modbus_background_tx(1);
+  slave.begin(baud);
+  slave.addUnit(1, 16);
+  slave.turnaround = TURNAROUND_US;
+  SimSerial::connect(modbusSerial, slave.port);
+
+  unsigned int cycles = 0;
+  result.correct = true;
+  while (hal::now() < RUN_TIME_US)
+  {
+    slave.poll();
+    modbus_update(packets);
+
+    // a new setpoint for every readback
+    if (read->successful_requests != cycles)
+    {
+      cycles = read->successful_requests;
+      if (state[0] != setpoint[0])
+        result.correct = false;
+      setpoint[0]++;
+    }
+
+    hal::advance(LOOP_WORK_US);
+  }
+
+  if (cycles)
+  {
+    result.cycleTime = (double)RUN_TIME_US / cycles;
+    result.bytes = (double)(modbusSerial.bytesSent + slave.port.bytesSent) / cycles;
+  }
+  if (packets[0].total_errors || packets[1].total_errors)
+    result.correct = false;
+  return result;
+}
+
+int main()
+{
+  static const long bauds[] = { 9600, 19200, 115200 };
+
+  printf("%7s %15s %15s %10s %12s %12s %8s\n", "baud", "16+3 cycle(us)",
+         "23 cycle(us)", "speedup", "16+3 bytes", "23 bytes", "values");
+
+  for (size_t b = 0; b < sizeof(bauds) / sizeof(bauds[0]); b++)
+  {
+    Result before = run(bauds[b], false);
+    Result after = run(bauds[b], true);
+
+    printf("%7ld %15.0f %15.0f %9.2fx %12.1f %12.1f %8s\n", bauds[b],
+           before.cycleTime, after.cycleTime, before.cycleTime / after.cycleTime,
+           before.bytes, after.bytes, before.correct && after.correct ? "ok" : "WRONG");
+  }
+
+  return 0;
+}
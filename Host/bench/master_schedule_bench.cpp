@@ -0,0 +1,245 @@
+/*
+ master_schedule_bench.cpp - bus utilization and staleness of per packet
+ and adaptive poll intervals against the fixed rate scheduler.
+
+ Twenty two slaves share a 19200 baud line: eight fermenters whose
+ temperatures sit still for a minute and then ramp for 20 s while the
+ glycol valve is open, four pumps whose pressure moves every 200 ms and
+ ten status blocks that change every two minutes. The master runs for
+ five minutes with
+
+ fixed     - every packet as often as the line allows, the polling delay
+             of modbus_configure() is the only knob
+ interval  - hand picked intervals, 250 ms pumps, 2 s fermenters, 5 s
+             status
+ adaptive  - interval 250 ms and max_interval 2 s on every packet
+ budget    - adaptive with modbus_budget(20)
+ fixed 20% - fixed with modbus_budget(20)
+
+ Utilization is the share of the time the line carries a frame or the
+ frame delay after it, as modbus_budget() counts it. The staleness of a
+ register is the time since the value the master holds was last the
+ slave's value, the worst one of each kind of slave after the first 10 s
+ is reported.
+
+ Build and run from the repository root:
+
+   cmake -S . -B build && cmake --build build --target master_schedule_bench
+   ./build/master_schedule_bench
+*/
+
+#include <stdio.h>
+
+#include "Arduino.h"
+#include "SimpleModbusMaster.h"
+#include "SimulatedSlave.h"
+
+#define BAUD 19200
+#define TIMEOUT_MS 1000
+#define POLLING_MS 10
+#define TURNAROUND_US 1000
+#define LOOP_WORK_US 200
+#define RUN_TIME_US 300000000ULL
+#define SIGNAL_PERIOD_US 10000ULL
+#define WARM_UP_US 10000000ULL // the first scan is slow with a budget, staleness is measured after it
+
+#define FERMENTERS 8
+#define PUMPS 4
+#define STATUS 10
+#define PACKETS (FERMENTERS + PUMPS + STATUS)
+#define MAX_REGS 8
+
+enum Kind { FERMENTER, PUMP, STATUS_BLOCK };
+
+static const char *kindNames[] = { "fermenter", "pump", "status" };
+static const unsigned int kindRegisters[] = { 4, 2, 8 };
+
+enum Scheduler { FIXED, INTERVAL, ADAPTIVE, BUDGET, FIXED_BUDGET };
+
+static Packet packets[PACKETS];
+static unsigned int regs[PACKETS][MAX_REGS];
+static unsigned long long correctSince[PACKETS][MAX_REGS];
+
+// the slave's values and the one before, which stopped being current at
+// changedAt
+static unsigned int current[PACKETS][MAX_REGS], previous[PACKETS][MAX_REGS];
+static unsigned long long changedAt[PACKETS][MAX_REGS];
+
+static Kind kindOf(unsigned int p)
+{
+  return p < FERMENTERS ? FERMENTER : p < FERMENTERS + PUMPS ? PUMP : STATUS_BLOCK;
+}
+
+// what the slave of packet p holds at time now
+static void signals(SimulatedSlave &slave, unsigned int p, unsigned long long now, unsigned long *seed)
+{
+  unsigned int *r = slave.registers(p + 1);
+  unsigned long long s = now / 1000000ULL;
+
+  switch (kindOf(p))
+  {
+    case FERMENTER:
+    {
+      // a minute still, then one count a second for 20 s
+      unsigned long long t = (s + p * 10) % 80;
+      r[0] = 180 + (unsigned int)(t > 60 ? t - 60 : 0);
+      r[1] = 180;
+      r[2] = 1050 - (unsigned int)(s / 3600);
+      r[3] = 120;
+      break;
+    }
+    case PUMP:
+      if (now % 200000ULL == 0)
+      {
+        *seed = *seed * 1103515245 + 12345;
+        r[0] = 3000 + (*seed >> 16) % 50;
+        r[1] = 800 + p;
+      }
+      break;
+    case STATUS_BLOCK:
+      for (unsigned int i = 0; i < kindRegisters[STATUS_BLOCK]; i++)
+        r[i] = (unsigned int)((s + p * 7) / 120) + i;
+      break;
+  }
+}
+
+struct Result
+{
+  double utilization; // percent
+  double requests; // per second
+  double stale[3]; // worst milliseconds per kind
+  bool correct;
+};
+
+static Result run(Scheduler scheduler)
+{
+  SimulatedSlave slave;
+  Result result = Result();
+
+  hal::reset();
+  slave.begin(BAUD);
+  slave.turnaround = TURNAROUND_US;
+
+  for (unsigned int p = 0; p < PACKETS; p++)
+  {
+    Kind kind = kindOf(p);
+    Packet *packet = &packets[p];
+    *packet = Packet();
+    packet->id = p + 1;
+    packet->function = READ_HOLDING_REGISTERS;
+    packet->address = 0;
+    packet->no_of_registers = kindRegisters[kind];
+    packet->register_array = regs[p];
+
+    if (scheduler == INTERVAL)
+      packet->interval = kind == PUMP ? 250 : kind == FERMENTER ? 2000 : 5000;
+    else if (scheduler == ADAPTIVE || scheduler == BUDGET)
+    {
+      packet->interval = 250;
+      packet->max_interval = 2000;
+    }
+
+    slave.addUnit(p + 1, MAX_REGS);
+    for (unsigned int i = 0; i < MAX_REGS; i++)
+    {
+      regs[p][i] = current[p][i] = previous[p][i] = 0;
+      correctSince[p][i] = changedAt[p][i] = 0;
+    }
+  }
+
+  modbus_configure(BAUD, TIMEOUT_MS, POLLING_MS, 10, 2, packets, PACKETS);
+  modbus_background_tx(1);
+  if (scheduler == BUDGET || scheduler == FIXED_BUDGET)
+    modbus_budget(20);
+  SimSerial::connect(modbusSerial, slave.port);
+
+  unsigned long seed = 1;
+  unsigned long long nextSignal = 0;
+  unsigned long long worst[3] = { 0, 0, 0 };
+
+  while (hal::now() < RUN_TIME_US)
+  {
+    unsigned long long now = hal::now();
+    if (now >= nextSignal)
+    {
+      for (unsigned int p = 0; p < PACKETS; p++)
+      {
+        signals(slave, p, nextSignal, &seed);
+        unsigned int *r = slave.registers(p + 1);
+        for (unsigned int i = 0; i < MAX_REGS; i++)
+          if (r[i] != current[p][i])
+          {
+            previous[p][i] = current[p][i];
+            current[p][i] = r[i];
+            changedAt[p][i] = nextSignal;
+          }
+      }
+      nextSignal += SIGNAL_PERIOD_US;
+    }
+
+    slave.poll();
+    modbus_update(packets);
+
+    for (unsigned int p = 0; p < PACKETS; p++)
+    {
+      if (now < WARM_UP_US)
+      {
+        for (unsigned int i = 0; i < MAX_REGS; i++)
+          correctSince[p][i] = now;
+        continue;
+      }
+      Kind kind = kindOf(p);
+      unsigned int *r = slave.registers(p + 1);
+      for (unsigned int i = 0; i < kindRegisters[kind]; i++)
+      {
+        if (regs[p][i] == r[i])
+          correctSince[p][i] = now;
+        else if (regs[p][i] == previous[p][i] && changedAt[p][i] > correctSince[p][i])
+          correctSince[p][i] = changedAt[p][i];
+        if (now - correctSince[p][i] > worst[kind])
+          worst[kind] = now - correctSince[p][i];
+      }
+    }
+
+    hal::advance(LOOP_WORK_US);
+  }
+
+  unsigned long requests = 0;
+  result.correct = true;
+  for (unsigned int p = 0; p < PACKETS; p++)
+  {
+    requests += packets[p].requests;
+    if (packets[p].total_errors || !packets[p].successful_requests)
+      result.correct = false;
+  }
+
+  // a request and its response are two frames
+  unsigned long bytes = modbusSerial.bytesSent + slave.port.bytesSent;
+  double busy = bytes * (10000000.0 / BAUD) + 2.0 * requests * (35000000.0 / BAUD);
+  result.utilization = 100.0 * busy / RUN_TIME_US;
+  result.requests = requests / (RUN_TIME_US / 1e6);
+  for (int k = 0; k < 3; k++)
+    result.stale[k] = worst[k] / 1000.0;
+  return result;
+}
+
+int main()
+{
+  static const char *names[] = { "fixed", "interval", "adaptive", "budget", "fixed 20%" };
+
+  printf("%-10s %9s %12s", "scheduler", "busy(%)", "requests/s");
+  for (int k = 0; k < 3; k++)
+    printf(" %10s(ms)", kindNames[k]);
+  printf(" %8s\n", "values");
+
+  for (int scheduler = FIXED; scheduler <= FIXED_BUDGET; scheduler++)
+  {
+    Result result = run((Scheduler)scheduler);
+    printf("%-10s %9.1f %12.1f", names[scheduler], result.utilization, result.requests);
+    for (int k = 0; k < 3; k++)
+      printf(" %14.0f", result.stale[k]);
+    printf(" %8s\n", result.correct ? "ok" : "WRONG");
+  }
+
+  return 0;
+}
@@ -0,0 +1,224 @@
+/*
+ master_setpoints_bench.cpp - time for a recipe change to reach 32
+ fermenters with one function 16 packet per slave and with a
+ ModbusSetpoints batch.
+
+ 32 fermenter controllers share a 19200 baud line. Each one is polled for
+ its 16 registers, which include 4 setpoints at register 10: temperature,
+ ramp rate, pressure and mode. After two seconds the recipe steps and new
+ setpoints are written:
+
+ same      - every fermenter gets the same values
+ 4 differ  - 4 fermenters get a temperature of their own
+ all       - every fermenter gets a temperature of its own
+ 2 missed  - like same, but 2 fermenters lose the broadcast, the master
+             only finds out by reading them back. Only a broadcast can
+             be lost without an error, for the others it is the same
+
+ The ways of writing them are
+
+ packets   - a function 16 packet per fermenter next to its read packet,
+             written on every scan, as a sketch does it without batches
+ unicast   - a batch without broadcast, one write per fermenter
+ broadcast - a batch that may broadcast
+
+ Reported are the milliseconds from the change until every slave holds
+ its values, until the master knows that they do (for packets that is
+ when the last write was answered), and the requests sent until then.
+
+ Build and run from the repository root:
+
+   cmake -S . -B build && cmake --build build --target master_setpoints_bench
+   ./build/master_setpoints_bench
+*/
+
+#include <stdio.h>
+
+#include "Arduino.h"
+#include "SimpleModbusMaster.h"
+#include "SimulatedSlave.h"
+
+#define BAUD 19200
+#define TIMEOUT_MS 100
+#define POLLING_MS 5
+#define TURNAROUND_US 1000
+#define LOOP_WORK_US 200
+#define UNITS 32
+#define REGISTERS 16
+#define SETPOINTS 10 // the first setpoint register
+#define NO_OF_SETPOINTS 4
+#define CHANGE_US 2000000ULL
+#define GIVE_UP_US 60000000ULL
+
+enum { SAME, FOUR_DIFFER, ALL_DIFFER, TWO_MISSED, SCENARIOS };
+enum { PACKETS, UNICAST, BROADCAST, METHODS };
+
+static const char *scenarios[] = { "same", "4 differ", "all", "2 missed" };
+static const char *methods[] = { "packets", "unicast", "broadcast" };
+
+static Packet packets[UNITS * 2];
+static unsigned int regs[UNITS][REGISTERS];
+static unsigned int targets[UNITS][NO_OF_SETPOINTS];
+static unsigned int shared[NO_OF_SETPOINTS];
+static ModbusSetpointUnit units[UNITS];
+
+struct Result
+{
+  double slavesMs; // until every slave holds its setpoints
+  double knownMs; // until the master knows
+  unsigned long requests;
+};
+
+static unsigned long requests(ModbusSetpoints *batch)
+{
+  unsigned long total = batch ? batch->packet.requests : 0;
+  for (unsigned int i = 0; i < UNITS * 2; i++)
+    total += packets[i].requests;
+  return total;
+}
+
+static bool converged(SimulatedSlave &slave)
+{
+  for (unsigned int u = 0; u < UNITS; u++)
+    for (unsigned int r = 0; r < NO_OF_SETPOINTS; r++)
+      if (slave.registers(u + 1)[SETPOINTS + r] != targets[u][r])
+        return false;
+  return true;
+}
+
+static Result run(unsigned int scenario, unsigned int method)
+{
+  SimulatedSlave slave;
+  ModbusSetpoints batch = { SETPOINTS, NO_OF_SETPOINTS, units, UNITS, shared, method == BROADCAST };
+  Result result = Result();
+
+  // a read packet per fermenter, and a write packet that writes the
+  // setpoints from targets once they have changed
+  unsigned int total = method == PACKETS ? UNITS * 2 : UNITS;
+  for (unsigned int u = 0; u < UNITS; u++)
+  {
+    Packet *read = &packets[u];
+    *read = Packet();
+    read->id = u + 1;
+    read->function = READ_HOLDING_REGISTERS;
+    read->address = 0;
+    read->no_of_registers = REGISTERS;
+    read->register_array = regs[u];
+
+    Packet *write = &packets[UNITS + u];
+    *write = Packet();
+    write->id = u + 1;
+    write->function = PRESET_MULTIPLE_REGISTERS;
+    write->address = SETPOINTS;
+    write->no_of_registers = NO_OF_SETPOINTS;
+    write->register_array = targets[u];
+
+    units[u].id = u + 1;
+    units[u].values = targets[u];
+    units[u].readback = read;
+  }
+
+  // the old recipe is in place everywhere
+  for (unsigned int u = 0; u < UNITS; u++)
+  {
+    targets[u][0] = 650; // 65.0 F
+    targets[u][1] = 5; // tenths of a degree an hour
+    targets[u][2] = 120; // 12.0 psi
+    targets[u][3] = 1; // fermenting
+  }
+
+  hal::reset();
+  modbus_configure(BAUD, TIMEOUT_MS, POLLING_MS, 3, 2, packets, total);
+  modbus_background_tx(1);
+  slave.begin(BAUD);
+  slave.turnaround = TURNAROUND_US;
+  for (unsigned char id = 1; id <= UNITS; id++)
+  {
+    slave.addUnit(id, REGISTERS);
+    for (unsigned int r = 0; r < NO_OF_SETPOINTS; r++)
+      slave.registers(id)[SETPOINTS + r] = targets[id - 1][r];
+  }
+  SimSerial::connect(modbusSerial, slave.port);
+
+  bool changed = false;
+  unsigned long requestsBefore = 0;
+  bool missed = scenario == TWO_MISSED && method == BROADCAST;
+  unsigned int knownAnswers = 0;
+
+  while (hal::now() < GIVE_UP_US)
+  {
+    if (!changed && hal::now() >= CHANGE_US)
+    {
+      // the next recipe step, cold crash
+      for (unsigned int u = 0; u < UNITS; u++)
+      {
+        targets[u][0] = 340; // 34.0 F
+        targets[u][1] = 20;
+        targets[u][2] = 150;
+        targets[u][3] = 2; // crashing
+        if ((scenario == FOUR_DIFFER && u % 8 == 3) || scenario == ALL_DIFFER)
+          targets[u][0] = 330 + u;
+      }
+      if (method != PACKETS)
+        modbus_setpoints(&batch);
+      changed = true;
+      requestsBefore = requests(method == PACKETS ? 0 : &batch);
+      for (unsigned int u = 0; u < UNITS; u++)
+        packets[UNITS + u].successful_requests = 0;
+    }
+
+    slave.poll();
+
+    // a fermenter that missed the broadcast still has the old recipe
+    if (missed && changed && slave.registers(7)[SETPOINTS] == targets[6][0])
+    {
+      slave.registers(7)[SETPOINTS] = 650;
+      slave.registers(23)[SETPOINTS] = 650;
+      missed = false;
+    }
+
+    modbus_update(packets);
+    hal::advance(LOOP_WORK_US);
+
+    if (!changed)
+      continue;
+
+    unsigned long long elapsed = hal::now() - CHANGE_US;
+    if (!result.slavesMs && converged(slave))
+      result.slavesMs = elapsed / 1000.0;
+
+    if (method == PACKETS)
+    {
+      knownAnswers = 0;
+      for (unsigned int u = 0; u < UNITS; u++)
+        knownAnswers += packets[UNITS + u].successful_requests > 0;
+    }
+    if (!result.knownMs && (method == PACKETS ? knownAnswers == UNITS : modbus_setpoints_pending(&batch) == 0))
+    {
+      result.knownMs = elapsed / 1000.0;
+      result.requests = requests(method == PACKETS ? 0 : &batch) - requestsBefore;
+    }
+
+    if (result.slavesMs && result.knownMs)
+      break;
+  }
+
+  if (!converged(slave))
+    result.slavesMs = -1;
+  return result;
+}
+
+int main()
+{
+  printf("%-9s %-10s %10s %10s %9s\n", "recipe", "writes", "slaves(ms)", "known(ms)", "requests");
+
+  for (unsigned int s = 0; s < SCENARIOS; s++)
+    for (unsigned int m = 0; m < METHODS; m++)
+    {
+      Result result = run(s, m);
+      printf("%-9s %-10s %10.0f %10.0f %9lu\n", scenarios[s], methods[m],
+             result.slavesMs, result.knownMs, result.requests);
+    }
+
+  return 0;
+}
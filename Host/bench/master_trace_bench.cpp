@@ -0,0 +1,176 @@
+/*
+ master_trace_bench.cpp - finding the slaves that blow the scan budget
+ from the master's trace, and what tracing costs.
+
+ Eight slaves share a 19200 baud line, one packet of 10 registers each,
+ with a scan budget of 200 ms. Most answer within 1 ms. Slave 3 takes 0
+ to 20 ms, slave 5 always takes 30 ms and slave 7 misses one request in
+ ten, which costs a 200 ms time out. The master scans them for a minute
+ with a 4096 record trace and a histogram for every slave id, saves both
+ to a TraceFile and reads the file back. From the histograms every
+ slave's median, 99th percentile and maximum are reported, and from the
+ records its share of the scan time.
+
+ The same run without tracing gives the CPU cost of tracing per
+ transaction on this host. The newest records are also exported with
+ modbus_trace_registers() and checked against the ring.
+
+ Build and run from the repository root:
+
+   cmake -S . -B build && cmake --build build --target master_trace_bench
+   ./build/master_trace_bench
+*/
+
+#include <stdio.h>
+
+#include <chrono>
+
+#include "Arduino.h"
+#include "SimpleModbusMaster.h"
+#include "SimulatedSlave.h"
+#include "TraceFile.h"
+
+#define BAUD 19200
+#define TIMEOUT_MS 200
+#define TURNAROUND_US 1000
+#define LOOP_WORK_US 50
+#define RUN_TIME_US 60000000ULL
+#define SLAVES 8
+#define SCAN_BUDGET_US 200000
+#define TRACE_SIZE 4096
+#define EXPORT_REGISTERS 64
+#define TRACE_PATH "master_trace_bench.mbtr"
+
+static Packet packets[SLAVES];
+static unsigned int regs[SLAVES][10];
+static ModbusTraceRecord trace[TRACE_SIZE];
+static ModbusHistogram histograms[SLAVES + 1];
+static ModbusPort port;
+
+struct Result
+{
+  unsigned long transactions;
+  double cpu; // nanoseconds of the run per transaction
+  double scanTime; // microseconds
+};
+
+static Result run(bool traced)
+{
+  SimulatedSlave slave;
+  Result result = Result();
+
+  hal::reset();
+  slave.begin(BAUD);
+  slave.turnaround = TURNAROUND_US;
+  for (unsigned int s = 0; s < SLAVES; s++)
+  {
+    slave.addUnit(s + 1, 10);
+    packets[s] = Packet();
+    packets[s].id = s + 1;
+    packets[s].function = READ_HOLDING_REGISTERS;
+    packets[s].no_of_registers = 10;
+    packets[s].register_array = regs[s];
+  }
+  slave.setDelay(5, 30000);
+
+  modbusSerial.begin(BAUD);
+  modbus_port_configure(&port, &modbusSerial, BAUD, TIMEOUT_MS, 0, 10, 2, packets, SLAVES);
+  modbus_port_background_tx(&port, 1);
+  if (traced)
+    modbus_port_trace(&port, trace, TRACE_SIZE, histograms, SLAVES + 1);
+  SimSerial::connect(modbusSerial, slave.port);
+
+  unsigned long seed = 1;
+  unsigned int seen = 0;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  while (hal::now() < RUN_TIME_US)
+  {
+    // a new request to slave 3 or 7 decides how they behave
+    if (packets[2].requests + packets[6].requests != seen)
+    {
+      seen = packets[2].requests + packets[6].requests;
+      seed = seed * 1103515245 + 12345;
+      slave.setDelay(3, (seed >> 16) % 20000);
+      slave.setAlive(7, (seed >> 8) % 10 != 0);
+    }
+
+    slave.poll();
+    modbus_port_update(&port);
+    hal::advance(LOOP_WORK_US);
+  }
+
+  std::chrono::steady_clock::duration elapsed = std::chrono::steady_clock::now() - start;
+
+  unsigned int scans = ~0u;
+  for (unsigned int s = 0; s < SLAVES; s++)
+  {
+    result.transactions += packets[s].requests;
+    if (packets[s].requests < scans)
+      scans = packets[s].requests;
+  }
+  result.cpu = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count() /
+               result.transactions;
+  result.scanTime = (double)RUN_TIME_US / scans;
+  return result;
+}
+
+int main()
+{
+  Result plain = run(false);
+  Result traced = run(true);
+
+  // newest records as registers, they must decode to the end of the ring
+  unsigned int exported[EXPORT_REGISTERS];
+  unsigned int count = modbus_port_trace_registers(&port, exported, EXPORT_REGISTERS);
+  TraceFile capture;
+  capture.capture(&port);
+  bool exportOk = count == EXPORT_REGISTERS / 7;
+  for (unsigned int i = 0; i < count && exportOk; i++)
+  {
+    const ModbusTraceRecord &record = capture.records[capture.records.size() - count + i];
+    const unsigned int *r = &exported[i * 7];
+    exportOk = r[0] == (unsigned int)(record.id << 8 | record.function) &&
+               r[1] == (unsigned int)(record.status << 8 | record.exception) &&
+               ((unsigned long)r[2] << 16 | r[3]) == (record.started & 0xFFFFFFFFUL) &&
+               r[4] == record.first_byte && r[5] == record.last_byte && r[6] == record.checked;
+  }
+
+  TraceFile file;
+  bool fileOk = capture.save(TRACE_PATH) && file.load(TRACE_PATH) &&
+                file.total == capture.total && file.records.size() == capture.records.size();
+  remove(TRACE_PATH);
+
+  // every slave's share of the time the records span
+  unsigned long long busy[SLAVES + 1] = { 0 };
+  unsigned long timeouts[SLAVES + 1] = { 0 };
+  for (size_t i = 0; i < file.records.size(); i++)
+  {
+    const ModbusTraceRecord &record = file.records[i];
+    busy[record.id] += TraceFile::checked(record);
+    timeouts[record.id] += record.status == MODBUS_TRACE_TIMEOUT;
+  }
+  unsigned long long span = 0;
+  for (unsigned int id = 1; id <= SLAVES; id++)
+    span += busy[id];
+
+  printf("scan %.0f ms against a budget of %d ms, %lu transactions, %zu in the trace file\n\n",
+         traced.scanTime / 1000, SCAN_BUDGET_US / 1000, traced.transactions, file.records.size());
+  printf("%5s %12s %10s %10s %10s %10s %10s\n", "slave", "transactions", "p50(ms)", "p99(ms)",
+         "max(ms)", "timeouts", "scan(%)");
+  for (unsigned int id = 1; id <= SLAVES; id++)
+  {
+    const ModbusHistogram &histogram = file.histograms[id];
+    printf("%5u %12lu %10.1f %10.1f %10.1f %10lu %10.1f\n", id, histogram.total,
+           modbus_histogram_percentile(&histogram, 500) / 1000.0,
+           modbus_histogram_percentile(&histogram, 990) / 1000.0, histogram.max / 1000.0,
+           timeouts[id], 100.0 * busy[id] / span);
+  }
+
+  printf("\nCPU per transaction, simulated slave included: %.0f ns untraced, %.0f ns traced\n",
+         plain.cpu, traced.cpu);
+  printf("on this host a trace record takes %zu bytes (14 on an AVR and in the file), "
+         "a histogram %zu (168 on an AVR)\n", sizeof(ModbusTraceRecord), sizeof(ModbusHistogram));
+  printf("register export %s, trace file %s\n", exportOk ? "ok" : "WRONG", fileOk ? "ok" : "WRONG");
+  return 0;
+}
@@ -0,0 +1,177 @@
+/*
+ master_tune_bench.cpp - scan time of a mixed speed 115200 baud line with
+ the time out and frame delay of modbus_configure() against the ones
+ modbus_tune() measures for every slave.
+
+ 20 slaves are polled for 10 registers each: 8 fast ones that answer
+ 100 us after the end of a request, 8 that take 2 ms and leave 100 us
+ between the characters of a response and 4 PLCs that take 15 ms and
+ pause 300 us. Every slave separates frames after 175 us of silence. The
+ configured time out is 200 ms for the PLCs and the frame delay the
+ standard 1750 us. Slave 21 answers like a fast one for 30 s and then
+ fails, it is re-probed every 500 ms. Each way runs for a minute:
+
+ configured - no tuning
+ tuned      - modbus_tune(timings, 32, 50, 200) from nothing
+ restored   - tuned with the timings the previous run left, as a sketch
+              that keeps them in EEPROM finds them after a restart
+ margin 0   - tuned without a margin
+
+ Reported are the time until every slave has answered once, the scan
+ time of the 20 slaves from 10 to 30 s and from 40 to 60 s, while slave
+ 21 is gone, and the errors other than those of slave 21. Last come the
+ times measured for a slave of each kind.
+
+ Build and run from the repository root:
+
+   cmake -S . -B build && cmake --build build --target master_tune_bench
+   ./build/master_tune_bench
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "Arduino.h"
+#include "SimpleModbusMaster.h"
+#include "SimulatedSlave.h"
+
+#define BAUD 115200
+#define TIMEOUT_MS 200
+#define POLLING_MS 0
+#define TURNAROUND_US 100
+#define SLAVE_FRAME_DELAY_US 175
+#define LOOP_WORK_US 50
+#define RUN_TIME_US 60000000ULL
+#define FAIL_AT_US 30000000ULL
+
+#define SLAVES 20
+#define PACKETS (SLAVES + 1)
+#define FAILING_ID 21
+#define REGISTERS 10
+#define TIMINGS 32
+
+enum { CONFIGURED, TUNED, RESTORED, MARGIN_0, WAYS };
+
+static const char *ways[] = { "configured", "tuned", "restored", "margin 0" };
+
+static Packet packets[PACKETS];
+static unsigned int regs[PACKETS][REGISTERS];
+static ModbusTiming timings[TIMINGS];
+
+struct Result
+{
+  double firstScanMs; // until every slave has answered once
+  double scanMs, scanFailingMs; // of the 20 slaves with slave 21 answering and failing
+  unsigned long errors; // of the 20 slaves
+};
+
+static unsigned long answers()
+{
+  unsigned long total = 0;
+  for (unsigned int i = 0; i < SLAVES; i++)
+    total += packets[i].successful_requests;
+  return total;
+}
+
+static Result run(unsigned int way)
+{
+  SimulatedSlave slave;
+  Result result = Result();
+
+  for (unsigned int i = 0; i < PACKETS; i++)
+  {
+    Packet *packet = &packets[i];
+    *packet = Packet();
+    packet->id = i + 1;
+    packet->function = READ_HOLDING_REGISTERS;
+    packet->no_of_registers = REGISTERS;
+    packet->register_array = regs[i];
+  }
+
+  // a restored run starts with what the run before it measured
+  if (way != RESTORED)
+    memset(timings, 0, sizeof(timings));
+
+  hal::reset();
+  modbus_configure(BAUD, TIMEOUT_MS, POLLING_MS, 3, 2, packets, PACKETS);
+  modbus_background_tx(1);
+  modbus_backoff(500, 500);
+  if (way != CONFIGURED)
+    modbus_tune(timings, TIMINGS, way == MARGIN_0 ? 0 : 50, 200);
+
+  slave.begin(BAUD);
+  slave.setFrameDelay(SLAVE_FRAME_DELAY_US);
+  slave.turnaround = TURNAROUND_US;
+  for (unsigned char id = 1; id <= PACKETS; id++)
+  {
+    slave.addUnit(id, REGISTERS);
+    if (id > 8 && id <= 16)
+    {
+      slave.setDelay(id, 2000);
+      slave.setGap(id, 100);
+    }
+    else if (id > 16 && id <= SLAVES)
+    {
+      slave.setDelay(id, 15000);
+      slave.setGap(id, 300);
+    }
+  }
+  SimSerial::connect(modbusSerial, slave.port);
+
+  unsigned long answersAt10 = 0, answersAt30 = 0, answersAt40 = 0;
+
+  while (hal::now() < RUN_TIME_US)
+  {
+    unsigned long long before = hal::now();
+
+    slave.poll();
+    modbus_update(packets);
+    hal::advance(LOOP_WORK_US);
+
+    unsigned long long now = hal::now();
+    if (before < FAIL_AT_US && now >= FAIL_AT_US)
+      slave.setAlive(FAILING_ID, false);
+    if (before < 10000000ULL && now >= 10000000ULL)
+      answersAt10 = answers();
+    if (before < FAIL_AT_US && now >= FAIL_AT_US)
+      answersAt30 = answers();
+    if (before < 40000000ULL && now >= 40000000ULL)
+      answersAt40 = answers();
+
+    if (!result.firstScanMs)
+    {
+      unsigned int answered = 0;
+      for (unsigned int i = 0; i < PACKETS; i++)
+        answered += packets[i].successful_requests > 0;
+      if (answered == PACKETS)
+        result.firstScanMs = now / 1000.0;
+    }
+  }
+
+  result.scanMs = 20000.0 / ((answersAt30 - answersAt10) / (double)SLAVES);
+  result.scanFailingMs = 20000.0 / ((answers() - answersAt40) / (double)SLAVES);
+  for (unsigned int i = 0; i < SLAVES; i++)
+    result.errors += packets[i].timeout + packets[i].incorrect_id_returned +
+                     packets[i].incorrect_function_returned + packets[i].incorrect_bytes_returned +
+                     packets[i].checksum_failed + packets[i].buffer_errors;
+  return result;
+}
+
+int main()
+{
+  printf("%-10s %14s %9s %17s %7s\n", "timing", "first scan(ms)", "scan(ms)", "21 failing(ms)", "errors");
+
+  for (unsigned int w = 0; w < WAYS; w++)
+  {
+    Result result = run(w);
+    printf("%-10s %14.1f %9.2f %17.2f %7lu\n", ways[w], result.firstScanMs, result.scanMs,
+           result.scanFailingMs, result.errors);
+  }
+
+  // what the last run measured for one slave of each kind
+  printf("\n%-10s %15s %8s\n", "slave", "turnaround(us)", "gap(us)");
+  for (unsigned int id = 1; id <= SLAVES; id += 8)
+    printf("%-10u %15u %8u\n", id, timings[id].turnaround * MODBUS_TRACE_TICK,
+           timings[id].gap * MODBUS_TRACE_TICK);
+  return 0;
+}
@@ -0,0 +1,102 @@
+/*
+ master_tx_bench.cpp - CPU time SimpleModbusMaster hands back to loop()
+ while it transmits requests.
+
+ The master writes holding registers to a simulated slave with function 16
+ and polls every 10 ms. The slave answers 1 ms after the end of request
+ silence. The master runs once on an unbuffered port (SoftwareSerial, every
+ write blocks and the request waits for T3.5 afterwards) and once on a
+ buffered port (HardwareSerial, the request is sent in the background).
+ For every request size the time spent inside modbus_update() per
+ transaction is reported together with how much of it the background send
+ gives back to the caller.
+
+ Build and run from the repository root:
+
+   cmake -S . -B build && cmake --build build --target master_tx_bench
+   ./build/master_tx_bench
+*/
+
+#include <stdio.h>
+
+#include "Arduino.h"
+#include "SimpleModbusMaster.h"
+#include "SimulatedSlave.h"
+
+#define LOOP_WORK_US 200
+#define TURNAROUND_US 1000
+#define RUN_TIME_US 10000000ULL
+#define TX_ENABLE_PIN 2
+#define MAX_REGS 59
+
+static unsigned int regs[MAX_REGS];
+
+struct Result
+{
+  double blockedPerTransaction; // microseconds spent in modbus_update()
+  unsigned long transactions;
+};
+
+static Result run(long baud, unsigned int no_of_registers, bool buffered)
+{
+  SimulatedSlave slave;
+  Packet packet = Packet();
+  Result result = Result();
+
+  packet.id = 1;
+  packet.function = PRESET_MULTIPLE_REGISTERS;
+  packet.address = 0;
+  packet.no_of_registers = no_of_registers;
+  packet.register_array = regs;
+
+  hal::reset();
+  if (!buffered)
+    modbusSerial.txBufferSize = 0;
+  modbus_configure(baud, 1000, 10, 10, TX_ENABLE_PIN, &packet, 1);
+  modbus_background_tx(1);
+  slave.begin(baud);
+  slave.addUnit(1, MAX_REGS);
+  slave.turnaround = TURNAROUND_US;
+  SimSerial::connect(modbusSerial, slave.port);
+
+  unsigned long long blocked = 0;
+  while (hal::now() < RUN_TIME_US)
+  {
+    slave.poll();
+
+    unsigned long long start = hal::now();
+    modbus_update(&packet);
+    blocked += hal::now() - start;
+
+    hal::advance(LOOP_WORK_US);
+  }
+
+  result.transactions = packet.successful_requests;
+  if (result.transactions)
+    result.blockedPerTransaction = (double)blocked / result.transactions;
+  return result;
+}
+
+int main()
+{
+  static const long bauds[] = { 9600, 115200 };
+  static const unsigned int sizes[] = { 1, 16, 59 };
+
+  printf("%7s %5s %9s %14s %14s %14s %11s\n", "baud", "regs", "wire(us)",
+         "blocking(us)", "buffered(us)", "returned(us)", "answered");
+
+  for (size_t b = 0; b < sizeof(bauds) / sizeof(bauds[0]); b++)
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+    {
+      Result before = run(bauds[b], sizes[s], false);
+      Result after = run(bauds[b], sizes[s], true);
+      unsigned long wire = (9 + sizes[s] * 2) * ((10000000 + bauds[b] - 1) / bauds[b]);
+
+      printf("%7ld %5u %9lu %14.0f %14.0f %14.0f %5lu/%-5lu\n", bauds[b], sizes[s], wire,
+             before.blockedPerTransaction, after.blockedPerTransaction,
+             before.blockedPerTransaction - after.blockedPerTransaction,
+             before.transactions, after.transactions);
+    }
+
+  return 0;
+}
@@ -0,0 +1,320 @@
+/*
+ register_map_bench.cpp - the cost of answering requests from a
+ ModbusRegisterMap against the plain register array of
+ SimpleModbusSlave.
+
+ A slave has 24 registers: u16, i16 and fixed ones, float32 pairs and a
+ setpoint block, all of them readable and writable so the plain array and
+ the map answer the same requests. Two of the registers have callbacks.
+ A master at 1 Mbaud sends function 3, 6, 16 and 23 requests over the
+ whole range, one kind at a time, to the array and to the map in turns.
+ Only the modbus_update() call that checks the frame and builds the
+ response is timed, in nanoseconds and on x86 in TSC cycles, everything
+ else is the same for both. Both have to give the same answers.
+
+ Then the map is swapped for one where some registers are read only and
+ there is a gap, and requests that the map has to refuse are sent: a
+ write to a read only register, half of a float32 and a read of the gap.
+ The exception each one gets is printed next to the one expected.
+
+ The tables of a map take 2 bytes per address and one entry per register
+ with callbacks, the sizes are printed for the host and for the AVR.
+
+ Build and run from the repository root:
+
+   cmake -S . -B build && cmake --build build --target register_map_bench
+   ./build/register_map_bench
+*/
+
+#include <stdio.h>
+
+#include <chrono>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#else
+#define HAVE_TSC 0
+#endif
+
+#include "Arduino.h"
+#include "SimpleModbusSlave.h"
+
+#define BAUD 1000000
+#define T3_5 10 // SimpleModbusSlave's low latency frame delay at 1 Mbaud
+#define REQUESTS 200000
+#define MAX_FRAME 260
+
+enum
+{
+  ALARM_STATE,
+  TEMP_STATE,
+  PRESSURE = 2, // float32, 2 and 3
+  FLOW = 4, // float32, 4 and 5
+  VALVE = 6,
+  SETPOINTS = 7, // 8 fixed registers
+  PUMP_SPEED = 15,
+  GRAVITY = 16, // float32, 16 and 17
+  HEATER = 18,
+  TOTAL_ERRORS = 23,
+  TOTAL_REGS_SIZE
+};
+
+static unsigned long setpointWrites, pressureReads;
+
+static void setpointChanged(unsigned int)
+{
+  setpointWrites++;
+}
+
+static void readPressure(unsigned int)
+{
+  pressureReads++;
+}
+
+constexpr ModbusRegister allRegisters[] =
+{
+  modbus_u16(ALARM_STATE, MODBUS_READ_WRITE),
+  modbus_fixed(TEMP_STATE, MODBUS_READ_WRITE, 10),
+  modbus_float32(PRESSURE, MODBUS_READ_WRITE, 0, readPressure),
+  modbus_float32(FLOW, MODBUS_READ_WRITE),
+  modbus_u16(VALVE, MODBUS_READ_WRITE),
+  modbus_fixed(SETPOINTS, MODBUS_READ_WRITE, 10, setpointChanged),
+  modbus_fixed(SETPOINTS + 1, MODBUS_READ_WRITE, 10),
+  modbus_fixed(SETPOINTS + 2, MODBUS_READ_WRITE, 10),
+  modbus_fixed(SETPOINTS + 3, MODBUS_READ_WRITE, 10),
+  modbus_fixed(SETPOINTS + 4, MODBUS_READ_WRITE, 10),
+  modbus_fixed(SETPOINTS + 5, MODBUS_READ_WRITE, 10),
+  modbus_fixed(SETPOINTS + 6, MODBUS_READ_WRITE, 10),
+  modbus_fixed(SETPOINTS + 7, MODBUS_READ_WRITE, 10),
+  modbus_i16(PUMP_SPEED, MODBUS_READ_WRITE),
+  modbus_float32(GRAVITY, MODBUS_READ_WRITE),
+  modbus_u16(HEATER, MODBUS_READ_WRITE),
+  modbus_u16(HEATER + 1, MODBUS_READ_WRITE),
+  modbus_u16(HEATER + 2, MODBUS_READ_WRITE),
+  modbus_u16(HEATER + 3, MODBUS_READ_WRITE),
+  modbus_u16(HEATER + 4, MODBUS_READ_WRITE),
+  modbus_u16(TOTAL_ERRORS, MODBUS_READ_WRITE),
+};
+
+// the same slave as a master may see it, with registers 19 to 22 unused
+constexpr ModbusRegister guardedRegisters[] =
+{
+  modbus_u16(ALARM_STATE, MODBUS_READ),
+  modbus_fixed(TEMP_STATE, MODBUS_READ, 10),
+  modbus_float32(PRESSURE, MODBUS_READ, 0, readPressure),
+  modbus_float32(FLOW, MODBUS_READ),
+  modbus_u16(VALVE, MODBUS_READ_WRITE),
+  modbus_fixed(SETPOINTS, MODBUS_READ_WRITE, 10, setpointChanged),
+  modbus_fixed(SETPOINTS + 1, MODBUS_READ_WRITE, 10),
+  modbus_i16(PUMP_SPEED, MODBUS_READ_WRITE),
+  modbus_float32(GRAVITY, MODBUS_READ_WRITE),
+  modbus_u16(HEATER, MODBUS_READ_WRITE),
+  modbus_u16(TOTAL_ERRORS, MODBUS_READ),
+};
+
+static ModbusRegisterMap<allRegisters, sizeof(allRegisters) / sizeof(allRegisters[0])> all;
+static ModbusRegisterMap<guardedRegisters, sizeof(guardedRegisters) / sizeof(guardedRegisters[0])> guarded;
+static unsigned int plain[TOTAL_REGS_SIZE];
+
+static SimSerial line; // the master's end of modbusSerial
+
+static unsigned long long handled; // nanoseconds in the timed modbus_update() calls
+static unsigned long long cycles;
+
+// Sends the request in frame and returns the response in it, 0 if there was none.
+static unsigned int transact(unsigned char *frame, unsigned int length, unsigned int *regs)
+{
+  unsigned int crc16 = modbus_crc16(frame, length);
+  frame[length] = crc16 >> 8;
+  frame[length + 1] = crc16 & 0xFF;
+
+  line.write(frame, length + 2);
+  hal::advance(line.txDoneAt() - hal::now());
+  modbus_update(regs);
+  hal::advance(T3_5);
+
+  // the frame is complete, this call checks and answers it
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+#if HAVE_TSC
+  unsigned long long tsc = __rdtsc();
+#endif
+  modbus_update(regs);
+#if HAVE_TSC
+  cycles += __rdtsc() - tsc;
+#endif
+  handled += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+  while (!modbusSerial.txIdle())
+  {
+    hal::advance(modbusSerial.txDoneAt() - hal::now());
+    modbus_update(regs);
+  }
+
+  length = 0;
+  while (line.available())
+  {
+    unsigned char value = line.read();
+    if (length < MAX_FRAME)
+      frame[length++] = value;
+  }
+  return length;
+}
+
+static void begin(const ModbusMapTables *map)
+{
+  hal::reset();
+  modbus_configure(BAUD, 1, 0, TOTAL_REGS_SIZE, 1);
+  modbus_configure_map(map);
+  modbusSerial.rxBufferSize = MAX_FRAME;
+  line.rxBufferSize = MAX_FRAME;
+  line.txBufferSize = MAX_FRAME;
+  line.begin(BAUD);
+  SimSerial::connect(line, modbusSerial);
+}
+
+// function 3, 6, 16 or 23 on the n-th request, over the whole range
+static unsigned int request(unsigned char function, unsigned int n, unsigned char *frame)
+{
+  unsigned int address = (n * 7) % TOTAL_REGS_SIZE;
+  unsigned int count = 1 + n % (TOTAL_REGS_SIZE - address);
+  bool inFloat = address == PRESSURE + 1 || address == FLOW + 1 || address == GRAVITY + 1;
+  unsigned int end = address + count;
+
+  frame[0] = 1;
+  frame[1] = function;
+  if (function == 6)
+  {
+    // a single register can't be a float32
+    if (inFloat || address == PRESSURE || address == FLOW || address == GRAVITY)
+      address = VALVE;
+    frame[2] = address >> 8;
+    frame[3] = address & 0xFF;
+    frame[4] = n >> 8;
+    frame[5] = n & 0xFF;
+    return 6;
+  }
+
+  // and writes don't split one
+  if (function != 3 && inFloat)
+    address--;
+  if (function != 3 && (end == PRESSURE + 1 || end == FLOW + 1 || end == GRAVITY + 1))
+    end++;
+  count = end - address;
+  frame[2] = address >> 8;
+  frame[3] = address & 0xFF;
+  frame[4] = count >> 8;
+  frame[5] = count & 0xFF;
+  if (function == 3)
+    return 6;
+
+  unsigned char *values = &frame[7];
+  if (function == 23)
+  {
+    // write the range and read as many registers from 0
+    frame[2] = 0;
+    frame[3] = 0;
+    frame[6] = address >> 8;
+    frame[7] = address & 0xFF;
+    frame[8] = count >> 8;
+    frame[9] = count & 0xFF;
+    values = &frame[11];
+  }
+  values[-1] = count * 2;
+  for (unsigned int i = 0; i < count * 2; i++)
+    values[i] = n + i;
+  return (values - frame) + count * 2;
+}
+
+struct Result
+{
+  double ns;
+  double cycles;
+};
+
+// Requests go to the plain array and to the map in turns so both see the
+// same machine, the answers have to be the same.
+static bool run(unsigned char function, Result &array, Result &map)
+{
+  unsigned long long time[2] = { 0, 0 }, count[2] = { 0, 0 };
+  bool same = true;
+  begin(0);
+
+  for (unsigned int n = 0; n < REQUESTS; n++)
+  {
+    unsigned char frame[2][MAX_FRAME];
+    unsigned int length[2];
+    for (unsigned int i = 0; i < 2; i++)
+    {
+      modbus_configure_map(i ? all.tables() : 0);
+      handled = 0;
+      cycles = 0;
+      length[i] = transact(frame[i], request(function, n, frame[i]), i ? all.registers : plain);
+      time[i] += handled;
+      count[i] += cycles;
+    }
+
+    if (length[0] < 5 || frame[0][1] != function || length[0] != length[1])
+      same = false;
+    for (unsigned int j = 0; same && j < length[0]; j++)
+      same = frame[0][j] == frame[1][j];
+  }
+
+  array.ns = (double)time[0] / REQUESTS;
+  array.cycles = (double)count[0] / REQUESTS;
+  map.ns = (double)time[1] / REQUESTS;
+  map.cycles = (double)count[1] / REQUESTS;
+  return same;
+}
+
+// the exception code of the response to a request the map has to refuse
+static unsigned int refused(const unsigned char *request, unsigned int length)
+{
+  unsigned char frame[MAX_FRAME];
+  for (unsigned int i = 0; i < length; i++)
+    frame[i] = request[i];
+  length = transact(frame, length, guarded.registers);
+  return length == 5 && (frame[1] & 0x80) ? frame[2] : 0;
+}
+
+int main()
+{
+  static const unsigned char functions[] = { 3, 6, 16, 23 };
+
+  printf("%-9s %8s %10s %12s %8s %8s\n", "function", "array", "map", "array", "map", "answers");
+  printf("%-9s %8s %10s %12s %8s %8s\n", "", "ns/req", "ns/req", "cycles/req", "cycles", "");
+  for (size_t i = 0; i < sizeof(functions) / sizeof(functions[0]); i++)
+  {
+    Result array, map;
+    bool same = run(functions[i], array, map);
+    printf("%-9u %8.0f %10.0f %12.0f %8.0f %8s\n", functions[i], array.ns, map.ns,
+           HAVE_TSC ? array.cycles : 0, HAVE_TSC ? map.cycles : 0,
+           same ? "same" : "DIFFER");
+  }
+  printf("callbacks: %lu setpoint writes, %lu pressure reads\n\n", setpointWrites, pressureReads);
+
+  begin(guarded.tables());
+  static const struct
+  {
+    const char *what;
+    unsigned char request[16];
+    unsigned int length;
+    unsigned int expected;
+  } refusals[] =
+  {
+    { "write to a read only register", { 1, 6, 0, TEMP_STATE, 0, 1 }, 6, 2 },
+    { "write to half of a float32", { 1, 16, 0, GRAVITY, 0, 1, 2, 0, 1 }, 9, 3 },
+    { "write into a float32", { 1, 6, 0, GRAVITY + 1, 0, 1 }, 6, 2 },
+    { "read of the gap", { 1, 3, 0, HEATER + 1, 0, 1 }, 6, 2 },
+    { "read across the gap", { 1, 3, 0, HEATER, 0, 2 }, 6, 3 },
+    { "read of the second word of a float", { 1, 3, 0, GRAVITY + 1, 0, 2 }, 6, 0 },
+  };
+  printf("%-36s %9s %9s\n", "request to the guarded map", "exception", "expected");
+  for (size_t i = 0; i < sizeof(refusals) / sizeof(refusals[0]); i++)
+    printf("%-36s %9u %9u\n", refusals[i].what, refused(refusals[i].request, refusals[i].length),
+           refusals[i].expected);
+
+  printf("\ntables of the map of %u registers with %u callbacks: %u bytes, %u on the AVR\n",
+         all.size, 2, (unsigned int)(all.size * 2 + 3 * sizeof(ModbusMapCallback)), all.size * 2 + 3 * 8);
+  return 0;
+}
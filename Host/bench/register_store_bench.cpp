@@ -0,0 +1,206 @@
+/*
+ register_store_bench.cpp - tear rate and latency of multi-register reads
+ while 1 to 8 sensor threads write the registers.
+
+ Each writer thread owns a block of 8 registers and publishes them over
+ and over, all 8 set to a counter it increments every time. A reader
+ thread reads registers 0 to 60, a full function 3 response, and a read
+ is torn if the registers of a block differ. The registers are shared
+ three ways:
+
+ plain   - an array every thread reads and writes as it likes, what a
+           sketch's holdingRegs[] becomes once the sensors get threads
+ mutex   - one lock around every write and every read
+ seqlock - RegisterStore with its default stripes of 16 registers, two
+           writers to a stripe
+
+ Reported are the reads and publishes per second, the share of reads
+ that came back torn, the share the seqlock had to start over, and the
+ read latency. With fewer cores than threads the threads take turns, a
+ writer is only caught in the middle of a publish when the scheduler
+ preempts it there and the maximum latency is a time slice whatever the
+ sharing.
+
+ Build and run from the repository root:
+
+   cmake -S . -B build && cmake --build build --target register_store_bench
+   ./build/register_store_bench
+*/
+
+#include <stdio.h>
+#include <time.h>
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "RegisterStore.h"
+
+#define REGISTERS 64
+#define BLOCK 8
+#define READ_REGISTERS 61
+#define RUN_TIME_NS 500000000LL
+
+enum Sharing { PLAIN, MUTEX, SEQLOCK };
+
+static std::atomic<unsigned short> plain[REGISTERS];
+static std::mutex mutex;
+static unsigned int locked[REGISTERS];
+
+static long long nanoseconds()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void publish(Sharing sharing, RegisterStore &store, unsigned int address, const unsigned int *values)
+{
+  switch (sharing)
+  {
+    case PLAIN:
+      for (unsigned int i = 0; i < BLOCK; i++)
+        plain[address + i].store(values[i], std::memory_order_relaxed);
+      break;
+    case MUTEX:
+    {
+      std::lock_guard<std::mutex> guard(mutex);
+      for (unsigned int i = 0; i < BLOCK; i++)
+        locked[address + i] = values[i];
+      break;
+    }
+    case SEQLOCK:
+      store.publish(address, values, BLOCK);
+      break;
+  }
+}
+
+static void read(Sharing sharing, RegisterStore &store, unsigned int *values)
+{
+  switch (sharing)
+  {
+    case PLAIN:
+      for (unsigned int i = 0; i < READ_REGISTERS; i++)
+        values[i] = plain[i].load(std::memory_order_relaxed);
+      break;
+    case MUTEX:
+    {
+      std::lock_guard<std::mutex> guard(mutex);
+      for (unsigned int i = 0; i < READ_REGISTERS; i++)
+        values[i] = locked[i];
+      break;
+    }
+    case SEQLOCK:
+      store.read(0, values, READ_REGISTERS);
+      break;
+  }
+}
+
+struct Result
+{
+  double reads; // per second
+  double publishes; // per second, all writers
+  double torn; // percent of reads
+  double retried; // percent of reads
+  long long p50, p99, max; // nanoseconds
+};
+
+static Result run(Sharing sharing, unsigned int writers)
+{
+  RegisterStore store(REGISTERS);
+  Result result = Result();
+  std::atomic<bool> stop(false);
+  std::vector<unsigned long> published(writers);
+
+  for (unsigned int i = 0; i < REGISTERS; i++)
+  {
+    plain[i].store(0, std::memory_order_relaxed);
+    locked[i] = 0;
+  }
+
+  std::vector<std::thread> threads;
+  for (unsigned int w = 0; w < writers; w++)
+    threads.push_back(std::thread([&, w]() {
+      unsigned int values[BLOCK];
+      unsigned long count = 0;
+      while (!stop.load(std::memory_order_relaxed))
+      {
+        count++;
+        for (unsigned int i = 0; i < BLOCK; i++)
+          values[i] = count & 0xFFFF;
+        publish(sharing, store, w * BLOCK, values);
+      }
+      published[w] = count;
+    }));
+
+  std::vector<long long> latencies;
+  latencies.reserve(1 << 22);
+  unsigned long torn = 0;
+  unsigned int values[READ_REGISTERS];
+
+  long long start = nanoseconds();
+  long long now = start;
+  while (now - start < RUN_TIME_NS)
+  {
+    read(sharing, store, values);
+    long long done = nanoseconds();
+    latencies.push_back(done - now);
+    now = done;
+
+    for (unsigned int b = 0; b < writers; b++)
+    {
+      unsigned int end = std::min((b + 1) * BLOCK, (unsigned int)READ_REGISTERS);
+      bool consistent = true;
+      for (unsigned int i = b * BLOCK + 1; i < end; i++)
+        consistent &= values[i] == values[b * BLOCK];
+      if (!consistent)
+      {
+        torn++;
+        break;
+      }
+    }
+  }
+
+  stop = true;
+  for (size_t t = 0; t < threads.size(); t++)
+    threads[t].join();
+
+  double seconds = (now - start) / 1e9;
+  unsigned long reads = latencies.size();
+  unsigned long publishes = 0;
+  for (unsigned int w = 0; w < writers; w++)
+    publishes += published[w];
+
+  std::sort(latencies.begin(), latencies.end());
+  result.reads = reads / seconds;
+  result.publishes = publishes / seconds;
+  result.torn = 100.0 * torn / reads;
+  result.retried = 100.0 * store.retries.load() / reads;
+  result.p50 = latencies[reads / 2];
+  result.p99 = latencies[reads * 99 / 100];
+  result.max = latencies[reads - 1];
+  return result;
+}
+
+int main()
+{
+  static const char *names[] = { "plain", "mutex", "seqlock" };
+  static const unsigned int writerCounts[] = { 1, 2, 4, 8 };
+
+  printf("hardware threads: %u\n", std::thread::hardware_concurrency());
+  printf("%-8s %7s %12s %14s %8s %10s %8s %8s %10s\n", "sharing", "writers",
+         "reads/s", "publishes/s", "torn(%)", "retried(%)", "p50(ns)", "p99(ns)", "max(ns)");
+
+  for (size_t w = 0; w < sizeof(writerCounts) / sizeof(writerCounts[0]); w++)
+    for (int sharing = PLAIN; sharing <= SEQLOCK; sharing++)
+    {
+      Result result = run((Sharing)sharing, writerCounts[w]);
+      printf("%-8s %7u %12.0f %14.0f %8.3f %10.3f %8lld %8lld %10lld\n", names[sharing],
+             writerCounts[w], result.reads, result.publishes, result.torn, result.retried,
+             result.p50, result.p99, result.max);
+    }
+
+  return 0;
+}
@@ -0,0 +1,221 @@
+/*
+ serial_loop_bench.cpp - SimpleModbusMaster on real Linux serial ports,
+ four pty pairs, driven by a SerialEventLoop against a thread that calls
+ modbus_port_update() for every port as fast as it can, the way loop()
+ of a sketch does.
+
+ Each port polls 8 slaves for 10 registers at 115200 baud. On the far end
+ of every pty a thread answers each function 3 request straight away. A
+ pty has no baud rate and no RS-485 mode, the bytes arrive at once, the
+ master still keeps its frame delays and the times a request takes on
+ the line at 115200. Each way runs for a few seconds of real time:
+
+ busy poll - modbus_port_update() for the 4 ports in a loop
+ epoll     - a SerialEventLoop sleeping until a byte or a time is due
+
+ Reported are the transactions per second of all ports, the CPU time the
+ master's thread used as a share of one core, read() calls on the lines
+ per transaction and the wakeups of the loop per transaction.
+
+ Build and run from the repository root:
+
+   cmake -S . -B build && cmake --build build --target serial_loop_bench
+   ./build/serial_loop_bench
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "Arduino.h"
+#include "SimpleModbusMaster.h"
+#include "LinuxSerial.h"
+#include "SerialEventLoop.h"
+
+#define BAUD 115200
+#define TIMEOUT_MS 100
+#define POLLING_MS 0
+#define PORTS 4
+#define SLAVES 8
+#define REGISTERS 10
+#define RUN_SECONDS 3
+
+enum { BUSY_POLL, EPOLL, WAYS };
+
+static const char *ways[] = { "busy poll", "epoll" };
+
+static ModbusPort ports[PORTS];
+static LinuxSerial lines[PORTS];
+static Packet packets[PORTS][SLAVES];
+static unsigned int regs[PORTS][SLAVES][REGISTERS];
+
+struct Result
+{
+  double transactionsPerSecond;
+  double cpu; // share of a core
+  double readsPerTransaction;
+  double wakeupsPerTransaction;
+};
+
+static double threadCpu()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double wallClock()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// the slaves on the far end of a pty, every function 3 request is 8 bytes
+static void answer(int fd)
+{
+  unsigned char request[8], response[5 + 2 * REGISTERS];
+  unsigned int length = 0;
+
+  // the termios of a pty pair is shared, the master's end made reads
+  // return at once, so wait for the request with poll()
+  for (;;)
+  {
+    struct pollfd in = { fd, POLLIN, 0 };
+    if (poll(&in, 1, -1) < 0)
+      return;
+    ssize_t n = read(fd, request + length, sizeof(request) - length);
+    if (n < 0)
+      return;
+    length += n;
+    if (length < sizeof(request))
+      continue;
+    length = 0;
+
+    unsigned int count = request[5];
+    response[0] = request[0];
+    response[1] = 3;
+    response[2] = count * 2;
+    for (unsigned int i = 0; i < count * 2; i++)
+      response[3 + i] = i;
+    unsigned int crc16 = modbus_crc16(response, 3 + count * 2);
+    response[3 + count * 2] = crc16 >> 8;
+    response[4 + count * 2] = crc16 & 0xFF;
+    if (write(fd, response, 5 + count * 2) < 0)
+      return;
+  }
+}
+
+// a pty pair, the master's end in master and the slaves' end raw in slave
+static bool openPty(int *master, int *slave)
+{
+  *master = posix_openpt(O_RDWR | O_NOCTTY);
+  if (*master < 0 || grantpt(*master) < 0 || unlockpt(*master) < 0)
+    return false;
+  *slave = open(ptsname(*master), O_RDWR | O_NOCTTY);
+  if (*slave < 0)
+    return false;
+
+  struct termios tio;
+  tcgetattr(*slave, &tio);
+  cfmakeraw(&tio);
+  tcsetattr(*slave, TCSANOW, &tio);
+  return true;
+}
+
+static Result run(unsigned int way)
+{
+  Result result = Result();
+  std::vector<std::thread> slaves;
+  int slaveFds[PORTS];
+
+  hal::reset();
+  for (unsigned int p = 0; p < PORTS; p++)
+  {
+    int master;
+    if (!openPty(&master, &slaveFds[p]) || !lines[p].begin(master, BAUD))
+    {
+      perror("serial_loop_bench");
+      exit(1);
+    }
+
+    for (unsigned int s = 0; s < SLAVES; s++)
+    {
+      Packet *packet = &packets[p][s];
+      *packet = Packet();
+      packet->id = s + 1;
+      packet->function = READ_HOLDING_REGISTERS;
+      packet->no_of_registers = REGISTERS;
+      packet->register_array = regs[p][s];
+    }
+    modbus_port_configure(&ports[p], &lines[p], BAUD, TIMEOUT_MS, POLLING_MS, 3, 0, packets[p], SLAVES);
+    slaves.push_back(std::thread(answer, slaveFds[p]));
+  }
+
+  SerialEventLoop loop;
+  std::atomic<bool> running(true);
+  double cpu = 0;
+
+  for (unsigned int p = 0; way == EPOLL && p < PORTS; p++)
+    loop.add(&ports[p], &lines[p]);
+
+  double start = wallClock();
+  std::thread master([&]() {
+    double begin = threadCpu();
+    if (way == EPOLL)
+      loop.run();
+    else
+      while (running.load(std::memory_order_relaxed))
+        for (unsigned int p = 0; p < PORTS; p++)
+          modbus_port_update(&ports[p]);
+    cpu = threadCpu() - begin;
+  });
+
+  sleep(RUN_SECONDS);
+  running = false;
+  loop.stop();
+  master.join();
+  double elapsed = wallClock() - start;
+
+  unsigned long transactions = 0, reads = 0;
+  for (unsigned int p = 0; p < PORTS; p++)
+  {
+    for (unsigned int s = 0; s < SLAVES; s++)
+      transactions += packets[p][s].successful_requests;
+    reads += lines[p].reads;
+    lines[p].end();
+    close(slaveFds[p]);
+  }
+  for (size_t i = 0; i < slaves.size(); i++)
+    slaves[i].join();
+
+  result.transactionsPerSecond = transactions / elapsed;
+  result.cpu = cpu / elapsed;
+  result.readsPerTransaction = (double)reads / transactions;
+  result.wakeupsPerTransaction = way == EPOLL ? (double)loop.wakeups / transactions : 0;
+  return result;
+}
+
+int main()
+{
+  hal::realTime();
+
+  printf("%-10s %15s %6s %11s %13s\n", "master", "transactions/s", "cpu", "reads/trans", "wakeups/trans");
+
+  for (unsigned int w = 0; w < WAYS; w++)
+  {
+    Result result = run(w);
+    printf("%-10s %15.0f %5.0f%% %11.1f %13.1f\n", ways[w], result.transactionsPerSecond,
+           result.cpu * 100, result.readsPerTransaction, result.wakeupsPerTransaction);
+  }
+
+  return 0;
+}
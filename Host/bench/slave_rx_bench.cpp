@@ -0,0 +1,180 @@
+/*
+ slave_rx_bench.cpp - loop() rate and response latency of SimpleModbusSlave
+ on the host HAL.
+
+ A simulated master reads 3 holding registers from slave 1 every 100 ms.
+ The slave's loop() calls modbus_update() and then spends LOOP_WORK_US on
+ its own work, the analogRead() and temperature conversion of
+ ModbusSlaveSimulation.ino. For every baud rate two slaves are run:
+
+ blocking - the receive loop SimpleModbusSlave used to have, which calls
+            delayMicroseconds(T1_5) after every byte it reads
+ library  - modbus_update() as it is now
+
+ Reported are loop() iterations per second, the longest single loop()
+ iteration and the latency from the last request byte to the first
+ response byte.
+
+ Build and run from the repository root:
+
+   cmake -S . -B build && cmake --build build --target slave_rx_bench
+   ./build/slave_rx_bench
+*/
+
+#include <stdio.h>
+
+#include "Arduino.h"
+#include "SimpleModbusSlave.h"
+
+#define LOOP_WORK_US 200
+#define REQUEST_PERIOD_US 100000ULL
+#define RUN_TIME_US 10000000ULL
+#define SLAVE_ID 1
+#define NO_OF_REGS 3
+
+static unsigned int holdingRegs[NO_OF_REGS];
+static long blockingBaud;
+
+// The receive path of the original modbus_update(), kept here as the
+// baseline. Only function 3 is answered which is all the master asks for.
+static unsigned int blocking_update(unsigned int *regs)
+{
+  unsigned int T1_5 = blockingBaud > 19200 ? 750 : 15000000 / blockingBaud;
+  unsigned int T3_5 = blockingBaud > 19200 ? 1750 : 35000000 / blockingBaud;
+  unsigned char frame[128];
+  unsigned char buffer = 0;
+
+  while (modbusSerial.available())
+  {
+    unsigned char value = modbusSerial.read();
+    if (buffer < sizeof(frame))
+      frame[buffer++] = value;
+    delayMicroseconds(T1_5); // inter character time out
+  }
+
+  if (buffer < 8 || frame[0] != SLAVE_ID || frame[1] != 3)
+    return 0;
+  if (modbus_crc16(frame, buffer - 2) != (unsigned int)((frame[buffer - 2] << 8) | frame[buffer - 1]))
+    return 0;
+
+  unsigned int address = (frame[2] << 8) | frame[3];
+  unsigned int count = (frame[4] << 8) | frame[5];
+  frame[2] = count * 2;
+  for (unsigned int i = 0; i < count; i++)
+  {
+    frame[3 + i * 2] = regs[address + i] >> 8;
+    frame[4 + i * 2] = regs[address + i] & 0xFF;
+  }
+  unsigned char size = 5 + count * 2;
+  unsigned int crc16 = modbus_crc16(frame, size - 2);
+  frame[size - 2] = crc16 >> 8;
+  frame[size - 1] = crc16 & 0xFF;
+
+  for (unsigned char i = 0; i < size; i++)
+    modbusSerial.write(frame[i]);
+  modbusSerial.flush();
+  delayMicroseconds(T3_5);
+  return 0;
+}
+
+static unsigned int library_update(unsigned int *regs)
+{
+  return modbus_update(regs);
+}
+
+struct Result
+{
+  double loopsPerSecond;
+  unsigned long long longestLoop;
+  double meanLatency;
+  unsigned long long maxLatency;
+  unsigned long responses;
+  unsigned long requests;
+};
+
+static Result run(long baud, unsigned int (*update)(unsigned int *))
+{
+  SimSerial master;
+  Result result = Result();
+
+  hal::reset();
+  blockingBaud = baud;
+  modbus_configure(baud, SLAVE_ID, 0, NO_OF_REGS, 0);
+  master.begin(baud);
+  SimSerial::connect(master, modbusSerial);
+
+  unsigned long long nextRequest = 0;
+  unsigned long long requestEnd = 0;
+  unsigned long long latencySum = 0;
+  unsigned long iterations = 0;
+  unsigned char responseBytes = 0;
+  bool waiting = false;
+
+  while (hal::now() < RUN_TIME_US)
+  {
+    // the master runs independently of the slave's loop()
+    if (hal::now() >= nextRequest && !waiting)
+    {
+      unsigned char request[8] = { SLAVE_ID, 3, 0, 0, 0, NO_OF_REGS, 0, 0 };
+      unsigned int crc16 = modbus_crc16(request, 6);
+      request[6] = crc16 >> 8;
+      request[7] = crc16 & 0xFF;
+      master.write(request, sizeof(request));
+      requestEnd = master.txDoneAt();
+      nextRequest += REQUEST_PERIOD_US;
+      result.requests++;
+      responseBytes = 0;
+      waiting = true;
+    }
+
+    while (master.available())
+    {
+      if (waiting && responseBytes == 0)
+      {
+        unsigned long long latency = master.rxTimestamp() - master.charTime() - requestEnd;
+        latencySum += latency;
+        if (latency > result.maxLatency)
+          result.maxLatency = latency;
+        result.responses++;
+      }
+      master.read();
+      if (++responseBytes == 5 + NO_OF_REGS * 2)
+        waiting = false;
+    }
+
+    // the slave's loop()
+    unsigned long long start = hal::now();
+    update(holdingRegs);
+    hal::advance(LOOP_WORK_US);
+    iterations++;
+    if (hal::now() - start > result.longestLoop)
+      result.longestLoop = hal::now() - start;
+  }
+
+  result.loopsPerSecond = iterations * 1e6 / hal::now();
+  result.meanLatency = result.responses ? (double)latencySum / result.responses : 0;
+  return result;
+}
+
+int main()
+{
+  static const long bauds[] = { 9600, 19200, 115200 };
+
+  printf("%-8s %7s %10s %12s %13s %12s %9s\n", "slave", "baud", "loops/s",
+         "longest(us)", "latency(us)", "max lat(us)", "answered");
+
+  for (size_t i = 0; i < sizeof(bauds) / sizeof(bauds[0]); i++)
+  {
+    Result before = run(bauds[i], blocking_update);
+    Result after = run(bauds[i], library_update);
+
+    printf("%-8s %7ld %10.0f %12llu %13.0f %12llu %5lu/%lu\n", "blocking", bauds[i],
+           before.loopsPerSecond, before.longestLoop, before.meanLatency, before.maxLatency,
+           before.responses, before.requests);
+    printf("%-8s %7ld %10.0f %12llu %13.0f %12llu %5lu/%lu\n", "library", bauds[i],
+           after.loopsPerSecond, after.longestLoop, after.meanLatency, after.maxLatency,
+           after.responses, after.requests);
+  }
+
+  return 0;
+}
@@ -0,0 +1,121 @@
+/*
+ slave_tx_bench.cpp - CPU time SimpleModbusSlave hands back to loop() while
+ it transmits responses.
+
+ A simulated master reads holding registers from slave 1 every 250 ms.
+ The slave runs once on an unbuffered port (SoftwareSerial, every write
+ blocks and the response waits for T3.5 afterwards) and once on a
+ buffered port (HardwareSerial, the response is sent in the background).
+ For every response size the time spent inside modbus_update() per
+ transaction is reported together with how much of it the background
+ send gives back to the caller.
+
+ Build and run from the repository root:
+
+   cmake -S . -B build && cmake --build build --target slave_tx_bench
+   ./build/slave_tx_bench
+*/
+
+#include <stdio.h>
+
+#include "Arduino.h"
+#include "SimpleModbusSlave.h"
+
+#define LOOP_WORK_US 200
+#define REQUEST_PERIOD_US 250000ULL
+#define RUN_TIME_US 10000000ULL
+#define SLAVE_ID 1
+#define TX_ENABLE_PIN 2
+#define MAX_REGS 60
+
+static unsigned int holdingRegs[MAX_REGS];
+
+struct Result
+{
+  double blockedPerTransaction; // microseconds spent in modbus_update()
+  double enableHighPerTransaction; // microseconds the transmit enable pin was high
+  unsigned long transactions;
+};
+
+static Result run(long baud, unsigned int regs, bool buffered)
+{
+  SimSerial master;
+  Result result = Result();
+
+  hal::reset();
+  if (!buffered)
+    modbusSerial.txBufferSize = 0;
+  modbus_configure(baud, SLAVE_ID, TX_ENABLE_PIN, MAX_REGS, 0);
+  modbus_configure_tx(1);
+  master.begin(baud);
+  master.rxBufferSize = 256; // the simulated master never drops a byte
+  SimSerial::connect(master, modbusSerial);
+
+  unsigned long long nextRequest = 0;
+  unsigned long long blocked = 0;
+  unsigned long long enableHigh = 0;
+  unsigned int responseBytes = 0;
+  unsigned int responseSize = 5 + regs * 2;
+
+  while (hal::now() < RUN_TIME_US)
+  {
+    if (hal::now() >= nextRequest)
+    {
+      unsigned char request[8] = { SLAVE_ID, 3, 0, 0, 0, (unsigned char)regs, 0, 0 };
+      unsigned int crc16 = modbus_crc16(request, 6);
+      request[6] = crc16 >> 8;
+      request[7] = crc16 & 0xFF;
+      master.write(request, sizeof(request));
+      nextRequest += REQUEST_PERIOD_US;
+      responseBytes = 0;
+    }
+
+    while (master.available())
+    {
+      master.read();
+      if (++responseBytes == responseSize)
+        result.transactions++;
+    }
+
+    // the slave's loop()
+    unsigned long long start = hal::now();
+    modbus_update(holdingRegs);
+    blocked += hal::now() - start;
+
+    bool high = hal::pinState(TX_ENABLE_PIN);
+    hal::advance(LOOP_WORK_US);
+    if (high || hal::pinState(TX_ENABLE_PIN))
+      enableHigh += hal::now() - start;
+  }
+
+  if (result.transactions)
+  {
+    result.blockedPerTransaction = (double)blocked / result.transactions;
+    result.enableHighPerTransaction = (double)enableHigh / result.transactions;
+  }
+  return result;
+}
+
+int main()
+{
+  static const long bauds[] = { 9600, 115200 };
+  static const unsigned int sizes[] = { 1, 16, 60 };
+
+  printf("%7s %5s %9s %14s %14s %14s %9s\n", "baud", "regs", "wire(us)",
+         "blocking(us)", "buffered(us)", "returned(us)", "DE(us)");
+
+  for (size_t b = 0; b < sizeof(bauds) / sizeof(bauds[0]); b++)
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+    {
+      Result before = run(bauds[b], sizes[s], false);
+      Result after = run(bauds[b], sizes[s], true);
+      unsigned long wire = (5 + sizes[s] * 2) * ((10000000 + bauds[b] - 1) / bauds[b]);
+
+      printf("%7ld %5u %9lu %14.0f %14.0f %14.0f %9.0f\n", bauds[b], sizes[s], wire,
+             before.blockedPerTransaction, after.blockedPerTransaction,
+             before.blockedPerTransaction - after.blockedPerTransaction,
+             after.enableHighPerTransaction);
+    }
+
+  return 0;
+}
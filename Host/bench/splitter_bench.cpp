@@ -0,0 +1,388 @@
+/*
+ splitter_bench.cpp - how fast ModbusSplitter cuts a raw byte stream from
+ the line into frames, against scanning it for a crc that comes to 0.
+
+ A master polls five units on a 1 Mbaud line for 30 s of virtual time
+ with every function it knows: registers read, written and both with
+ function 23, coils and inputs read and written, a broadcast write, a
+ read unit 4 answers with exception 2 and a dead unit 5 that never
+ answers. A CaptureWriter records the line and the frames are put back
+ to back into one stream as a sniffer without a timer would see them.
+ A second stream has one frame in a hundred with a byte changed, one cut
+ short and one after a few bytes of noise.
+
+ The clean stream has to come out as exactly the frames captured. For
+ the noisy one the intact frames recovered are counted, and the frames
+ given out that were never sent. Every splitter is timed on both streams,
+ fed in reads of 64 bytes like from a UART and in one piece. The frame
+ check on its own is timed frame by frame and in batches with
+ modbus_crc16_check_batch(). 1 Mbaud is 0.1 MB/s.
+
+ Build and run from the repository root:
+
+   cmake -S . -B build && cmake --build build --target splitter_bench
+   ./build/splitter_bench
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include <chrono>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Arduino.h"
+#include "CaptureFile.h"
+#include "ModbusCRC.h"
+#include "ModbusSplitter.h"
+#include "SimpleModbusMaster.h"
+#include "SimulatedSlave.h"
+
+#define BAUD 1000000
+#define TIMEOUT_MS 20
+#define TURNAROUND_US 200
+#define LOOP_WORK_US 5
+#define RUN_TIME_US 30000000ULL
+#define NOISE_PERCENT 1
+#define READ_SIZE 64
+#define TIMED_BYTES (64ull * 1024 * 1024)
+#define CAPTURE_PATH "splitter_bench.mbcp"
+
+typedef std::vector<std::string> Frames;
+typedef std::set<std::pair<size_t, size_t> > Places; // offset and length in a stream
+
+// what the splitter under test gave out
+static const unsigned char *base;
+static Frames found;
+static Places foundAt;
+static unsigned long foundFrames, foundSum;
+
+static void keep(const unsigned char *frame, unsigned int length)
+{
+  found.push_back(std::string((const char *)frame, length));
+  foundAt.insert(std::make_pair(frame - base, length));
+}
+
+static void count(const unsigned char *frame, unsigned int length)
+{
+  foundFrames++;
+  foundSum += frame[length - 1];
+}
+
+static Frames record()
+{
+  SimulatedSlave slave;
+  static unsigned int regs[8][64];
+  static unsigned char bits[4][32];
+  Packet packets[9];
+
+  hal::reset();
+  slave.begin(BAUD);
+  slave.turnaround = TURNAROUND_US;
+  slave.addUnit(1, 100);
+  slave.addUnit(2, 0);
+  slave.addBits(2, 256, 128);
+  slave.addUnit(3, 64);
+  slave.addUnit(4, 8);
+  slave.addUnit(5, 8);
+  slave.setAlive(5, false);
+  for (unsigned int i = 0; i < 100; i++)
+    slave.registers(1)[i] = i * 331;
+
+  for (unsigned int i = 0; i < 9; i++)
+    packets[i] = Packet();
+  packets[0].id = 1;
+  packets[0].function = READ_HOLDING_REGISTERS;
+  packets[0].no_of_registers = 60;
+  packets[0].register_array = regs[0];
+  packets[1].id = 1;
+  packets[1].function = PRESET_MULTIPLE_REGISTERS;
+  packets[1].address = 60;
+  packets[1].no_of_registers = 20;
+  packets[1].register_array = regs[1];
+  packets[2].id = 2;
+  packets[2].function = READ_COIL_STATUS;
+  packets[2].no_of_registers = 200;
+  packets[2].bit_array = bits[0];
+  packets[3].id = 2;
+  packets[3].function = READ_INPUT_STATUS;
+  packets[3].no_of_registers = 100;
+  packets[3].bit_array = bits[1];
+  packets[4].id = 2;
+  packets[4].function = FORCE_MULTIPLE_COILS;
+  packets[4].address = 200;
+  packets[4].no_of_registers = 50;
+  packets[4].bit_array = bits[2];
+  packets[5].id = 3;
+  packets[5].function = READ_WRITE_MULTIPLE_REGISTERS;
+  packets[5].no_of_registers = 30;
+  packets[5].register_array = regs[2];
+  packets[5].write_address = 40;
+  packets[5].no_of_write_registers = 10;
+  packets[5].write_array = regs[3];
+  packets[6].id = 0;
+  packets[6].function = PRESET_MULTIPLE_REGISTERS;
+  packets[6].no_of_registers = 4;
+  packets[6].register_array = regs[4];
+  packets[7].id = 4;
+  packets[7].function = READ_HOLDING_REGISTERS;
+  packets[7].no_of_registers = 10; // more than unit 4 has
+  packets[7].register_array = regs[5];
+  packets[8].id = 5;
+  packets[8].function = FORCE_SINGLE_COIL;
+  packets[8].bit_array = bits[3];
+
+  modbus_configure(BAUD, TIMEOUT_MS, 0, 255, 2, packets, 9);
+  modbus_background_tx(1);
+  SimSerial::connect(modbusSerial, slave.port);
+
+  CaptureWriter writer;
+  remove(CAPTURE_PATH);
+  writer.open(CAPTURE_PATH);
+
+  unsigned int tick = 0;
+  while (hal::now() < RUN_TIME_US)
+  {
+    // the written values change now and then
+    if (++tick % 1000 == 0)
+    {
+      regs[1][tick / 1000 % 20] = tick;
+      regs[3][tick / 1000 % 10] = tick;
+      bits[2][tick / 1000 % 7] ^= 0x55;
+    }
+    slave.poll();
+    modbus_update(packets);
+    hal::advance(LOOP_WORK_US);
+  }
+  writer.close();
+  modbusSerial.disconnect();
+
+  // only the master's side, the slave's frames are the same bytes
+  Frames frames;
+  CaptureReader reader;
+  CaptureFrame frame;
+  if (reader.open(CAPTURE_PATH))
+    while (reader.next(frame))
+      if (frame.flags & MODBUS_CAPTURE_MASTER)
+        frames.push_back(std::string((const char *)frame.data, frame.length));
+  reader.close();
+  remove(CAPTURE_PATH);
+  return frames;
+}
+
+// the frames back to back, with noise if intact is given; intact gets
+// where the frames are that were left as they were sent
+static std::vector<unsigned char> stream(const Frames &frames, Places *intact)
+{
+  std::vector<unsigned char> out;
+  unsigned long seed = 7;
+  for (size_t i = 0; i < frames.size(); i++)
+  {
+    std::string frame = frames[i];
+    unsigned int damage = 100;
+    if (intact)
+    {
+      seed = seed * 1103515245 + 12345;
+      damage = (seed >> 16) % (100 / NOISE_PERCENT);
+      unsigned int where = (seed >> 8) % frame.size();
+      if (damage == 0)
+        frame[where] ^= 1 << (seed % 8);
+      else if (damage == 1)
+        frame.resize(where);
+      else if (damage == 2)
+        for (unsigned int n = 0; n <= seed % 4; n++)
+          out.push_back(seed >> (8 + 4 * n));
+      if (damage > 1)
+        intact->insert(std::make_pair(out.size(), frame.size()));
+    }
+    out.insert(out.end(), frame.begin(), frame.end());
+  }
+  return out;
+}
+
+typedef void (*Splitter)(const unsigned char *data, size_t length, size_t read, ModbusFrameCallback frame);
+
+// one crc step of the bitwise implementation
+static unsigned int bitwise(unsigned int crc, unsigned char byte)
+{
+  crc ^= byte;
+  for (unsigned char bit = 0; bit < 8; bit++)
+    crc = crc & 1 ? (crc >> 1) ^ 0xA001 : crc >> 1;
+  return crc;
+}
+
+// a frame ends at the first byte after which the crc over it is 0
+static void scanBitwise(const unsigned char *data, size_t length, size_t, ModbusFrameCallback frame)
+{
+  size_t start = 0;
+  while (start + 4 <= length)
+  {
+    unsigned int crc = MODBUS_CRC_INIT;
+    size_t end = start;
+    for (; end < length && end - start < MODBUS_FRAME_MAX; end++)
+    {
+      crc = bitwise(crc, data[end]);
+      if (crc == 0 && end - start >= 3)
+        break;
+    }
+    if (end < length && crc == 0)
+    {
+      frame(&data[start], end + 1 - start);
+      start = end + 1;
+    }
+    else
+      start++;
+  }
+}
+
+static void scanTable(const unsigned char *data, size_t length, size_t, ModbusFrameCallback frame)
+{
+  size_t start = 0;
+  while (start + 4 <= length)
+  {
+    unsigned int crc = MODBUS_CRC_INIT;
+    size_t end = start;
+    for (; end < length && end - start < MODBUS_FRAME_MAX; end++)
+    {
+      crc = modbus_crc16_update(crc, &data[end], 1);
+      if (crc == 0 && end - start >= 3)
+        break;
+    }
+    if (end < length && crc == 0)
+    {
+      frame(&data[start], end + 1 - start);
+      start = end + 1;
+    }
+    else
+      start++;
+  }
+}
+
+static void split(const unsigned char *data, size_t length, size_t read, ModbusFrameCallback frame)
+{
+  ModbusSplitter splitter;
+  modbus_split_init(&splitter);
+  for (size_t at = 0; at < length; at += read)
+    modbus_split(&splitter, &data[at], length - at < read ? length - at : read, frame);
+}
+
+struct Variant
+{
+  const char *name;
+  Splitter splitter;
+  size_t read;
+};
+
+static const Variant variants[] = {
+  { "crc scan, bitwise", scanBitwise, 0 },
+  { "crc scan, table", scanTable, 0 },
+  { "modbus_split, 64 byte reads", split, READ_SIZE },
+  { "modbus_split, one buffer", split, 0 },
+};
+
+static void run(const Variant &variant, const std::vector<unsigned char> &data, size_t read)
+{
+  base = &data[0];
+  found.clear();
+  foundAt.clear();
+  variant.splitter(&data[0], data.size(), read ? read : data.size(), keep);
+}
+
+static double megabytesPerSecond(const Variant &variant, const std::vector<unsigned char> &data)
+{
+  size_t read = variant.read ? variant.read : data.size();
+  unsigned long runs = TIMED_BYTES / data.size() + 1;
+  if (variant.splitter == scanBitwise)
+    runs = runs / 8 + 1;
+
+  foundFrames = foundSum = 0;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (unsigned long run = 0; run < runs; run++)
+    variant.splitter(&data[0], data.size(), read, count);
+  double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  return runs * data.size() / elapsed / 1e6;
+}
+
+// the frame check alone, one frame at a time and in batches
+static void checks(const Frames &frames)
+{
+  std::vector<const unsigned char *> pointers(frames.size());
+  std::vector<unsigned int> lengths(frames.size());
+  std::vector<unsigned char> valid(frames.size());
+  size_t bytes = 0;
+  for (size_t i = 0; i < frames.size(); i++)
+  {
+    pointers[i] = (const unsigned char *)frames[i].data();
+    lengths[i] = frames[i].size();
+    bytes += frames[i].size();
+  }
+  unsigned long runs = TIMED_BYTES / bytes + 1;
+
+  unsigned long intact = 0;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (unsigned long run = 0; run < runs; run++)
+    for (size_t i = 0; i < frames.size(); i++)
+      intact += modbus_crc16_update(MODBUS_CRC_INIT, pointers[i], lengths[i]) == 0;
+  double single = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  unsigned long batched = 0;
+  start = std::chrono::steady_clock::now();
+  for (unsigned long run = 0; run < runs; run++)
+    for (size_t i = 0; i < frames.size(); i += MODBUS_SPLIT_BATCH)
+    {
+      unsigned int n = frames.size() - i < MODBUS_SPLIT_BATCH ? frames.size() - i : MODBUS_SPLIT_BATCH;
+      batched += modbus_crc16_check_batch(&pointers[i], &lengths[i], n, &valid[i]);
+    }
+  double batch = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  printf("\nframe check, %.1f bytes a frame:\n", (double)bytes / frames.size());
+  printf("  %-28s %9.1f MB/s %7.1f ns/frame%s\n", "one by one", runs * bytes / single / 1e6,
+         single * 1e9 / (runs * frames.size()), intact == runs * frames.size() ? "" : "  WRONG");
+  printf("  %-28s %9.1f MB/s %7.1f ns/frame%s\n", "modbus_crc16_check_batch", runs * bytes / batch / 1e6,
+         batch * 1e9 / (runs * frames.size()), batched == runs * frames.size() ? "" : "  WRONG");
+}
+
+int main()
+{
+  Frames sent = record();
+  Places intact;
+  std::vector<unsigned char> clean = stream(sent, 0);
+  std::vector<unsigned char> noisy = stream(sent, &intact);
+
+  printf("%lu frames, %.2f MB clean and %.2f MB with %d%% of the frames damaged each way\n\n",
+         (unsigned long)sent.size(), clean.size() / 1e6, noisy.size() / 1e6, NOISE_PERCENT);
+  printf("%-28s %10s %10s %7s %11s %8s\n", "", "clean MB/s", "noisy MB/s", "clean", "recovered", "invented");
+
+  bool allExact = true;
+  for (size_t v = 0; v < sizeof(variants) / sizeof(variants[0]); v++)
+  {
+    const Variant &variant = variants[v];
+    run(variant, clean, variant.read);
+    bool exact = found == sent;
+    if (variant.splitter == split)
+      allExact = allExact && exact;
+
+    // frames that are where an intact one was sent, reads of any size
+    // have to give the same
+    run(variant, noisy, 0);
+    Frames whole = found;
+    unsigned long recovered = 0;
+    for (Places::const_iterator i = foundAt.begin(); i != foundAt.end(); i++)
+      recovered += intact.count(*i);
+    unsigned long invented = found.size() - recovered;
+    run(variant, noisy, variant.read);
+    exact = exact && found == whole;
+
+    double cleanRate = megabytesPerSecond(variant, clean);
+    double noisyRate = megabytesPerSecond(variant, noisy);
+    printf("%-28s %10.1f %10.1f %7s %5lu/%-5lu %8lu\n", variant.name, cleanRate, noisyRate,
+           exact ? "exact" : "WRONG", recovered, (unsigned long)intact.size(), invented);
+  }
+
+  checks(sent);
+
+  printf("\nmodbus_split %s the capture on the clean stream\n", allExact ? "gives back" : "DIFFERS FROM");
+  return 0;
+}
@@ -0,0 +1,197 @@
+/*
+ tcp_gateway_bench.cpp - requests per second and latency of the Modbus/TCP
+ gateway in front of SimpleModbusSlave.
+
+ The gateway runs in a thread of this process and serves 100 holding
+ registers. A load generator on the loopback interface keeps 1, 16 and
+ 256 connections busy, each with one function 3 request for 10 registers
+ outstanding at a time, and times every request from send() to the last
+ byte of its response. Every response is checked against the registers.
+
+ Build and run from the repository root:
+
+   cmake -S . -B build && cmake --build build --target tcp_gateway_bench
+   ./build/tcp_gateway_bench
+*/
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#include "ModbusTcpGateway.h"
+
+#define REGISTERS 100
+#define READ_REGISTERS 10
+#define RUN_TIME_NS 2000000000LL
+#define RESPONSE_SIZE (9 + READ_REGISTERS * 2)
+
+static unsigned int holdingRegs[REGISTERS];
+
+static long long nanoseconds()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+struct Client
+{
+  int fd;
+  unsigned int transaction;
+  long long sentAt;
+  unsigned char response[RESPONSE_SIZE];
+  unsigned int received;
+};
+
+struct Result
+{
+  double requestsPerSecond;
+  double p50, p99, max; // microseconds
+  unsigned long errors;
+};
+
+static bool request(Client *client)
+{
+  unsigned int address = client->transaction % (REGISTERS - READ_REGISTERS);
+  unsigned char adu[12] = {
+    (unsigned char)(client->transaction >> 8), (unsigned char)client->transaction,
+    0, 0, 0, 6, 1, 3,
+    (unsigned char)(address >> 8), (unsigned char)address, 0, READ_REGISTERS
+  };
+
+  client->received = 0;
+  client->sentAt = nanoseconds();
+  return write(client->fd, adu, sizeof(adu)) == (ssize_t)sizeof(adu);
+}
+
+static bool check(Client *client)
+{
+  const unsigned char *r = client->response;
+  unsigned int address = client->transaction % (REGISTERS - READ_REGISTERS);
+  if ((unsigned int)((r[0] << 8) | r[1]) != (client->transaction & 0xFFFF) || r[5] != 3 + READ_REGISTERS * 2 ||
+      r[7] != 3 || r[8] != READ_REGISTERS * 2)
+    return false;
+  for (unsigned int i = 0; i < READ_REGISTERS; i++)
+    if ((unsigned int)((r[9 + i * 2] << 8) | r[10 + i * 2]) != holdingRegs[address + i])
+      return false;
+  return true;
+}
+
+static Result run(unsigned short port, unsigned int connections)
+{
+  Result result = Result();
+  std::vector<Client> clients(connections);
+  std::vector<long long> latencies;
+  int epollFd = epoll_create1(0);
+
+  struct sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  address.sin_port = htons(port);
+
+  for (unsigned int i = 0; i < connections; i++)
+  {
+    Client *client = &clients[i];
+    client->fd = socket(AF_INET, SOCK_STREAM, 0);
+    client->transaction = i * 1000;
+    if (connect(client->fd, (struct sockaddr *)&address, sizeof(address)) < 0)
+    {
+      perror("connect");
+      result.errors++;
+      return result;
+    }
+    int on = 1;
+    setsockopt(client->fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    fcntl(client->fd, F_SETFL, fcntl(client->fd, F_GETFL, 0) | O_NONBLOCK);
+
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = client;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, client->fd, &event);
+  }
+
+  long long start = nanoseconds();
+  for (unsigned int i = 0; i < connections; i++)
+    request(&clients[i]);
+
+  struct epoll_event events[256];
+  while (nanoseconds() - start < RUN_TIME_NS)
+  {
+    int n = epoll_wait(epollFd, events, 256, 100);
+    for (int e = 0; e < n; e++)
+    {
+      Client *client = (Client *)events[e].data.ptr;
+      ssize_t got = read(client->fd, client->response + client->received,
+                         RESPONSE_SIZE - client->received);
+      if (got <= 0)
+        continue;
+      client->received += got;
+      if (client->received < RESPONSE_SIZE)
+        continue;
+
+      latencies.push_back(nanoseconds() - client->sentAt);
+      if (!check(client))
+        result.errors++;
+      client->transaction++;
+      request(client);
+    }
+  }
+  double elapsed = (nanoseconds() - start) / 1e9;
+
+  for (unsigned int i = 0; i < connections; i++)
+    close(clients[i].fd);
+  close(epollFd);
+
+  if (!latencies.empty())
+  {
+    std::sort(latencies.begin(), latencies.end());
+    result.requestsPerSecond = latencies.size() / elapsed;
+    result.p50 = latencies[latencies.size() / 2] / 1000.0;
+    result.p99 = latencies[latencies.size() * 99 / 100] / 1000.0;
+    result.max = latencies.back() / 1000.0;
+  }
+  return result;
+}
+
+int main()
+{
+  static const unsigned int connections[] = { 1, 16, 256 };
+
+  for (unsigned int i = 0; i < REGISTERS; i++)
+    holdingRegs[i] = i * 7;
+
+  ModbusTcpGateway gateway;
+  if (!gateway.begin(0, 1, holdingRegs, REGISTERS))
+  {
+    perror("gateway");
+    return 1;
+  }
+  std::thread server(&ModbusTcpGateway::run, &gateway);
+
+  printf("%12s %14s %10s %10s %10s %8s\n", "connections", "requests/s",
+         "p50(us)", "p99(us)", "max(us)", "errors");
+
+  for (size_t c = 0; c < sizeof(connections) / sizeof(connections[0]); c++)
+  {
+    Result result = run(gateway.port(), connections[c]);
+    printf("%12u %14.0f %10.1f %10.1f %10.1f %8lu\n", connections[c],
+           result.requestsPerSecond, result.p50, result.p99, result.max, result.errors);
+  }
+
+  gateway.stop();
+  server.join();
+  return 0;
+}
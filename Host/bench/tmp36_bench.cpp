@@ -0,0 +1,169 @@
+/*
+ tmp36_bench.cpp - the temperature input of ModbusSlaveSimulation.ino in
+ float, as the sketch used to have it, against the fixed point and
+ oversampled TMP36Input.
+
+ A TMP36 sweeping from 0 to 40 C is read through a 10 bit ADC with about
+ half an LSB of noise, the way a real ADC and sensor dither the reading.
+ For both inputs the table shows
+
+ cycles/loop - the cost of one loop() worth of conversion, on x86 in TSC
+               cycles, the float path converts every sample and the fixed
+               point one adds it and converts every 16th
+ resolution  - the step of the register, in degrees Fahrenheit
+ rms error   - of the register against the true temperature, F
+ loops/s     - loop() of the sketch on the host: modbus_update() on an
+               idle line, the alarm input and the temperature input
+
+ The host has an FPU, on the AVR every float operation is a library call
+ and the difference is larger than here.
+
+ Build and run from the repository root:
+
+   cmake -S . -B build && cmake --build build --target tmp36_bench
+   ./build/tmp36_bench
+*/
+
+#include <stdio.h>
+#include <math.h>
+
+#include <chrono>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#else
+#define HAVE_TSC 0
+#endif
+
+#include "Arduino.h"
+#include "SimpleModbusSlave.h"
+#include "TMP36Input.h"
+
+#define SAMPLES (1 << 22)
+#define LOOPS 2000000
+#define NOISE_LSB 0.5f // standard deviation of the ADC noise
+#define ALARM_PIN 13
+#define TEMP_PIN A0
+
+enum { ALARM_STATE, TEMP_STATE, TOTAL_ERRORS, TOTAL_REGS_SIZE };
+
+static unsigned int holdingRegs[TOTAL_REGS_SIZE];
+static TMP36Input tempInput;
+
+// the temperature input the sketch used to have, kept as the baseline
+static unsigned char float_sample(unsigned int *regs, int analogTemp)
+{
+  float voltageTemp = (analogTemp/1024.0)*5.0;
+  float tempF = ((9.0/5.0)*(voltageTemp - 0.5)*100) + 32.0;
+  regs[TEMP_STATE] = (int)tempF;
+  return 1;
+}
+
+static unsigned char fixed_sample(unsigned int *regs, int analogTemp)
+{
+  if (!tmp36_sample(&tempInput, analogTemp))
+    return 0;
+  regs[TEMP_STATE] = tempInput.tenths;
+  return 1;
+}
+
+static unsigned long seed;
+
+// the true temperature of sample i in degrees Fahrenheit
+static float temperature(unsigned int i)
+{
+  return 32 + 1.8f * 40.0f * i / SAMPLES;
+}
+
+// and what the ADC reads for it
+static int adc(float fahrenheit)
+{
+  // about gaussian noise from the sum of 4 uniform numbers
+  float noise = 0;
+  for (int k = 0; k < 4; k++)
+  {
+    seed = seed * 1103515245 + 12345;
+    noise += ((seed >> 16) & 0x7FFF) / 32768.0f - 0.5f;
+  }
+  float millivolts = 500 + ((fahrenheit - 32) / 1.8f) * 10;
+  int value = (int)floorf(millivolts / 5000 * 1024 + noise * NOISE_LSB * 1.73f + 0.5f);
+  return value < 0 ? 0 : value > 1023 ? 1023 : value;
+}
+
+struct Result
+{
+  double cyclesPerLoop;
+  double resolution;
+  double rmsError;
+  double loopsPerSecond;
+};
+
+static Result run(unsigned char (*sample)(unsigned int *, int), double scale)
+{
+  Result result = Result();
+  static int samples[SAMPLES];
+
+  seed = 1;
+  for (unsigned int i = 0; i < SAMPLES; i++)
+    samples[i] = adc(temperature(i));
+
+  // the conversion alone
+  tmp36_init(&tempInput);
+  unsigned long long cycles = 0;
+#if HAVE_TSC
+  unsigned long long start = __rdtsc();
+#endif
+  for (unsigned int i = 0; i < SAMPLES; i++)
+    sample(holdingRegs, samples[i]);
+#if HAVE_TSC
+  cycles = __rdtsc() - start;
+#endif
+  result.cyclesPerLoop = (double)cycles / SAMPLES;
+
+  // the error of every value against the temperature in the middle of
+  // the samples it was made of
+  tmp36_init(&tempInput);
+  unsigned int first = 0;
+  unsigned long values = 0;
+  double squares = 0;
+  for (unsigned int i = 0; i < SAMPLES; i++)
+    if (sample(holdingRegs, samples[i]))
+    {
+      double error = (int)holdingRegs[TEMP_STATE] / scale - temperature((first + i) / 2);
+      squares += error * error;
+      values++;
+      first = i + 1;
+    }
+  result.rmsError = sqrt(squares / values);
+  result.resolution = 5000.0 / 1024 * 0.18 * (sample == fixed_sample ? 0.25 : 1);
+
+  // the sketch's loop() on the host
+  hal::reset();
+  modbus_configure(115200, 1, 0, TOTAL_REGS_SIZE, 0);
+  tmp36_init(&tempInput);
+  std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+  for (unsigned int i = 0; i < LOOPS; i++)
+  {
+    hal::setAnalog(TEMP_PIN, samples[i & (SAMPLES - 1)]);
+    holdingRegs[TOTAL_ERRORS] = modbus_update(holdingRegs);
+    holdingRegs[ALARM_STATE] = digitalRead(ALARM_PIN);
+    sample(holdingRegs, analogRead(TEMP_PIN));
+  }
+  double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+  result.loopsPerSecond = LOOPS / elapsed;
+  return result;
+}
+
+int main()
+{
+  printf("%-6s %12s %11s %10s %12s\n", "input", "cycles/loop", "resolution", "rms error", "loops/s");
+
+  Result before = run(float_sample, 1);
+  Result after = run(fixed_sample, 10);
+  printf("%-6s %12.1f %10.2fF %9.2fF %12.0f\n", "float", HAVE_TSC ? before.cyclesPerLoop : 0,
+         before.resolution, before.rmsError, before.loopsPerSecond);
+  printf("%-6s %12.1f %10.2fF %9.2fF %12.0f\n", "fixed", HAVE_TSC ? after.cyclesPerLoop : 0,
+         after.resolution, after.rmsError, after.loopsPerSecond);
+  return 0;
+}
@@ -0,0 +1,235 @@
+#include "CaptureFile.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define VERSION 1
+#define HEADER_SIZE 8
+#define RECORD_HEADER_SIZE 12
+#define WRITE_BUFFER_SIZE (1 << 20)
+
+// the writer the hook passes frames to, there is one ModbusCapture hook
+static CaptureWriter *active;
+
+static unsigned int get16(const unsigned char *in)
+{
+  return in[0] | (in[1] << 8);
+}
+
+static unsigned long long get64(const unsigned char *in)
+{
+  unsigned long long value = 0;
+  for (int i = 7; i >= 0; i--)
+    value = (value << 8) | in[i];
+  return value;
+}
+
+CaptureWriter::CaptureWriter()
+  : frames(0), file(0)
+{
+}
+
+CaptureWriter::~CaptureWriter()
+{
+  close();
+}
+
+bool CaptureWriter::open(const char *path)
+{
+  close();
+
+  // A run that crashed in the middle of a record leaves it cut off at the
+  // end of the file, the next record has to start where the last complete
+  // one ends. Records start at multiples of 8, a record whose padding is
+  // missing leaves the reader at an offset that isn't.
+  long end = 0;
+  CaptureReader reader;
+  bool capture = reader.open(path);
+  if (capture)
+  {
+    if (reader.recordHeaderSize() != RECORD_HEADER_SIZE)
+      return false;
+    CaptureFrame frame;
+    end = HEADER_SIZE;
+    while (reader.next(frame) && reader.position() % 8 == 0)
+      end = reader.position();
+    reader.close();
+  }
+
+  file = fopen(path, "ab");
+  if (!file)
+    return false;
+
+  buffer.resize(WRITE_BUFFER_SIZE);
+  setvbuf(file, &buffer[0], _IOFBF, buffer.size());
+
+  // anything but a capture is left alone, a header cut off is written again
+  fseek(file, 0, SEEK_END);
+  long size = ftell(file);
+  if (!capture && size >= HEADER_SIZE)
+  {
+    close();
+    return false;
+  }
+  if (size != end && ftruncate(fileno(file), end) < 0)
+  {
+    close();
+    return false;
+  }
+
+  // a new file starts with the header, an old one already has it
+  if (end == 0)
+  {
+    unsigned char header[HEADER_SIZE] = { 'M', 'B', 'C', 'P',
+                                          VERSION, 0, RECORD_HEADER_SIZE, 0 };
+    fwrite(header, 1, sizeof(header), file);
+  }
+
+  frames = 0;
+  active = this;
+  modbus_capture(hook);
+  return true;
+}
+
+void CaptureWriter::close()
+{
+  if (active == this)
+  {
+    modbus_capture(0);
+    active = 0;
+  }
+  if (file)
+  {
+    fclose(file);
+    file = 0;
+  }
+}
+
+void CaptureWriter::setPort(const void *line, unsigned char port)
+{
+  if (lines.size() <= port)
+    lines.resize(port + 1);
+  lines[port] = line;
+}
+
+unsigned char CaptureWriter::portOf(const void *line)
+{
+  for (size_t i = 0; i < lines.size(); i++)
+    if (lines[i] == line)
+      return i;
+
+  lines.push_back(line);
+  return lines.size() - 1;
+}
+
+void CaptureWriter::write(unsigned char port, unsigned char flags, unsigned long long time,
+                          const unsigned char *frame, unsigned int length)
+{
+  if (!file)
+    return;
+
+  // one fwrite() a record, the frame is at most 256 bytes
+  unsigned char record[RECORD_HEADER_SIZE + 256 + 8];
+  if (length > 256)
+    length = 256;
+  for (int i = 0; i < 8; i++)
+    record[i] = time >> (8 * i);
+  record[8] = length & 0xFF;
+  record[9] = length >> 8;
+  record[10] = port;
+  record[11] = flags;
+  memcpy(record + RECORD_HEADER_SIZE, frame, length);
+
+  unsigned int size = (RECORD_HEADER_SIZE + length + 7) & ~7u;
+  memset(record + RECORD_HEADER_SIZE + length, 0, size - RECORD_HEADER_SIZE - length);
+  fwrite(record, 1, size, file);
+  frames++;
+}
+
+void CaptureWriter::hook(const void *line, unsigned char flags, unsigned long time,
+                         const unsigned char *frame, unsigned int length)
+{
+  active->write(active->portOf(line), flags, time, frame, length);
+}
+
+CaptureReader::CaptureReader()
+  : data(0), length(0), offset(0), recordHeader(RECORD_HEADER_SIZE)
+{
+}
+
+CaptureReader::~CaptureReader()
+{
+  close();
+}
+
+bool CaptureReader::open(const char *path)
+{
+  close();
+
+  int fd = ::open(path, O_RDONLY);
+  if (fd < 0)
+    return false;
+
+  struct stat st;
+  void *map = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && st.st_size >= HEADER_SIZE)
+    map = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (map == MAP_FAILED)
+    return false;
+
+  data = (const unsigned char *)map;
+  length = st.st_size;
+
+  // records are read in order, tell the kernel to read ahead
+  madvise(map, length, MADV_SEQUENTIAL);
+
+  recordHeader = get16(data + 6);
+  if (memcmp(data, "MBCP", 4) != 0 || get16(data + 4) != VERSION || recordHeader < RECORD_HEADER_SIZE)
+  {
+    close();
+    return false;
+  }
+
+  rewind();
+  return true;
+}
+
+void CaptureReader::close()
+{
+  if (data)
+    munmap((void *)data, length);
+  data = 0;
+  length = 0;
+  offset = 0;
+}
+
+bool CaptureReader::next(CaptureFrame &frame)
+{
+  if (length - offset < recordHeader)
+    return false;
+
+  const unsigned char *record = data + offset;
+  frame.length = get16(record + 8);
+  if (length - offset - recordHeader < frame.length)
+    return false;
+
+  frame.time = get64(record);
+  frame.port = record[10];
+  frame.flags = record[11];
+  frame.data = record + recordHeader;
+
+  // the padding of the last record may be missing
+  offset += (recordHeader + frame.length + 7) & ~7u;
+  if (offset > length)
+    offset = length;
+  return true;
+}
+
+void CaptureReader::rewind()
+{
+  offset = data ? HEADER_SIZE : 0;
+}
@@ -0,0 +1,105 @@
+/*
+ CaptureFile.h - every frame SimpleModbusMaster and SimpleModbusSlave
+ send and receive on the host, recorded to a file that is read back by
+ mapping it into memory.
+
+ CaptureWriter installs itself as the ModbusCapture hook and appends each
+ frame to the file as it happens. Every serial port gets a number the
+ first time it carries a frame, from 0 up, unless setPort() gave it one.
+ The file is little endian whatever the host:
+
+   "MBCP", u16 version 1, u16 size of a record header (12)
+   records, in the order the frames were captured:
+     u64 micros(), u16 length, u8 port, u8 flags (MODBUS_CAPTURE_*),
+     the frame, crc included, then zeros up to a multiple of 8 bytes
+
+ A record never refers to another one, so captures of separate runs can
+ be appended to the same file and a file cut off in the middle of a
+ record is good up to that record. CaptureWriter::open() cuts such a
+ record off before it appends, so the frames of the next run are read
+ back from where they start.
+
+ CaptureReader maps a capture and steps through the records in place,
+ nothing is copied. A frame's data stays valid until close().
+*/
+
+#ifndef CAPTURE_FILE_H
+#define CAPTURE_FILE_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include <vector>
+
+#include "ModbusCapture.h"
+
+struct CaptureFrame
+{
+  unsigned long long time; // micros() when it was captured
+  unsigned char port;
+  unsigned char flags; // MODBUS_CAPTURE_*
+  unsigned int length;
+  const unsigned char *data;
+};
+
+class CaptureWriter
+{
+  public:
+    CaptureWriter();
+    ~CaptureWriter();
+
+    // appends to path, creating it if needed, and starts capturing, false
+    // if path is something other than a capture with 12 byte record headers
+    bool open(const char *path);
+    // stops capturing and writes out what is buffered
+    void close();
+
+    // record the frames of line as port
+    void setPort(const void *line, unsigned char port);
+
+    void write(unsigned char port, unsigned char flags, unsigned long long time,
+               const unsigned char *frame, unsigned int length);
+
+    unsigned long frames; // written since open()
+
+  private:
+    static void hook(const void *line, unsigned char flags, unsigned long time,
+                     const unsigned char *frame, unsigned int length);
+    unsigned char portOf(const void *line);
+
+    FILE *file;
+    std::vector<const void *> lines; // by port number
+    std::vector<char> buffer;
+};
+
+class CaptureReader
+{
+  public:
+    CaptureReader();
+    ~CaptureReader();
+
+    bool open(const char *path);
+    void close();
+
+    // the next record, false after the last one
+    bool next(CaptureFrame &frame);
+    // back to the first record
+    void rewind();
+
+    // once next() has returned false, the last record was cut off
+    bool truncated() const { return offset < length; }
+    // bytes of the file, header included
+    size_t size() const { return length; }
+    // offset of the record next() reads, the end of the file after the last
+    size_t position() const { return offset; }
+    // bytes in front of every frame
+    unsigned int recordHeaderSize() const { return recordHeader; }
+
+  private:
+    const unsigned char *data;
+    size_t length;
+    size_t offset; // of the next record
+    unsigned int recordHeader; // bytes in front of every frame
+};
+
+#endif
@@ -0,0 +1,321 @@
+#include "CaptureReplay.h"
+
+#include "SimpleModbusSlave.h"
+
+#define PORTS 256
+#define REPLAY_BAUD 115200
+#define REPLAY_STEP 2000 // microseconds, more than T3.5 and a millis() tick
+#define REPLAY_TIMEOUT 10 // milliseconds, longer than a replayed response takes
+#define MAP_SIZE 0xFFFF // registers, coils and inputs of the replayed slave
+
+// hands the master a captured response, what the master sends is dropped
+class ReplayStream : public Stream
+{
+  public:
+    ReplayStream() : data(0), length(0), index(0) {}
+
+    void load(const unsigned char *_data, unsigned int _length)
+    {
+      data = _data;
+      length = _length;
+      index = 0;
+    }
+
+    int available() { return length - index; }
+    int read() { return index < length ? (data ? data[index++] : (index++, 0)) : -1; }
+    int peek() { return index < length ? (data ? data[index] : 0) : -1; }
+    size_t write(uint8_t) { return 1; }
+    using Stream::write;
+    void flush() {}
+
+  private:
+    const unsigned char *data;
+    unsigned int length, index;
+};
+
+static ReplayStream stream;
+static ModbusPort port;
+static Packet packet;
+static ModbusTraceRecord record;
+static std::vector<unsigned int> registers, writeRegisters;
+static std::vector<unsigned char> bits;
+
+// the slave's map, shared by every id
+static std::vector<unsigned int> slaveRegisters;
+static std::vector<unsigned char> slaveCoils, slaveInputs;
+
+// what SimpleModbusSlave did with the last request
+static unsigned char slaveReply; // 0 nothing, 1 a response, 2 an exception
+
+static unsigned int *anyUnit(unsigned char, unsigned int *size)
+{
+  *size = MAP_SIZE;
+  return &slaveRegisters[0];
+}
+
+static void replayHook(const void *, unsigned char flags, unsigned long,
+                       const unsigned char *frame, unsigned int length)
+{
+  if ((flags & (MODBUS_CAPTURE_MASTER | MODBUS_CAPTURE_TX)) == MODBUS_CAPTURE_TX && length > 2)
+    slaveReply = (frame[1] & 0x80) ? 2 : 1;
+}
+
+static unsigned int get16(const unsigned char *in)
+{
+  return (in[0] << 8) | in[1];
+}
+
+CaptureReplay::CaptureReplay()
+  : frames(0), transactions(0), stray(0), first(0), last(0)
+{
+}
+
+void CaptureReplay::analyse(CaptureReader &reader)
+{
+  run(reader, false);
+}
+
+void CaptureReplay::replay(CaptureReader &reader)
+{
+  ModbusCaptureHook previous = modbus_capture_hook;
+  size_t rxBufferSize = modbusSerial.rxBufferSize;
+  size_t txBufferSize = modbusSerial.txBufferSize;
+
+  registers.assign(0x10000, 0);
+  writeRegisters.assign(0x10000, 0);
+  bits.assign(0x10000 / 8, 0);
+  slaveRegisters.assign(MAP_SIZE, 0);
+  slaveCoils.assign((MAP_SIZE + 7) / 8, 0);
+  slaveInputs.assign((MAP_SIZE + 7) / 8, 0);
+
+  // the slave gets every request in one piece and sends its response
+  // before modbus_update() returns
+  modbusSerial.disconnect();
+  modbusSerial.rxBufferSize = 256;
+  modbusSerial.txBufferSize = 0;
+  modbus_configure(REPLAY_BAUD, 1, 0, MAP_SIZE, 0);
+  modbus_configure_units(anyUnit);
+  modbus_configure_coils(&slaveCoils[0], MAP_SIZE, &slaveInputs[0], MAP_SIZE);
+
+  // a failing packet is never dropped, every transaction starts afresh
+  packet = Packet();
+  modbus_port_configure(&port, &stream, REPLAY_BAUD, REPLAY_TIMEOUT, 0, 255, 0, &packet, 1);
+  modbus_port_trace(&port, &record, 1, 0, 0);
+  modbus_capture(replayHook);
+
+  run(reader, true);
+
+  modbus_capture(previous);
+  modbus_configure_units(0);
+  modbus_configure_coils(0, 0, 0, 0);
+  modbusSerial.rxBufferSize = rxBufferSize;
+  modbusSerial.txBufferSize = txBufferSize;
+}
+
+void CaptureReplay::run(CaptureReader &reader, bool replaying)
+{
+  stats.clear();
+  index.assign(PORTS * 2 * 256, -1);
+  pending.assign(PORTS * 2, Pending());
+  frames = 0;
+  transactions = 0;
+  stray = 0;
+  first = last = 0;
+
+  CaptureFrame captured;
+  reader.rewind();
+  while (reader.next(captured))
+  {
+    if (!frames)
+      first = captured.time;
+    last = captured.time;
+    frames++;
+    frame(captured, replaying);
+  }
+
+  // the capture ended before the last requests were answered
+  for (size_t i = 0; i < pending.size(); i++)
+    finish(pending[i], 0, replaying);
+}
+
+void CaptureReplay::frame(const CaptureFrame &captured, bool replaying)
+{
+  bool master = (captured.flags & MODBUS_CAPTURE_MASTER) != 0;
+  bool sent = (captured.flags & MODBUS_CAPTURE_TX) != 0;
+  Pending &waiting = pending[captured.port * 2 + master];
+
+  // a request is sent by the master and received by the slave
+  if (master != sent)
+  {
+    if (waiting.slave >= 0)
+      finish(waiting, &captured, replaying);
+    else
+      stray++;
+    return;
+  }
+
+  // the request before this one was never answered
+  finish(waiting, 0, replaying);
+  if (!captured.length)
+    return;
+
+  CaptureSlave &target = slave(captured.port, master, captured.data[0]);
+  target.requests++;
+  transactions++;
+  if (replaying)
+    replaySlave(target, captured);
+
+  waiting.slave = &target - &stats[0];
+  waiting.request = captured.data;
+  waiting.length = captured.length;
+  waiting.time = captured.time;
+}
+
+void CaptureReplay::finish(Pending &waiting, const CaptureFrame *response, bool replaying)
+{
+  if (waiting.slave < 0)
+    return;
+
+  CaptureSlave &target = stats[waiting.slave];
+  if (response)
+  {
+    target.answered++;
+    modbus_histogram_add(&target.times, response->time - waiting.time);
+  }
+  else if (waiting.request[0] != 0)
+    target.unanswered++;
+
+  if (replaying)
+    replayMaster(target, waiting, response);
+  waiting.slave = -1;
+}
+
+CaptureSlave &CaptureReplay::slave(unsigned char port, bool master, unsigned char id)
+{
+  int &i = index[(port * 2 + master) * 256 + id];
+  if (i < 0)
+  {
+    CaptureSlave added = CaptureSlave();
+    added.port = port;
+    added.id = id;
+    added.master = master;
+    i = stats.size();
+    stats.push_back(added);
+  }
+  return stats[i];
+}
+
+std::vector<CaptureSlave> CaptureReplay::slaves() const
+{
+  std::vector<CaptureSlave> sorted;
+  for (size_t i = 0; i < index.size(); i++)
+    if (index[i] >= 0)
+      sorted.push_back(stats[index[i]]);
+  return sorted;
+}
+
+// Sends the captured request from a packet built out of it and lets the
+// master check the captured response, or time out without one.
+void CaptureReplay::replayMaster(CaptureSlave &target, const Pending &request, const CaptureFrame *response)
+{
+  const unsigned char *frame = request.request;
+  unsigned int length = request.length;
+  if (length < 8)
+  {
+    target.skipped++;
+    return;
+  }
+
+  packet = Packet();
+  packet.connection = 1;
+  packet.id = frame[0];
+  packet.function = frame[1];
+  packet.address = get16(&frame[2]);
+  packet.no_of_registers = get16(&frame[4]);
+  packet.register_array = &registers[0];
+  packet.bit_array = &bits[0];
+
+  // writes send the values of the request again
+  unsigned int count = packet.no_of_registers;
+  switch (packet.function)
+  {
+    case READ_COIL_STATUS:
+    case READ_INPUT_STATUS:
+    case READ_HOLDING_REGISTERS:
+      break;
+    case FORCE_SINGLE_COIL:
+      modbus_set_bit(&bits[0], 0, frame[4] == 0xFF);
+      break;
+    case FORCE_MULTIPLE_COILS:
+      if (length != 9 + (count + 7) / 8)
+        count = ~0u;
+      else
+        modbus_unpack_bits(&bits[0], 0, &frame[7], count);
+      break;
+    case PRESET_MULTIPLE_REGISTERS:
+      if (length != 9 + count * 2)
+        count = ~0u;
+      else
+        modbus_unpack_registers(&registers[0], &frame[7], count);
+      break;
+    case READ_WRITE_MULTIPLE_REGISTERS:
+      packet.write_address = length > 9 ? get16(&frame[6]) : 0;
+      packet.no_of_write_registers = length > 9 ? get16(&frame[8]) : 0;
+      packet.write_array = &writeRegisters[0];
+      if (length != 13 + packet.no_of_write_registers * 2)
+        count = ~0u;
+      else
+        modbus_unpack_registers(&writeRegisters[0], &frame[11], packet.no_of_write_registers);
+      break;
+    default:
+      count = ~0u;
+  }
+  if (count == ~0u)
+  {
+    target.skipped++;
+    return;
+  }
+
+  // a response that overflowed frame[] gets a byte more than was kept
+  if (response)
+    stream.load(response->data, response->length + ((response->flags & MODBUS_CAPTURE_OVERFLOW) ? 1 : 0));
+  else
+    stream.load(0, 0);
+
+  unsigned long traced = port.traceTotal;
+  while (port.traceTotal == traced)
+  {
+    modbus_port_update(&port);
+    hal::advance(REPLAY_STEP);
+  }
+  target.verdicts[record.status]++;
+
+  // and is ready for the next one
+  while (!port.transmission_ready_Flag)
+  {
+    modbus_port_update(&port);
+    hal::advance(REPLAY_STEP);
+  }
+}
+
+// Hands the captured request to the slave as if it had just arrived.
+void CaptureReplay::replaySlave(CaptureSlave &target, const CaptureFrame &request)
+{
+  static const unsigned char extra = 0;
+
+  slaveReply = 0;
+  modbusSerial.receive(request.data, request.length);
+  if (request.flags & MODBUS_CAPTURE_OVERFLOW)
+    modbusSerial.receive(&extra, 1);
+
+  modbus_update(&slaveRegisters[0]);
+  hal::advance(REPLAY_STEP);
+  modbus_update(&slaveRegisters[0]);
+
+  if (slaveReply == 1)
+    target.slaveAnswered++;
+  else if (slaveReply == 2)
+    target.slaveExceptions++;
+  else
+    target.slaveSilent++;
+}
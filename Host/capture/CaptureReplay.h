@@ -0,0 +1,92 @@
+/*
+ CaptureReplay.h - response times and replay of a Modbus capture.
+
+ analyse() pairs every request in a capture with the response that
+ followed it on the same port. A request that is followed by another
+ request is unanswered, a broadcast is never answered. The time between
+ a request and its response goes into a ModbusHistogram of the slave it
+ was sent to, per port. On a port captured from SimpleModbusMaster that
+ is the time the master waited, on one captured from SimpleModbusSlave
+ the time the slave took to start answering.
+
+ replay() feeds the capture through the real parsers as fast as they
+ go, on the virtual clock. Every request goes to SimpleModbusSlave, which
+ answers for any id with 65535 registers, coils and inputs. Every request
+ the master can send goes to SimpleModbusMaster together with the
+ response it got, or none, and the master's verdict is counted the way
+ its trace records it. The frames and the code are the ones of the line,
+ so a response rejected in the field is rejected again here, under a
+ debugger if need be.
+
+ replay() reconfigures SimpleModbusSlave on modbusSerial, advances the
+ virtual clock and takes over the ModbusCapture hook while it runs.
+*/
+
+#ifndef CAPTURE_REPLAY_H
+#define CAPTURE_REPLAY_H
+
+#include <vector>
+
+#include "CaptureFile.h"
+#include "SimpleModbusMaster.h"
+
+// what one slave saw on one port
+struct CaptureSlave
+{
+  unsigned char port;
+  unsigned char id;
+  bool master; // the port was captured from SimpleModbusMaster
+
+  unsigned long requests;
+  unsigned long answered;
+  unsigned long unanswered; // broadcasts not counted
+  ModbusHistogram times; // microseconds from request to response
+
+  // replay()
+  unsigned long verdicts[MODBUS_TRACE_BUFFER + 1]; // by MODBUS_TRACE_* of the master
+  unsigned long skipped; // functions the master doesn't send
+  unsigned long slaveAnswered; // SimpleModbusSlave answered normally
+  unsigned long slaveExceptions; // or with an exception
+  unsigned long slaveSilent; // or not at all, a broadcast or a bad frame
+};
+
+class CaptureReplay
+{
+  public:
+    CaptureReplay();
+
+    void analyse(CaptureReader &reader);
+    void replay(CaptureReader &reader);
+
+    // slaves that were sent a request, by port, side and id
+    std::vector<CaptureSlave> slaves() const;
+
+    unsigned long frames; // frames read by the last call
+    unsigned long transactions; // requests and broadcasts
+    unsigned long stray; // responses without a request
+    unsigned long long first, last; // micros() of the first and the last frame
+
+  private:
+    struct Pending
+    {
+      Pending() : slave(-1), request(0), length(0), time(0) {}
+      int slave; // index into stats, -1 if no request is waiting
+      const unsigned char *request;
+      unsigned int length;
+      unsigned long long time;
+    };
+
+    void run(CaptureReader &reader, bool replaying);
+    void frame(const CaptureFrame &frame, bool replaying);
+    void finish(Pending &pending, const CaptureFrame *response, bool replaying);
+    CaptureSlave &slave(unsigned char port, bool master, unsigned char id);
+
+    void replayMaster(CaptureSlave &slave, const Pending &request, const CaptureFrame *response);
+    void replaySlave(CaptureSlave &slave, const CaptureFrame &request);
+
+    std::vector<CaptureSlave> stats;
+    std::vector<int> index; // into stats by port, side and id, -1 if none
+    std::vector<Pending> pending; // by port and side
+};
+
+#endif
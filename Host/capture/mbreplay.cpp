@@ -0,0 +1,113 @@
+/*
+ mbreplay.cpp - response times of every slave in a Modbus capture and a
+ replay of the capture through SimpleModbusMaster and SimpleModbusSlave.
+
+ Usage: mbreplay [-n] capture.mbcp
+
+ The capture is what a CaptureWriter recorded, see CaptureFile.h. For
+ every port, side and slave id the requests, the answers and the median,
+ 90th and 99th percentile and maximum response time are printed. Then
+ the capture is replayed and for every slave the master's verdict on each
+ transaction (MODBUS_TRACE_*) and what the slave answered to each request
+ is printed. -n leaves the replay out. Both passes report how many frames
+ a second they went through.
+
+ Build from the repository root:
+
+   cmake -S . -B build && cmake --build build --target mbreplay
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include <chrono>
+
+#include "CaptureFile.h"
+#include "CaptureReplay.h"
+
+static const char *verdicts[] = { "ok", "timeout", "exception", "checksum",
+                                  "id", "function", "bytes", "buffer" };
+
+static double seconds(std::chrono::steady_clock::time_point start)
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static double ms(unsigned long microseconds)
+{
+  return microseconds / 1000.0;
+}
+
+int main(int argc, char **argv)
+{
+  bool replay = true;
+  const char *path = 0;
+  for (int i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "-n") == 0)
+      replay = false;
+    else
+      path = argv[i];
+  }
+  if (!path)
+  {
+    fprintf(stderr, "usage: mbreplay [-n] capture.mbcp\n");
+    return 2;
+  }
+
+  CaptureReader reader;
+  if (!reader.open(path))
+  {
+    fprintf(stderr, "mbreplay: %s is not a capture\n", path);
+    return 1;
+  }
+
+  CaptureReplay capture;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  capture.analyse(reader);
+  double analysed = seconds(start);
+
+  printf("%s: %lu frames, %lu transactions, %lu stray responses, %.1f s captured%s\n", path,
+         capture.frames, capture.transactions, capture.stray,
+         (capture.last - capture.first) / 1e6, reader.truncated() ? ", last record cut off" : "");
+  printf("analysed in %.3f s, %.1f M frames/s\n\n", analysed, capture.frames / analysed / 1e6);
+
+  std::vector<CaptureSlave> slaves = capture.slaves();
+  printf("%4s %6s %3s %10s %10s %10s %9s %9s %9s %9s\n", "port", "side", "id", "requests",
+         "answered", "unanswered", "p50(ms)", "p90(ms)", "p99(ms)", "max(ms)");
+  for (size_t i = 0; i < slaves.size(); i++)
+  {
+    const CaptureSlave &slave = slaves[i];
+    printf("%4u %6s %3u %10lu %10lu %10lu %9.2f %9.2f %9.2f %9.2f\n", slave.port,
+           slave.master ? "master" : "slave", slave.id, slave.requests, slave.answered,
+           slave.unanswered, ms(modbus_histogram_percentile(&slave.times, 500)),
+           ms(modbus_histogram_percentile(&slave.times, 900)),
+           ms(modbus_histogram_percentile(&slave.times, 990)), ms(slave.times.max));
+  }
+
+  if (!replay)
+    return 0;
+
+  start = std::chrono::steady_clock::now();
+  capture.replay(reader);
+  double replayed = seconds(start);
+
+  printf("\nreplayed in %.3f s, %.1f M frames/s\n\n", replayed, capture.frames / replayed / 1e6);
+
+  slaves = capture.slaves();
+  printf("%4s %6s %3s", "port", "side", "id");
+  for (size_t v = 0; v < sizeof(verdicts) / sizeof(verdicts[0]); v++)
+    printf(" %9s", verdicts[v]);
+  printf(" %8s | %9s %9s %9s\n", "skipped", "answered", "exception", "silent");
+  for (size_t i = 0; i < slaves.size(); i++)
+  {
+    const CaptureSlave &slave = slaves[i];
+    printf("%4u %6s %3u", slave.port, slave.master ? "master" : "slave", slave.id);
+    for (size_t v = 0; v < sizeof(verdicts) / sizeof(verdicts[0]); v++)
+      printf(" %9lu", slave.verdicts[v]);
+    printf(" %8lu | %9lu %9lu %9lu\n", slave.skipped, slave.slaveAnswered,
+           slave.slaveExceptions, slave.slaveSilent);
+  }
+
+  return 0;
+}
@@ -0,0 +1,122 @@
+#include "BreweryFloor.h"
+
+#include "SimpleModbusSlave.h"
+#include "TMP36Input.h"
+
+// the floor modbus_update() dispatches to
+static BreweryFloor *attached;
+
+TMP36Script::TMP36Script(float _setpoint, float _swing, float _period, float _phase, float _alarmAt)
+  : setpoint(_setpoint), swing(_swing), period(_period), phase(_phase), alarmAt(_alarmAt)
+{
+}
+
+float TMP36Script::temperature(unsigned long long now) const
+{
+  return setpoint + swing * sinf(2 * (float)M_PI * (now / 1e6f) / period + phase);
+}
+
+int TMP36Script::convert(float celsius)
+{
+  // TMP36 is 500 mV at 0 C, +10 mV for every 1 C, read by a 5 V 10 bit ADC
+  // and oversampled to TMP36_BITS
+  int reading = (int)((0.5f + celsius / 100) / 5.0f * (1 << TMP36_BITS) + 0.5f);
+  if (reading < 0)
+    reading = 0;
+  if (reading > (1 << TMP36_BITS) - 4)
+    reading = (1 << TMP36_BITS) - 4;
+
+  // and back the way ModbusSlaveSimulation.ino does it
+  return tmp36_tenths(reading);
+}
+
+void TMP36Script::update(unsigned int *holdingRegs, unsigned int size, unsigned long long now)
+{
+  if (size < TOTAL_REGS_SIZE)
+    return;
+
+  float celsius = temperature(now);
+  holdingRegs[ALARM_STATE] = celsius > alarmAt;
+  holdingRegs[TEMP_STATE] = convert(celsius);
+}
+
+BreweryFloor::BreweryFloor()
+  : clock(hal::now), dispatched(0), unknown(0), count(0)
+{
+  for (unsigned int i = 0; i < 256; i++)
+    table[i] = 0;
+}
+
+BreweryFloor::~BreweryFloor()
+{
+  detach();
+  for (unsigned int i = 0; i < 256; i++)
+    if (table[i])
+    {
+      delete table[i]->script;
+      delete table[i];
+    }
+}
+
+void BreweryFloor::addUnit(unsigned char id, unsigned int no_of_registers, SensorScript *script)
+{
+  // 0 is the broadcast id
+  if (id == 0)
+  {
+    delete script;
+    return;
+  }
+
+  Unit *unit = table[id];
+  if (unit)
+    delete unit->script;
+  else
+  {
+    unit = table[id] = new Unit;
+    count++;
+  }
+  unit->regs.assign(no_of_registers, 0);
+  unit->script = script;
+}
+
+unsigned int *BreweryFloor::registers(unsigned char id)
+{
+  return table[id] && !table[id]->regs.empty() ? &table[id]->regs[0] : 0;
+}
+
+unsigned int BreweryFloor::units() const
+{
+  return count;
+}
+
+void BreweryFloor::attach()
+{
+  attached = this;
+  modbus_configure_units(lookup);
+}
+
+void BreweryFloor::detach()
+{
+  if (attached != this)
+    return;
+  attached = 0;
+  modbus_configure_units(0);
+}
+
+unsigned int *BreweryFloor::lookup(unsigned char id, unsigned int *holdingRegsSize)
+{
+  BreweryFloor *floor = attached;
+  Unit *unit = floor->table[id];
+  if (!unit || unit->regs.empty())
+  {
+    floor->unknown++;
+    return 0;
+  }
+
+  floor->dispatched++;
+  if (unit->script)
+    unit->script->update(&unit->regs[0], unit->regs.size(), floor->clock());
+
+  *holdingRegsSize = unit->regs.size();
+  return &unit->regs[0];
+}
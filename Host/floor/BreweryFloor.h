@@ -0,0 +1,100 @@
+/*
+ BreweryFloor.h - hundreds of SimpleModbusSlave devices in one Linux
+ process, for load testing a master against a whole brewery floor.
+
+ Every unit id from 1 to 247 can be given its own holding register array
+ and a sensor script standing in for the sketch's loop(). attach() makes
+ SimpleModbusSlave answer for all of them through
+ modbus_configure_units(): a request is dispatched on its unit id with a
+ single table lookup, however many units there are.
+
+ Scripts are not run on a timer. A unit's script brings its registers up
+ to date when a request for the unit arrives, so idle units cost nothing
+ and the registers a master reads are always current.
+
+ SimpleModbusSlave keeps its state in globals, so only one floor can be
+ attached in a process.
+*/
+
+#ifndef BREWERY_FLOOR_H
+#define BREWERY_FLOOR_H
+
+#include <vector>
+
+#include "Arduino.h"
+
+// stands in for the loop() of a slave sketch
+class SensorScript
+{
+  public:
+    virtual ~SensorScript() {}
+
+    // bring the registers up to date, now is in microseconds
+    virtual void update(unsigned int *holdingRegs, unsigned int size, unsigned long long now) = 0;
+};
+
+// The temperature input of ModbusSlaveSimulation.ino: a TMP36 on a 10 bit
+// ADC oversampled to tenths of a degree Fahrenheit in TEMP_STATE, with the
+// alarm input in ALARM_STATE. The vessel temperature swings sinusoidally
+// around its setpoint and the alarm is raised above alarmAt.
+class TMP36Script : public SensorScript
+{
+  public:
+    // the register layout of ModbusSlaveSimulation.ino
+    enum { ALARM_STATE, TEMP_STATE, TOTAL_ERRORS, TOTAL_REGS_SIZE };
+
+    TMP36Script(float setpoint, float swing, float period, float phase, float alarmAt);
+
+    void update(unsigned int *holdingRegs, unsigned int size, unsigned long long now);
+
+    // degrees Celsius at now
+    float temperature(unsigned long long now) const;
+
+    // the register value the sketch computes for a temperature
+    static int convert(float celsius);
+
+  private:
+    float setpoint; // degrees Celsius
+    float swing; // amplitude, degrees Celsius
+    float period; // seconds
+    float phase; // radians
+    float alarmAt; // degrees Celsius
+};
+
+class BreweryFloor
+{
+  public:
+    BreweryFloor();
+    ~BreweryFloor();
+
+    // emulate a slave with the given number of holding registers, script
+    // may be 0 and is deleted with the floor
+    void addUnit(unsigned char id, unsigned int no_of_registers, SensorScript *script);
+    unsigned int *registers(unsigned char id);
+    unsigned int units() const;
+
+    // serve the units through SimpleModbusSlave, after modbus_configure()
+    void attach();
+    void detach();
+
+    // the ModbusUnitLookup attach() installs, for a ModbusTcpGateway
+    static unsigned int *lookup(unsigned char id, unsigned int *holdingRegsSize);
+
+    // the time scripts see, hal::now() unless replaced
+    unsigned long long (*clock)();
+
+    unsigned long dispatched; // requests for a unit on the floor
+    unsigned long unknown; // requests for an id no unit has
+
+  private:
+    struct Unit
+    {
+      std::vector<unsigned int> regs;
+      SensorScript *script;
+    };
+
+    Unit *table[256]; // by unit id
+    unsigned int count;
+};
+
+#endif
@@ -0,0 +1,69 @@
+/*
+ floor_sim.cpp - a brewery floor of SimpleModbusSlave devices served over
+ Modbus/TCP, to load test a master or SCADA client.
+
+ Usage: floor_sim [port] [units] [registers]
+
+ Listens on port 502 by default (which needs root, use 5020 otherwise)
+ with 200 slaves, unit ids 1 to 200, of 3 holding registers each, the
+ layout of ModbusSlaveSimulation.ino. Every slave's TMP36 follows its own
+ temperature swing in real time: ales around 19 C, lagers around 10 C and
+ a few cold crashing tanks whose alarm trips now and then.
+
+ Build from the repository root:
+
+   cmake -S . -B build && cmake --build build --target floor_sim
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "BreweryFloor.h"
+#include "ModbusTcpGateway.h"
+
+static unsigned long long wallClock()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+int main(int argc, char **argv)
+{
+  unsigned short port = argc > 1 ? atoi(argv[1]) : 502;
+  unsigned int units = argc > 2 ? atoi(argv[2]) : 200;
+  unsigned int size = argc > 3 ? atoi(argv[3]) : TMP36Script::TOTAL_REGS_SIZE;
+
+  if (units < 1 || units > 247)
+    units = 200;
+  if (size < TMP36Script::TOTAL_REGS_SIZE)
+    size = TMP36Script::TOTAL_REGS_SIZE;
+
+  BreweryFloor floor;
+  floor.clock = wallClock;
+  for (unsigned int id = 1; id <= units; id++)
+  {
+    float phase = id * 0.7f;
+    SensorScript *script;
+    if (id % 10 == 0)
+      script = new TMP36Script(2, 3, 600, phase, 4); // cold crash
+    else if (id % 3 == 0)
+      script = new TMP36Script(10, 0.5f, 300, phase, 13); // lager
+    else
+      script = new TMP36Script(19, 1, 120, phase, 23); // ale
+    floor.addUnit(id, size, script);
+  }
+
+  ModbusTcpGateway gateway;
+  floor.attach();
+  if (!gateway.begin(port, BreweryFloor::lookup))
+  {
+    perror("floor_sim");
+    return 1;
+  }
+  printf("serving %u slaves of %u registers on port %u\n", units, size, gateway.port());
+
+  gateway.run();
+  return 0;
+}
@@ -0,0 +1,378 @@
+#include "ModbusTcpGateway.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#define GATEWAY_BAUD 1000000
+#define MBAP_HEADER_SIZE 7 // transaction id, protocol id, length, unit id
+#define MAX_ADU_SIZE 260
+#define MAX_EVENTS 64
+
+// the frame delay SimpleModbusSlave uses at 1 Mbaud with low latency
+#define GATEWAY_T3_5 10
+
+static void setNonBlocking(int fd)
+{
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+}
+
+ModbusTcpGateway::ModbusTcpGateway()
+  : requests(0), unanswered(0), listenFd(-1), epollFd(-1), stopFd(-1),
+    listenPort(0), slaveID(1), holdingRegs(0), unitLookup(0)
+{
+}
+
+ModbusTcpGateway::~ModbusTcpGateway()
+{
+  closeAll();
+  if (listenFd >= 0)
+    ::close(listenFd);
+  if (stopFd >= 0)
+    ::close(stopFd);
+  if (epollFd >= 0)
+    ::close(epollFd);
+}
+
+bool ModbusTcpGateway::begin(unsigned short _port, unsigned char _slaveID,
+                             unsigned int *_holdingRegs, unsigned int holdingRegsSize)
+{
+  slaveID = _slaveID;
+  holdingRegs = _holdingRegs;
+
+  // the slave sees requests on modbusSerial, the gateway writes them to its peer
+  hal::reset();
+  modbus_configure(GATEWAY_BAUD, slaveID, 0, holdingRegsSize, 1);
+  modbus_configure_units(0);
+  modbusSerial.rxBufferSize = MAX_ADU_SIZE; // a whole request arrives between two updates
+  line.rxBufferSize = MAX_ADU_SIZE;
+  line.txBufferSize = MAX_ADU_SIZE;
+  line.begin(GATEWAY_BAUD);
+  SimSerial::connect(line, modbusSerial);
+  return listen(_port);
+}
+
+bool ModbusTcpGateway::begin(unsigned short _port, ModbusUnitLookup lookup)
+{
+  if (!begin(_port, 0, 0, 0))
+    return false;
+
+  unitLookup = lookup;
+  modbus_configure_units(lookup);
+  return true;
+}
+
+bool ModbusTcpGateway::listen(unsigned short _port)
+{
+  listenFd = socket(AF_INET, SOCK_STREAM, 0);
+  if (listenFd < 0)
+    return false;
+
+  int on = 1;
+  setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+  struct sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_ANY);
+  address.sin_port = htons(_port);
+  if (bind(listenFd, (struct sockaddr *)&address, sizeof(address)) < 0 ||
+      ::listen(listenFd, SOMAXCONN) < 0)
+    return false;
+
+  socklen_t length = sizeof(address);
+  getsockname(listenFd, (struct sockaddr *)&address, &length);
+  listenPort = ntohs(address.sin_port);
+  setNonBlocking(listenFd);
+
+  epollFd = epoll_create1(0);
+  stopFd = eventfd(0, EFD_NONBLOCK);
+  if (epollFd < 0 || stopFd < 0)
+    return false;
+
+  // listenFd and stopFd are told apart from connections by a null pointer
+  // and the address of stopFd
+  struct epoll_event event;
+  event.events = EPOLLIN;
+  event.data.ptr = 0;
+  epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &event);
+  event.data.ptr = &stopFd;
+  epoll_ctl(epollFd, EPOLL_CTL_ADD, stopFd, &event);
+  return true;
+}
+
+unsigned short ModbusTcpGateway::port() const
+{
+  return listenPort;
+}
+
+void ModbusTcpGateway::stop()
+{
+  uint64_t one = 1;
+  if (write(stopFd, &one, sizeof(one)) < 0)
+    return;
+}
+
+void ModbusTcpGateway::run()
+{
+  struct epoll_event events[MAX_EVENTS];
+  std::vector<Connection *> closed;
+
+  for (;;)
+  {
+    int n = epoll_wait(epollFd, events, MAX_EVENTS, -1);
+    if (n < 0 && errno != EINTR)
+    {
+      closeAll();
+      return;
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+      if (events[i].data.ptr == &stopFd)
+      {
+        uint64_t value;
+        if (read(stopFd, &value, sizeof(value)) < 0)
+          continue;
+        // the connections of this batch that were closed are among them
+        closeAll();
+        return;
+      }
+
+      if (events[i].data.ptr == 0)
+      {
+        accept();
+        continue;
+      }
+
+      Connection *connection = (Connection *)events[i].data.ptr;
+      if (events[i].events & (EPOLLERR | EPOLLHUP))
+        close(connection);
+      else
+      {
+        if (events[i].events & EPOLLIN)
+          receive(connection);
+        if (connection->fd >= 0 && (events[i].events & EPOLLOUT))
+          send(connection);
+      }
+
+      // a closed connection may still have events further down the list
+      if (connection->fd < 0)
+        closed.push_back(connection);
+    }
+
+    for (size_t i = 0; i < closed.size(); i++)
+    {
+      connections.erase(std::find(connections.begin(), connections.end(), closed[i]));
+      delete closed[i];
+    }
+    closed.clear();
+  }
+}
+
+void ModbusTcpGateway::accept()
+{
+  for (;;)
+  {
+    int fd = ::accept(listenFd, 0, 0);
+    if (fd < 0)
+      return;
+
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    setNonBlocking(fd);
+
+    Connection *connection = new Connection;
+    connection->fd = fd;
+    connection->outIndex = 0;
+    connection->waitingToSend = false;
+    connections.push_back(connection);
+
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = connection;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event);
+  }
+}
+
+void ModbusTcpGateway::close(Connection *connection)
+{
+  if (connection->fd < 0)
+    return;
+  epoll_ctl(epollFd, EPOLL_CTL_DEL, connection->fd, 0);
+  ::close(connection->fd);
+  connection->fd = -1;
+}
+
+// Closes the socket of every client and forgets the connections, when
+// run() returns and when the gateway goes away.
+void ModbusTcpGateway::closeAll()
+{
+  for (size_t i = 0; i < connections.size(); i++)
+  {
+    close(connections[i]);
+    delete connections[i];
+  }
+  connections.clear();
+}
+
+void ModbusTcpGateway::receive(Connection *connection)
+{
+  unsigned char buffer[4096];
+  ssize_t n;
+
+  while ((n = read(connection->fd, buffer, sizeof(buffer))) > 0)
+    connection->in.insert(connection->in.end(), buffer, buffer + n);
+
+  if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK))
+  {
+    close(connection);
+    return;
+  }
+
+  // answer every complete request, a partial one waits for more bytes
+  size_t index = 0;
+  std::vector<unsigned char> &in = connection->in;
+  while (in.size() - index >= MBAP_HEADER_SIZE)
+  {
+    const unsigned char *adu = &in[index];
+    unsigned int protocol = (adu[2] << 8) | adu[3];
+    unsigned int length = (adu[4] << 8) | adu[5]; // unit id and pdu
+
+    // not Modbus, there is no way to find the next request
+    if (protocol != 0 || length < 2 || length > MAX_ADU_SIZE - 6)
+    {
+      close(connection);
+      return;
+    }
+
+    if (in.size() - index < 6 + length)
+      break;
+
+    handle(connection, adu, 6 + length);
+    index += 6 + length;
+  }
+  in.erase(in.begin(), in.begin() + index);
+
+  send(connection);
+}
+
+void ModbusTcpGateway::send(Connection *connection)
+{
+  std::vector<unsigned char> &out = connection->out;
+
+  while (connection->outIndex < out.size())
+  {
+    ssize_t n = write(connection->fd, &out[connection->outIndex], out.size() - connection->outIndex);
+    if (n < 0)
+    {
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+      {
+        close(connection);
+        return;
+      }
+      break;
+    }
+    connection->outIndex += n;
+  }
+
+  bool pending = connection->outIndex < out.size();
+  if (!pending)
+  {
+    out.clear();
+    connection->outIndex = 0;
+  }
+
+  // only wait for the socket to drain while there is something to send
+  if (pending != connection->waitingToSend)
+  {
+    struct epoll_event event;
+    event.events = EPOLLIN | (pending ? (uint32_t)EPOLLOUT : 0u);
+    event.data.ptr = connection;
+    epoll_ctl(epollFd, EPOLL_CTL_MOD, connection->fd, &event);
+    connection->waitingToSend = pending;
+  }
+}
+
+// Turns one MBAP request into an RTU frame for the slave and queues the
+// answer on the connection.
+void ModbusTcpGateway::handle(Connection *connection, const unsigned char *adu, unsigned int length)
+{
+  unsigned char frame[MAX_ADU_SIZE];
+  unsigned char unit = adu[6];
+  unsigned int pduLength = length - MBAP_HEADER_SIZE;
+
+  frame[0] = (!unitLookup && (unit == 0 || unit == 255)) ? slaveID : unit;
+  memcpy(frame + 1, adu + MBAP_HEADER_SIZE, pduLength);
+
+  unsigned int responseLength = transact(frame, pduLength + 1);
+  if (responseLength)
+    requests++;
+  else
+  {
+    // exception 11, gateway target device failed to respond
+    frame[1] = adu[MBAP_HEADER_SIZE] | 0x80;
+    frame[2] = 11;
+    responseLength = 3;
+    unanswered++;
+  }
+
+  // the MBAP header echoes the transaction id and the unit id
+  std::vector<unsigned char> &out = connection->out;
+  out.push_back(adu[0]);
+  out.push_back(adu[1]);
+  out.push_back(0);
+  out.push_back(0);
+  out.push_back(responseLength >> 8);
+  out.push_back(responseLength & 0xFF);
+  out.push_back(unit);
+  out.insert(out.end(), frame + 1, frame + responseLength);
+}
+
+// Sends the unit id and pdu in frame[] to the slave as an RTU frame and
+// leaves its response without the crc in frame[]. Returns the length of
+// the response or 0 if the slave did not answer.
+unsigned int ModbusTcpGateway::transact(unsigned char *frame, unsigned int length)
+{
+  unsigned int crc16 = modbus_crc16(frame, length);
+  frame[length] = crc16 >> 8;
+  frame[length + 1] = crc16 & 0xFF;
+
+  // the request has been received once the line has been silent for T3.5
+  line.write(frame, length + 2);
+  hal::advance(line.txDoneAt() - hal::now());
+  modbus_update(holdingRegs);
+  hal::advance(GATEWAY_T3_5);
+  modbus_update(holdingRegs);
+
+  // the response is sent in the background, keep the slave topping up its
+  // TX buffer until everything has gone out
+  while (!modbusSerial.txIdle())
+  {
+    hal::advance(modbusSerial.txDoneAt() - hal::now());
+    modbus_update(holdingRegs);
+  }
+
+  unsigned int responseLength = 0;
+  while (line.available())
+  {
+    unsigned char value = line.read();
+    if (responseLength < MAX_ADU_SIZE)
+      frame[responseLength++] = value;
+  }
+
+  if (responseLength < 5 ||
+      modbus_crc16(frame, responseLength - 2) !=
+      (unsigned int)((frame[responseLength - 2] << 8) | frame[responseLength - 1]))
+    return 0;
+
+  return responseLength - 2;
+}
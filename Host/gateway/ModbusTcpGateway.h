@@ -0,0 +1,91 @@
+/*
+ ModbusTcpGateway.h - Modbus/TCP server in front of SimpleModbusSlave on
+ a Linux host.
+
+ Every request that arrives over TCP is unwrapped from its MBAP header,
+ given the unit id and a crc and handed to SimpleModbusSlave as an RTU
+ frame on modbusSerial, exactly as if it had come down an RS-485 line.
+ The slave's response is checked, stripped of its crc and sent back under
+ the transaction id of the request. The slave code is linked unchanged,
+ so the TCP clients see the same holdingRegs array, functions and
+ exception responses as an RTU master does.
+
+ modbusSerial is the host HAL's simulated UART, driven at 1 Mbaud with
+ the low latency frame delay on the virtual clock. A request costs a few
+ microseconds of CPU on top of the slave's own work, no real time passes.
+
+ All connections are served from one thread with epoll. Requests of one
+ connection are answered in order, any number of them may be pipelined.
+ Unit id 0 and 255 address the slave itself. A request for another unit,
+ or one the slave does not answer, gets exception 11 (gateway target
+ device failed to respond). A gateway in front of several slaves, begun
+ with a unit lookup (see modbus_configure_units()), passes every unit id
+ on unchanged.
+
+ SimpleModbusSlave keeps its state in globals, so only one gateway can
+ run in a process.
+*/
+
+#ifndef MODBUS_TCP_GATEWAY_H
+#define MODBUS_TCP_GATEWAY_H
+
+#include <vector>
+
+#include "Arduino.h"
+#include "SimpleModbusSlave.h"
+
+class ModbusTcpGateway
+{
+  public:
+    ModbusTcpGateway();
+    ~ModbusTcpGateway();
+
+    // Listen on the given TCP port (0 picks a free one, see port()) and
+    // serve holdingRegs as slave slaveID. Returns false if the socket
+    // could not be set up.
+    bool begin(unsigned short port, unsigned char slaveID,
+               unsigned int *holdingRegs, unsigned int holdingRegsSize);
+
+    // serve every slave lookup returns a register array for
+    bool begin(unsigned short port, ModbusUnitLookup lookup);
+
+    // serve requests until stop() is called, from another thread if needed
+    void run();
+    void stop();
+
+    unsigned short port() const;
+
+    unsigned long requests; // answered by the slave
+    unsigned long unanswered; // answered with exception 11
+
+  private:
+    struct Connection
+    {
+      int fd;
+      std::vector<unsigned char> in;
+      std::vector<unsigned char> out;
+      size_t outIndex; // next byte of out to send
+      bool waitingToSend; // EPOLLOUT is enabled
+    };
+
+    void accept();
+    void receive(Connection *connection);
+    void send(Connection *connection);
+    void close(Connection *connection);
+    void closeAll();
+    void handle(Connection *connection, const unsigned char *adu, unsigned int length);
+    unsigned int transact(unsigned char *frame, unsigned int length);
+    bool listen(unsigned short port);
+
+    int listenFd;
+    int epollFd;
+    int stopFd;
+    unsigned short listenPort;
+    unsigned char slaveID;
+    unsigned int *holdingRegs;
+    ModbusUnitLookup unitLookup;
+    std::vector<Connection *> connections; // open or closed in this round of events
+    SimSerial line; // the master's end of modbusSerial
+};
+
+#endif
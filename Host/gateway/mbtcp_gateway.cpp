@@ -0,0 +1,57 @@
+/*
+ mbtcp_gateway.cpp - serve a SimpleModbusSlave register map over Modbus/TCP.
+
+ Usage: mbtcp_gateway [port] [registers] [slave id]
+
+ Listens on port 502 by default (which needs root, use 5020 otherwise)
+ with 100 holding registers as slave 1. Register 0 counts the seconds
+ since the gateway started so clients have something changing to read.
+
+ Build from the repository root:
+
+   cmake -S . -B build && cmake --build build --target mbtcp_gateway
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <thread>
+#include <vector>
+
+#include "ModbusTcpGateway.h"
+
+int main(int argc, char **argv)
+{
+  unsigned short port = argc > 1 ? atoi(argv[1]) : 502;
+  unsigned int size = argc > 2 ? atoi(argv[2]) : 100;
+  unsigned char id = argc > 3 ? atoi(argv[3]) : 1;
+
+  if (size == 0)
+    size = 1;
+  std::vector<unsigned int> holdingRegs(size);
+
+  ModbusTcpGateway gateway;
+  if (!gateway.begin(port, id, &holdingRegs[0], size))
+  {
+    perror("mbtcp_gateway");
+    return 1;
+  }
+  printf("serving %u registers as slave %u on port %u\n", size, id, gateway.port());
+
+  // the uptime counter is written while requests are served, a 16 bit
+  // store is as atomic as it is on the Arduino
+  std::thread uptime([&holdingRegs]() {
+    time_t start = time(0);
+    for (;;)
+    {
+      sleep(1);
+      holdingRegs[0] = time(0) - start;
+    }
+  });
+  uptime.detach();
+
+  gateway.run();
+  return 0;
+}
@@ -0,0 +1,90 @@
+/*
+ Arduino.h - Host stand-in for the parts of the Arduino core used by the
+ libraries in this repository, so they can be compiled and benchmarked
+ as native Linux programs.
+
+ Time is virtual. millis() and micros() only move when the program calls
+ delay(), delayMicroseconds() or hal::advance(), so a simulation runs as
+ fast as the host allows and gives the same numbers on every run. A
+ program that talks to real serial ports switches to the monotonic clock
+ with hal::realTime().
+*/
+
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 1
+#define LOW 0
+
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+
+#define A0 14
+#define A1 15
+#define A2 16
+#define A3 17
+#define A4 18
+#define A5 19
+
+// AVR port registers are plain bytes on the host, writing them does nothing
+extern uint8_t PORTB, PORTC, PORTD;
+#define _BV(bit) (1 << (bit))
+#define _SFR_BYTE(sfr) (sfr)
+
+// program memory is ordinary memory on the host
+#define PROGMEM
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+#define pgm_read_word(addr) (*(const uint16_t *)(addr))
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+int analogRead(uint8_t pin);
+
+#include "SimSerial.h"
+
+// the serial port the Modbus libraries talk through
+extern SimSerial modbusSerial;
+
+namespace hal
+{
+  const int NUM_PINS = 20;
+
+  // virtual time in microseconds since hal::reset()
+  unsigned long long now();
+
+  // move virtual time forward, in real time sleep that long
+  void advance(unsigned long long us);
+
+  // from now on time is CLOCK_MONOTONIC since the last reset(), for good
+  void realTime();
+
+  // restore time, pins and modbusSerial to their power on state
+  void reset();
+
+  // value returned by analogRead(pin)
+  void setAnalog(uint8_t pin, int value);
+
+  // level written by digitalWrite() or forced by setDigital()
+  int pinState(uint8_t pin);
+  void setDigital(uint8_t pin, int value);
+
+  // number of LOW to HIGH transitions written to the pin
+  unsigned long pinRises(uint8_t pin);
+}
+
+#endif
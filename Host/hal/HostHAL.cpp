@@ -0,0 +1,136 @@
+#include "Arduino.h"
+
+#include <errno.h>
+#include <time.h>
+
+SimSerial modbusSerial;
+uint8_t PORTB, PORTC, PORTD;
+
+static unsigned long long clock_us;
+static bool real_time;
+static unsigned long long real_epoch; // CLOCK_MONOTONIC at reset() in real time
+static int pinLevel[hal::NUM_PINS];
+static int analogLevel[hal::NUM_PINS];
+static unsigned long pinRiseCount[hal::NUM_PINS];
+
+static unsigned long long monotonic()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+unsigned long long hal::now()
+{
+  if (real_time)
+    return monotonic() - real_epoch;
+  return clock_us;
+}
+
+void hal::advance(unsigned long long us)
+{
+  if (!real_time)
+  {
+    clock_us += us;
+    return;
+  }
+
+  struct timespec ts;
+  ts.tv_sec = us / 1000000;
+  ts.tv_nsec = (us % 1000000) * 1000;
+  while (nanosleep(&ts, &ts) < 0 && errno == EINTR)
+    ;
+}
+
+void hal::realTime()
+{
+  real_time = true;
+  real_epoch = monotonic();
+}
+
+void hal::reset()
+{
+  clock_us = 0;
+  real_epoch = monotonic();
+  for (int i = 0; i < NUM_PINS; i++)
+  {
+    pinLevel[i] = LOW;
+    analogLevel[i] = 0;
+    pinRiseCount[i] = 0;
+  }
+  modbusSerial.rxBufferSize = SIM_SERIAL_BUFFER_SIZE;
+  modbusSerial.txBufferSize = SIM_SERIAL_BUFFER_SIZE;
+  modbusSerial.clear();
+}
+
+void hal::setAnalog(uint8_t pin, int value)
+{
+  if (pin >= A0)
+    pin -= A0;
+  if (pin < NUM_PINS)
+    analogLevel[pin] = value;
+}
+
+int hal::pinState(uint8_t pin)
+{
+  return pin < NUM_PINS ? pinLevel[pin] : LOW;
+}
+
+void hal::setDigital(uint8_t pin, int value)
+{
+  if (pin < NUM_PINS)
+    pinLevel[pin] = value;
+}
+
+unsigned long hal::pinRises(uint8_t pin)
+{
+  return pin < NUM_PINS ? pinRiseCount[pin] : 0;
+}
+
+unsigned long millis()
+{
+  return hal::now() / 1000;
+}
+
+unsigned long micros()
+{
+  return hal::now();
+}
+
+void delay(unsigned long ms)
+{
+  hal::advance(ms * 1000ULL);
+}
+
+void delayMicroseconds(unsigned int us)
+{
+  hal::advance(us);
+}
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+  if (mode == INPUT_PULLUP)
+    hal::setDigital(pin, HIGH);
+}
+
+void digitalWrite(uint8_t pin, uint8_t value)
+{
+  if (pin >= hal::NUM_PINS)
+    return;
+  if (value && !pinLevel[pin])
+    pinRiseCount[pin]++;
+  pinLevel[pin] = value ? HIGH : LOW;
+}
+
+int digitalRead(uint8_t pin)
+{
+  return hal::pinState(pin);
+}
+
+int analogRead(uint8_t pin)
+{
+  // A0..A5 and 0..5 both name the analog channels
+  if (pin >= A0)
+    pin -= A0;
+  return pin < hal::NUM_PINS ? analogLevel[pin] : 0;
+}
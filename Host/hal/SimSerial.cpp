@@ -0,0 +1,188 @@
+#include "Arduino.h"
+
+SimSerial::SimSerial()
+  : bytesSent(0), bytesReceived(0), bytesDropped(0),
+    rxBufferSize(SIM_SERIAL_BUFFER_SIZE), txBufferSize(SIM_SERIAL_BUFFER_SIZE),
+    peer(0), baud(9600), lineFreeAt(0)
+{
+}
+
+void SimSerial::begin(long _baud)
+{
+  baud = _baud;
+  bytesSent = bytesReceived = bytesDropped = 0;
+  clear();
+}
+
+void SimSerial::end()
+{
+  clear();
+}
+
+void SimSerial::connect(SimSerial &a, SimSerial &b)
+{
+  a.peer = &b;
+  b.peer = &a;
+}
+
+void SimSerial::disconnect()
+{
+  if (peer)
+    peer->peer = 0;
+  peer = 0;
+}
+
+unsigned long SimSerial::charTime() const
+{
+  // start bit, 8 data bits and a stop bit, rounded up
+  return (10000000UL + baud - 1) / baud;
+}
+
+// Move every byte whose stop bit has been sent into the peer's RX buffer.
+void SimSerial::deliver()
+{
+  unsigned long long now = hal::now();
+  unsigned long t = charTime();
+
+  while (!tx.empty() && tx.front().time + t <= now)
+  {
+    Byte b = tx.front();
+    tx.pop_front();
+    b.time += t;
+    bytesSent++;
+
+    if (!peer)
+      continue;
+
+    if (peer->rx.size() < peer->rxBufferSize)
+    {
+      peer->rx.push_back(b);
+      peer->bytesReceived++;
+    }
+    else
+      peer->bytesDropped++;
+  }
+}
+
+int SimSerial::available()
+{
+  if (peer)
+    peer->deliver();
+  return rx.size();
+}
+
+int SimSerial::read()
+{
+  if (!available())
+    return -1;
+  int value = rx.front().value;
+  rx.pop_front();
+  return value;
+}
+
+int SimSerial::peek()
+{
+  if (!available())
+    return -1;
+  return rx.front().value;
+}
+
+unsigned long long SimSerial::rxTimestamp()
+{
+  if (!available())
+    return 0;
+  return rx.front().time;
+}
+
+int SimSerial::availableForWrite()
+{
+  deliver();
+  if (txBufferSize == 0)
+    return 0;
+
+  // bytes still waiting for the shifter occupy the ring buffer,
+  // one slot is always kept free like HardwareSerial does
+  unsigned long long now = hal::now();
+  size_t waiting = 0;
+  for (size_t i = 0; i < tx.size(); i++)
+    if (tx[i].time > now)
+      waiting++;
+  return txBufferSize - 1 - waiting;
+}
+
+size_t SimSerial::write(uint8_t value)
+{
+  // block until there is room in the TX ring buffer
+  while (txBufferSize > 0 && availableForWrite() <= 0)
+  {
+    unsigned long long now = hal::now();
+    for (size_t i = 0; i < tx.size(); i++)
+      if (tx[i].time > now)
+      {
+        hal::advance(tx[i].time - now);
+        break;
+      }
+  }
+
+  unsigned long long now = hal::now();
+  Byte b;
+  b.value = value;
+  b.time = lineFreeAt > now ? lineFreeAt : now;
+  lineFreeAt = b.time + charTime();
+  tx.push_back(b);
+
+  // unbuffered, the byte is bit banged before write() returns
+  if (txBufferSize == 0)
+    flush();
+  return 1;
+}
+
+void SimSerial::flush()
+{
+  unsigned long long now = hal::now();
+  if (lineFreeAt > now)
+    hal::advance(lineFreeAt - now);
+  deliver();
+}
+
+void SimSerial::holdUntil(unsigned long long t)
+{
+  if (t > lineFreeAt)
+    lineFreeAt = t;
+}
+
+unsigned long long SimSerial::txDoneAt() const
+{
+  return lineFreeAt;
+}
+
+bool SimSerial::txIdle()
+{
+  deliver();
+  return tx.empty();
+}
+
+void SimSerial::receive(const uint8_t *data, size_t length)
+{
+  unsigned long long now = hal::now();
+  for (size_t i = 0; i < length; i++)
+  {
+    if (rx.size() < rxBufferSize)
+    {
+      Byte b;
+      b.value = data[i];
+      b.time = now;
+      rx.push_back(b);
+      bytesReceived++;
+    }
+    else
+      bytesDropped++;
+  }
+}
+
+void SimSerial::clear()
+{
+  tx.clear();
+  rx.clear();
+  lineFreeAt = hal::now();
+}
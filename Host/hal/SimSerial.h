@@ -0,0 +1,92 @@
+/*
+ SimSerial.h - Simulated UART for the host HAL.
+
+ Two SimSerial ports are wired back to back with connect(). Each byte
+ written occupies the line for 10 bit times at the configured baud rate
+ and only becomes available() on the peer once its stop bit has been
+ sent, so the receiver sees the same timing it would on a real RS-485
+ line. Like the Arduino HardwareSerial both directions have a bounded
+ ring buffer: write() blocks (advances the virtual clock) while the TX
+ buffer is full, and bytes that arrive to a full RX buffer are dropped.
+
+ Setting txBufferSize to 0 turns the port into a SoftwareSerial: every
+ write() sends its byte before returning and availableForWrite() is 0.
+*/
+
+#ifndef SIM_SERIAL_H
+#define SIM_SERIAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <deque>
+
+#include "Stream.h"
+
+#define SIM_SERIAL_BUFFER_SIZE 64
+
+class SimSerial : public Stream
+{
+  public:
+    SimSerial();
+
+    // Arduino Stream interface
+    void begin(long baud);
+    void end();
+    int available();
+    int read();
+    int peek();
+    size_t write(uint8_t value);
+    using Stream::write;
+    int availableForWrite();
+    void flush();
+
+    // wire two ports together, anything written on one is received by the other
+    static void connect(SimSerial &a, SimSerial &b);
+    // and apart again, the port and its peer
+    void disconnect();
+
+    // microseconds one 10 bit character occupies the line
+    unsigned long charTime() const;
+
+    // virtual time at which the last byte written has left the shifter
+    unsigned long long txDoneAt() const;
+
+    // true once every byte written has been sent
+    bool txIdle();
+
+    // don't start sending anything written from now on before virtual time t
+    void holdUntil(unsigned long long t);
+
+    // virtual time at which the next unread byte arrived, 0 if none is waiting
+    unsigned long long rxTimestamp();
+
+    // bytes from outside the simulation, a replayed capture for example,
+    // arrive now as if they had come over the line
+    void receive(const uint8_t *data, size_t length);
+
+    // drop everything in flight and in both buffers
+    void clear();
+
+    // statistics since begin()
+    unsigned long bytesSent, bytesReceived, bytesDropped;
+
+    // ring buffer sizes, default SIM_SERIAL_BUFFER_SIZE
+    size_t rxBufferSize, txBufferSize;
+
+  private:
+    struct Byte
+    {
+      uint8_t value;
+      unsigned long long time; // start of transmission when queued, arrival when received
+    };
+
+    void deliver();
+
+    SimSerial *peer;
+    long baud;
+    unsigned long long lineFreeAt;
+    std::deque<Byte> tx; // bytes written but not yet completely sent
+    std::deque<Byte> rx; // bytes received and waiting to be read
+};
+
+#endif
@@ -0,0 +1,35 @@
+/*
+ Stream.h - Host stand-in for the Arduino Stream/Print interface.
+
+ Only the members the libraries in this repository use are declared. Any
+ serial backend of the host HAL derives from it so a library can be
+ pointed at a simulated or a real port alike.
+*/
+
+#ifndef HOST_STREAM_H
+#define HOST_STREAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+class Stream
+{
+  public:
+    virtual ~Stream() {}
+
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+    virtual size_t write(uint8_t value) = 0;
+    virtual size_t write(const uint8_t *data, size_t length)
+    {
+      for (size_t i = 0; i < length; i++)
+        write(data[i]);
+      return length;
+    }
+    // like Print::availableForWrite(), 0 when the port cannot tell
+    virtual int availableForWrite() { return 0; }
+    virtual void flush() = 0;
+};
+
+#endif
@@ -0,0 +1,119 @@
+#include "Arduino.h"
+#include "Wire.h"
+
+TwoWire Wire;
+
+TwoWire::TwoWire()
+  : transfers(0), busTime(0), clock(100000), txAddress(0), txLength(0),
+    rxLength(0), rxIndex(0)
+{
+  for (int i = 0; i < 128; i++)
+    devices[i] = 0;
+}
+
+void TwoWire::begin()
+{
+  txLength = 0;
+  rxLength = 0;
+  rxIndex = 0;
+}
+
+void TwoWire::setClock(uint32_t frequency)
+{
+  if (frequency)
+    clock = frequency;
+}
+
+void TwoWire::attach(uint8_t address, I2CDevice *device)
+{
+  devices[address & 0x7F] = device;
+}
+
+// Blocks for the time the address byte and the given number of data
+// bytes take on the bus.
+void TwoWire::transfer(size_t bytes)
+{
+  unsigned long long clocks = (bytes + 1) * 9 + 2;
+  unsigned long long us = (clocks * 1000000 + clock - 1) / clock;
+  hal::advance(us);
+  busTime += us;
+  transfers++;
+}
+
+void TwoWire::beginTransmission(uint8_t address)
+{
+  txAddress = address & 0x7F;
+  txLength = 0;
+}
+
+size_t TwoWire::write(uint8_t value)
+{
+  if (txLength == WIRE_BUFFER_LENGTH)
+    return 0;
+  txBuffer[txLength++] = value;
+  return 1;
+}
+
+size_t TwoWire::write(const uint8_t *data, size_t length)
+{
+  for (size_t i = 0; i < length; i++)
+    if (!write(data[i]))
+      return i;
+  return length;
+}
+
+uint8_t TwoWire::endTransmission(uint8_t)
+{
+  I2CDevice *device = devices[txAddress];
+  uint8_t length = txLength;
+  txLength = 0;
+
+  // without an acknowledge the master stops after the address byte
+  if (!device)
+  {
+    transfer(0);
+    return 2;
+  }
+
+  transfer(length);
+  device->receive(txBuffer, length);
+  return 0;
+}
+
+uint8_t TwoWire::requestFrom(uint8_t address, uint8_t quantity)
+{
+  I2CDevice *device = devices[address & 0x7F];
+  if (quantity > WIRE_BUFFER_LENGTH)
+    quantity = WIRE_BUFFER_LENGTH;
+
+  rxIndex = 0;
+  rxLength = 0;
+  if (!device)
+  {
+    transfer(0);
+    return 0;
+  }
+
+  transfer(quantity);
+  rxLength = device->request(rxBuffer, quantity);
+  return rxLength;
+}
+
+int TwoWire::available()
+{
+  return rxLength - rxIndex;
+}
+
+int TwoWire::read()
+{
+  if (rxIndex == rxLength)
+    return -1;
+  return rxBuffer[rxIndex++];
+}
+
+int TwoWire::peek()
+{
+  if (rxIndex == rxLength)
+    return -1;
+  return rxBuffer[rxIndex];
+}
@@ -0,0 +1,74 @@
+/*
+ Wire.h - Host stand-in for the Arduino Wire (TWI/I2C master) library.
+
+ Devices are simulated in software and attached to the bus at their
+ 7 bit address with Wire.attach(). Like the AVR implementation every call
+ blocks until the transfer is over, here by moving the virtual clock on
+ by the time the bytes take on the bus at the configured clock rate
+ (100 kHz unless setClock() is called): 9 clocks per byte including the
+ address byte, plus one each for the start and stop conditions.
+
+ endTransmission() returns 2 (address NACK) when nothing is attached at
+ the address and requestFrom() returns 0 bytes.
+*/
+
+#ifndef HOST_WIRE_H
+#define HOST_WIRE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define WIRE_BUFFER_LENGTH 32
+
+// A device on the simulated I2C bus
+class I2CDevice
+{
+  public:
+    virtual ~I2CDevice() {}
+
+    // the master wrote length bytes in one transmission
+    virtual void receive(const uint8_t *data, size_t length) = 0;
+
+    // the master reads length bytes, returns how many the device sent
+    virtual size_t request(uint8_t *data, size_t length) = 0;
+};
+
+class TwoWire
+{
+  public:
+    TwoWire();
+
+    // Arduino Wire interface
+    void begin();
+    void setClock(uint32_t frequency);
+    void beginTransmission(uint8_t address);
+    size_t write(uint8_t value);
+    size_t write(const uint8_t *data, size_t length);
+    uint8_t endTransmission(uint8_t sendStop = 1);
+    uint8_t requestFrom(uint8_t address, uint8_t quantity);
+    int available();
+    int read();
+    int peek();
+
+    // put a simulated device on the bus, 0 takes it off again
+    void attach(uint8_t address, I2CDevice *device);
+
+    unsigned long transfers; // transmissions and requests on the bus
+    unsigned long long busTime; // microseconds spent in transfers
+
+  private:
+    void transfer(size_t bytes);
+
+    I2CDevice *devices[128];
+    uint32_t clock;
+    uint8_t txAddress;
+    uint8_t txBuffer[WIRE_BUFFER_LENGTH];
+    uint8_t txLength;
+    uint8_t rxBuffer[WIRE_BUFFER_LENGTH];
+    uint8_t rxLength;
+    uint8_t rxIndex;
+};
+
+extern TwoWire Wire;
+
+#endif
@@ -0,0 +1,193 @@
+#include "LinuxSerial.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/serial.h>
+
+LinuxSerial::LinuxSerial()
+  : bytesSent(0), bytesReceived(0), reads(0), handle(-1), kernelRs485(false), rxHead(0), rxTail(0)
+{
+}
+
+LinuxSerial::~LinuxSerial()
+{
+  end();
+}
+
+static speed_t speedOf(long baud)
+{
+  switch (baud)
+  {
+    case 1200: return B1200;
+    case 2400: return B2400;
+    case 4800: return B4800;
+    case 9600: return B9600;
+    case 19200: return B19200;
+    case 38400: return B38400;
+    case 57600: return B57600;
+    case 115200: return B115200;
+    case 230400: return B230400;
+    case 460800: return B460800;
+    case 500000: return B500000;
+    case 921600: return B921600;
+    case 1000000: return B1000000;
+  }
+  return B0;
+}
+
+bool LinuxSerial::begin(const char *path, long baud, bool rs485)
+{
+  int fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if (fd < 0)
+    return false;
+  return begin(fd, baud, rs485);
+}
+
+bool LinuxSerial::begin(int fd, long baud, bool rs485)
+{
+  end();
+  handle = fd;
+  fcntl(handle, F_SETFL, fcntl(handle, F_GETFL, 0) | O_NONBLOCK);
+
+  speed_t speed = speedOf(baud);
+  struct termios tio;
+  if (speed == B0 || tcgetattr(handle, &tio) < 0)
+  {
+    end();
+    return false;
+  }
+
+  // raw bytes, 8N1, reads return whatever has arrived
+  cfmakeraw(&tio);
+  tio.c_cflag &= ~(CSTOPB | PARENB | CRTSCTS);
+  tio.c_cflag |= CS8 | CLOCAL | CREAD;
+  tio.c_cc[VMIN] = 0;
+  tio.c_cc[VTIME] = 0;
+  cfsetispeed(&tio, speed);
+  cfsetospeed(&tio, speed);
+  if (tcsetattr(handle, TCSANOW, &tio) < 0)
+  {
+    end();
+    return false;
+  }
+  tcflush(handle, TCIOFLUSH);
+
+  // RTS high while sending, low as soon as the last stop bit is out
+  kernelRs485 = false;
+  if (rs485)
+  {
+    struct serial_rs485 conf = serial_rs485();
+    conf.flags = SER_RS485_ENABLED | SER_RS485_RTS_ON_SEND;
+    conf.delay_rts_before_send = 0;
+    conf.delay_rts_after_send = 0;
+    kernelRs485 = ioctl(handle, TIOCSRS485, &conf) == 0;
+  }
+
+  rxHead = rxTail = 0;
+  bytesSent = bytesReceived = reads = 0;
+  return true;
+}
+
+void LinuxSerial::end()
+{
+  if (handle >= 0)
+    close(handle);
+  handle = -1;
+  kernelRs485 = false;
+  rxHead = rxTail = 0;
+}
+
+int LinuxSerial::fd() const
+{
+  return handle;
+}
+
+bool LinuxSerial::rs485() const
+{
+  return kernelRs485;
+}
+
+// moves what the kernel has received into rx[], only when rx[] is empty so
+// that it never has to wrap
+void LinuxSerial::fill()
+{
+  if (rxHead != rxTail || handle < 0)
+    return;
+
+  rxHead = rxTail = 0;
+  ssize_t n = ::read(handle, rx, sizeof(rx));
+  reads++;
+  if (n > 0)
+  {
+    rxTail = n;
+    bytesReceived += n;
+  }
+}
+
+int LinuxSerial::available()
+{
+  fill();
+  return rxTail - rxHead;
+}
+
+int LinuxSerial::read()
+{
+  fill();
+  return rxHead == rxTail ? -1 : rx[rxHead++];
+}
+
+int LinuxSerial::peek()
+{
+  fill();
+  return rxHead == rxTail ? -1 : rx[rxHead];
+}
+
+size_t LinuxSerial::write(uint8_t value)
+{
+  return write(&value, 1);
+}
+
+size_t LinuxSerial::write(const uint8_t *data, size_t length)
+{
+  size_t written = 0;
+
+  // the master only writes what availableForWrite() offered, a full queue
+  // is waited out rather than losing part of a frame
+  while (handle >= 0 && written < length)
+  {
+    ssize_t n = ::write(handle, data + written, length - written);
+    if (n > 0)
+      written += n;
+    else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    {
+      struct pollfd out = { handle, POLLOUT, 0 };
+      ::poll(&out, 1, 100);
+    }
+    else if (n < 0 && errno != EINTR)
+      break;
+  }
+
+  bytesSent += written;
+  return written;
+}
+
+int LinuxSerial::availableForWrite()
+{
+  if (handle < 0)
+    return 0;
+
+  int queued = 0;
+  if (ioctl(handle, TIOCOUTQ, &queued) < 0)
+    queued = 0;
+  return queued < LINUX_SERIAL_TX_ROOM ? LINUX_SERIAL_TX_ROOM - queued : 0;
+}
+
+void LinuxSerial::flush()
+{
+  if (handle >= 0)
+    tcdrain(handle);
+}
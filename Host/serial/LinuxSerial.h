@@ -0,0 +1,72 @@
+/*
+ LinuxSerial.h - a real serial port for the host HAL, a /dev/tty* opened
+ with termios, so SimpleModbusMaster can drive an RS-485 line from a
+ Linux gateway.
+
+ The port is raw 8N1 and non-blocking. available() and read() take what
+ the kernel has received, write() hands bytes to the kernel's TX queue
+ and availableForWrite() tells how much of LINUX_SERIAL_TX_ROOM is free,
+ so the master sends in the background as it does on a HardwareSerial.
+
+ With rs485 the kernel's RS-485 mode (TIOCSRS485) raises RTS while the
+ UART sends and drops it after the last stop bit, which drives the
+ transceiver's DE/RE pins without the TxEnablePin of the master and the
+ microsecond timing that needs. Configure the master with a TxEnablePin
+ below 2. A port whose driver has no RS-485 mode, a USB adapter that
+ switches by itself or a pty, works all the same and rs485() tells
+ which. The termios VTIME inter-character timer counts in tenths of a
+ second, far too coarse for Modbus frames, so framing is left to the
+ master's frame delay and SerialEventLoop wakes it with a timerfd.
+
+ millis() and micros() have to run in real time, see hal::realTime().
+*/
+
+#ifndef LINUX_SERIAL_H
+#define LINUX_SERIAL_H
+
+#include "Arduino.h"
+
+#define LINUX_SERIAL_RX_SIZE 512
+#define LINUX_SERIAL_TX_ROOM 256 // bytes of the kernel's TX queue the port offers
+
+class LinuxSerial : public Stream
+{
+  public:
+    LinuxSerial();
+    ~LinuxSerial();
+
+    // open path at baud, 8N1, with the kernel driving the transceiver if
+    // rs485, false if the port can't be opened or doesn't take the baud rate
+    bool begin(const char *path, long baud, bool rs485 = true);
+    // the same for a descriptor that is already open, a pty for example,
+    // the port closes it in end()
+    bool begin(int fd, long baud, bool rs485 = true);
+    void end();
+
+    int fd() const;
+    bool rs485() const; // the kernel drives the transceiver
+
+    // Arduino Stream interface
+    int available();
+    int read();
+    int peek();
+    size_t write(uint8_t value);
+    size_t write(const uint8_t *data, size_t length);
+    using Stream::write;
+    int availableForWrite();
+    void flush();
+
+    // statistics since begin()
+    unsigned long bytesSent, bytesReceived;
+    unsigned long reads; // read() system calls, including those that found nothing
+
+  private:
+    void fill();
+
+    int handle;
+    bool kernelRs485;
+    unsigned char rx[LINUX_SERIAL_RX_SIZE];
+    unsigned int rxHead, rxTail; // rx[rxHead] is the next byte, rx[rxTail] the first free one
+};
+
+#endif
@@ -0,0 +1,133 @@
+#include "SerialEventLoop.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+#define MAX_EVENTS 64
+
+SerialEventLoop::SerialEventLoop()
+  : rounds(0), wakeups(0), epollFd(-1), timerFd(-1), stopFd(-1), update(0), context(0)
+{
+}
+
+SerialEventLoop::~SerialEventLoop()
+{
+  if (epollFd >= 0)
+    close(epollFd);
+  if (timerFd >= 0)
+    close(timerFd);
+  if (stopFd >= 0)
+    close(stopFd);
+}
+
+// the timer and stop() are told apart from the lines by their addresses,
+// a line's event carries nothing, the ports read their own bytes
+bool SerialEventLoop::open()
+{
+  if (epollFd >= 0)
+    return true;
+
+  epollFd = epoll_create1(0);
+  timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+  stopFd = eventfd(0, EFD_NONBLOCK);
+  if (epollFd < 0 || timerFd < 0 || stopFd < 0)
+    return false;
+
+  struct epoll_event event;
+  event.events = EPOLLIN;
+  event.data.ptr = &timerFd;
+  epoll_ctl(epollFd, EPOLL_CTL_ADD, timerFd, &event);
+  event.data.ptr = &stopFd;
+  epoll_ctl(epollFd, EPOLL_CTL_ADD, stopFd, &event);
+  return true;
+}
+
+bool SerialEventLoop::add(ModbusPort *port, LinuxSerial *line)
+{
+  if (!open())
+    return false;
+
+  // edge triggered, bytes that arrive while the master isn't waiting for a
+  // response stay unread and would wake the loop again and again
+  struct epoll_event event;
+  event.events = EPOLLIN | EPOLLET;
+  event.data.ptr = 0;
+  if (epoll_ctl(epollFd, EPOLL_CTL_ADD, line->fd(), &event) < 0)
+    return false;
+
+  ports.push_back(port);
+  return true;
+}
+
+void SerialEventLoop::onUpdate(void (*_update)(void *context), void *_context)
+{
+  update = _update;
+  context = _context;
+}
+
+void SerialEventLoop::stop()
+{
+  uint64_t one = 1;
+  if (write(stopFd, &one, sizeof(one)) < 0)
+    return;
+}
+
+void SerialEventLoop::run()
+{
+  struct epoll_event events[MAX_EVENTS];
+
+  for (;;)
+  {
+    // an update can make another one due straight away, the request that
+    // follows a response for example, so update until every port sleeps
+    unsigned long idle;
+    do
+    {
+      idle = MODBUS_IDLE_MAX;
+      for (size_t i = 0; i < ports.size(); i++)
+        modbus_port_update(ports[i]);
+      if (update)
+        update(context);
+      for (size_t i = 0; i < ports.size() && idle; i++)
+      {
+        unsigned long portIdle = modbus_port_idle(ports[i]);
+        if (portIdle < idle)
+          idle = portIdle;
+      }
+      rounds++;
+    } while (!idle);
+
+    struct itimerspec timer;
+    memset(&timer, 0, sizeof(timer));
+    timer.it_value.tv_sec = idle / 1000000;
+    timer.it_value.tv_nsec = (idle % 1000000) * 1000;
+    timerfd_settime(timerFd, 0, &timer, 0);
+
+    int n = epoll_wait(epollFd, events, MAX_EVENTS, -1);
+    if (n < 0 && errno != EINTR)
+      return;
+    wakeups++;
+
+    for (int i = 0; i < n; i++)
+    {
+      if (events[i].data.ptr == &timerFd)
+      {
+        uint64_t expirations;
+        if (read(timerFd, &expirations, sizeof(expirations)) < 0)
+          continue;
+      }
+      else if (events[i].data.ptr == &stopFd)
+      {
+        uint64_t value;
+        if (read(stopFd, &value, sizeof(value)) < 0)
+          continue;
+        return;
+      }
+    }
+  }
+}
@@ -0,0 +1,68 @@
+/*
+ SerialEventLoop.h - drives any number of SimpleModbusMaster ports on
+ LinuxSerial lines from one thread that sleeps in between.
+
+ A sketch calls modbus_port_update() for every port in loop() as fast as
+ it can, which on a Linux host keeps a core busy for a line that is
+ silent most of the time. Here every port's descriptor is in one epoll
+ set together with a timerfd. After updating the ports the loop asks
+ each one with modbus_port_idle() how long it has nothing to do, arms
+ the timer for the shortest of these and waits until it expires or a
+ byte arrives on any line. The timerfd counts in nanoseconds, the frame
+ delays and time outs of the master are kept to within the scheduling
+ latency of the host.
+
+   LinuxSerial line1, line2;
+   ModbusPort port1, port2;
+   hal::realTime();
+   line1.begin("/dev/ttyS1", 19200);
+   modbus_port_configure(&port1, &line1, 19200, 1000, 10, 3, 0, packets1, 8);
+   ...
+   SerialEventLoop loop;
+   loop.add(&port1, &line1);
+   loop.add(&port2, &line2);
+   loop.run(); // until stop() from another thread
+
+ Only the thread running the loop may touch the ports, a callback given
+ to onUpdate() is called there after every round of updates.
+*/
+
+#ifndef SERIAL_EVENT_LOOP_H
+#define SERIAL_EVENT_LOOP_H
+
+#include <vector>
+
+#include "LinuxSerial.h"
+#include "SimpleModbusMaster.h"
+
+class SerialEventLoop
+{
+  public:
+    SerialEventLoop();
+    ~SerialEventLoop();
+
+    // poll the packets of port on line, false if epoll or the timer failed
+    bool add(ModbusPort *port, LinuxSerial *line);
+
+    // called after the ports have been updated, from the loop's thread
+    void onUpdate(void (*update)(void *context), void *context);
+
+    // update and sleep until stop() is called, from another thread if needed
+    void run();
+    void stop();
+
+    unsigned long rounds; // of updates
+    unsigned long wakeups; // by a byte, the timer or stop()
+
+  private:
+    bool open();
+
+    int epollFd;
+    int timerFd;
+    int stopFd;
+    std::vector<ModbusPort *> ports;
+    void (*update)(void *context);
+    void *context;
+};
+
+#endif
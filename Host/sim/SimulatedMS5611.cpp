@@ -0,0 +1,101 @@
+#include "SimulatedMS5611.h"
+
+// datasheet example values, C1..C6 at PROM words 1 to 6
+static const uint16_t exampleProm[6] = { 40127, 36924, 23317, 23282, 33464, 28312 };
+
+SimulatedMS5611::SimulatedMS5611()
+  : conversions(0), earlyReads(0), interrupted(0), d1Index(0), d2Index(0),
+    command(0), converting(false), conversionDone(0), result(0)
+{
+  prom[0] = 0;
+  prom[7] = 0;
+  setPROM(exampleProm);
+  script(std::vector<uint32_t>(1, 9085466), std::vector<uint32_t>(1, 8569150));
+}
+
+void SimulatedMS5611::script(const std::vector<uint32_t> &d1, const std::vector<uint32_t> &d2)
+{
+  d1Script = d1;
+  d2Script = d2;
+  d1Index = d2Index = 0;
+}
+
+void SimulatedMS5611::setPROM(const uint16_t c[6])
+{
+  for (int i = 0; i < 6; i++)
+    prom[i + 1] = c[i];
+}
+
+unsigned long SimulatedMS5611::conversionTime(uint8_t OSR)
+{
+  switch (OSR)
+  {
+    case 0x00: return 600;
+    case 0x02: return 1170;
+    case 0x04: return 2280;
+    case 0x06: return 4540;
+    default: return 9040;
+  }
+}
+
+void SimulatedMS5611::receive(const uint8_t *data, size_t length)
+{
+  if (length == 0)
+    return;
+
+  if (converting && hal::now() < conversionDone)
+    interrupted++;
+
+  command = data[0];
+
+  if ((command & 0xF0) == 0x40 || (command & 0xF0) == 0x50)
+  {
+    // D1 (pressure) or D2 (temperature) conversion
+    std::vector<uint32_t> &values = (command & 0xF0) == 0x40 ? d1Script : d2Script;
+    size_t &index = (command & 0xF0) == 0x40 ? d1Index : d2Index;
+
+    result = values.empty() ? 0 : values[index];
+    if (!values.empty())
+      index = (index + 1) % values.size();
+
+    converting = true;
+    conversionDone = hal::now() + conversionTime(command & 0x0F);
+    conversions++;
+  }
+  else if (command == 0x1E)
+  {
+    converting = false;
+    result = 0;
+  }
+}
+
+size_t SimulatedMS5611::request(uint8_t *data, size_t length)
+{
+  if (command == 0x00)
+  {
+    // ADC read, 0 until the conversion has finished and after it was read
+    uint32_t value = 0;
+    if (converting && hal::now() >= conversionDone)
+    {
+      value = result;
+      converting = false;
+    }
+    else
+      earlyReads++;
+    result = 0;
+
+    for (size_t i = 0; i < length; i++)
+      data[i] = i < 3 ? (value >> (16 - 8 * i)) & 0xFF : 0xFF;
+    return length;
+  }
+
+  if ((command & 0xF0) == 0xA0)
+  {
+    uint16_t word = prom[(command >> 1) & 0x07];
+    for (size_t i = 0; i < length; i++)
+      data[i] = i < 2 ? (word >> (8 - 8 * i)) & 0xFF : 0xFF;
+    return length;
+  }
+
+  return 0;
+}
@@ -0,0 +1,53 @@
+/*
+ SimulatedMS5611.h - MS5611-01BA barometric pressure sensor on the host
+ I2C bus, for running the MS561101BA library against a scripted device.
+
+ The device answers the reset, PROM read, D1/D2 conversion and ADC read
+ commands of the datasheet. A conversion takes the datasheet's maximum
+ time for its OSR and an ADC read before it has finished returns 0 like
+ the real part does. Conversion results come from a script of raw D1/D2
+ values that is played back in a loop, by default the datasheet example
+ of 20.07 C and 1000.09 mbar.
+*/
+
+#ifndef SIMULATED_MS5611_H
+#define SIMULATED_MS5611_H
+
+#include <vector>
+
+#include "Arduino.h"
+#include "Wire.h"
+
+class SimulatedMS5611 : public I2CDevice
+{
+  public:
+    SimulatedMS5611();
+
+    // the raw readings the conversions return, one D1/D2 pair per sample
+    void script(const std::vector<uint32_t> &d1, const std::vector<uint32_t> &d2);
+
+    // factory calibration C1..C6
+    void setPROM(const uint16_t c[6]);
+
+    // microseconds a conversion with the given OSR (0, 2, 4, 6 or 8) takes
+    static unsigned long conversionTime(uint8_t OSR);
+
+    // I2CDevice
+    void receive(const uint8_t *data, size_t length);
+    size_t request(uint8_t *data, size_t length);
+
+    unsigned long conversions; // D1 and D2 conversions started
+    unsigned long earlyReads; // ADC reads with no finished conversion to return
+    unsigned long interrupted; // commands sent while a conversion was running
+
+  private:
+    uint16_t prom[8];
+    std::vector<uint32_t> d1Script, d2Script;
+    size_t d1Index, d2Index;
+    uint8_t command; // last command, tells request() what to send
+    bool converting;
+    unsigned long long conversionDone; // virtual time the result is ready
+    uint32_t result; // of the last conversion, 0 once read
+};
+
+#endif
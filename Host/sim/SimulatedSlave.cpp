@@ -0,0 +1,286 @@
+#include "SimulatedSlave.h"
+#include "ModbusCRC.h"
+#include "ModbusRegisters.h"
+
+SimulatedSlave::SimulatedSlave()
+  : turnaround(0), framesAnswered(0), framesIgnored(0),
+    units(248), rxLength(0), lastByte(0), T3_5(1750)
+{
+  // the slave never makes the line wait, its TX buffer takes any response
+  port.txBufferSize = 512;
+  port.rxBufferSize = 512;
+}
+
+void SimulatedSlave::begin(long baud)
+{
+  port.begin(baud);
+  T3_5 = baud > 19200 ? 1750 : 35000000 / baud;
+  rxLength = 0;
+  framesAnswered = framesIgnored = 0;
+}
+
+void SimulatedSlave::addUnit(unsigned char id, unsigned int no_of_registers)
+{
+  units[id].present = true;
+  units[id].alive = true;
+  units[id].regs.assign(no_of_registers, 0);
+}
+
+unsigned int *SimulatedSlave::registers(unsigned char id)
+{
+  return units[id].regs.empty() ? 0 : &units[id].regs[0];
+}
+
+void SimulatedSlave::addBits(unsigned char id, unsigned int no_of_coils, unsigned int no_of_inputs)
+{
+  units[id].coils.assign((no_of_coils + 7) / 8, 0);
+  units[id].inputs.assign((no_of_inputs + 7) / 8, 0);
+  units[id].no_of_coils = no_of_coils;
+  units[id].no_of_inputs = no_of_inputs;
+}
+
+unsigned char *SimulatedSlave::coils(unsigned char id)
+{
+  return units[id].coils.empty() ? 0 : &units[id].coils[0];
+}
+
+unsigned char *SimulatedSlave::inputs(unsigned char id)
+{
+  return units[id].inputs.empty() ? 0 : &units[id].inputs[0];
+}
+
+void SimulatedSlave::setAlive(unsigned char id, bool alive)
+{
+  units[id].alive = alive;
+}
+
+void SimulatedSlave::setDelay(unsigned char id, unsigned long delay)
+{
+  units[id].delay = delay;
+}
+
+void SimulatedSlave::setGap(unsigned char id, unsigned long gap)
+{
+  units[id].gap = gap;
+}
+
+void SimulatedSlave::setFrameDelay(unsigned long frameDelay)
+{
+  T3_5 = frameDelay;
+}
+
+void SimulatedSlave::poll()
+{
+  while (port.available())
+  {
+    lastByte = port.rxTimestamp();
+    unsigned char value = port.read();
+    if (rxLength < sizeof(frame))
+      frame[rxLength] = value;
+    rxLength++;
+  }
+
+  if (rxLength && hal::now() >= lastByte + T3_5)
+  {
+    unsigned int length = rxLength;
+    rxLength = 0;
+    if (length <= sizeof(frame))
+      process(length);
+    else
+      framesIgnored++;
+  }
+}
+
+void SimulatedSlave::process(unsigned int length)
+{
+  if (length < 4 || modbus_crc16(frame, length - 2) != (unsigned int)((frame[length - 2] << 8) | frame[length - 1]))
+  {
+    framesIgnored++;
+    return;
+  }
+
+  unsigned char id = frame[0];
+  unsigned char function = frame[1];
+  unsigned int address = (frame[2] << 8) | frame[3];
+  unsigned int count = (frame[4] << 8) | frame[5];
+
+  // a broadcast write goes to every unit and is never answered
+  if (id == 0)
+  {
+    for (unsigned int u = 1; u < units.size(); u++)
+    {
+      std::vector<unsigned int> &regs = units[u].regs;
+      if (!units[u].present || !units[u].alive)
+        continue;
+      if (function == 6 && address < regs.size())
+        regs[address] = count;
+      if (function == 16 && address + count <= regs.size())
+        for (unsigned int i = 0; i < count; i++)
+          regs[address + i] = (frame[7 + i * 2] << 8) | frame[8 + i * 2];
+      if (function == 5 && address < units[u].no_of_coils)
+        modbus_set_bit(&units[u].coils[0], address, count == 0xFF00);
+      if (function == 15 && count && address + count <= units[u].no_of_coils)
+        modbus_unpack_bits(&units[u].coils[0], address, &frame[7], count);
+    }
+    return;
+  }
+
+  if (!units[id].present || !units[id].alive)
+  {
+    framesIgnored++;
+    return;
+  }
+
+  std::vector<unsigned int> &regs = units[id].regs;
+
+  switch (function)
+  {
+    case 3:
+      if (count == 0 || count > 125)
+        exception(function, 3);
+      else if (address + count > regs.size())
+        exception(function, 2);
+      else
+      {
+        frame[2] = count * 2;
+        for (unsigned int i = 0; i < count; i++)
+        {
+          frame[3 + i * 2] = regs[address + i] >> 8;
+          frame[4 + i * 2] = regs[address + i] & 0xFF;
+        }
+        respond(3 + count * 2);
+      }
+      break;
+
+    case 6:
+      if (address >= regs.size())
+        exception(function, 2);
+      else
+      {
+        regs[address] = count;
+        respond(6);
+      }
+      break;
+
+    case 16:
+      if (count == 0 || count > 123 || frame[6] != count * 2 || length != 9 + count * 2)
+        exception(function, 3);
+      else if (address + count > regs.size())
+        exception(function, 2);
+      else
+      {
+        for (unsigned int i = 0; i < count; i++)
+          regs[address + i] = (frame[7 + i * 2] << 8) | frame[8 + i * 2];
+        respond(6);
+      }
+      break;
+
+    case 23:
+    {
+      unsigned int writeAddress = (frame[6] << 8) | frame[7];
+      unsigned int writeCount = (frame[8] << 8) | frame[9];
+      if (count == 0 || count > 125 || writeCount == 0 || writeCount > 121 ||
+          frame[10] != writeCount * 2 || length != 13 + writeCount * 2)
+        exception(function, 3);
+      else if (address + count > regs.size() || writeAddress + writeCount > regs.size())
+        exception(function, 2);
+      else
+      {
+        for (unsigned int i = 0; i < writeCount; i++)
+          regs[writeAddress + i] = (frame[11 + i * 2] << 8) | frame[12 + i * 2];
+        frame[2] = count * 2;
+        for (unsigned int i = 0; i < count; i++)
+        {
+          frame[3 + i * 2] = regs[address + i] >> 8;
+          frame[4 + i * 2] = regs[address + i] & 0xFF;
+        }
+        respond(3 + count * 2);
+      }
+      break;
+    }
+
+    case 1:
+      readBits(function, units[id].coils, units[id].no_of_coils, address, count);
+      break;
+
+    case 2:
+      readBits(function, units[id].inputs, units[id].no_of_inputs, address, count);
+      break;
+
+    case 5:
+      if (!units[id].no_of_coils)
+        exception(function, 1);
+      else if (count != 0xFF00 && count != 0)
+        exception(function, 3);
+      else if (address >= units[id].no_of_coils)
+        exception(function, 2);
+      else
+      {
+        modbus_set_bit(&units[id].coils[0], address, count != 0);
+        respond(6);
+      }
+      break;
+
+    case 15:
+      if (!units[id].no_of_coils)
+        exception(function, 1);
+      else if (count == 0 || count > 1968 || frame[6] != (count + 7) / 8 || length != 9u + frame[6])
+        exception(function, 3);
+      else if (address + count > units[id].no_of_coils)
+        exception(function, 2);
+      else
+      {
+        modbus_unpack_bits(&units[id].coils[0], address, &frame[7], count);
+        respond(6);
+      }
+      break;
+
+    default:
+      exception(function, 1);
+  }
+}
+
+void SimulatedSlave::readBits(unsigned char function, const std::vector<unsigned char> &bits,
+                              unsigned int size, unsigned int address, unsigned int count)
+{
+  if (!size)
+    exception(function, 1);
+  else if (count == 0 || count > 2000)
+    exception(function, 3);
+  else if (address + count > size)
+    exception(function, 2);
+  else
+  {
+    frame[2] = (count + 7) / 8;
+    modbus_pack_bits(&frame[3], &bits[0], address, count);
+    respond(3 + frame[2]);
+  }
+}
+
+void SimulatedSlave::exception(unsigned char function, unsigned char code)
+{
+  frame[1] = function | 0x80;
+  frame[2] = code;
+  respond(3);
+}
+
+// Appends the crc to the first length bytes of frame[] and sends them.
+void SimulatedSlave::respond(unsigned char length)
+{
+  unsigned int crc16 = modbus_crc16(frame, length);
+  frame[length] = crc16 >> 8;
+  frame[length + 1] = crc16 & 0xFF;
+
+  port.holdUntil(lastByte + T3_5 + turnaround + units[frame[0]].delay);
+  unsigned long gap = units[frame[0]].gap;
+  if (!gap)
+    port.write(frame, length + 2);
+  else
+    for (unsigned int i = 0; i < length + 2u; i++)
+    {
+      if (i)
+        port.holdUntil(port.txDoneAt() + gap);
+      port.write(frame[i]);
+    }
+  framesAnswered++;
+}
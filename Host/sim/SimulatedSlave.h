@@ -0,0 +1,88 @@
+/*
+ SimulatedSlave.h - Modbus RTU slaves on the far end of a SimSerial line,
+ for benchmarking SimpleModbusMaster on the host.
+
+ One SimulatedSlave answers for any number of unit ids on its port, each
+ with its own holding register array. Frames are delimited by a T3.5
+ silence and the response starts turnaround microseconds after that, as
+ long as poll() is called at least that often. Units can be switched off
+ to simulate a dead slave that never answers.
+
+ Functions 3, 6, 16 and 23 are answered, and functions 1, 2, 5 and 15 for
+ units that have been given coils and discrete inputs with addBits().
+ Anything else gets exception 1. A unit can be made slow to answer with
+ setDelay() and to leave pauses between the characters of its responses
+ with setGap(), as a slave with a slow CPU or a PLC scan does.
+*/
+
+#ifndef SIMULATED_SLAVE_H
+#define SIMULATED_SLAVE_H
+
+#include <vector>
+
+#include "Arduino.h"
+
+class SimulatedSlave
+{
+  public:
+    SimulatedSlave();
+
+    void begin(long baud);
+
+    // answer requests for id with a register array of the given size
+    void addUnit(unsigned char id, unsigned int no_of_registers);
+    unsigned int *registers(unsigned char id);
+
+    // coils and discrete inputs of a unit, packed 8 to a byte
+    void addBits(unsigned char id, unsigned int no_of_coils, unsigned int no_of_inputs);
+    unsigned char *coils(unsigned char id);
+    unsigned char *inputs(unsigned char id);
+
+    // a unit that is not alive never answers
+    void setAlive(unsigned char id, bool alive);
+
+    // microseconds a unit takes to answer on top of turnaround
+    void setDelay(unsigned char id, unsigned long delay);
+
+    // microseconds of silence between the characters of a unit's responses
+    void setGap(unsigned char id, unsigned long gap);
+
+    // microseconds of silence that end a request, T3.5 of the baud rate
+    // and 1750 above 19200 unless set after begin()
+    void setFrameDelay(unsigned long frameDelay);
+
+    // receive, process and answer whatever the master has sent
+    void poll();
+
+    SimSerial port;
+    unsigned long turnaround; // microseconds from end of request to response
+    unsigned long framesAnswered;
+    unsigned long framesIgnored; // dead unit, unknown id or bad crc
+
+  private:
+    struct Unit
+    {
+      Unit() : present(false), alive(false), delay(0), gap(0), no_of_coils(0), no_of_inputs(0) {}
+      bool present;
+      bool alive;
+      unsigned long delay;
+      unsigned long gap;
+      std::vector<unsigned int> regs;
+      std::vector<unsigned char> coils, inputs;
+      unsigned int no_of_coils, no_of_inputs;
+    };
+
+    void process(unsigned int length);
+    void readBits(unsigned char function, const std::vector<unsigned char> &bits,
+                  unsigned int size, unsigned int address, unsigned int count);
+    void respond(unsigned char length);
+    void exception(unsigned char function, unsigned char code);
+
+    std::vector<Unit> units;
+    unsigned char frame[256];
+    unsigned int rxLength;
+    unsigned long long lastByte;
+    unsigned long T3_5;
+};
+
+#endif
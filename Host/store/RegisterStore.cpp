@@ -0,0 +1,254 @@
+#include "RegisterStore.h"
+
+#include <algorithm>
+#include <thread>
+
+#include "SimpleModbusSlave.h"
+
+// the store modbus_update() serves
+static RegisterStore *attached;
+
+// spins on a held stripe before a writer gives up its time slice
+#define SPINS 64
+
+RegisterStore::RegisterStore(unsigned int size, unsigned int _stripeSize)
+  : retries(0), waits(0), registers(size), stripeSize(_stripeSize ? _stripeSize : 1),
+    slaveID(0), pending(false)
+{
+  unsigned int count = (registers + stripeSize - 1) / stripeSize;
+  stripes.reset(new Stripe[count ? count : 1]);
+  for (unsigned int i = 0; i < count; i++)
+  {
+    stripes[i].sequence.store(0, std::memory_order_relaxed);
+    stripes[i].writer.store(0, std::memory_order_relaxed);
+  }
+
+  // two copies of every stripe, side by side
+  regs.reset(new std::atomic<unsigned short>[2 * count * stripeSize + 1]);
+  for (unsigned int i = 0; i < 2 * count * stripeSize; i++)
+    regs[i].store(0, std::memory_order_relaxed);
+
+  image.assign(registers ? registers : 1, 0);
+  served = image;
+}
+
+RegisterStore::~RegisterStore()
+{
+  detach();
+}
+
+unsigned int RegisterStore::size() const
+{
+  return registers;
+}
+
+std::atomic<unsigned short> &RegisterStore::slot(unsigned int address, unsigned int copy) const
+{
+  unsigned int stripe = address / stripeSize;
+  return regs[(2 * stripe + copy) * stripeSize + address % stripeSize];
+}
+
+void RegisterStore::lock(unsigned int stripe)
+{
+  std::atomic<unsigned int> &writer = stripes[stripe].writer;
+  unsigned int spins = 0;
+
+  for (;;)
+  {
+    unsigned int free = 0;
+    if (!writer.load(std::memory_order_relaxed) &&
+        writer.compare_exchange_weak(free, 1, std::memory_order_acquire))
+      break;
+    if (++spins == SPINS)
+    {
+      waits.fetch_add(1, std::memory_order_relaxed);
+      std::this_thread::yield();
+      spins = 0;
+    }
+  }
+}
+
+void RegisterStore::unlock(unsigned int stripe)
+{
+  stripes[stripe].writer.store(0, std::memory_order_release);
+}
+
+// Stripes are locked from the lowest up, so two writers of overlapping
+// ranges can never hold one each of what the other one needs. The copy
+// readers are not using is brought up to date, the registers outside the
+// range from the current copy, and then the stripe switches over.
+void RegisterStore::publish(unsigned int address, const unsigned int *values, unsigned int count)
+{
+  if (address >= registers)
+    return;
+  if (count > registers - address)
+    count = registers - address;
+  if (!count)
+    return;
+
+  unsigned int first = address / stripeSize;
+  unsigned int last = (address + count - 1) / stripeSize;
+
+  for (unsigned int s = first; s <= last; s++)
+    lock(s);
+
+  // a reader that sees a register of the new copy sees every switch
+  // before it
+  std::atomic_thread_fence(std::memory_order_release);
+
+  for (unsigned int s = first; s <= last; s++)
+  {
+    unsigned int current = (stripes[s].sequence.load(std::memory_order_relaxed) >> 1) & 1;
+    const std::atomic<unsigned short> *from = &slot(s * stripeSize, current);
+    std::atomic<unsigned short> *to = &slot(s * stripeSize, current ^ 1);
+    unsigned int end = std::min((s + 1) * stripeSize, registers);
+    for (unsigned int r = s * stripeSize; r < end; r++, from++, to++)
+    {
+      unsigned int value = (r >= address && r < address + count) ? values[r - address] :
+                           from->load(std::memory_order_relaxed);
+      to->store(value, std::memory_order_relaxed);
+    }
+  }
+
+  // A write of one stripe switches it in a single step. The stripes of a
+  // wider write are held odd until all of them have switched, a reader
+  // waits that long rather than see half of it.
+  if (first == last)
+    stripes[first].sequence.fetch_add(2, std::memory_order_release);
+  else
+  {
+    for (unsigned int s = first; s <= last; s++)
+      stripes[s].sequence.fetch_add(1, std::memory_order_release);
+    for (unsigned int s = first; s <= last; s++)
+      stripes[s].sequence.fetch_add(1, std::memory_order_release);
+  }
+
+  for (unsigned int s = first; s <= last; s++)
+    unlock(s);
+}
+
+void RegisterStore::publish(unsigned int address, unsigned int value)
+{
+  publish(address, &value, 1);
+}
+
+// Sequences only ever go up, so their sum is the same before and after
+// the copy only if no stripe has switched in between. A writer that is
+// preempted half way through never holds up a reader, it is writing the
+// other copy. Only the few instructions a wide write takes to switch its
+// stripes are waited for, spinning and then yielding.
+unsigned int RegisterStore::read(unsigned int address, unsigned int *values, unsigned int count) const
+{
+  if (address >= registers)
+    return 0;
+  if (count > registers - address)
+    count = registers - address;
+  if (!count)
+    return 0;
+
+  unsigned int first = address / stripeSize;
+  unsigned int last = (address + count - 1) / stripeSize;
+  unsigned int tries = 0;
+  unsigned int spins = 0;
+
+  for (;;)
+  {
+    unsigned int before = 0;
+    bool switching = false;
+    for (unsigned int s = first; s <= last; s++)
+    {
+      unsigned int sequence = stripes[s].sequence.load(std::memory_order_acquire);
+      switching |= sequence & 1;
+      before += sequence;
+    }
+    if (switching)
+    {
+      if (++spins == SPINS)
+      {
+        std::this_thread::yield();
+        spins = 0;
+      }
+      continue;
+    }
+
+    unsigned int i = 0;
+    for (unsigned int s = first; s <= last; s++)
+    {
+      unsigned int current = (stripes[s].sequence.load(std::memory_order_relaxed) >> 1) & 1;
+      const std::atomic<unsigned short> *copy = &slot(s * stripeSize, current);
+      unsigned int offset = address + i - s * stripeSize;
+      unsigned int end = std::min((s + 1) * stripeSize, address + count);
+      for (; address + i < end; i++, offset++)
+        values[i] = copy[offset].load(std::memory_order_relaxed);
+    }
+
+    // the copy is done before the sequences are read again
+    std::atomic_thread_fence(std::memory_order_acquire);
+
+    unsigned int after = 0;
+    for (unsigned int s = first; s <= last; s++)
+      after += stripes[s].sequence.load(std::memory_order_relaxed);
+    if (after == before)
+      break;
+    tries++;
+  }
+
+  if (tries)
+    const_cast<RegisterStore *>(this)->retries.fetch_add(tries, std::memory_order_relaxed);
+  return tries;
+}
+
+void RegisterStore::attach(unsigned char _slaveID)
+{
+  slaveID = _slaveID;
+  attached = this;
+  modbus_configure_units(lookup);
+}
+
+void RegisterStore::detach()
+{
+  if (attached != this)
+    return;
+  attached = 0;
+  modbus_configure_units(0);
+}
+
+// Runs of registers the master changed are published as they were written,
+// a function 16 write reaches the store in one piece.
+unsigned int RegisterStore::update()
+{
+  unsigned int state = modbus_update(&image[0]); // the lookup hands out image
+  if (!pending)
+    return state;
+  pending = false;
+
+  unsigned int i = 0;
+  while (i < registers)
+  {
+    if (image[i] == served[i])
+    {
+      i++;
+      continue;
+    }
+    unsigned int start = i;
+    while (i < registers && image[i] != served[i])
+      i++;
+    publish(start, &image[start], i - start);
+  }
+
+  return state;
+}
+
+unsigned int *RegisterStore::lookup(unsigned char id, unsigned int *holdingRegsSize)
+{
+  RegisterStore *store = attached;
+  if (!store || !store->registers || (id != store->slaveID && id != 0))
+    return 0;
+
+  store->read(0, &store->image[0], store->registers);
+  store->served = store->image;
+  store->pending = true;
+
+  *holdingRegsSize = store->registers;
+  return &store->image[0];
+}
@@ -0,0 +1,97 @@
+/*
+ RegisterStore.h - holding registers shared between sensor acquisition
+ threads and the SimpleModbusSlave protocol loop on a Linux host.
+
+ In ModbusSlaveSimulation.ino the sensors are read and modbus_update() is
+ called one after the other in loop(), so a slow ADC read holds up the
+ responses and a burst of requests holds up the sensors. Here every sensor
+ gets a thread of its own that publish()es its registers, and the
+ protocol thread serves them without ever taking a lock.
+
+ The registers are split into stripes of consecutive registers. Every
+ stripe is kept twice and has a sequence number that says which copy is
+ current (a seqlock with two copies, sometimes called a latch). A writer
+ fills in the other copy and then bumps the sequence to switch over.
+ Writers of the same stripe wait for each other, writers of different
+ stripes never meet. A reader copies the current registers between two
+ reads of the sequences and starts over if any of them has moved, so a
+ multi-register read never sees half of a publish(), never blocks a
+ writer and is not held up by a writer that has been preempted half way
+ through. A publish() is seen all at once by every read() that covers it.
+
+ attach() serves the store as one slave through modbus_configure_units():
+ when a request arrives the slave is handed a consistent copy of all the
+ registers, and update(), called in place of modbus_update(), publishes
+ the registers a function 6, 16 or 23 request has written back to the
+ store. SimpleModbusSlave keeps its state in globals, so only one store
+ can be attached in a process and only one thread may call update().
+*/
+
+#ifndef REGISTER_STORE_H
+#define REGISTER_STORE_H
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "Arduino.h"
+
+class RegisterStore
+{
+  public:
+    // size registers, stripeSize registers to a sequence number
+    RegisterStore(unsigned int size, unsigned int stripeSize = 16);
+    ~RegisterStore();
+
+    unsigned int size() const;
+
+    // from any thread, registers past the end of the store are dropped
+    void publish(unsigned int address, const unsigned int *values, unsigned int count);
+    void publish(unsigned int address, unsigned int value);
+
+    // A consistent copy of count registers from any thread, without a lock.
+    // Returns the number of copies a publish() overlapped and that were
+    // thrown away.
+    unsigned int read(unsigned int address, unsigned int *values, unsigned int count) const;
+
+    // serve the store as slaveID through SimpleModbusSlave, after
+    // modbus_configure()
+    void attach(unsigned char slaveID);
+    void detach();
+
+    // modbus_update() and publish what the master wrote, from the protocol
+    // thread only
+    unsigned int update();
+
+    // the ModbusUnitLookup attach() installs
+    static unsigned int *lookup(unsigned char id, unsigned int *holdingRegsSize);
+
+    std::atomic<unsigned long> retries; // read() copies thrown away
+    std::atomic<unsigned long> waits; // publish() yielded to another writer of a stripe
+
+  private:
+    // a cache line each, writers of neighbouring stripes do not share one
+    struct Stripe
+    {
+      std::atomic<unsigned int> sequence; // copy (sequence >> 1) & 1 is current, odd while switching
+      std::atomic<unsigned int> writer; // 1 while a writer fills in the other copy
+      char pad[64 - 2 * sizeof(std::atomic<unsigned int>)];
+    };
+
+    std::atomic<unsigned short> &slot(unsigned int address, unsigned int copy) const;
+    void lock(unsigned int stripe);
+    void unlock(unsigned int stripe);
+
+    unsigned int registers;
+    unsigned int stripeSize;
+    std::unique_ptr<std::atomic<unsigned short>[]> regs; // both copies of every stripe
+    std::unique_ptr<Stripe[]> stripes;
+
+    // the protocol thread's copy the slave serves a request from
+    unsigned char slaveID;
+    std::vector<unsigned int> image;
+    std::vector<unsigned int> served; // image as the store handed it out
+    bool pending; // a request was served from image since the last update()
+};
+
+#endif
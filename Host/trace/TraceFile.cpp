@@ -0,0 +1,148 @@
+#include "TraceFile.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define VERSION 1
+#define RECORD_SIZE 14
+
+static void put16(std::vector<unsigned char> &out, unsigned int value)
+{
+  out.push_back(value & 0xFF);
+  out.push_back((value >> 8) & 0xFF);
+}
+
+static void put32(std::vector<unsigned char> &out, unsigned long value)
+{
+  put16(out, value & 0xFFFF);
+  put16(out, (value >> 16) & 0xFFFF);
+}
+
+static unsigned int get16(const unsigned char *in)
+{
+  return in[0] | (in[1] << 8);
+}
+
+static unsigned long get32(const unsigned char *in)
+{
+  return get16(in) | ((unsigned long)get16(in + 2) << 16);
+}
+
+TraceFile::TraceFile()
+  : total(0)
+{
+}
+
+void TraceFile::capture(const ModbusPort *port)
+{
+  total = port->traceTotal;
+
+  unsigned int count = port->traceTotal < port->traceSize ? port->traceTotal : port->traceSize;
+  records.resize(count);
+  unsigned int index = port->trace ? (port->traceHead + port->traceSize - count) % port->traceSize : 0;
+  for (unsigned int i = 0; i < count; i++)
+  {
+    records[i] = port->trace[index];
+    if (++index == port->traceSize)
+      index = 0;
+  }
+
+  histograms.assign(port->histograms, port->histograms + port->no_of_histograms);
+}
+
+bool TraceFile::save(const char *path) const
+{
+  std::vector<unsigned char> out;
+  out.insert(out.end(), "MBTR", "MBTR" + 4);
+  put16(out, VERSION);
+  put16(out, RECORD_SIZE);
+  put32(out, total);
+  put32(out, records.size());
+  put32(out, histograms.size());
+  put32(out, MODBUS_HISTOGRAM_BUCKETS);
+
+  for (size_t i = 0; i < records.size(); i++)
+  {
+    const ModbusTraceRecord &record = records[i];
+    out.push_back(record.id);
+    out.push_back(record.function);
+    out.push_back(record.status);
+    out.push_back(record.exception);
+    put32(out, record.started);
+    put16(out, record.first_byte);
+    put16(out, record.last_byte);
+    put16(out, record.checked);
+  }
+
+  for (size_t h = 0; h < histograms.size(); h++)
+  {
+    put32(out, histograms[h].total);
+    put32(out, histograms[h].max);
+    for (unsigned int b = 0; b < MODBUS_HISTOGRAM_BUCKETS; b++)
+      put32(out, histograms[h].counts[b]);
+  }
+
+  FILE *file = fopen(path, "wb");
+  if (!file)
+    return false;
+  bool written = fwrite(&out[0], 1, out.size(), file) == out.size();
+  return fclose(file) == 0 && written;
+}
+
+bool TraceFile::load(const char *path)
+{
+  FILE *file = fopen(path, "rb");
+  if (!file)
+    return false;
+
+  std::vector<unsigned char> in;
+  unsigned char buffer[4096];
+  size_t length;
+  while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    in.insert(in.end(), buffer, buffer + length);
+  fclose(file);
+
+  if (in.size() < 24 || memcmp(&in[0], "MBTR", 4) != 0 ||
+      get16(&in[4]) != VERSION || get16(&in[6]) != RECORD_SIZE ||
+      get32(&in[20]) != MODBUS_HISTOGRAM_BUCKETS)
+    return false;
+
+  unsigned long count = get32(&in[12]);
+  unsigned long no_of_histograms = get32(&in[16]);
+  if (in.size() != 24 + count * RECORD_SIZE + no_of_histograms * (8 + 4 * MODBUS_HISTOGRAM_BUCKETS))
+    return false;
+
+  total = get32(&in[8]);
+  const unsigned char *p = &in[24];
+
+  records.resize(count);
+  for (unsigned long i = 0; i < count; i++, p += RECORD_SIZE)
+  {
+    ModbusTraceRecord &record = records[i];
+    record.id = p[0];
+    record.function = p[1];
+    record.status = p[2];
+    record.exception = p[3];
+    record.started = get32(p + 4);
+    record.first_byte = get16(p + 8);
+    record.last_byte = get16(p + 10);
+    record.checked = get16(p + 12);
+  }
+
+  histograms.resize(no_of_histograms);
+  for (unsigned long h = 0; h < no_of_histograms; h++)
+  {
+    histograms[h].total = get32(p);
+    histograms[h].max = get32(p + 4);
+    p += 8;
+    for (unsigned int b = 0; b < MODBUS_HISTOGRAM_BUCKETS; b++, p += 4)
+      histograms[h].counts[b] = get32(p);
+  }
+
+  return true;
+}
+
+unsigned long TraceFile::checked(const ModbusTraceRecord &record)
+{
+  return (unsigned long)record.checked * MODBUS_TRACE_TICK;
+}
@@ -0,0 +1,45 @@
+/*
+ TraceFile.h - SimpleModbusMaster transaction traces and latency
+ histograms on disk, for looking at a Linux master's bus after the fact.
+
+ capture() copies the trace ring and the histograms of a ModbusPort,
+ save() writes them to a file and load() reads one back. The file is
+ little endian whatever the host:
+
+   "MBTR", u16 version 1, u16 size of a record (14)
+   u32 transactions traced, u32 records, u32 histograms, u32 buckets
+   records, oldest first:
+     u8 id, u8 function, u8 status, u8 exception,
+     u32 started, u16 first byte, u16 last byte, u16 checked
+   histograms, by slave id:
+     u32 total, u32 max, u32 count of every bucket
+
+ The records are the newest ones the ring still held, the histograms
+ count every transaction.
+*/
+
+#ifndef TRACE_FILE_H
+#define TRACE_FILE_H
+
+#include <vector>
+
+#include "SimpleModbusMaster.h"
+
+class TraceFile
+{
+  public:
+    TraceFile();
+
+    void capture(const ModbusPort *port);
+    bool save(const char *path) const;
+    bool load(const char *path);
+
+    // microseconds from the start of a record's request to its checked response
+    static unsigned long checked(const ModbusTraceRecord &record);
+
+    unsigned long total; // transactions traced
+    std::vector<ModbusTraceRecord> records; // oldest first
+    std::vector<ModbusHistogram> histograms; // by slave id
+};
+
+#endif
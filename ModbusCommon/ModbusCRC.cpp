@@ -0,0 +1,226 @@
+#include "ModbusCRC.h"
+
+#ifdef __AVR__
+#include <avr/pgmspace.h>
+#define CRC_TABLE(i) pgm_read_word(&crcTable[(i)])
+#else
+#define PROGMEM
+#define CRC_TABLE(i) crcTable[(i)]
+#endif
+
+// crcTable[i] is the crc of the single byte i using the reflected 
+// polynomial 0xA001. On AVR it lives in flash and is read with pgm_read_word.
+static const uint16_t crcTable[256] PROGMEM = {
+  0x0000, 0xC0C1, 0xC181, 0x0140, 0xC301, 0x03C0, 0x0280, 0xC241,
+  0xC601, 0x06C0, 0x0780, 0xC741, 0x0500, 0xC5C1, 0xC481, 0x0440,
+  0xCC01, 0x0CC0, 0x0D80, 0xCD41, 0x0F00, 0xCFC1, 0xCE81, 0x0E40,
+  0x0A00, 0xCAC1, 0xCB81, 0x0B40, 0xC901, 0x09C0, 0x0880, 0xC841,
+  0xD801, 0x18C0, 0x1980, 0xD941, 0x1B00, 0xDBC1, 0xDA81, 0x1A40,
+  0x1E00, 0xDEC1, 0xDF81, 0x1F40, 0xDD01, 0x1DC0, 0x1C80, 0xDC41,
+  0x1400, 0xD4C1, 0xD581, 0x1540, 0xD701, 0x17C0, 0x1680, 0xD641,
+  0xD201, 0x12C0, 0x1380, 0xD341, 0x1100, 0xD1C1, 0xD081, 0x1040,
+  0xF001, 0x30C0, 0x3180, 0xF141, 0x3300, 0xF3C1, 0xF281, 0x3240,
+  0x3600, 0xF6C1, 0xF781, 0x3740, 0xF501, 0x35C0, 0x3480, 0xF441,
+  0x3C00, 0xFCC1, 0xFD81, 0x3D40, 0xFF01, 0x3FC0, 0x3E80, 0xFE41,
+  0xFA01, 0x3AC0, 0x3B80, 0xFB41, 0x3900, 0xF9C1, 0xF881, 0x3840,
+  0x2800, 0xE8C1, 0xE981, 0x2940, 0xEB01, 0x2BC0, 0x2A80, 0xEA41,
+  0xEE01, 0x2EC0, 0x2F80, 0xEF41, 0x2D00, 0xEDC1, 0xEC81, 0x2C40,
+  0xE401, 0x24C0, 0x2580, 0xE541, 0x2700, 0xE7C1, 0xE681, 0x2640,
+  0x2200, 0xE2C1, 0xE381, 0x2340, 0xE101, 0x21C0, 0x2080, 0xE041,
+  0xA001, 0x60C0, 0x6180, 0xA141, 0x6300, 0xA3C1, 0xA281, 0x6240,
+  0x6600, 0xA6C1, 0xA781, 0x6740, 0xA501, 0x65C0, 0x6480, 0xA441,
+  0x6C00, 0xACC1, 0xAD81, 0x6D40, 0xAF01, 0x6FC0, 0x6E80, 0xAE41,
+  0xAA01, 0x6AC0, 0x6B80, 0xAB41, 0x6900, 0xA9C1, 0xA881, 0x6840,
+  0x7800, 0xB8C1, 0xB981, 0x7940, 0xBB01, 0x7BC0, 0x7A80, 0xBA41,
+  0xBE01, 0x7EC0, 0x7F80, 0xBF41, 0x7D00, 0xBDC1, 0xBC81, 0x7C40,
+  0xB401, 0x74C0, 0x7580, 0xB541, 0x7700, 0xB7C1, 0xB681, 0x7640,
+  0x7200, 0xB2C1, 0xB381, 0x7340, 0xB101, 0x71C0, 0x7080, 0xB041,
+  0x5000, 0x90C1, 0x9181, 0x5140, 0x9301, 0x53C0, 0x5280, 0x9241,
+  0x9601, 0x56C0, 0x5780, 0x9741, 0x5500, 0x95C1, 0x9481, 0x5440,
+  0x9C01, 0x5CC0, 0x5D80, 0x9D41, 0x5F00, 0x9FC1, 0x9E81, 0x5E40,
+  0x5A00, 0x9AC1, 0x9B81, 0x5B40, 0x9901, 0x59C0, 0x5880, 0x9841,
+  0x8801, 0x48C0, 0x4980, 0x8941, 0x4B00, 0x8BC1, 0x8A81, 0x4A40,
+  0x4E00, 0x8EC1, 0x8F81, 0x4F40, 0x8D01, 0x4DC0, 0x4C80, 0x8C41,
+  0x4400, 0x84C1, 0x8581, 0x4540, 0x8701, 0x47C0, 0x4680, 0x8641,
+  0x8201, 0x42C0, 0x4380, 0x8341, 0x4100, 0x81C1, 0x8081, 0x4040
+};
+
+static uint16_t updateBitwise(uint16_t crc, const unsigned char *data, unsigned int length)
+{
+  unsigned int temp = crc;
+  for (unsigned int i = 0; i < length; i++)
+  {
+    temp = temp ^ data[i];
+    for (unsigned char j = 1; j <= 8; j++)
+    {
+      unsigned int flag = temp & 0x0001;
+      temp >>= 1;
+      if (flag)
+        temp ^= 0xA001;
+    }
+  }
+  return temp;
+}
+
+static uint16_t updateTable(uint16_t crc, const unsigned char *data, unsigned int length)
+{
+  while (length--)
+    crc = (crc >> 8) ^ CRC_TABLE((crc ^ *data++) & 0xFF);
+  return crc;
+}
+
+#ifndef __AVR__
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * 
+  
+  SLICING BY 4 AND 8
+
+  sliceTables.t[k][i] is the crc of byte i followed by k zero bytes. The 16 bit
+  crc only overlaps the first 2 bytes of each slice, the remaining bytes are
+  looked up directly, so every byte of the slice is independent and the 
+  lookups can run in parallel instead of one after the other.
+
+  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+struct SliceTables
+{
+  uint16_t t[8][256];
+  
+  SliceTables()
+  {
+    for (unsigned int i = 0; i < 256; i++)
+      t[0][i] = crcTable[i];
+    for (unsigned int k = 1; k < 8; k++)
+      for (unsigned int i = 0; i < 256; i++)
+        t[k][i] = (t[k - 1][i] >> 8) ^ crcTable[t[k - 1][i] & 0xFF];
+  }
+};
+
+static const SliceTables sliceTables;
+
+static uint16_t updateSlice4(uint16_t crc, const unsigned char *data, unsigned int length)
+{
+  const uint16_t (*t)[256] = sliceTables.t;
+  while (length >= 4)
+  {
+    crc = t[3][(data[0] ^ crc) & 0xFF] ^
+          t[2][(data[1] ^ (crc >> 8)) & 0xFF] ^
+          t[1][data[2]] ^
+          t[0][data[3]];
+    data += 4;
+    length -= 4;
+  }
+  return updateTable(crc, data, length);
+}
+
+static inline uint16_t slice8(const uint16_t (*t)[256], uint16_t crc, const unsigned char *data)
+{
+  return t[7][(data[0] ^ crc) & 0xFF] ^
+         t[6][(data[1] ^ (crc >> 8)) & 0xFF] ^
+         t[5][data[2]] ^
+         t[4][data[3]] ^
+         t[3][data[4]] ^
+         t[2][data[5]] ^
+         t[1][data[6]] ^
+         t[0][data[7]];
+}
+
+static uint16_t updateSlice8(uint16_t crc, const unsigned char *data, unsigned int length)
+{
+  const uint16_t (*t)[256] = sliceTables.t;
+  while (length >= 8)
+  {
+    crc = slice8(t, crc, data);
+    data += 8;
+    length -= 8;
+  }
+  return updateSlice4(crc, data, length);
+}
+
+// Four frames side by side over the length they have in common. Each
+// step of one frame waits for its previous step, the other three fill
+// that wait.
+static void checkFour(const unsigned char *const *frames, const unsigned int *lengths, unsigned char *valid)
+{
+  const uint16_t (*t)[256] = sliceTables.t;
+  unsigned int common = lengths[0];
+  for (unsigned int k = 1; k < 4; k++)
+    if (lengths[k] < common)
+      common = lengths[k];
+  common &= ~7u;
+  
+  uint16_t crc0 = MODBUS_CRC_INIT, crc1 = MODBUS_CRC_INIT;
+  uint16_t crc2 = MODBUS_CRC_INIT, crc3 = MODBUS_CRC_INIT;
+  for (unsigned int i = 0; i < common; i += 8)
+  {
+    crc0 = slice8(t, crc0, frames[0] + i);
+    crc1 = slice8(t, crc1, frames[1] + i);
+    crc2 = slice8(t, crc2, frames[2] + i);
+    crc3 = slice8(t, crc3, frames[3] + i);
+  }
+  
+  valid[0] = updateSlice8(crc0, frames[0] + common, lengths[0] - common) == 0;
+  valid[1] = updateSlice8(crc1, frames[1] + common, lengths[1] - common) == 0;
+  valid[2] = updateSlice8(crc2, frames[2] + common, lengths[2] - common) == 0;
+  valid[3] = updateSlice8(crc3, frames[3] + common, lengths[3] - common) == 0;
+}
+
+unsigned int modbus_crc16_slice4(const unsigned char *data, unsigned int length)
+{
+  return modbus_crc16_swap(updateSlice4(MODBUS_CRC_INIT, data, length));
+}
+
+unsigned int modbus_crc16_slice8(const unsigned char *data, unsigned int length)
+{
+  return modbus_crc16_swap(updateSlice8(MODBUS_CRC_INIT, data, length));
+}
+
+#endif
+
+unsigned int modbus_crc16_swap(unsigned int crc)
+{
+  return ((crc << 8) | (crc >> 8)) & 0xFFFF;
+}
+
+unsigned int modbus_crc16_update(unsigned int crc, const unsigned char *data, unsigned int length)
+{
+#ifdef __AVR__
+  return updateTable(crc, data, length);
+#else
+  return updateSlice8(crc, data, length);
+#endif
+}
+
+unsigned int modbus_crc16(const unsigned char *data, unsigned int length)
+{
+  // the returned value is already swopped - crcLo byte is first & crcHi byte is last
+  return modbus_crc16_swap(modbus_crc16_update(MODBUS_CRC_INIT, data, length));
+}
+
+unsigned int modbus_crc16_check_batch(const unsigned char *const *frames, const unsigned int *lengths, 
+                                      unsigned int count, unsigned char *valid)
+{
+  unsigned int i = 0;
+#ifndef __AVR__
+  for (; i + 4 <= count; i += 4)
+    checkFour(frames + i, lengths + i, valid + i);
+#endif
+  // the crc over a whole frame, its own crc included, is 0
+  for (; i < count; i++)
+    valid[i] = modbus_crc16_update(MODBUS_CRC_INIT, frames[i], lengths[i]) == 0;
+  
+  unsigned int intact = 0;
+  for (i = 0; i < count; i++)
+    intact += valid[i];
+  return intact;
+}
+
+unsigned int modbus_crc16_bitwise(const unsigned char *data, unsigned int length)
+{
+  return modbus_crc16_swap(updateBitwise(MODBUS_CRC_INIT, data, length));
+}
+
+unsigned int modbus_crc16_table(const unsigned char *data, unsigned int length)
+{
+  return modbus_crc16_swap(updateTable(MODBUS_CRC_INIT, data, length));
+}
@@ -0,0 +1,63 @@
+#ifndef MODBUS_CRC_H
+#define MODBUS_CRC_H
+
+/*
+ ModbusCRC is the CRC-16 (polynomial 0xA001, initial value 0xFFFF) used by
+ Modbus RTU. It is shared by SimpleModbusMaster and SimpleModbusSlave and
+ works on any buffer, not only the library frame[] arrays.
+
+ All the functions return the crc already swopped so it can be written
+ into a frame the same way the libraries always did:
+
+   crc16 = modbus_crc16(frame, n);
+   frame[n] = crc16 >> 8;      // crc Lo
+   frame[n + 1] = crc16 & 0xFF; // crc Hi
+
+ There are several implementations of the same calculation:
+
+ modbus_crc16_bitwise - the original loop, 8 shifts per byte, no tables
+ modbus_crc16_table   - one 256 entry table lookup per byte. On AVR the
+                        512 byte table is kept in flash (PROGMEM)
+ modbus_crc16_slice4  - 4 bytes per step using 4 tables (host builds only)
+ modbus_crc16_slice8  - 8 bytes per step using 8 tables (host builds only)
+
+ modbus_crc16 picks the fastest one for the target, the table on AVR and
+ slice by 8 everywhere else.
+
+ modbus_crc16_update continues a crc over more data and is meant for
+ streams where a frame arrives in pieces. Start it with MODBUS_CRC_INIT.
+ It works with the crc in its natural (unswopped) order, use
+ modbus_crc16_swap to convert the final value.
+
+ modbus_crc16_check_batch checks a batch of received frames, crc included.
+ The crc over a whole intact frame is 0. On host builds the frames are
+ checked four at a time with slice by 8, interleaved so the table lookups
+ of one frame overlap with those of the others, which is what short
+ frames need: a single frame of 8 to 30 bytes is a chain of dependent
+ lookups that leaves the CPU waiting.
+
+ Copy the ModbusCommon directory into the Arduino "libraries" folder
+ next to SimpleModbusMaster and SimpleModbusSlave.
+*/
+
+#include <stdint.h>
+
+#define MODBUS_CRC_INIT 0xFFFF
+
+// function definitions
+unsigned int modbus_crc16(const unsigned char *data, unsigned int length);
+unsigned int modbus_crc16_update(unsigned int crc, const unsigned char *data, unsigned int length);
+unsigned int modbus_crc16_swap(unsigned int crc);
+
+// valid[i] is set to 1 if frames[i] is intact, returns how many are
+unsigned int modbus_crc16_check_batch(const unsigned char *const *frames, const unsigned int *lengths, 
+                                      unsigned int count, unsigned char *valid);
+
+unsigned int modbus_crc16_bitwise(const unsigned char *data, unsigned int length);
+unsigned int modbus_crc16_table(const unsigned char *data, unsigned int length);
+#ifndef __AVR__
+unsigned int modbus_crc16_slice4(const unsigned char *data, unsigned int length);
+unsigned int modbus_crc16_slice8(const unsigned char *data, unsigned int length);
+#endif
+
+#endif
@@ -0,0 +1,12 @@
+#include "ModbusCapture.h"
+
+#ifdef MODBUS_CAPTURE
+
+ModbusCaptureHook modbus_capture_hook;
+
+void modbus_capture(ModbusCaptureHook hook)
+{
+  modbus_capture_hook = hook;
+}
+
+#endif
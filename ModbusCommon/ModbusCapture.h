@@ -0,0 +1,50 @@
+#ifndef MODBUS_CAPTURE_H
+#define MODBUS_CAPTURE_H
+
+/*
+ ModbusCapture hands every frame SimpleModbusMaster and SimpleModbusSlave
+ send or receive to a hook, so a host build can record the bus and the
+ recording can be replayed through the same code later.
+
+ The hook is only compiled in when MODBUS_CAPTURE is defined, the host
+ build does that for the whole library. On the Arduino MODBUS_CAPTURE_FRAME
+ expands to nothing and costs neither flash nor time.
+
+   modbus_capture(hook); // every frame from now on, 0 to stop
+
+ hook(line, flags, time, frame, length) is called with the serial port
+ the frame went over, MODBUS_CAPTURE_* flags, micros() and the frame as
+ it was on the line, crc included. A frame sent is stamped when the
+ library starts sending it and a frame received when its last byte was
+ read, the time between a request and its response is then what the
+ master waited and what the slave took to answer. A received frame that
+ did not fit into frame[] has MODBUS_CAPTURE_OVERFLOW set and only the
+ bytes that fitted.
+
+ The hook is called from modbus_update() and should return quickly.
+*/
+
+#define MODBUS_CAPTURE_TX 1 // sent, otherwise received
+#define MODBUS_CAPTURE_MASTER 2 // by SimpleModbusMaster, otherwise SimpleModbusSlave
+#define MODBUS_CAPTURE_OVERFLOW 4 // the rest of the frame was dropped
+
+typedef void (*ModbusCaptureHook)(const void *line, unsigned char flags, unsigned long time,
+                                  const unsigned char *frame, unsigned int length);
+
+#ifdef MODBUS_CAPTURE
+
+extern ModbusCaptureHook modbus_capture_hook;
+
+// function definitions
+void modbus_capture(ModbusCaptureHook hook);
+
+#define MODBUS_CAPTURE_FRAME(line, flags, time, frame, length) \
+  do { if (modbus_capture_hook) modbus_capture_hook(line, flags, time, frame, length); } while (0)
+
+#else
+
+#define MODBUS_CAPTURE_FRAME(line, flags, time, frame, length) do { } while (0)
+
+#endif
+
+#endif
@@ -0,0 +1,165 @@
+#include "ModbusRegisters.h"
+
+#include <string.h>
+
+#ifdef MODBUS_REGISTERS_SSE2
+#include <emmintrin.h>
+#ifdef __SSSE3__
+#include <tmmintrin.h>
+#endif
+#endif
+
+// an unsigned int has the layout of the frame data, no conversion needed
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__ && __SIZEOF_INT__ == 2
+#define REGISTERS_ARE_BIG_ENDIAN
+#endif
+
+void modbus_pack_registers_bytewise(unsigned char *data, const unsigned int *regs, unsigned int count)
+{
+  for (unsigned int i = 0; i < count; i++)
+  {
+    unsigned int temp = regs[i];
+    data[0] = temp >> 8; // split the register into 2 bytes
+    data[1] = temp & 0xFF;
+    data += 2;
+  }
+}
+
+void modbus_unpack_registers_bytewise(unsigned int *regs, const unsigned char *data, unsigned int count)
+{
+  for (unsigned int i = 0; i < count; i++)
+  {
+    regs[i] = (data[0] << 8) | data[1];
+    data += 2;
+  }
+}
+
+#ifdef MODBUS_REGISTERS_SSE2
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * 
+  
+  SSE2 CONVERSION
+
+  8 registers are 16 bytes of frame data and two vectors of unsigned int.
+  Packing keeps the low 16 bits of every register (sign extended, so the
+  saturating pack can't change them), narrows them to 8 words and swaps
+  the bytes of each word. Unpacking swaps the bytes and widens the words
+  with zeros. The registers left over are done bytewise.
+
+  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+static inline __m128i swapWords(__m128i words)
+{
+#ifdef __SSSE3__
+  const __m128i order = _mm_set_epi8(14, 15, 12, 13, 10, 11, 8, 9, 6, 7, 4, 5, 2, 3, 0, 1);
+  return _mm_shuffle_epi8(words, order);
+#else
+  return _mm_or_si128(_mm_slli_epi16(words, 8), _mm_srli_epi16(words, 8));
+#endif
+}
+
+void modbus_pack_registers_sse2(unsigned char *data, const unsigned int *regs, unsigned int count)
+{
+  unsigned int i = 0;
+  for (; i + 8 <= count; i += 8)
+  {
+    __m128i low = _mm_loadu_si128((const __m128i *)(regs + i));
+    __m128i high = _mm_loadu_si128((const __m128i *)(regs + i + 4));
+    low = _mm_srai_epi32(_mm_slli_epi32(low, 16), 16);
+    high = _mm_srai_epi32(_mm_slli_epi32(high, 16), 16);
+    __m128i words = _mm_packs_epi32(low, high);
+    _mm_storeu_si128((__m128i *)(data + i * 2), swapWords(words));
+  }
+  modbus_pack_registers_bytewise(data + i * 2, regs + i, count - i);
+}
+
+void modbus_unpack_registers_sse2(unsigned int *regs, const unsigned char *data, unsigned int count)
+{
+  const __m128i zero = _mm_setzero_si128();
+  unsigned int i = 0;
+  for (; i + 8 <= count; i += 8)
+  {
+    __m128i words = swapWords(_mm_loadu_si128((const __m128i *)(data + i * 2)));
+    _mm_storeu_si128((__m128i *)(regs + i), _mm_unpacklo_epi16(words, zero));
+    _mm_storeu_si128((__m128i *)(regs + i + 4), _mm_unpackhi_epi16(words, zero));
+  }
+  modbus_unpack_registers_bytewise(regs + i, data + i * 2, count - i);
+}
+
+#endif
+
+void modbus_pack_registers(unsigned char *data, const unsigned int *regs, unsigned int count)
+{
+#if defined(REGISTERS_ARE_BIG_ENDIAN)
+  memcpy(data, regs, count * 2);
+#elif defined(MODBUS_REGISTERS_SSE2)
+  modbus_pack_registers_sse2(data, regs, count);
+#else
+  modbus_pack_registers_bytewise(data, regs, count);
+#endif
+}
+
+void modbus_unpack_registers(unsigned int *regs, const unsigned char *data, unsigned int count)
+{
+#if defined(REGISTERS_ARE_BIG_ENDIAN)
+  memcpy(regs, data, count * 2);
+#elif defined(MODBUS_REGISTERS_SSE2)
+  modbus_unpack_registers_sse2(regs, data, count);
+#else
+  modbus_unpack_registers_bytewise(regs, data, count);
+#endif
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * 
+  
+  BIT PACKING
+
+  A byte of frame data holds 8 bits of the array, the ones from first + 8i
+  on. When first is not a multiple of 8 they straddle two bytes of the
+  array and are shifted together from both. Bits past count are sent as 
+  zeros.
+
+  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+void modbus_pack_bits(unsigned char *data, const unsigned char *bits, unsigned int first, unsigned int count)
+{
+  unsigned int bytes = (count + 7) / 8;
+  unsigned char shift = first & 7;
+  bits += first >> 3;
+  
+  if (shift == 0)
+    memcpy(data, bits, bytes);
+  else
+    for (unsigned int i = 0; i < bytes; i++)
+    {
+      unsigned char value = bits[i] >> shift;
+      // the next byte of the array is only read if some of it is needed
+      if (i * 8 + 8 - shift < count)
+        value |= bits[i + 1] << (8 - shift);
+      data[i] = value;
+    }
+  
+  if (count & 7)
+    data[bytes - 1] &= (1 << (count & 7)) - 1;
+}
+
+void modbus_unpack_bits(unsigned char *bits, unsigned int first, const unsigned char *data, unsigned int count)
+{
+  for (unsigned int i = 0; count; i++)
+  {
+    unsigned char n = count < 8 ? count : 8;
+    unsigned int mask = (1 << n) - 1;
+    unsigned int position = first + i * 8;
+    unsigned char *dest = &bits[position >> 3];
+    unsigned char shift = position & 7;
+    
+    // the bits land in one byte of the array or straddle two
+    unsigned int value = (data[i] & mask) << shift;
+    mask <<= shift;
+    dest[0] = (dest[0] & ~mask) | value;
+    if (shift + n > 8)
+      dest[1] = (dest[1] & ~(mask >> 8)) | (value >> 8);
+    
+    count -= n;
+  }
+}
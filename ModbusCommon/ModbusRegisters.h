@@ -0,0 +1,103 @@
+#ifndef MODBUS_REGISTERS_H
+#define MODBUS_REGISTERS_H
+
+/*
+ ModbusRegisters converts between a register array and the big-endian
+ register data of a Modbus frame. It is shared by SimpleModbusMaster and
+ SimpleModbusSlave like ModbusCRC.
+
+ A ModbusRegisterView points at the register data inside a frame, for
+ example the values of a function 16 request, and reads or writes them
+ in place without an intermediate buffer:
+
+   ModbusRegisterView values = { &frame[7], no_of_registers };
+   values.read(&holdingRegs[startingAddress]); // frame -> registers
+   setpoint = values.get(0);                   // a single register
+
+ modbus_pack_registers writes count registers to data, high byte first,
+ and modbus_unpack_registers reads them back. Only the low 16 bits of
+ each register are sent, as before. There are several implementations
+ of the same conversion:
+
+ modbus_pack_registers_bytewise - the original loop, a shift and a mask
+                                  per byte
+ modbus_pack_registers_sse2     - 8 registers per step with a byte swap
+                                  in SSE2 (x86 host builds only, SSSE3
+                                  builds swap with a single shuffle)
+
+ modbus_pack_registers picks the fastest one for the target. Where an
+ unsigned int is a big-endian 16 bit word the frame data is the register
+ array and it is a plain memcpy.
+
+ Coils and discrete inputs are kept 8 to a byte, the lowest address in
+ bit 0 of the first byte, which is the order Modbus sends them in. 
+ modbus_get_bit and modbus_set_bit address a single one, modbus_pack_bits
+ copies count of them starting at first into frame data and 
+ modbus_unpack_bits copies frame data back without touching the bits 
+ around them. A range starting on a byte boundary is a plain copy.
+*/
+
+#include <stdint.h>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define MODBUS_REGISTERS_SSE2
+#endif
+
+// function definitions
+void modbus_pack_registers(unsigned char *data, const unsigned int *regs, unsigned int count);
+void modbus_unpack_registers(unsigned int *regs, const unsigned char *data, unsigned int count);
+
+void modbus_pack_bits(unsigned char *data, const unsigned char *bits, unsigned int first, unsigned int count);
+void modbus_unpack_bits(unsigned char *bits, unsigned int first, const unsigned char *data, unsigned int count);
+
+inline unsigned char modbus_get_bit(const unsigned char *bits, unsigned int index)
+{
+  return (bits[index >> 3] >> (index & 7)) & 1;
+}
+
+inline void modbus_set_bit(unsigned char *bits, unsigned int index, unsigned char value)
+{
+  if (value)
+    bits[index >> 3] |= 1 << (index & 7);
+  else
+    bits[index >> 3] &= ~(1 << (index & 7));
+}
+
+void modbus_pack_registers_bytewise(unsigned char *data, const unsigned int *regs, unsigned int count);
+void modbus_unpack_registers_bytewise(unsigned int *regs, const unsigned char *data, unsigned int count);
+#ifdef MODBUS_REGISTERS_SSE2
+void modbus_pack_registers_sse2(unsigned char *data, const unsigned int *regs, unsigned int count);
+void modbus_unpack_registers_sse2(unsigned int *regs, const unsigned char *data, unsigned int count);
+#endif
+
+// count big-endian registers in place in a frame, nothing is copied
+struct ModbusRegisterView
+{
+  unsigned char *data;
+  unsigned int count;
+  
+  unsigned int get(unsigned int index) const
+  {
+    return (data[index * 2] << 8) | data[index * 2 + 1];
+  }
+  
+  void set(unsigned int index, unsigned int value)
+  {
+    data[index * 2] = value >> 8; // register Hi
+    data[index * 2 + 1] = value & 0xFF; // register Lo
+  }
+  
+  // copy all the registers of the view to regs
+  void read(unsigned int *regs) const
+  {
+    modbus_unpack_registers(regs, data, count);
+  }
+  
+  // fill the view from regs
+  void write(const unsigned int *regs)
+  {
+    modbus_pack_registers(data, regs, count);
+  }
+};
+
+#endif
@@ -0,0 +1,222 @@
+#include "ModbusSplitter.h"
+#include "ModbusCRC.h"
+
+#include <string.h>
+
+// a frame can't be cut before more bytes have arrived
+#define MORE 0xFFFF
+
+// The length of the frame at data as a request or as a response, 0 if the
+// function has no such frame and more than available if its byte count
+// hasn't arrived yet.
+static unsigned int expectedLength(const unsigned char *data, unsigned int available, unsigned char response)
+{
+  if (available < 2)
+    return available + 1;
+
+  unsigned char function = data[1];
+  if (function & 0x80) // an exception
+    return response ? 5 : 0;
+
+  switch (function)
+  {
+    case 1:
+    case 2:
+    case 3:
+    case 4:
+      if (!response)
+        return 8;
+      return available > 2 ? 5 + data[2] : available + 1;
+    case 5:
+    case 6:
+      return 8;
+    case 15:
+    case 16:
+      if (response)
+        return 8;
+      return available > 6 ? 9 + data[6] : available + 1;
+    case 23:
+      if (response)
+        return available > 2 ? 5 + data[2] : available + 1;
+      return available > 10 ? 13 + data[10] : available + 1;
+    default:
+      return 0;
+  }
+}
+
+// a response follows a request unless it was broadcast
+static unsigned char following(const unsigned char *frame, unsigned char response)
+{
+  return !response && frame[0] != 0;
+}
+
+// The length of a frame of a known function at data if its crc is right,
+// 0 if it isn't and MORE if that can't be told yet.
+static unsigned int known(ModbusSplitter *splitter, const unsigned char *data, unsigned int available,
+                          unsigned char *response)
+{
+  unsigned char undecided = 0;
+
+  // the expected direction first, then the other one
+  for (unsigned char i = 0; i < 2; i++)
+  {
+    *response = i ? !splitter->response : splitter->response;
+    unsigned int length = expectedLength(data, available, *response);
+    if (length > available)
+      undecided = 1;
+    else if (length >= 4 && length <= MODBUS_FRAME_MAX &&
+             modbus_crc16_update(MODBUS_CRC_INIT, data, length) == 0)
+      return length;
+  }
+
+  return undecided ? MORE : 0;
+}
+
+// Finds the frame at data after the expected one failed. Returns its
+// length, 0 with the bytes up to the next frame in garbage, or MORE.
+static unsigned int resolve(ModbusSplitter *splitter, const unsigned char *data, unsigned int available,
+                            unsigned int *garbage)
+{
+  unsigned char response;
+  unsigned int length = known(splitter, data, available, &response);
+  if (length == MORE && available < MODBUS_FRAME_MAX)
+    return MORE;
+  if (length && length != MORE)
+  {
+    splitter->response = following(data, response);
+    return length;
+  }
+
+  // whatever is before the next frame of a known function is either one
+  // frame of another function or garbage, a full buffer decides
+  unsigned int limit = available < MODBUS_FRAME_MAX ? available : MODBUS_FRAME_MAX;
+  unsigned int next = 1;
+  for (; next < limit; next++)
+  {
+    length = known(splitter, &data[next], available - next, &response);
+    if (length == MORE && available < MODBUS_FRAME_MAX)
+      return MORE;
+    if (length && length != MORE)
+      break;
+  }
+  if (next == limit && available < MODBUS_FRAME_MAX)
+    return MORE;
+
+  // a frame of an unknown function ends where the crc comes to 0
+  unsigned int crc = MODBUS_CRC_INIT;
+  for (length = 1; length <= next; length++)
+  {
+    crc = modbus_crc16_update(crc, &data[length - 1], 1);
+    if (crc == 0 && length >= 4)
+      return length;
+  }
+
+  // with no frame in sight the next byte may still start one
+  *garbage = next == limit ? 1 : next;
+  return 0;
+}
+
+// Passes every frame in data to the callback and returns the number of
+// bytes used, the rest is the start of a frame that needs more bytes.
+static unsigned int split(ModbusSplitter *splitter, const unsigned char *data, unsigned int available,
+                          ModbusFrameCallback frame)
+{
+  unsigned int position = 0;
+
+  for (;;)
+  {
+    // cut the next frames where they are expected to end
+    const unsigned char *frames[MODBUS_SPLIT_BATCH];
+    unsigned int lengths[MODBUS_SPLIT_BATCH];
+    unsigned char responses[MODBUS_SPLIT_BATCH + 1];
+    unsigned char valid[MODBUS_SPLIT_BATCH];
+    unsigned int count = 0;
+    unsigned int next = position;
+
+    responses[0] = splitter->response;
+    while (count < MODBUS_SPLIT_BATCH)
+    {
+      unsigned int length = expectedLength(&data[next], available - next, responses[count]);
+      if (length < 4 || length > MODBUS_FRAME_MAX || length > available - next)
+        break;
+      frames[count] = &data[next];
+      lengths[count] = length;
+      responses[count + 1] = following(&data[next], responses[count]);
+      next += length;
+      count++;
+    }
+
+    // and check them together, up to the first one that is broken
+    modbus_crc16_check_batch(frames, lengths, count, valid);
+    unsigned int i = 0;
+    for (; i < count && valid[i]; i++)
+    {
+      frame(frames[i], lengths[i]);
+      position += lengths[i];
+      splitter->response = responses[i + 1];
+      splitter->frames++;
+    }
+    if (i == MODBUS_SPLIT_BATCH)
+      continue;
+
+    unsigned int garbage;
+    unsigned int length = resolve(splitter, &data[position], available - position, &garbage);
+    if (length == MORE)
+      return position;
+
+    if (length == 0)
+    {
+      splitter->garbage += garbage;
+      position += garbage;
+    }
+    else
+    {
+      frame(&data[position], length);
+      position += length;
+      splitter->frames++;
+    }
+  }
+}
+
+void modbus_split_init(ModbusSplitter *splitter)
+{
+  splitter->no_of_held = 0;
+  splitter->response = 0;
+  splitter->frames = 0;
+  splitter->garbage = 0;
+}
+
+void modbus_split(ModbusSplitter *splitter, const unsigned char *data, unsigned int length,
+                  ModbusFrameCallback frame)
+{
+  // the bytes kept from the last call go first, topped up from data
+  while (splitter->no_of_held && length)
+  {
+    unsigned int held = splitter->no_of_held;
+    unsigned int added = length < MODBUS_FRAME_MAX - held ? length : MODBUS_FRAME_MAX - held;
+    memcpy(&splitter->held[held], data, added);
+
+    unsigned int used = split(splitter, splitter->held, held + added, frame);
+    if (used >= held)
+    {
+      // past the kept bytes, the rest is still in data
+      data += used - held;
+      length -= used - held;
+      splitter->no_of_held = 0;
+    }
+    else
+    {
+      splitter->no_of_held = held + added - used;
+      memmove(splitter->held, &splitter->held[used], splitter->no_of_held);
+      data += added;
+      length -= added;
+    }
+  }
+
+  if (!length)
+    return;
+
+  unsigned int used = split(splitter, data, length, frame);
+  splitter->no_of_held = length - used;
+  memcpy(splitter->held, &data[used], splitter->no_of_held);
+}
@@ -0,0 +1,54 @@
+#ifndef MODBUS_SPLITTER_H
+#define MODBUS_SPLITTER_H
+
+/*
+ ModbusSplitter finds the Modbus RTU frames in a raw stream of bytes from
+ the line without knowing when they arrived, for a passive sniffer that
+ cannot time the T3.5 silences at 1 Mbaud or gets its bytes in blocks.
+
+ Frames follow each other in the stream. The function code and byte
+ count at the start of a frame give its length as a request and as a
+ response, and the frame before tells which of the two to expect. A
+ frame is accepted when its crc is right. If neither length is, the crc
+ is run on byte by byte and the first point where the crc over all of it
+ comes to 0 ends the frame, which also finds frames of functions the
+ splitter doesn't know. If that fails too the byte is garbage and the
+ search goes on from the next one.
+
+ The stream is first cut into frames at the expected lengths and a batch
+ of MODBUS_SPLIT_BATCH frames is checked at once with
+ modbus_crc16_check_batch(). Only a frame that fails is looked at more
+ closely, an intact stream costs one crc pass and nothing else.
+
+   ModbusSplitter splitter;
+   modbus_split_init(&splitter);
+   ...
+   modbus_split(&splitter, data, length, onFrame); // as bytes arrive
+
+ onFrame(frame, length) is called for every frame, crc included, in the
+ order of the stream. A frame that is split over two calls is kept in the
+ splitter until the rest has arrived, frame then points into the
+ splitter and is valid during the call only. Up to MODBUS_FRAME_MAX bytes
+ are kept back until it can be decided where the next frame ends.
+*/
+
+#define MODBUS_FRAME_MAX 256 // the longest RTU frame
+#define MODBUS_SPLIT_BATCH 16 // frames checked at once
+
+typedef void (*ModbusFrameCallback)(const unsigned char *frame, unsigned int length);
+
+typedef struct
+{
+  unsigned char held[MODBUS_FRAME_MAX]; // the start of a frame still arriving
+  unsigned int no_of_held;
+  unsigned char response; // the next frame is expected to be a response
+  unsigned long frames; // found
+  unsigned long garbage; // bytes that were no part of a frame
+} ModbusSplitter;
+
+// function definitions
+void modbus_split_init(ModbusSplitter *splitter);
+void modbus_split(ModbusSplitter *splitter, const unsigned char *data, unsigned int length,
+                  ModbusFrameCallback frame);
+
+#endif
@@ -1,443 +1,1815 @@
-#include "SimpleModbusMaster.h"
-
-#define BUFFER_SIZE 128
-
-// modbus specific exceptions
-#define ILLEGAL_FUNCTION 1
-#define ILLEGAL_DATA_ADDRESS 2
-#define ILLEGAL_DATA_VALUE 3
-
-unsigned char transmission_ready_Flag;
-unsigned char messageOkFlag, messageErrFlag;
-unsigned char retry_count;
-unsigned char TxEnablePin;
-// frame[] is used to recieve and transmit packages. 
-// The maximum number of bytes in a modbus packet is 256 bytes
-// This is limited to the serial buffer of 128 bytes
-unsigned char frame[BUFFER_SIZE]; 
-unsigned int timeout, polling;
-unsigned int T1_5; // inter character time out in microseconds
-unsigned int T3_5; // frame delay in microseconds
-unsigned long previousTimeout, previousPolling;
-unsigned int total_no_of_packets;
-Packet* packet; // current packet
-
-// function definitions
-void constructPacket();
-void checkResponse();
-void check_F3_data(unsigned char buffer);
-void check_F16_data();
-unsigned char getData();
-void check_packet_status();
-unsigned int calculateCRC(unsigned char bufferSize);
-void sendPacket(unsigned char bufferSize);
-
-
-unsigned int modbus_update(Packet* packets) 
-{
-	// Initialize the connection_status variable to the
-	// total_no_of_packets. This value cannot be used as 
-	// an index (and normally you won't). Returning this 
-	// value to the main skecth informs the user that the 
-	// previously scanned packet has no connection error.
-	
-	unsigned int connection_status = total_no_of_packets;
-
-  if (transmission_ready_Flag) 
-	{
-	
-		static unsigned int packet_index;	
-	
-		unsigned int failed_connections = 0;
-	
-		unsigned char current_connection;
-	
-		do
-		{		
-		
-			if (packet_index == total_no_of_packets) // wrap around to the beginning
-				packet_index = 0;
-		
-			// proceed to the next packet
-			packet = &packets[packet_index];
-		
-			// get the current connection status
-			current_connection = packet->connection;
-		
-			if (!current_connection)
-			{
-				connection_status = packet_index;
-			
-				// If all the connection attributes are false return
-				// immediately to the main sketch
-				if (++failed_connections == total_no_of_packets)
-					return connection_status;
-			}
-		
-			packet_index++;
-			
-		}while (!current_connection); // while a packet has no connection get the next one
-		
-		constructPacket();
-	}
-    
-	checkResponse();
-	
-  check_packet_status();	
-	
-	return connection_status; 
-}
-  
-void constructPacket()
-{	 
-	transmission_ready_Flag = 0; // disable the next transmission
-	
-  packet->requests++;
-  frame[0] = packet->id;
-  frame[1] = packet->function;
-  frame[2] = packet->address >> 8; // address Hi
-  frame[3] = packet->address & 0xFF; // address Lo
-  frame[4] = packet->no_of_registers >> 8; // no_of_registers Hi
-  frame[5] = packet->no_of_registers & 0xFF; // no_of_registers Lo
-        
-  unsigned int crc16;
-	
-  // construct the frame according to the modbus function  
-  if (packet->function == PRESET_MULTIPLE_REGISTERS) 
-  {
-    unsigned char no_of_bytes = packet->no_of_registers * 2;
-    unsigned char frameSize = 9 + no_of_bytes; // first 7 bytes of the array + 2 bytes CRC+ noOfBytes
-    frame[6] = no_of_bytes; // number of bytes
-    unsigned char index = 7; // user data starts at index 7
-    unsigned int temp;
-		unsigned char no_of_registers = packet->no_of_registers;
-    for (unsigned char i = 0; i < no_of_registers; i++)
-    {
-      temp = packet->register_array[i]; // get the data
-      frame[index] = temp >> 8;
-      index++;
-      frame[index] = temp & 0xFF;
-      index++;
-    }
-    crc16 = calculateCRC(frameSize - 2);	
-    frame[frameSize - 2] = crc16 >> 8; // split crc into 2 bytes
-    frame[frameSize - 1] = crc16 & 0xFF;
-    sendPacket(frameSize);
-         
-    if (packet->id == 0) // check broadcast id 
-    {
-			messageOkFlag = 1; // message successful, there will be no response on a broadcast
-			previousPolling = millis(); // start the polling delay
-		}
-  }
-	else // READ_HOLDING_REGISTERS is assumed
-	{
-		crc16 = calculateCRC(6); // the first 6 bytes of the frame is used in the CRC calculation
-    frame[6] = crc16 >> 8; // crc Lo
-    frame[7] = crc16 & 0xFF; // crc Hi
-    sendPacket(8); // a request with function 3, 4 & 6 is always 8 bytes in size 
-	}
-}
-  
-void checkResponse()
-{
-	if (!messageOkFlag && !messageErrFlag) // check for response
-	{	
-    	unsigned char buffer = getData();
-       
-    	if (buffer > 0) // if there's something in the buffer continue
-    	{
-      		if (frame[0] == packet->id) // check id returned
-      		{
-				// to indicate an exception response a slave will 'OR' 
-    			// the requested function with 0x80 
-				if ((frame[1] & 0x80) == 0x80) // extract 0x80
-				{
-					// the third byte in the exception response packet is the actual exception
-					switch (frame[2])
-					{
-						case ILLEGAL_FUNCTION: packet->illegal_function++; break;
-						case ILLEGAL_DATA_ADDRESS: packet->illegal_data_address++; break;
-						case ILLEGAL_DATA_VALUE: packet->illegal_data_value++; break;
-						default: packet->misc_exceptions++;
-					}
-					messageErrFlag = 1; // set an error
-					previousPolling = millis(); // start the polling delay
-				}
-				else // the response is valid
-				{
-					if (frame[1] == packet->function) // check function number returned
-					{
-						// receive the frame according to the modbus function
-						if (packet->function == PRESET_MULTIPLE_REGISTERS) 
-							check_F16_data();
-						else // READ_HOLDING_REGISTERS is assumed
-							check_F3_data(buffer);
-					}
-					else // incorrect function number returned
-					{
-						packet->incorrect_function_returned++; 
-						messageErrFlag = 1; // set an error
-						previousPolling = millis(); // start the polling delay
-					} 
-				} // check exception response
-			} 
-			else // incorrect id returned
-			{
-				packet->incorrect_id_returned++; 
-				messageErrFlag = 1; // set an error
-				previousPolling = millis(); // start the polling delay
-			}
-		} // check buffer
-	} // check message booleans
-}
-
-// checks the time out and polling delay and if a message has been recieved succesfully 
-void check_packet_status()
-{
-  unsigned char pollingFinished = (millis() - previousPolling) > polling;
-
-  if (messageOkFlag && pollingFinished) // if a valid message was recieved and the polling delay has expired clear the flag
-  {
-    messageOkFlag = 0;
-    packet->successful_requests++; // transaction sent successfully
-    packet->retries = 0; // if a request was successful reset the retry counter
-    transmission_ready_Flag = 1; 
-  }  
-	
-  // if an error message was recieved and the polling delay has expired clear the flag
-  if (messageErrFlag && pollingFinished) 
-  {
-    messageErrFlag = 0; // clear error flag 
-    packet->retries++;
-    transmission_ready_Flag = 1;
-  } 
- 	
-  // if the timeout delay has past clear the slot number for next request
-  if (!transmission_ready_Flag && ((millis() - previousTimeout) > timeout)) 
-  {
-    packet->timeout++;
-    packet->retries++;
-    transmission_ready_Flag = 1; 
-  }
-    
-  // if the number of retries have reached the max number of retries 
-  // allowable, stop requesting the specific packet
-  if (packet->retries == retry_count)
-	{
-    packet->connection = 0;
-		packet->retries = 0;
-	}
-		
-	if (transmission_ready_Flag)
-	{
-		// update the total_errors atribute of the 
-		// packet before requesting a new one
-		packet->total_errors = packet->timeout + 
-													 packet->incorrect_id_returned +
-													 packet->incorrect_function_returned +
-													 packet->incorrect_bytes_returned +
-													 packet->checksum_failed +
-													 packet->buffer_errors +
-													 packet->illegal_function +
-													 packet->illegal_data_address +
-													 packet->illegal_data_value;
-	}
-}
-
-void check_F3_data(unsigned char buffer)
-{
-	unsigned char no_of_registers = packet->no_of_registers;
-  unsigned char no_of_bytes = no_of_registers * 2;
-  if (frame[2] == no_of_bytes) // check number of bytes returned
-  {
-    // combine the crc Low & High bytes
-    unsigned int recieved_crc = ((frame[buffer - 2] << 8) | frame[buffer - 1]); 
-    unsigned int calculated_crc = calculateCRC(buffer - 2);
-				
-    if (calculated_crc == recieved_crc) // verify checksum
-    {
-      unsigned char index = 3;
-			for (unsigned char i = 0; i < no_of_registers; i++)
-      {
-        // start at the 4th element in the recieveFrame and combine the Lo byte 
-				packet->register_array[i] = (frame[index] << 8) | frame[index + 1]; 
-        index += 2;
-      }
-      messageOkFlag = 1; // message successful
-    }
-    else // checksum failed
-    {
-      packet->checksum_failed++; 
-      messageErrFlag = 1; // set an error
-    }
-      
-    // start the polling delay for messageOkFlag & messageErrFlag
-    previousPolling = millis(); 
-  }
-  else // incorrect number of bytes returned  
-  {
-    packet->incorrect_bytes_returned++; 
-    messageErrFlag = 1; // set an error
-    previousPolling = millis(); // start the polling delay
-  }	                     
-}
-  
-void check_F16_data()
-{
-  unsigned int recieved_address = ((frame[2] << 8) | frame[3]);
-  unsigned int recieved_registers = ((frame[4] << 8) | frame[5]); 
-  unsigned int recieved_crc = ((frame[6] << 8) | frame[7]); // combine the crc Low & High bytes
-  unsigned int calculated_crc = calculateCRC(6); // only the first 6 bytes are used for crc calculation
-  
-  // check the whole packet		
-  if (recieved_address == packet->address && 
-      recieved_registers == packet->no_of_registers && 
-      recieved_crc == calculated_crc)
-      messageOkFlag = 1; // message successful
-  else
-  {
-    packet->checksum_failed++; 
-    messageErrFlag = 1;
-  }
-						
-  // start the polling delay for messageOkFlag & messageErrFlag
-  previousPolling = millis();
-}
-
-// get the serial data from the buffer
-unsigned char getData()
-{
-  unsigned char buffer = 0;
-	unsigned char overflowFlag = 0;
-		
-  while (modbusSerial.available())
-  {
-		// The maximum number of bytes is limited to the serial buffer size of 128 bytes
-		// If more bytes is received than the BUFFER_SIZE the overflow flag will be set and the 
-		// serial buffer will be red untill all the data is cleared from the receive buffer,
-		// while the slave is still responding.
-		if (overflowFlag) 
-			modbusSerial.read();
-		else
-		{
-			if (buffer == BUFFER_SIZE)
-				overflowFlag = 1;
-				
-			frame[buffer] = modbusSerial.read();
-			buffer++;
-		}
-      
-    delayMicroseconds(T1_5); // inter character time out
-  }
-	
-  // The minimum buffer size from a slave can be an exception response of 5 bytes 
-  // If the buffer was partialy filled clear the buffer.
-	// The maximum number of bytes in a modbus packet is 256 bytes.
-	// The serial buffer limits this to 128 bytes.
-  // If the buffer overflows than clear the buffer and set
-  // a packet error.
-  if ((buffer > 0 && buffer < 5) || overflowFlag)
-  {
-    buffer = 0;
-    packet->buffer_errors++; 
-    messageErrFlag = 1; // set an error
-    previousPolling = millis(); // start the polling delay 
-  }
-	
-  return buffer;
-}
-
-void modbus_configure(long baud, unsigned int _timeout, unsigned int _polling, 
-										unsigned char _retry_count, unsigned char _TxEnablePin, 
-										Packet* _packet, unsigned int _total_no_of_packets)
-{
-  modbusSerial.begin(baud);
-  
-  if (_TxEnablePin > 1) 
-  { // pin 0 & pin 1 are reserved for RX/TX. To disable set _TxEnablePin < 2
-    TxEnablePin = _TxEnablePin; 
-    pinMode(TxEnablePin, OUTPUT);
-    digitalWrite(TxEnablePin, LOW);
-  }
-	
-	// Modbus states that a baud rate higher than 19200 must use a fixed 750 us 
-  // for inter character time out and 1.75 ms for a frame delay.
-  // For baud rates below 19200 the timeing is more critical and has to be calculated.
-  // E.g. 9600 baud in a 10 bit packet is 960 characters per second
-  // In milliseconds this will be 960characters per 1000ms. So for 1 character
-  // 1000ms/960characters is 1.04167ms per character and finaly modbus states an
-  // intercharacter must be 1.5T or 1.5 times longer than a normal character and thus
-  // 1.5T = 1.04167ms * 1.5 = 1.5625ms. A frame delay is 3.5T.
-	
-	if (baud > 19200)
-	{
-		T1_5 = 750; 
-		T3_5 = 1750; 
-	}
-	else 
-	{
-		T1_5 = 15000000/baud; // 1T * 1.5 = T1.5
-		T3_5 = 35000000/baud; // 1T * 3.5 = T3.5
-	}
-	
-	// initialize connection status of each packet
-	for (unsigned char i = 0; i < _total_no_of_packets; i++)
-	{
-		_packet->connection = 1;
-		_packet++;
-	}
-	
-	// initialize
-	transmission_ready_Flag = 1;
-	messageOkFlag = 0; 
-  messageErrFlag = 0;
-  timeout = _timeout;
-  polling = _polling;
-	retry_count = _retry_count;
-	TxEnablePin = _TxEnablePin;
-	total_no_of_packets = _total_no_of_packets;
-  previousTimeout = 0; 
-  previousPolling = 0; 
-} 
-
-unsigned int calculateCRC(unsigned char bufferSize) 
-{
-  unsigned int temp, temp2, flag;
-  temp = 0xFFFF;
-  for (unsigned char i = 0; i < bufferSize; i++)
-  {
-    temp = temp ^ frame[i];
-    for (unsigned char j = 1; j <= 8; j++)
-    {
-      flag = temp & 0x0001;
-      temp >>= 1;
-      if (flag)
-        temp ^= 0xA001;
-    }
-  }
-  // Reverse byte order. 
-  temp2 = temp >> 8;
-  temp = (temp << 8) | temp2;
-  temp &= 0xFFFF;
-  return temp; // the returned value is already swopped - crcLo byte is first & crcHi byte is last
-}
-
-void sendPacket(unsigned char bufferSize)
-{
-	if (TxEnablePin > 1)
-		digitalWrite(TxEnablePin, HIGH);
-		
-	for (unsigned char i = 0; i < bufferSize; i++)
-		modbusSerial.write(frame[i]);
-		
-	modbusSerial.flush();
-	
-	// allow a frame delay to indicate end of transmission
-	delayMicroseconds(T3_5); 
-	
-	if (TxEnablePin > 1)
-		digitalWrite(TxEnablePin, LOW);
-		
-	previousTimeout = millis(); // initialize timeout delay	
+#include "SimpleModbusMaster.h"
+
+// modbus specific exceptions
+#define ILLEGAL_FUNCTION 1
+#define ILLEGAL_DATA_ADDRESS 2
+#define ILLEGAL_DATA_VALUE 3
+
+// the port used by modbus_configure() and modbus_update()
+static ModbusPort defaultPort;
+
+// function definitions
+static void constructPacket(ModbusPort* port);
+static void checkResponse(ModbusPort* port);
+static void check_F3_data(ModbusPort* port, unsigned char buffer);
+static void check_F16_data(ModbusPort* port);
+static void check_bit_data(ModbusPort* port, unsigned char buffer);
+static void storeRegister(ModbusPort* port, Packet* packet, unsigned int index, unsigned int value);
+static unsigned char getData(ModbusPort* port);
+static void check_packet_status(ModbusPort* port);
+static void backoff(ModbusPort* port);
+static void adaptInterval(ModbusPort* port);
+static Packet* mostOverdue(ModbusPort* port);
+static Packet* priorityPacket(ModbusPort* port, unsigned long* waited);
+static void requeue(ModbusPort* port, Packet* packet);
+static unsigned char busAvailable(ModbusPort* port);
+static void useBus(ModbusPort* port, unsigned char bytes);
+static void traceTransaction(ModbusPort* port);
+static Packet* setpointPacket(ModbusPort* port);
+static void setpointsWritten(ModbusPort* port, unsigned char ok);
+static void verifySetpoints(ModbusPort* port, Packet* packet);
+static unsigned int traceTicks(unsigned long microseconds);
+static void tuneTransaction(ModbusPort* port);
+static void learnTiming(ModbusPort* port);
+static void sendPacket(ModbusPort* port, unsigned char bufferSize);
+static unsigned char transmit(ModbusPort* port);
+static void txComplete(ModbusPort* port);
+
+unsigned int modbus_update(Packet* packets) 
+{
+	defaultPort.packets = packets;
+	return modbus_port_update(&defaultPort);
+}
+
+unsigned int modbus_port_update(ModbusPort* port) 
+{
+	// Initialize the connection_status variable to the
+	// total_no_of_packets. This value cannot be used as 
+	// an index (and normally you won't). Returning this 
+	// value to the main skecth informs the user that the 
+	// previously scanned packet has no connection error.
+	
+	unsigned int connection_status = port->total_no_of_packets;
+
+	// a request is still on its way out, nothing else can happen 
+	// until the transmitter has finished
+	if (port->txLength && !transmit(port))
+		return connection_status;
+
+  if (port->transmission_ready_Flag) 
+	{
+		// a new request may only start after a frame delay of silence
+		if ((micros() - port->lastFrameTime) < port->frameDelay)
+			return connection_status;
+		
+		// with a bus budget the line stays idle until the credit is back
+		if (port->budget && !port->urgent && !busAvailable(port))
+			return connection_status;
+		
+		// queued packets and due ones above routine go first, after share of
+		// them in a row a routine packet or setpoint write gets its turn
+		unsigned long waited;
+		Packet* preempting = priorityPacket(port, &waited);
+		unsigned char routine = !preempting || (port->share && port->preempted >= port->share);
+		
+		if (!routine)
+			port->packet = preempting;
+		// pending setpoint writes go before the polled packets
+		else if (!port->setpoints || !setpointPacket(port))
+		{
+			unsigned int failed_connections = 0;
+	
+			unsigned char current_connection;
+	
+			do
+			{		
+		
+				if (port->packet_index == port->total_no_of_packets) // wrap around to the beginning
+					port->packet_index = 0;
+		
+				// proceed to the next packet
+				port->packet = &port->packets[port->packet_index];
+		
+				// get the current connection status
+				current_connection = port->packet->connection;
+			
+				if (port->packet->merged_into || port->packet->priority) // read by another request or not routine
+					current_connection = 0;
+				else if (!current_connection)
+					connection_status = port->packet_index;
+			
+				// with backoff enabled a failing packet is requested again once
+				// its interval has passed, whether or not it is connected.
+				// Re-probes take turns with healthy packets so the time outs of 
+				// several dead slaves never add up in one go.
+				if (port->packet->merged_into || port->packet->priority)
+					;
+				else if (port->max_backoff && port->packet->backoff)
+					current_connection = !port->probing && 
+															 (long)(millis() - port->packet->next_attempt) >= 0;
+				else if (port->max_backoff)
+					current_connection = 1;
+			
+				// a packet with an interval of its own waits until it is due
+				if (current_connection && !port->packet->backoff && port->packet->poll_interval &&
+						(long)(millis() - port->packet->next_poll) < 0)
+					current_connection = 0;
+			
+				// If no packet can be requested return
+				// immediately to the main sketch
+				if (!current_connection && ++failed_connections == port->total_no_of_packets)
+				{
+					port->probing = 0; // only failing packets are left, probe on the next call
+					if (!preempting)
+						return connection_status;
+					port->packet = preempting; // no routine packet is waiting for its turn
+					routine = 0;
+					break;
+				}
+		
+				port->packet_index++;
+			
+			}while (!current_connection); // while a packet has no connection get the next one
+		
+			// of the packets that are due the one that has waited longest goes
+			// first, a busy line then delays every packet by about the same time
+			if (routine && port->packet->poll_interval && !port->packet->backoff)
+				port->packet = mostOverdue(port);
+		}
+		
+		if (!routine)
+		{
+			port->preempted++;
+			if (port->delays)
+				modbus_histogram_add(&port->delays[port->packet->priority], waited);
+			port->requesting = port->packet->requested != 0;
+			if (port->packet->requested == 2)
+				port->urgent--;
+			port->packet->requested = 0;
+		}
+		else
+		{
+			port->preempted = 0;
+			port->requesting = 0;
+			if (port->delays && !port->writing && port->packet->poll_interval && !port->packet->backoff)
+				modbus_histogram_add(&port->delays[MODBUS_PRIORITY_ROUTINE], 
+														 (millis() - port->packet->next_poll) * 1000);
+		}
+		
+		port->probing = port->packet->backoff != 0;
+		
+		constructPacket(port);
+		
+		// the time out only starts once the request has left the line
+		if (port->txLength)
+			return connection_status;
+	}
+    
+	// the transaction is traced once its response has been checked
+	unsigned char waiting = !port->messageOkFlag && !port->messageErrFlag;
+	
+	checkResponse(port);
+	
+	if (waiting && (port->messageOkFlag || port->messageErrFlag))
+		traceTransaction(port);
+	
+  check_packet_status(port);	
+	
+	return connection_status; 
+}
+  
+static void constructPacket(ModbusPort* port)
+{	 
+	Packet* packet = port->packet;
+	unsigned char* frame = port->frame;
+	
+	port->transmission_ready_Flag = 0; // disable the next transmission
+	
+	// forget whatever was received since the last response
+	port->rxLength = 0;
+	port->rxOverflow = 0;
+	port->dataChanged = 0;
+	
+	// the next request of the packet is due one interval from now
+	if (packet->poll_interval < packet->interval)
+		packet->poll_interval = packet->interval;
+	packet->next_poll = millis() + packet->poll_interval;
+	
+  // a packet merged with others reads the range covering all of them
+  if (!packet->next_merged)
+  {
+    packet->read_address = packet->address;
+    packet->read_registers = packet->no_of_registers;
+  }
+  
+  // the frame delay and time out of the slave, tuned or configured
+  tuneTransaction(port);
+  
+  for (Packet* p = packet; p; p = p->next_merged)
+    p->requests++;
+  frame[0] = packet->id;
+  frame[1] = packet->function;
+  frame[2] = packet->read_address >> 8; // address Hi
+  frame[3] = packet->read_address & 0xFF; // address Lo
+  frame[4] = packet->read_registers >> 8; // no_of_registers Hi
+  frame[5] = packet->read_registers & 0xFF; // no_of_registers Lo
+        
+  unsigned int crc16;
+	
+  // construct the frame according to the modbus function  
+  if (packet->function == PRESET_MULTIPLE_REGISTERS) 
+  {
+    unsigned char no_of_bytes = packet->no_of_registers * 2;
+    unsigned char frameSize = 9 + no_of_bytes; // first 7 bytes of the array + 2 bytes CRC+ noOfBytes
+    frame[6] = no_of_bytes; // number of bytes
+    unsigned char index = 7; // user data starts at index 7
+    unsigned int temp;
+		unsigned char no_of_registers = packet->no_of_registers;
+    for (unsigned char i = 0; i < no_of_registers; i++)
+    {
+      temp = packet->register_array[i]; // get the data
+      frame[index] = temp >> 8;
+      index++;
+      frame[index] = temp & 0xFF;
+      index++;
+    }
+    crc16 = modbus_crc16(frame, frameSize - 2);	
+    frame[frameSize - 2] = crc16 >> 8; // split crc into 2 bytes
+    frame[frameSize - 1] = crc16 & 0xFF;
+    sendPacket(port, frameSize);
+  }
+	else if (packet->function == FORCE_MULTIPLE_COILS)
+	{
+		// the coils are sent packed 8 to a byte like bit_array keeps them
+		unsigned char no_of_bytes = (packet->no_of_registers + 7) / 8;
+		unsigned char frameSize = 9 + no_of_bytes; // first 7 bytes of the array + 2 bytes CRC+ noOfBytes
+		frame[6] = no_of_bytes; // number of bytes
+		modbus_pack_bits(&frame[7], packet->bit_array, 0, packet->no_of_registers);
+		crc16 = modbus_crc16(frame, frameSize - 2);	
+		frame[frameSize - 2] = crc16 >> 8; // split crc into 2 bytes
+		frame[frameSize - 1] = crc16 & 0xFF;
+		sendPacket(port, frameSize);
+	}
+	else if (packet->function == READ_WRITE_MULTIPLE_REGISTERS)
+	{
+		// the registers are written first and then read back in the same
+		// transaction, the read range is already in bytes 2 to 5
+		unsigned char no_of_bytes = packet->no_of_write_registers * 2;
+		unsigned char frameSize = 13 + no_of_bytes; // 11 bytes of the array + noOfBytes + 2 bytes CRC
+		frame[6] = packet->write_address >> 8; // write address Hi
+		frame[7] = packet->write_address & 0xFF; // write address Lo
+		frame[8] = packet->no_of_write_registers >> 8; // no_of_write_registers Hi
+		frame[9] = packet->no_of_write_registers & 0xFF; // no_of_write_registers Lo
+		frame[10] = no_of_bytes; // number of bytes
+		unsigned char index = 11; // user data starts at index 11
+		unsigned int temp;
+		unsigned char no_of_registers = packet->no_of_write_registers;
+		for (unsigned char i = 0; i < no_of_registers; i++)
+		{
+			temp = packet->write_array[i]; // get the data
+			frame[index] = temp >> 8;
+			index++;
+			frame[index] = temp & 0xFF;
+			index++;
+		}
+		crc16 = modbus_crc16(frame, frameSize - 2);	
+		frame[frameSize - 2] = crc16 >> 8; // split crc into 2 bytes
+		frame[frameSize - 1] = crc16 & 0xFF;
+		sendPacket(port, frameSize);
+	}
+	else // READ_HOLDING_REGISTERS, READ_COIL_STATUS, READ_INPUT_STATUS or FORCE_SINGLE_COIL
+	{
+		if (packet->function == FORCE_SINGLE_COIL)
+		{
+			frame[4] = modbus_get_bit(packet->bit_array, 0) ? 0xFF : 0x00; // 0xFF00 is ON, 0x0000 OFF
+			frame[5] = 0x00;
+		}
+		crc16 = modbus_crc16(frame, 6); // the first 6 bytes of the frame is used in the CRC calculation
+    frame[6] = crc16 >> 8; // crc Lo
+    frame[7] = crc16 & 0xFF; // crc Hi
+    sendPacket(port, 8); // a request with function 1, 2, 3, 4, 5 & 6 is always 8 bytes in size 
+	}
+	
+	// there will be no response to a write on the broadcast id
+	if (packet->id == 0 && (packet->function == PRESET_MULTIPLE_REGISTERS || 
+			packet->function == FORCE_SINGLE_COIL || packet->function == FORCE_MULTIPLE_COILS))
+	{
+		port->messageOkFlag = 1; // message successful
+		port->previousPolling = millis(); // start the polling delay
+		if (!port->txLength) // already sent, otherwise traced by txComplete()
+			traceTransaction(port);
+	}
+}
+  
+static void checkResponse(ModbusPort* port)
+{
+	Packet* packet = port->packet;
+	unsigned char* frame = port->frame;
+	
+	if (!port->messageOkFlag && !port->messageErrFlag) // check for response
+	{	
+    	unsigned char buffer = getData(port);
+       
+    	if (buffer > 0) // if there's something in the buffer continue
+    	{
+      		if (frame[0] == packet->id) // check id returned
+      		{
+				// to indicate an exception response a slave will 'OR' 
+    			// the requested function with 0x80 
+				if ((frame[1] & 0x80) == 0x80) // extract 0x80
+				{
+					// the third byte in the exception response packet is the actual exception
+					switch (frame[2])
+					{
+						case ILLEGAL_FUNCTION: packet->illegal_function++; break;
+						case ILLEGAL_DATA_ADDRESS: packet->illegal_data_address++; break;
+						case ILLEGAL_DATA_VALUE: packet->illegal_data_value++; break;
+						default: packet->misc_exceptions++;
+					}
+					port->traceStatus = MODBUS_TRACE_EXCEPTION;
+					port->traceException = frame[2];
+					port->messageErrFlag = 1; // set an error
+					port->previousPolling = millis(); // start the polling delay
+				}
+				else // the response is valid
+				{
+					if (frame[1] == packet->function) // check function number returned
+					{
+						// receive the frame according to the modbus function
+						if (packet->function == PRESET_MULTIPLE_REGISTERS || 
+								packet->function == FORCE_SINGLE_COIL || packet->function == FORCE_MULTIPLE_COILS) 
+							check_F16_data(port);
+						else if (packet->function == READ_COIL_STATUS || packet->function == READ_INPUT_STATUS)
+							check_bit_data(port, buffer);
+						else // READ_HOLDING_REGISTERS is assumed, a function 23 response looks the same
+							check_F3_data(port, buffer);
+					}
+					else // incorrect function number returned
+					{
+						packet->incorrect_function_returned++; 
+						port->traceStatus = MODBUS_TRACE_FUNCTION;
+						port->messageErrFlag = 1; // set an error
+						port->previousPolling = millis(); // start the polling delay
+					} 
+				} // check exception response
+			} 
+			else // incorrect id returned
+			{
+				packet->incorrect_id_returned++; 
+				port->traceStatus = MODBUS_TRACE_ID;
+				port->messageErrFlag = 1; // set an error
+				port->previousPolling = millis(); // start the polling delay
+			}
+		} // check buffer
+	} // check message booleans
+}
+
+// checks the time out and polling delay and if a message has been recieved succesfully 
+static void check_packet_status(ModbusPort* port)
+{
+	Packet* packet = port->packet;
+	
+  // an urgent packet doesn't wait for the polling delay
+  unsigned char pollingFinished = (millis() - port->previousPolling) > port->polling || port->urgent;
+
+  if (port->messageOkFlag && pollingFinished) // if a valid message was recieved and the polling delay has expired clear the flag
+  {
+    port->messageOkFlag = 0;
+    packet->successful_requests++; // transaction sent successfully
+    packet->retries = 0; // if a request was successful reset the retry counter
+    packet->backoff = 0; // and poll it normally again
+    if (port->max_backoff)
+      packet->connection = 1;
+    if (packet->max_interval > packet->interval)
+      adaptInterval(port);
+    for (Packet* p = packet->next_merged; p; p = p->next_merged)
+      p->successful_requests++;
+    learnTiming(port);
+    if (port->writing)
+      setpointsWritten(port, 1);
+    else if (port->setpoints)
+      verifySetpoints(port, packet);
+    port->transmission_ready_Flag = 1; 
+  }  
+	
+  // if an error message was recieved and the polling delay has expired clear the flag
+  if (port->messageErrFlag && pollingFinished) 
+  {
+    port->messageErrFlag = 0; // clear error flag 
+    packet->retries++;
+    backoff(port);
+    learnTiming(port);
+    if (port->writing)
+      setpointsWritten(port, 0);
+    if (port->requesting)
+      requeue(port, packet);
+    port->transmission_ready_Flag = 1;
+  } 
+ 	
+  // if the timeout delay has past clear the slot number for next request
+  if (!port->transmission_ready_Flag && ((millis() - port->previousTimeout) > port->slaveTimeout)) 
+  {
+    packet->timeout++;
+    packet->retries++;
+    port->traceStatus = MODBUS_TRACE_TIMEOUT;
+    traceTransaction(port);
+    learnTiming(port);
+    backoff(port);
+    if (port->writing)
+      setpointsWritten(port, 0);
+    if (port->requesting)
+      requeue(port, packet);
+    port->transmission_ready_Flag = 1; 
+  }
+    
+  // if the number of retries have reached the max number of retries 
+  // allowable, stop requesting the specific packet
+  if (packet->retries == port->retry_count)
+	{
+    packet->connection = 0;
+		packet->retries = 0;
+	}
+	
+	// packets read by the same request share its connection status
+	for (Packet* p = packet->next_merged; p; p = p->next_merged)
+		p->connection = packet->connection;
+		
+	if (port->transmission_ready_Flag)
+	{
+		// update the total_errors atribute of the 
+		// packet before requesting a new one
+		packet->total_errors = packet->timeout + 
+													 packet->incorrect_id_returned +
+													 packet->incorrect_function_returned +
+													 packet->incorrect_bytes_returned +
+													 packet->checksum_failed +
+													 packet->buffer_errors +
+													 packet->illegal_function +
+													 packet->illegal_data_address +
+													 packet->illegal_data_value;
+	}
+}
+
+// Skips the current packet for the next backoff interval, the interval
+// doubles with every failure in a row up to max_backoff.
+static void backoff(ModbusPort* port)
+{
+	Packet* packet = port->packet;
+	
+	if (!port->max_backoff)
+		return;
+	
+	if (!packet->backoff)
+		packet->backoff = port->min_backoff;
+	else if (packet->backoff < port->max_backoff / 2)
+		packet->backoff *= 2;
+	else
+		packet->backoff = port->max_backoff;
+	
+	packet->next_attempt = millis() + packet->backoff;
+}
+
+// After a response that changed nothing the packet's interval grows by half
+// up to max_interval, a change brings it straight back down to interval.
+static void adaptInterval(ModbusPort* port)
+{
+	Packet* packet = port->packet;
+	
+	// writes change nothing, they keep the interval they have
+	if (packet->function == PRESET_MULTIPLE_REGISTERS || 
+			packet->function == FORCE_SINGLE_COIL || packet->function == FORCE_MULTIPLE_COILS)
+		return;
+	
+	unsigned int previous = packet->poll_interval;
+	unsigned int interval;
+	
+	if (port->dataChanged)
+		interval = packet->interval;
+	else if (previous < packet->max_interval - previous / 2)
+		interval = previous + previous / 2 + 1;
+	else
+		interval = packet->max_interval;
+	
+	packet->poll_interval = interval;
+	packet->next_poll = packet->next_poll - previous + interval; // it was set from the old interval
+}
+
+static Packet* mostOverdue(ModbusPort* port)
+{
+	Packet* overdue = port->packet;
+	unsigned long now = millis();
+	
+	for (unsigned int i = 0; i < port->total_no_of_packets; i++)
+	{
+		Packet* p = &port->packets[i];
+		if (p->poll_interval && p->connection && !p->backoff && !p->merged_into && !p->priority &&
+				(long)(now - p->next_poll) >= 0 && (long)(p->next_poll - overdue->next_poll) < 0)
+			overdue = p;
+	}
+	
+	return overdue;
+}
+
+// The packet queued by modbus_port_request() or due with a priority above
+// routine that goes next: the highest class first and within a class the
+// one that has waited longest. waited is set to the microseconds it has,
+// for a packet due by its interval to within a millisecond.
+static Packet* priorityPacket(ModbusPort* port, unsigned long* waited)
+{
+	Packet* next = 0;
+	unsigned long longest = 0;
+	unsigned long now = millis();
+	unsigned long now_us = micros();
+	
+	for (unsigned int i = 0; i < port->total_no_of_packets; i++)
+	{
+		Packet* p = &port->packets[i];
+		unsigned long wait;
+		
+		if (p->requested)
+			wait = now_us - p->queued;
+		else if (!p->priority || !p->poll_interval || p->merged_into) // only on demand
+			continue;
+		else if (p->backoff) // re-probes take turns with other packets
+		{
+			if (port->probing || (long)(now - p->next_attempt) < 0)
+				continue;
+			wait = (now - p->next_attempt) * 1000;
+		}
+		else if ((!p->connection && !port->max_backoff) || (long)(now - p->next_poll) < 0)
+			continue;
+		else
+			wait = (now - p->next_poll) * 1000;
+		
+		if (!next || p->priority > next->priority || (p->priority == next->priority && wait > longest))
+		{
+			next = p;
+			longest = wait;
+		}
+	}
+	
+	*waited = longest;
+	return next;
+}
+
+// A request queued by modbus_port_request() failed, it is queued again 
+// until retry_count attempts in a row have failed.
+static void requeue(ModbusPort* port, Packet* packet)
+{
+	if (packet->retries < port->retry_count)
+		modbus_port_request(port, packet);
+}
+
+// Credit is kept in percent microseconds: it grows by budget for every
+// microsecond that passes and a character or frame delay on the line 
+// costs 100 for every microsecond it takes. A request may start when 
+// the credit is not negative, so the line is busy at most budget percent
+// of the time on average.
+static unsigned char busAvailable(ModbusPort* port)
+{
+	unsigned long now = micros();
+	unsigned long elapsed = now - port->creditTime;
+	port->creditTime = now;
+	
+	// no more than a full request and response can be saved up
+	long burst = (2L * MODBUS_BUFFER_SIZE * port->charTime + 2L * port->T3_5) * 100;
+	if (elapsed > (unsigned long)(burst / port->budget))
+		elapsed = burst / port->budget;
+	port->busCredit += (long)elapsed * port->budget;
+	if (port->busCredit > burst)
+		port->busCredit = burst;
+	
+	return port->busCredit >= 0;
+}
+
+// charges a frame of the given size and the frame delay after it
+static void useBus(ModbusPort* port, unsigned char bytes)
+{
+	if (port->budget)
+		port->busCredit -= ((long)bytes * port->charTime + port->T3_5) * 100;
+}
+
+static void check_F3_data(ModbusPort* port, unsigned char buffer)
+{
+	Packet* packet = port->packet;
+	unsigned char* frame = port->frame;
+	
+  unsigned char no_of_bytes = packet->read_registers * 2;
+  if (frame[2] == no_of_bytes) // check number of bytes returned
+  {
+    // combine the crc Low & High bytes
+    unsigned int recieved_crc = ((frame[buffer - 2] << 8) | frame[buffer - 1]); 
+    unsigned int calculated_crc = modbus_crc16(frame, buffer - 2);
+				
+    if (calculated_crc == recieved_crc) // verify checksum
+    {
+      // hand every packet the request covers its own registers
+      for (Packet* p = packet; p; p = p->next_merged)
+      {
+        // start at the 4th element in the recieveFrame and combine the Lo byte 
+        unsigned char index = 3 + (p->address - packet->read_address) * 2;
+        unsigned char no_of_registers = p->no_of_registers;
+        for (unsigned char i = 0; i < no_of_registers; i++)
+        {
+          storeRegister(port, p, i, (frame[index] << 8) | frame[index + 1]); 
+          index += 2;
+        }
+      }
+      port->messageOkFlag = 1; // message successful
+    }
+    else // checksum failed
+    {
+      packet->checksum_failed++; 
+      port->traceStatus = MODBUS_TRACE_CHECKSUM;
+      port->messageErrFlag = 1; // set an error
+    }
+      
+    // start the polling delay for messageOkFlag & messageErrFlag
+    port->previousPolling = millis(); 
+  }
+  else // incorrect number of bytes returned  
+  {
+    packet->incorrect_bytes_returned++; 
+    port->traceStatus = MODBUS_TRACE_BYTES;
+    port->messageErrFlag = 1; // set an error
+    port->previousPolling = millis(); // start the polling delay
+  }	                     
+}
+  
+// checks the response of a write, functions 5, 15 and 16 echo the address
+// and the number of registers or coils written, function 5 the coil value
+static void check_F16_data(ModbusPort* port)
+{
+	Packet* packet = port->packet;
+	unsigned char* frame = port->frame;
+	
+  unsigned int recieved_address = ((frame[2] << 8) | frame[3]);
+  unsigned int recieved_registers = ((frame[4] << 8) | frame[5]); 
+  unsigned int recieved_crc = ((frame[6] << 8) | frame[7]); // combine the crc Low & High bytes
+  unsigned int calculated_crc = modbus_crc16(frame, 6); // only the first 6 bytes are used for crc calculation
+  unsigned int expected_registers = packet->no_of_registers;
+  
+  if (packet->function == FORCE_SINGLE_COIL)
+    expected_registers = modbus_get_bit(packet->bit_array, 0) ? 0xFF00 : 0x0000;
+  
+  // check the whole packet		
+  if (recieved_address == packet->address && 
+      recieved_registers == expected_registers && 
+      recieved_crc == calculated_crc)
+      port->messageOkFlag = 1; // message successful
+  else
+  {
+    packet->checksum_failed++; 
+    port->traceStatus = MODBUS_TRACE_CHECKSUM;
+    port->messageErrFlag = 1;
+  }
+						
+  // start the polling delay for messageOkFlag & messageErrFlag
+  port->previousPolling = millis();
+}
+
+static void check_bit_data(ModbusPort* port, unsigned char buffer)
+{
+	Packet* packet = port->packet;
+	unsigned char* frame = port->frame;
+	
+  unsigned char no_of_bytes = (packet->no_of_registers + 7) / 8;
+  if (frame[2] == no_of_bytes && buffer == 5 + no_of_bytes) // check number of bytes returned
+  {
+    // combine the crc Low & High bytes
+    unsigned int recieved_crc = ((frame[buffer - 2] << 8) | frame[buffer - 1]); 
+    unsigned int calculated_crc = modbus_crc16(frame, buffer - 2);
+				
+    if (calculated_crc == recieved_crc) // verify checksum
+    {
+      // the coils or inputs start at the 4th element, packed like bit_array.
+      // Only the bytes that differ are looked at bit by bit.
+      unsigned int no_of_bits = packet->no_of_registers;
+      for (unsigned char i = 0; i < no_of_bytes; i++)
+      {
+        unsigned char mask = (i * 8u + 8 <= no_of_bits) ? 0xFF : (1 << (no_of_bits & 7)) - 1;
+        unsigned char difference = (frame[3 + i] ^ packet->bit_array[i]) & mask;
+        if (!difference)
+          continue;
+        
+        packet->bit_array[i] ^= difference;
+        packet->changed = 1;
+        port->dataChanged = 1;
+        if (port->on_change)
+          for (unsigned char bit = 0; bit < 8; bit++)
+            if (difference & (1 << bit))
+              port->on_change(packet, i * 8 + bit, !modbus_get_bit(packet->bit_array, i * 8 + bit));
+      }
+      port->messageOkFlag = 1; // message successful
+    }
+    else // checksum failed
+    {
+      packet->checksum_failed++; 
+      port->traceStatus = MODBUS_TRACE_CHECKSUM;
+      port->messageErrFlag = 1; // set an error
+    }
+  }
+  else // incorrect number of bytes returned  
+  {
+    packet->incorrect_bytes_returned++; 
+    port->traceStatus = MODBUS_TRACE_BYTES;
+    port->messageErrFlag = 1; // set an error
+  }	                     
+  
+  // start the polling delay for messageOkFlag & messageErrFlag
+  port->previousPolling = millis(); 
+}
+
+// Stores a register of a response if it moved more than the packet's 
+// deadband away from the value in register_array and reports the change.
+static void storeRegister(ModbusPort* port, Packet* packet, unsigned int index, unsigned int value)
+{
+	unsigned int previous = packet->register_array[index];
+	
+	// the distance between the two 16 bit values the short way round
+	unsigned int difference = (value - previous) & 0xFFFF;
+	if (difference > 0x8000)
+		difference = (0 - difference) & 0xFFFF;
+	
+	if (difference == 0 || difference <= packet->deadband)
+		return;
+	
+	packet->register_array[index] = value;
+	packet->changed = 1;
+	port->dataChanged = 1;
+	if (port->on_change)
+		port->on_change(packet, index, previous);
+}
+
+// get the serial data from the buffer
+static unsigned char getData(ModbusPort* port)
+{
+	Stream* serial = port->serial;
+	
+	// Bytes are collected into frame[] as they arrive without waiting for 
+	// the rest of the response. The response is complete once the line has
+	// been silent for a frame delay.
+  while (serial->available())
+  {
+		// The maximum number of bytes is limited to the serial buffer size of 128 bytes
+		// If more bytes is received than the MODBUS_BUFFER_SIZE the overflow flag will be set
+		// and the rest of the response is read and discarded.
+		if (port->rxLength == MODBUS_BUFFER_SIZE)
+		{
+			port->rxOverflow = 1;
+			serial->read();
+		}
+		else
+		{
+			if (port->rxLength == 0 && !port->traceReceived)
+			{
+				port->traceFirstByte = micros();
+				port->traceReceived = 1;
+			}
+			else if (micros() - port->lastFrameTime > port->rxGap)
+				port->rxGap = micros() - port->lastFrameTime;
+			port->frame[port->rxLength] = serial->read();
+			port->rxLength++;
+		}
+		port->lastFrameTime = micros();
+  }
+	
+	if (port->rxLength == 0 || (micros() - port->lastFrameTime) < port->frameDelay)
+		return 0;
+	
+  unsigned char buffer = port->rxLength;
+	unsigned char overflowFlag = port->rxOverflow;
+	port->rxLength = 0;
+	port->rxOverflow = 0;
+	useBus(port, buffer);
+	
+	MODBUS_CAPTURE_FRAME(serial, MODBUS_CAPTURE_MASTER | (overflowFlag ? MODBUS_CAPTURE_OVERFLOW : 0), 
+											 port->lastFrameTime, port->frame, buffer);
+	
+  // The minimum buffer size from a slave can be an exception response of 5 bytes 
+  // If the buffer was partialy filled clear the buffer.
+	// The maximum number of bytes in a modbus packet is 256 bytes.
+	// The serial buffer limits this to 128 bytes.
+  // If the buffer overflows than clear the buffer and set
+  // a packet error.
+  if ((buffer > 0 && buffer < 5) || overflowFlag)
+  {
+    buffer = 0;
+    port->packet->buffer_errors++; 
+    port->traceStatus = MODBUS_TRACE_BUFFER;
+    port->messageErrFlag = 1; // set an error
+    port->previousPolling = millis(); // start the polling delay 
+  }
+	
+  return buffer;
+}
+
+unsigned long modbus_idle()
+{
+	return modbus_port_idle(&defaultPort);
+}
+
+// microseconds from now until micros() reaches time
+static unsigned long untilMicros(unsigned long now, unsigned long time)
+{
+	return (long)(time - now) > 0 ? time - now : 0;
+}
+
+// and until millis() reaches time
+static unsigned long untilMillis(unsigned long now, unsigned long time)
+{
+	long ms = time - millis();
+	if (ms <= 0)
+		return 0;
+	return ms * 1000 - now % 1000;
+}
+
+// The same conditions as modbus_port_update() checks, turned into the time
+// until they hold. It errs on the short side, an update with nothing to do
+// is cheap and the loop asks again.
+unsigned long modbus_port_idle(ModbusPort* port)
+{
+	unsigned long now = micros();
+	unsigned long idle = MODBUS_IDLE_MAX;
+	
+	// a request is still on its way out
+	if (port->txLength)
+		return untilMicros(now, port->txDoneTime);
+	
+	if (!port->transmission_ready_Flag)
+	{
+		// a checked response waits for the polling delay
+		if (port->messageOkFlag || port->messageErrFlag)
+			return port->urgent ? 0 : untilMillis(now, port->previousPolling + port->polling + 1);
+		// a response ends with a frame delay of silence
+		if (port->rxLength)
+			return untilMicros(now, port->lastFrameTime + port->frameDelay);
+		return untilMillis(now, port->previousTimeout + port->slaveTimeout + 1);
+	}
+	
+	// the packet due first
+	if (port->urgent)
+		idle = 0;
+	for (ModbusSetpoints* batch = port->setpoints; batch && idle; batch = batch->next)
+	{
+		if (batch->broadcastPending)
+			idle = 0;
+		for (unsigned int i = 0; i < batch->no_of_units && idle; i++)
+			if (batch->units[i].state == MODBUS_SETPOINT_WRITE)
+				idle = 0;
+	}
+	for (unsigned int i = 0; i < port->total_no_of_packets && idle; i++)
+	{
+		Packet* p = &port->packets[i];
+		unsigned long due;
+		
+		if (p->requested)
+			due = 0;
+		else if (p->merged_into || (p->priority && !p->poll_interval))
+			continue;
+		else if (port->max_backoff && p->backoff)
+			due = untilMillis(now, p->next_attempt);
+		else if (!p->connection && !port->max_backoff)
+			continue;
+		else if (p->poll_interval)
+			due = untilMillis(now, p->next_poll);
+		else
+			due = 0;
+		
+		if (due < idle)
+			idle = due;
+	}
+	
+	// the request can't start before the frame delay and the bus budget allow
+	unsigned long silence = untilMicros(now, port->lastFrameTime + port->frameDelay);
+	if (silence > idle)
+		idle = silence;
+	if (port->budget && !port->urgent)
+	{
+		long credit = port->busCredit + (long)(now - port->creditTime) * port->budget;
+		if (credit < 0 && (unsigned long)(-credit / port->budget + 1) > idle)
+			idle = -credit / port->budget + 1;
+	}
+	
+	return idle < MODBUS_IDLE_MAX ? idle : MODBUS_IDLE_MAX;
+}
+
+void modbus_configure(long baud, unsigned int _timeout, unsigned int _polling, 
+										unsigned char _retry_count, unsigned char _TxEnablePin, 
+										Packet* _packet, unsigned int _total_no_of_packets)
+{
+  modbusSerial.begin(baud);
+	modbus_port_configure(&defaultPort, &modbusSerial, baud, _timeout, _polling, 
+												_retry_count, _TxEnablePin, _packet, _total_no_of_packets);
+}
+
+void modbus_port_configure(ModbusPort* port, Stream* serial, long baud, 
+													 unsigned int _timeout, unsigned int _polling, 
+													 unsigned char _retry_count, unsigned char _TxEnablePin, 
+													 Packet* _packet, unsigned int _total_no_of_packets)
+{
+	port->serial = serial;
+	port->TxEnablePin = 0;
+	
+  if (_TxEnablePin > 1) 
+  { // pin 0 & pin 1 are reserved for RX/TX. To disable set _TxEnablePin < 2
+    port->TxEnablePin = _TxEnablePin; 
+    pinMode(port->TxEnablePin, OUTPUT);
+    digitalWrite(port->TxEnablePin, LOW);
+  }
+	
+	// Modbus states that a baud rate higher than 19200 must use a fixed 750 us 
+  // for inter character time out and 1.75 ms for a frame delay.
+  // For baud rates below 19200 the timeing is more critical and has to be calculated.
+  // E.g. 9600 baud in a 10 bit packet is 960 characters per second
+  // In milliseconds this will be 960characters per 1000ms. So for 1 character
+  // 1000ms/960characters is 1.04167ms per character and finaly modbus states an
+  // intercharacter must be 1.5T or 1.5 times longer than a normal character and thus
+  // 1.5T = 1.04167ms * 1.5 = 1.5625ms. A frame delay is 3.5T.
+	// Only T3.5 is needed, a response ends with a T3.5 silence on the line.
+	
+	if (baud > 19200)
+		port->T3_5 = 1750; 
+	else 
+		port->T3_5 = 35000000/baud; // 1T * 3.5 = T3.5
+	
+	// initialize connection status of each packet
+	port->packets = _packet;
+	for (unsigned int i = 0; i < _total_no_of_packets; i++)
+	{
+		_packet->connection = 1;
+		_packet->backoff = 0;
+		_packet->poll_interval = _packet->interval;
+		_packet->next_poll = millis(); // due now, whatever the array held
+		_packet->merged_into = 0;
+		_packet->next_merged = 0;
+		_packet->requested = 0;
+		_packet->queued = 0;
+		_packet++;
+	}
+	
+	// A HardwareSerial port buffers writes and reports the free space, then 
+	// requests are sent in the background. SoftwareSerial reports no space,
+	// it sends every byte as it is written and the request blocks instead.
+	// With a transmit enable pin the pin is only released by the next update,
+	// so the request blocks as it always has unless modbus_background_tx()
+	// says loop() is short enough.
+	port->asyncTx = serial->availableForWrite() > 0 && port->TxEnablePin < 2;
+	port->charTime = (10000000 + baud - 1) / baud; // 10 bits per character rounded up
+	port->txLength = 0;
+	port->rxLength = 0;
+	port->rxOverflow = 0;
+	port->lastFrameTime = micros();
+	
+	// initialize
+	port->transmission_ready_Flag = 1;
+	port->messageOkFlag = 0; 
+  port->messageErrFlag = 0;
+  port->timeout = _timeout;
+  port->polling = _polling;
+	port->retry_count = _retry_count;
+	port->min_backoff = 0; // failing packets are dropped after retry_count, see modbus_port_backoff()
+	port->max_backoff = 0;
+	port->probing = 0;
+	port->on_change = 0;
+	port->budget = 0; // the line may be used all the time, see modbus_port_budget()
+	port->busCredit = 0;
+	port->creditTime = micros();
+	port->dataChanged = 0;
+	port->trace = 0; // see modbus_port_trace()
+	port->traceSize = 0;
+	port->traceHead = 0;
+	port->traceTotal = 0;
+	port->histograms = 0;
+	port->no_of_histograms = 0;
+	port->traceReceived = 0;
+	port->traceStatus = MODBUS_TRACE_OK;
+	port->traceException = 0;
+	port->setpoints = 0; // see modbus_port_setpoints()
+	port->writing = 0;
+	port->share = MODBUS_PRIORITY_SHARE; // see modbus_port_priority()
+	port->preempted = 0;
+	port->urgent = 0;
+	port->requesting = 0;
+	port->delays = 0;
+	port->timings = 0; // see modbus_port_tune()
+	port->no_of_timings = 0;
+	port->margin = 0;
+	port->min_frame_delay = 0;
+	port->frameDelay = port->T3_5;
+	port->slaveTimeout = _timeout;
+	port->tuned = 0;
+	port->requestEnd = 0;
+	port->rxGap = 0;
+	port->total_no_of_packets = _total_no_of_packets;
+	port->packet_index = 0;
+	port->packet = port->packets;
+  port->previousTimeout = 0; 
+  port->previousPolling = 0; 
+} 
+
+void modbus_backoff(unsigned int _min_backoff, unsigned int _max_backoff)
+{
+	modbus_port_backoff(&defaultPort, _min_backoff, _max_backoff);
+}
+
+void modbus_port_backoff(ModbusPort* port, unsigned int _min_backoff, unsigned int _max_backoff)
+{
+	if (_min_backoff == 0) // the interval has to be able to grow
+		_min_backoff = 1;
+	if (_max_backoff && _max_backoff < _min_backoff)
+		_max_backoff = _min_backoff;
+	
+	port->min_backoff = _min_backoff;
+	port->max_backoff = _max_backoff;
+}
+
+void modbus_background_tx(unsigned char _on)
+{
+	modbus_port_background_tx(&defaultPort, _on);
+}
+
+void modbus_port_background_tx(ModbusPort* port, unsigned char _on)
+{
+	port->asyncTx = _on && port->serial->availableForWrite() > 0;
+}
+
+void modbus_coalesce(unsigned int _max_gap)
+{
+	modbus_port_coalesce(&defaultPort, _max_gap);
+}
+
+// Packets of one slave are merged greedily from the lowest address up. The
+// packet starting a request takes the next lowest packet as long as it is 
+// no more than _max_gap registers past the end of the range and the 
+// response of the whole range still fits into frame[]. Packets with a
+// priority are left alone, they are only sent when queued and a merged
+// packet isn't sent at all.
+void modbus_port_coalesce(ModbusPort* port, unsigned int _max_gap)
+{
+	// a function 3 response has 5 bytes of id, function, byte count and crc
+	const unsigned int max_registers = (MODBUS_BUFFER_SIZE - 5) / 2;
+	
+	Packet* packets = port->packets;
+	unsigned int total = port->total_no_of_packets;
+	
+	for (unsigned int i = 0; i < total; i++)
+	{
+		packets[i].merged_into = 0;
+		packets[i].next_merged = 0;
+	}
+	
+	for (;;)
+	{
+		// the lowest packet not merged yet starts a new request
+		Packet* first = 0;
+		for (unsigned int i = 0; i < total; i++)
+		{
+			Packet* p = &packets[i];
+			if (p->function == READ_HOLDING_REGISTERS && p->id && !p->priority && !p->merged_into && 
+					(!first || p->address < first->address))
+				first = p;
+		}
+		
+		if (!first)
+			break;
+		
+		first->merged_into = first; // marks it as taken until all are merged
+		first->read_address = first->address;
+		first->read_registers = first->no_of_registers;
+		Packet* last = first;
+		
+		for (;;)
+		{
+			unsigned int end = first->read_address + first->read_registers;
+			Packet* next = 0;
+			for (unsigned int i = 0; i < total; i++)
+			{
+				Packet* p = &packets[i];
+				if (p->function == READ_HOLDING_REGISTERS && p->id == first->id && !p->priority && 
+						!p->merged_into && (!next || p->address < next->address))
+					next = p;
+			}
+			
+			if (!next || next->address > end + _max_gap)
+				break;
+			
+			unsigned int next_end = next->address + next->no_of_registers;
+			if (next_end < end)
+				next_end = end;
+			if (next_end - first->read_address > max_registers)
+				break;
+			
+			next->merged_into = first;
+			last->next_merged = next;
+			last = next;
+			first->read_registers = next_end - first->read_address;
+		}
+	}
+	
+	// a packet starting a request is requested itself
+	for (unsigned int i = 0; i < total; i++)
+		if (packets[i].merged_into == &packets[i])
+			packets[i].merged_into = 0;
+}
+
+void modbus_budget(unsigned char _budget)
+{
+	modbus_port_budget(&defaultPort, _budget);
+}
+
+void modbus_port_budget(ModbusPort* port, unsigned char _budget)
+{
+	if (_budget >= 100) // the whole line, the same as no budget
+		_budget = 0;
+	
+	port->budget = _budget;
+	port->busCredit = 0;
+	port->creditTime = micros();
+}
+
+void modbus_request(Packet* _packet)
+{
+	modbus_port_request(&defaultPort, _packet);
+}
+
+// A packet is queued once, asking again before it has been requested keeps
+// the time it was first queued. A packet read by the request of another
+// one queues that one.
+void modbus_port_request(ModbusPort* port, Packet* _packet)
+{
+	if (_packet->merged_into)
+		_packet = _packet->merged_into;
+	if (_packet->requested)
+		return;
+	
+	_packet->queued = micros();
+	_packet->requested = 1;
+	if (_packet->priority >= MODBUS_PRIORITY_URGENT)
+	{
+		_packet->requested = 2;
+		port->urgent++;
+	}
+}
+
+void modbus_priority(unsigned char _share, ModbusHistogram* _delays)
+{
+	modbus_port_priority(&defaultPort, _share, _delays);
+}
+
+void modbus_port_priority(ModbusPort* port, unsigned char _share, ModbusHistogram* _delays)
+{
+	port->share = _share;
+	port->preempted = 0;
+	port->delays = _delays;
+	
+	for (unsigned char c = 0; _delays && c < MODBUS_PRIORITIES; c++)
+	{
+		ModbusHistogram* histogram = &_delays[c];
+		for (unsigned char b = 0; b < MODBUS_HISTOGRAM_BUCKETS; b++)
+			histogram->counts[b] = 0;
+		histogram->total = 0;
+		histogram->max = 0;
+	}
+}
+
+void modbus_tune(ModbusTiming* _timings, unsigned int _no_of_timings, 
+								 unsigned char _margin, unsigned int _min_frame_delay)
+{
+	modbus_port_tune(&defaultPort, _timings, _no_of_timings, _margin, _min_frame_delay);
+}
+
+// the crc of the measurements of a timing, byte by byte so that an entry 
+// saved on one machine checks on another
+static unsigned int timingCheck(const ModbusTiming* timing)
+{
+	unsigned char bytes[5];
+	bytes[0] = timing->turnaround >> 8;
+	bytes[1] = timing->turnaround & 0xFF;
+	bytes[2] = timing->gap >> 8;
+	bytes[3] = timing->gap & 0xFF;
+	bytes[4] = timing->samples;
+	return modbus_crc16(bytes, 5);
+}
+
+void modbus_port_tune(ModbusPort* port, ModbusTiming* _timings, unsigned int _no_of_timings, 
+											unsigned char _margin, unsigned int _min_frame_delay)
+{
+	port->timings = _no_of_timings ? _timings : 0;
+	port->no_of_timings = _no_of_timings;
+	port->margin = _margin;
+	port->min_frame_delay = _min_frame_delay;
+	
+	// what was measured before is kept if it is intact
+	for (unsigned int i = 0; i < _no_of_timings; i++)
+	{
+		ModbusTiming* timing = &_timings[i];
+		if (timing->check != timingCheck(timing))
+		{
+			timing->turnaround = 0;
+			timing->gap = 0;
+			timing->samples = 0;
+			timing->check = timingCheck(timing);
+		}
+		timing->state = MODBUS_TIMING_OK;
+	}
+}
+
+// Bytes of the response the current packet expects, the most there can be
+// for an exception or a function this doesn't know.
+static unsigned char responseBytes(Packet* packet)
+{
+	switch (packet->function)
+	{
+		case READ_COIL_STATUS:
+		case READ_INPUT_STATUS:
+			return 5 + (packet->no_of_registers + 7) / 8;
+		case READ_HOLDING_REGISTERS:
+			return 5 + packet->read_registers * 2;
+		case READ_WRITE_MULTIPLE_REGISTERS:
+			return 5 + packet->no_of_registers * 2;
+		case FORCE_SINGLE_COIL:
+		case FORCE_MULTIPLE_COILS:
+		case PRESET_MULTIPLE_REGISTERS:
+			return 8;
+	}
+	return MODBUS_BUFFER_SIZE;
+}
+
+// Sets the frame delay and time out of the transaction that is starting,
+// the configured ones unless the slave has been measured often enough.
+static void tuneTransaction(ModbusPort* port)
+{
+	Packet* packet = port->packet;
+	
+	port->frameDelay = port->T3_5;
+	port->slaveTimeout = port->timeout;
+	port->tuned = 0;
+	
+	if (!port->timings || packet->id == 0 || packet->id >= port->no_of_timings)
+		return;
+	
+	ModbusTiming* timing = &port->timings[packet->id];
+	if (timing->samples < MODBUS_TIMING_SAMPLES || timing->turnaround == 0xFFFF || 
+			timing->gap == 0xFFFF || timing->state == MODBUS_TIMING_VERIFY)
+		return;
+	
+	unsigned long scale = 100 + port->margin;
+	
+	// frames are told apart by T1.5 at the least, the standard asks for T3.5
+	unsigned long frameDelay = (unsigned long)timing->gap * MODBUS_TRACE_TICK * scale / 100;
+	if (frameDelay < port->charTime * 3 / 2)
+		frameDelay = port->charTime * 3 / 2;
+	if (frameDelay < port->min_frame_delay)
+		frameDelay = port->min_frame_delay;
+	if (frameDelay > port->T3_5)
+		frameDelay = port->T3_5;
+	
+	// every character of the response may come as late as the longest pause
+	unsigned long character = (unsigned long)timing->gap * MODBUS_TRACE_TICK;
+	if (character < port->charTime)
+		character = port->charTime;
+	unsigned long response = (unsigned long)timing->turnaround * MODBUS_TRACE_TICK + 
+													 responseBytes(packet) * character;
+	unsigned long timeout = (response * scale / 100 + frameDelay + 999) / 1000;
+	
+	port->frameDelay = frameDelay;
+	if (timeout < port->timeout)
+		port->slaveTimeout = timeout;
+	port->tuned = 1;
+}
+
+// Counts the times of the transaction that ended into the timing of its
+// slave.
+static void learnTiming(ModbusPort* port)
+{
+	Packet* packet = port->packet;
+	
+	if (!port->timings || packet->id == 0 || packet->id >= port->no_of_timings)
+		return;
+	
+	ModbusTiming* timing = &port->timings[packet->id];
+	unsigned char status = port->traceStatus;
+	
+	if (status == MODBUS_TRACE_TIMEOUT)
+	{
+		// a tuned time out may have been too short, the configured one tells
+		if (port->tuned && timing->state == MODBUS_TIMING_OK)
+			timing->state = MODBUS_TIMING_VERIFY;
+		else if (timing->state == MODBUS_TIMING_VERIFY)
+			timing->state = MODBUS_TIMING_SILENT;
+		return;
+	}
+	
+	if (status == MODBUS_TRACE_CHECKSUM || status == MODBUS_TRACE_BYTES || status == MODBUS_TRACE_BUFFER)
+	{
+		// perhaps a frame cut in two by a frame delay that is too short
+		if (port->tuned)
+		{
+			timing->turnaround = 0;
+			timing->gap = 0;
+			timing->samples = 0;
+			timing->check = timingCheck(timing);
+		}
+		return;
+	}
+	
+	if (!port->traceReceived)
+		return;
+	
+	// the first byte was read once it had arrived, one character after it
+	// started
+	long turnaround = port->traceFirstByte - port->requestEnd - port->charTime;
+	unsigned int ticks = traceTicks(turnaround > 0 ? turnaround : 0);
+	
+	if (ticks > timing->turnaround)
+		timing->turnaround = ticks;
+	if (traceTicks(port->rxGap) > timing->gap)
+		timing->gap = traceTicks(port->rxGap);
+	if (timing->samples < 255)
+		timing->samples++;
+	timing->state = MODBUS_TIMING_OK;
+	timing->check = timingCheck(timing);
+}
+
+void modbus_trace(ModbusTraceRecord* _trace, unsigned int _traceSize, 
+									ModbusHistogram* _histograms, unsigned int _no_of_histograms)
+{
+	modbus_port_trace(&defaultPort, _trace, _traceSize, _histograms, _no_of_histograms);
+}
+
+void modbus_port_trace(ModbusPort* port, ModbusTraceRecord* _trace, unsigned int _traceSize, 
+											 ModbusHistogram* _histograms, unsigned int _no_of_histograms)
+{
+	port->trace = _traceSize ? _trace : 0;
+	port->traceSize = _traceSize;
+	port->traceHead = 0;
+	port->traceTotal = 0;
+	port->histograms = _no_of_histograms ? _histograms : 0;
+	port->no_of_histograms = _no_of_histograms;
+	
+	for (unsigned int i = 0; i < _no_of_histograms; i++)
+	{
+		ModbusHistogram* histogram = &_histograms[i];
+		for (unsigned char b = 0; b < MODBUS_HISTOGRAM_BUCKETS; b++)
+			histogram->counts[b] = 0;
+		histogram->total = 0;
+		histogram->max = 0;
+	}
+}
+
+unsigned int modbus_trace_registers(unsigned int* regs, unsigned int size)
+{
+	return modbus_port_trace_registers(&defaultPort, regs, size);
+}
+
+unsigned int modbus_port_trace_registers(ModbusPort* port, unsigned int* regs, unsigned int size)
+{
+	if (!port->trace)
+		return 0;
+	
+	unsigned int count = size / 7;
+	if (count > port->traceSize)
+		count = port->traceSize;
+	if (count > port->traceTotal)
+		count = port->traceTotal;
+	
+	// the oldest of the newest count records
+	unsigned int index = (port->traceHead + port->traceSize - count) % port->traceSize;
+	for (unsigned int i = 0; i < count; i++)
+	{
+		ModbusTraceRecord* record = &port->trace[index];
+		regs[0] = (record->id << 8) | record->function;
+		regs[1] = (record->status << 8) | record->exception;
+		regs[2] = (record->started >> 16) & 0xFFFF;
+		regs[3] = record->started & 0xFFFF;
+		regs[4] = record->first_byte;
+		regs[5] = record->last_byte;
+		regs[6] = record->checked;
+		regs += 7;
+		if (++index == port->traceSize)
+			index = 0;
+	}
+	
+	return count;
+}
+
+// The first 8 buckets are 0 to 7 us, after that every power of two is
+// split into 4: bucket shift * 4 + (microseconds >> shift) where shift 
+// leaves the top 3 bits.
+static unsigned char histogramBucket(unsigned long microseconds)
+{
+	unsigned char shift = 0;
+	while ((microseconds >> shift) >= 8)
+		shift++;
+	
+	unsigned int bucket = shift * 4 + (microseconds >> shift);
+	return bucket < MODBUS_HISTOGRAM_BUCKETS ? bucket : MODBUS_HISTOGRAM_BUCKETS - 1;
+}
+
+void modbus_histogram_add(ModbusHistogram* histogram, unsigned long microseconds)
+{
+	unsigned char bucket = histogramBucket(microseconds);
+	if (histogram->counts[bucket] != (unsigned int)~0) // saturates instead of wrapping
+		histogram->counts[bucket]++;
+	histogram->total++;
+	if (microseconds > histogram->max)
+		histogram->max = microseconds;
+}
+
+unsigned long modbus_histogram_percentile(const ModbusHistogram* histogram, unsigned int permille)
+{
+	if (!histogram->total)
+		return 0;
+	
+	// the transaction permille of the way up, rounded up
+	unsigned long target = histogram->total - histogram->total * (1000 - permille) / 1000;
+	if (target == 0)
+		target = 1;
+	
+	unsigned long counted = 0;
+	for (unsigned char b = 0; b < MODBUS_HISTOGRAM_BUCKETS; b++)
+	{
+		counted += histogram->counts[b];
+		if (counted < target)
+			continue;
+		
+		// the highest value of the bucket, but never more than was seen
+		unsigned long highest = b;
+		if (b >= 8)
+		{
+			unsigned char shift = b / 4 - 1;
+			highest = ((unsigned long)(b % 4 + 5) << shift) - 1;
+		}
+		return highest < histogram->max ? highest : histogram->max;
+	}
+	
+	return histogram->max;
+}
+
+// microseconds as steps of a ModbusTraceRecord
+static unsigned int traceTicks(unsigned long microseconds)
+{
+	microseconds /= MODBUS_TRACE_TICK;
+	return microseconds < 0xFFFF ? microseconds : 0xFFFF;
+}
+
+// Writes the current transaction to the trace and its time to the
+// histogram of its slave.
+static void traceTransaction(ModbusPort* port)
+{
+	Packet* packet = port->packet;
+	unsigned long elapsed = micros() - port->traceStarted;
+	
+	if (port->histograms && packet->id < port->no_of_histograms)
+		modbus_histogram_add(&port->histograms[packet->id], elapsed);
+	
+	if (!port->trace)
+		return;
+	
+	ModbusTraceRecord* record = &port->trace[port->traceHead];
+	record->id = packet->id;
+	record->function = packet->function;
+	record->status = port->traceStatus;
+	record->exception = port->traceException;
+	record->started = port->traceStarted;
+	record->first_byte = port->traceReceived ? traceTicks(port->traceFirstByte - port->traceStarted) : 0xFFFF;
+	record->last_byte = port->traceReceived ? traceTicks(port->lastFrameTime - port->traceStarted) : 0xFFFF;
+	record->checked = traceTicks(elapsed);
+	
+	if (++port->traceHead == port->traceSize)
+		port->traceHead = 0;
+	port->traceTotal++;
+}
+
+void modbus_setpoints(ModbusSetpoints* _batch)
+{
+	modbus_port_setpoints(&defaultPort, _batch);
+}
+
+// The first and number of the registers from the first to the last one
+// that differ, 0 if none does. Setpoints are 16 bit values.
+static unsigned char differences(const unsigned int* values, const unsigned int* registers, 
+																 unsigned int count, unsigned char* first)
+{
+	unsigned int i = 0;
+	while (i < count && ((values[i] ^ registers[i]) & 0xFFFF) == 0)
+		i++;
+	if (i == count)
+		return 0;
+	
+	unsigned int last = count - 1;
+	while (((values[last] ^ registers[last]) & 0xFFFF) == 0)
+		last--;
+	
+	*first = i;
+	return last - i + 1;
+}
+
+// Plans the writes of a batch. The shared value of each register is found
+// with a majority vote in one pass, it is the value more than half of the
+// units have if there is one.
+void modbus_port_setpoints(ModbusPort* port, ModbusSetpoints* _batch)
+{
+	// a batch is added to the port once, its request looks like a packet
+	ModbusSetpoints** link = &port->setpoints;
+	while (*link && *link != _batch)
+		link = &(*link)->next;
+	if (!*link)
+	{
+		*link = _batch;
+		_batch->next = 0;
+		_batch->next_unit = 0;
+		memset(&_batch->packet, 0, sizeof(Packet));
+		_batch->packet.function = PRESET_MULTIPLE_REGISTERS;
+		_batch->packet.connection = 1;
+	}
+	
+	ModbusSetpointUnit* units = _batch->units;
+	unsigned int no_of_units = _batch->no_of_units;
+	unsigned int no_of_registers = _batch->no_of_registers;
+	
+	for (unsigned int r = 0; r < no_of_registers; r++)
+	{
+		unsigned int candidate = 0;
+		unsigned int votes = 0;
+		for (unsigned int i = 0; i < no_of_units; i++)
+		{
+			unsigned int value = units[i].values[r];
+			if (votes == 0)
+				candidate = value;
+			if (((value ^ candidate) & 0xFFFF) == 0)
+				votes++;
+			else
+				votes--;
+		}
+		_batch->shared[r] = candidate;
+	}
+	
+	// a broadcast pays off once it saves two requests
+	unsigned int sharing = 0;
+	unsigned char first;
+	for (unsigned int i = 0; i < no_of_units; i++)
+		if (!differences(units[i].values, _batch->shared, no_of_registers, &first))
+			sharing++;
+	_batch->broadcastPending = _batch->broadcast && sharing >= 2;
+	
+	// a write of the old values that is still under way is ignored
+	_batch->sending = no_of_units + 1;
+	
+	for (unsigned int i = 0; i < no_of_units; i++)
+	{
+		ModbusSetpointUnit* unit = &units[i];
+		unit->failures = 0;
+		unit->state = MODBUS_SETPOINT_WRITE;
+		unit->first = 0;
+		unit->count = no_of_registers;
+		
+		if (_batch->broadcastPending)
+		{
+			unit->count = differences(unit->values, _batch->shared, no_of_registers, &unit->first);
+			if (!unit->count)
+				unit->state = MODBUS_SETPOINT_BROADCAST;
+		}
+	}
+}
+
+unsigned int modbus_setpoints_pending(const ModbusSetpoints* _batch)
+{
+	unsigned int pending = 0;
+	for (unsigned int i = 0; i < _batch->no_of_units; i++)
+		if (_batch->units[i].state != MODBUS_SETPOINT_DONE && _batch->units[i].state != MODBUS_SETPOINT_FAILED)
+			pending++;
+	return pending;
+}
+
+// Makes the next setpoint write of the port the current packet, the
+// broadcast of a batch first and then its units in turns.
+static Packet* setpointPacket(ModbusPort* port)
+{
+	for (ModbusSetpoints* batch = port->setpoints; batch; batch = batch->next)
+	{
+		Packet* packet = &batch->packet;
+		
+		if (batch->broadcastPending)
+		{
+			packet->id = 0;
+			packet->address = batch->address;
+			packet->no_of_registers = batch->no_of_registers;
+			packet->register_array = batch->shared;
+			batch->sending = batch->no_of_units;
+		}
+		else
+		{
+			unsigned int i = 0;
+			unsigned int index = batch->next_unit;
+			for (; i < batch->no_of_units; i++, index++)
+			{
+				if (index >= batch->no_of_units)
+					index = 0;
+				if (batch->units[index].state == MODBUS_SETPOINT_WRITE)
+					break;
+			}
+			if (i == batch->no_of_units)
+				continue;
+			
+			ModbusSetpointUnit* unit = &batch->units[index];
+			packet->id = unit->id;
+			packet->address = batch->address + unit->first;
+			packet->no_of_registers = unit->count;
+			packet->register_array = unit->values + unit->first;
+			batch->sending = index;
+			batch->next_unit = index + 1;
+		}
+		
+		packet->backoff = 0; // a failing unit isn't a failing packet
+		port->writing = batch;
+		port->packet = packet;
+		return packet;
+	}
+	
+	return 0;
+}
+
+// The write of the current transaction has been answered or has failed.
+static void setpointsWritten(ModbusPort* port, unsigned char ok)
+{
+	ModbusSetpoints* batch = port->writing;
+	port->writing = 0;
+	
+	if (batch->sending == batch->no_of_units) // the broadcast, sent is all there is to know
+	{
+		batch->broadcastPending = 0;
+		for (unsigned int i = 0; i < batch->no_of_units; i++)
+		{
+			ModbusSetpointUnit* unit = &batch->units[i];
+			if (unit->state != MODBUS_SETPOINT_BROADCAST)
+				continue;
+			unit->state = unit->readback ? MODBUS_SETPOINT_VERIFY : MODBUS_SETPOINT_DONE;
+			if (unit->readback)
+				unit->reads = unit->readback->requests;
+		}
+	}
+	else if (batch->sending < batch->no_of_units)
+	{
+		ModbusSetpointUnit* unit = &batch->units[batch->sending];
+		if (!ok)
+		{
+			if (++unit->failures >= port->retry_count)
+				unit->state = MODBUS_SETPOINT_FAILED;
+		}
+		else if (unit->readback && unit->count < batch->no_of_registers)
+		{
+			// the rest of the registers came with the broadcast
+			unit->state = MODBUS_SETPOINT_VERIFY;
+			unit->reads = unit->readback->requests;
+		}
+		else
+		{
+			unit->failures = 0;
+			unit->state = MODBUS_SETPOINT_DONE;
+		}
+	}
+	
+	batch->sending = batch->no_of_units + 1;
+}
+
+// A read was answered, it checks the setpoints of the units it reads back
+// if it was requested after they were written.
+static void verifySetpoints(ModbusPort* port, Packet* packet)
+{
+	for (ModbusSetpoints* batch = port->setpoints; batch; batch = batch->next)
+		for (unsigned int i = 0; i < batch->no_of_units; i++)
+		{
+			ModbusSetpointUnit* unit = &batch->units[i];
+			if (unit->state != MODBUS_SETPOINT_VERIFY)
+				continue;
+			
+			Packet* readback = packet;
+			while (readback && readback != unit->readback)
+				readback = readback->next_merged;
+			if (!readback || readback->requests == unit->reads)
+				continue;
+			
+			// a readback that doesn't cover the setpoints can't tell
+			unit->state = MODBUS_SETPOINT_DONE;
+			if (batch->address < readback->address || 
+					batch->address + batch->no_of_registers > readback->address + readback->no_of_registers)
+				continue;
+			
+			unit->count = differences(unit->values, &readback->register_array[batch->address - readback->address],
+																batch->no_of_registers, &unit->first);
+			if (unit->count)
+				unit->state = ++unit->failures >= port->retry_count ? MODBUS_SETPOINT_FAILED : MODBUS_SETPOINT_WRITE;
+			else
+				unit->failures = 0;
+		}
+}
+
+void modbus_on_change(ModbusChangeCallback _on_change)
+{
+	modbus_port_on_change(&defaultPort, _on_change);
+}
+
+void modbus_port_on_change(ModbusPort* port, ModbusChangeCallback _on_change)
+{
+	port->on_change = _on_change;
+}
+
+// With a buffered serial port sendPacket() only starts the transmission.
+// transmit() keeps the serial TX buffer topped up from frame[] on every call
+// to modbus_update() and works out from the baud rate when the last byte will
+// have left the line. Half a character after that, a guard for the estimate
+// which starts from a micros() read before write() in 4us steps on the AVR,
+// txComplete() releases the transmit enable pin and starts the time out.
+// The frame delay before the next request is enforced in modbus_update()
+// from lastFrameTime instead of a delay.
+static void sendPacket(ModbusPort* port, unsigned char bufferSize)
+{
+	useBus(port, bufferSize);
+	
+	port->traceStarted = micros();
+	port->traceReceived = 0;
+	port->rxGap = 0;
+	port->traceStatus = MODBUS_TRACE_OK;
+	port->traceException = 0;
+	
+	MODBUS_CAPTURE_FRAME(port->serial, MODBUS_CAPTURE_MASTER | MODBUS_CAPTURE_TX, 
+											 port->traceStarted, port->frame, bufferSize);
+	
+	if (port->TxEnablePin > 1)
+		digitalWrite(port->TxEnablePin, HIGH);
+	
+	if (port->asyncTx)
+	{
+		port->txLength = bufferSize;
+		port->txIndex = 0;
+		port->txDoneTime = micros();
+		transmit(port);
+		return;
+	}
+		
+	for (unsigned char i = 0; i < bufferSize; i++)
+		port->serial->write(port->frame[i]);
+		
+	port->serial->flush();
+	port->lastFrameTime = micros();
+	port->requestEnd = port->lastFrameTime;
+	
+	// allow a frame delay to indicate end of transmission
+	delayMicroseconds(port->frameDelay); 
+	
+	if (port->TxEnablePin > 1)
+		digitalWrite(port->TxEnablePin, LOW);
+		
+	port->previousTimeout = millis(); // initialize timeout delay	
+}
+
+// Hands the serial port as many bytes as it can buffer and returns 1 once
+// the whole request has been sent.
+static unsigned char transmit(ModbusPort* port)
+{
+	while (port->txIndex < port->txLength && port->serial->availableForWrite() > 0)
+	{
+		// a byte written to an idle port starts straight away, otherwise it
+		// follows the byte before it
+		unsigned long now = micros();
+		if ((long)(port->txDoneTime - now) < 0)
+			port->txDoneTime = now;
+		port->txDoneTime += port->charTime;
+		
+		port->serial->write(port->frame[port->txIndex]);
+		port->txIndex++;
+		
+		// half a character of guard, see sendPacket()
+		if (port->txIndex == port->txLength)
+			port->txDoneTime += port->charTime / 2;
+	}
+	
+	if (port->txIndex == port->txLength && (long)(micros() - port->txDoneTime) >= 0)
+	{
+		txComplete(port);
+		return 1;
+	}
+	
+	return 0;
+}
+
+// TX complete event, the stop bit of the last byte has left the line
+static void txComplete(ModbusPort* port)
+{
+	port->txLength = 0;
+	port->lastFrameTime = micros();
+	port->requestEnd = port->lastFrameTime;
+	
+	if (port->TxEnablePin > 1)
+		digitalWrite(port->TxEnablePin, LOW);
+	
+	port->previousTimeout = millis(); // initialize timeout delay
+	
+	if (port->packet->id == 0) // a broadcast is finished once it has been sent
+	{
+		port->previousPolling = millis();
+		traceTransaction(port);
+	}
 }
\ No newline at end of file
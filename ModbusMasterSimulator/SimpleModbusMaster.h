@@ -1,147 +1,675 @@
-#ifndef SIMPLE_MODBUS_MASTER_H
-#define SIMPLE_MODBUS_MASTER_H
-
-/* 
-	 SimpleModbusMaster allows you to communicate
-	 to any slave using the Modbus RTU protocol.
-	
-	 To communicate with a slave you need to create a 
-   packet that will contain all the information
-   required to communicate to the slave. There are 
-   numerous counters for easy diagnostic.
-   These are variables already implemented in a 
-   packet. You can set and clear these variables
-   as needed.
-   
-   There are general modbus information counters:
-   requests - contains the total requests to a slave
-   successful_requests - contains the total successful requests
-   total_errors - contains the total errors as a sum
-   timeout - contains the total time out errors
-   incorrect_id_returned - contains the total incorrect id returned errors
-   incorrect_function_returned - contains the total incorrect function returned errors
-   incorrect_bytes_returned - contains the total incorrect bytes returned errors
-   checksum_failed - contains the total checksum failed errors
-   buffer_errors - contains the total buffer errors
-  
-   And there are modbus specific exception counters:
-   illegal_function - contains the total illegal_function errors
-   illegal_data_address - contains the total illegal_data_address errors
-   illegal_data_value - contains the total illegal_data_value errors
-	 misc_exceptions - contains the total miscellaneous returned exceptions 
-	
-   And finally there is variable called "connection" that 
-   at any given moment contains the current connection 
-   status of the packet. If true then the connection is 
-   active. If false then communication will be stopped
-   on this packet untill the programmer sets the connections
-   variable to true explicitly. The reason for this is 
-   because of the time out involved in modbus communication.
-   EACH faulty slave that's not communicating will slow down
-   communication on the line with the time out value. E.g.
-   Using a time out of 1500ms, if you have 10 slaves and 9 of them
-   stops communicating the latency burden placed on communication
-   will be 1500ms * 9 = 13,5 seconds!!!!
-   
-   In addition to this when all the packets are scanned and 
-   all of them have a false connection a value is returned
-   from modbus_port() to inform you something is wrong with 
-   the port. This is most likely to happen when there is 
-   something physically wrong with the RS485 line. 
-   This is only for information. You have to explicitly set 
-   each packets connection attribute to false. 
-   Packets scanning and communication will automatically
-   revert to normal.
-   
-   All the error checking, updating and communication multitasking
-   takes place in the background!
-  
-   In general to communicate with to a slave using modbus
-   RTU you will request information using the specific
-   slave id, the function request, the starting address
-   and lastly the number of registers to request.
-   Function 3 & 16 are supported. In addition to
-   this broadcasting (id = 0) is supported for function 16.
-   Constants are provided for:
-   Function 3 -  READ_HOLDING_REGISTERS 
-   Function 16 - PRESET_MULTIPLE_REGISTERS 
-	 
-	 Note:  
-   The Arduino serial ring buffer is 128 bytes or 64 registers.
-   Most of the time you will connect the arduino to a master via serial
-   using a MAX485 or similar.
- 
-   In a function 3 request the master will attempt to read from your
-   slave and since 5 bytes is already used for ID, FUNCTION, NO OF BYTES
-   and two BYTES CRC the master can only request 122 bytes or 61 registers.
- 
-   In a function 16 request the master will attempt to write to your 
-   slave and since a 9 bytes is already used for ID, FUNCTION, ADDRESS, 
-   NO OF REGISTERS, NO OF BYTES and two BYTES CRC the master can only write
-   118 bytes or 59 registers.
- 
-   Using the FTDI USB to Serial converter the maximum bytes you can send is limited 
-   to its internal buffer which is 60 bytes or 30 unsigned int registers. 
- 
-   Thus:
- 
-   In a function 3 request the master will attempt to read from your
-   slave and since 5 bytes is already used for ID, FUNCTION, NO OF BYTES
-   and two BYTES CRC the master can only request 54 bytes or 27 registers.
- 
-   In a function 16 request the master will attempt to write to your 
-   slave and since a 9 bytes is already used for ID, FUNCTION, ADDRESS, 
-   NO OF REGISTERS, NO OF BYTES and two BYTES CRC the master can only write
-   50 bytes or 25 registers.
- 
-   Since it is assumed that you will mostly use the Arduino to connect to a 
-   master without using a USB to Serial converter the internal buffer is set
-   the same as the Arduino Serial ring buffer which is 128 bytes.
-*/
-
-#include "Arduino.h"
-
-#define READ_HOLDING_REGISTERS 3
-#define	PRESET_MULTIPLE_REGISTERS 16
-
-typedef struct
-{
-  // specific packet info
-  unsigned char id;
-  unsigned char function;
-  unsigned int address;
-  unsigned int no_of_registers; 
-  unsigned int* register_array;
-  
-  // modbus information counters
-  unsigned int requests;
-  unsigned int successful_requests;
-  unsigned long total_errors;
-  unsigned int retries;
-  unsigned int timeout;
-  unsigned int incorrect_id_returned;
-  unsigned int incorrect_function_returned;
-  unsigned int incorrect_bytes_returned;
-  unsigned int checksum_failed;
-  unsigned int buffer_errors;
-  
-  // modbus specific exception counters
-  unsigned int illegal_function;
-  unsigned int illegal_data_address;
-  unsigned int illegal_data_value;
-	unsigned char misc_exceptions;
-	
-  // connection status of packet
-  unsigned char connection; 
-  
-}Packet;
-
-typedef Packet* packetPointer;
-
-// function definitions
-unsigned int modbus_update(Packet* packets);
-void modbus_configure(long baud, unsigned int _timeout, unsigned int _polling, 
-											unsigned char _retry_count, unsigned char _TxEnablePin,
-											Packet* packets, unsigned int _total_no_of_packets);
-
+#ifndef SIMPLE_MODBUS_MASTER_H
+#define SIMPLE_MODBUS_MASTER_H
+
+/* 
+	 SimpleModbusMaster allows you to communicate
+	 to any slave using the Modbus RTU protocol.
+	
+	 To communicate with a slave you need to create a 
+   packet that will contain all the information
+   required to communicate to the slave. There are 
+   numerous counters for easy diagnostic.
+   These are variables already implemented in a 
+   packet. You can set and clear these variables
+   as needed.
+   
+   There are general modbus information counters:
+   requests - contains the total requests to a slave
+   successful_requests - contains the total successful requests
+   total_errors - contains the total errors as a sum
+   timeout - contains the total time out errors
+   incorrect_id_returned - contains the total incorrect id returned errors
+   incorrect_function_returned - contains the total incorrect function returned errors
+   incorrect_bytes_returned - contains the total incorrect bytes returned errors
+   checksum_failed - contains the total checksum failed errors
+   buffer_errors - contains the total buffer errors
+  
+   And there are modbus specific exception counters:
+   illegal_function - contains the total illegal_function errors
+   illegal_data_address - contains the total illegal_data_address errors
+   illegal_data_value - contains the total illegal_data_value errors
+	 misc_exceptions - contains the total miscellaneous returned exceptions 
+	
+   And finally there is variable called "connection" that 
+   at any given moment contains the current connection 
+   status of the packet. If true then the connection is 
+   active. If false then communication will be stopped
+   on this packet untill the programmer sets the connections
+   variable to true explicitly. The reason for this is 
+   because of the time out involved in modbus communication.
+   EACH faulty slave that's not communicating will slow down
+   communication on the line with the time out value. E.g.
+   Using a time out of 1500ms, if you have 10 slaves and 9 of them
+   stops communicating the latency burden placed on communication
+   will be 1500ms * 9 = 13,5 seconds!!!!
+   
+   Instead of waiting for the programmer the master can back off on its
+   own. After modbus_backoff(1000, 60000) a packet that fails is skipped for
+   1 s, then 2 s, 4 s and so on up to a minute between attempts. Each
+   attempt costs at most one time out and attempts take turns with the
+   healthy packets, so the dead slaves above steal a little bandwidth now
+   and then while the healthy ones keep their polling rate. connection
+   still drops to false after retry_count failures in a row but the
+   packet keeps being probed and the first good response sets it back to
+   true and the interval back to normal polling.
+   
+   A sketch often reads one slave through several packets, e.g. the
+   temperature, the gravity and the valve states of a fermenter, each one
+   a request of its own. modbus_coalesce(max_gap) merges function 3
+   packets to the same id whose registers are at most max_gap registers
+   apart into the fewest requests that fit the frame buffer. The first 
+   packet of the merged range is requested and the response is copied into
+   the register_array of every packet it covers. Their requests, 
+   successful_requests and connection follow the requested packet, errors 
+   are only counted there. A max_gap of 0 merges adjacent ranges only and 
+   never reads a register no packet asked for, a slave may answer an 
+   illegal data address if a gap is read. Packets with a priority (see
+   modbus_request()) are never merged, a routine range would otherwise
+   only be read when the high priority packet is queued, or a high
+   priority packet lose its class to a routine one.
+   
+   Most registers of a large map hardly ever change, yet every poll 
+   delivers all of them again. A response only writes the registers of 
+   register_array (or the bits of bit_array) that differ from what is
+   there, sets the packet's changed flag, which the sketch clears once it
+   has dealt with the change, and calls the function given to 
+   modbus_on_change() once for every register that changed:
+   
+     void changed(Packet* packet, unsigned int index, unsigned int previous)
+     {
+       // packet->register_array[index] is the new value
+     }
+     ...
+     modbus_on_change(changed);
+   
+   A packet's deadband keeps noise out: a register is only updated and
+   reported when it has moved more than deadband away from the value last
+   reported, so a slow drift is still reported once it adds up. Registers
+   are compared as 16 bit values that wrap, so signed values and counters 
+   rolling over from 65535 to 0 work as expected. Coils and inputs have no
+   deadband, every change is reported.
+   
+   The polling delay given to modbus_configure() applies to every packet
+   alike, a cellar temperature that moves once a minute is read as often
+   as a pump pressure. A packet's interval sets the milliseconds between 
+   its requests, other packets are requested in the meantime. With a 
+   max_interval above interval the master adapts the interval itself: 
+   every response that changes nothing lets it grow by half up to 
+   max_interval and a change (beyond the deadband) brings it back down to
+   interval. A packet merged by modbus_coalesce() goes with the interval of
+   the packet requesting it. modbus_budget(percent) caps the share of time
+   the line carries requests and responses, frame delays included. When 
+   the budget is used up the master waits. Of the packets that are due
+   the one that has been due longest is requested first, so on a busy 
+   line every packet is late by about the same time.
+   
+   Pushing a recipe step to 30 fermenters with a function 16 packet each
+   takes 30 transactions, even when most of them get the same values. A
+   ModbusSetpoints batch holds the setpoints of one register layout for
+   any number of units, one batch per layout:
+   
+     ModbusSetpointUnit units[30]; // id, values and readback of each
+     ModbusSetpoints batch = { 100, 4, units, 30, shared, 1 };
+     ...
+     modbus_setpoints(&batch); // after every change of the values
+   
+   modbus_setpoints() puts the value most units have for each register 
+   into shared. If broadcast is set, which says that every slave on the
+   line that would take a broadcast is a unit, and at least two units 
+   have all of these values, they are sent in a single broadcast. Only the 
+   units that differ are then written one by one, and only the registers
+   that differ. A broadcast gets no response, so it is verified lazily: 
+   the next response to a unit's readback packet that was requested after
+   the write is compared with the unit's values and the registers that 
+   didn't take are written again. Read setpoints back with a deadband of
+   0. Setpoint writes go before the polled packets. 
+   modbus_setpoints_pending() counts the units still open, the state of 
+   each unit tells what is left to do.
+   
+   Routine packets are requested in turns, so a write that has to go out
+   now, closing a glycol valve say, waits behind every packet of the 
+   list. A packet's priority puts it into a class above the routine ones:
+   
+     closeValve.priority = MODBUS_PRIORITY_URGENT;
+     ...
+     modbus_request(&closeValve); // when the valve has to close
+   
+   modbus_request() queues a packet for one request. Of the queued 
+   packets, and the packets with a priority that are due by their 
+   interval, the highest class goes next and within a class the one that
+   has waited longest. A packet with a priority and no interval is only
+   requested when it is queued. An urgent packet cuts the polling delay 
+   and a bus budget short, the transaction already on the line is always
+   finished. A queued request that fails is queued again until 
+   retry_count attempts have failed. So that routine packets aren't shut
+   out, one of them goes after share higher transactions in a row, 4 
+   unless modbus_priority() sets it, and a routine packet waits at most 
+   for share of them and the routine packets before it. Classes above 
+   routine take no turns, a line kept busy with urgent packets starves the
+   high ones. modbus_priority() can also count the time from being queued
+   or due to being requested in a ModbusHistogram for every class.
+   Routine packets without an interval are always due and not counted.
+   
+   The time out and frame delay of modbus_configure() have to suit the 
+   slowest slave and the frame delay the standard asks for, 1750 us above
+   19200 baud, is 20 characters at 115200. With modbus_tune() the master
+   measures for every slave how long it takes to answer and the longest
+   pause between the bytes of a response, and once it has seen 
+   MODBUS_TIMING_SAMPLES answers it waits only that long plus a margin:
+   
+     ModbusTiming timings[32]; // slave ids 0 to 31
+     ...
+     modbus_tune(timings, 32, 50, 200);
+   
+   The frame delay that ends a response of a tuned slave is its longest
+   pause plus 50%, at least T1.5 and the 200 us every slave on the line 
+   needs to tell two frames apart, which the master can't measure and the
+   sketch has to know, and never above T3.5. The time out of a request is
+   the turnaround and the characters of the expected response with their
+   pauses plus 50%. A tuned time out that expires is checked by waiting
+   the configured time out on the next attempt, an answer then counts
+   towards the slave's timing, silence means it is gone and the tuned 
+   time out stays. A checksum, byte count or buffer error of a tuned 
+   slave, which a frame delay cut too short would cause, starts its 
+   measurements over. ModbusTiming is plain data, the sketch can put the
+   array into EEPROM now and then and get it back on the next start to 
+   be fast from the first scan, entries whose check doesn't match are 
+   cleared.
+   
+   The counters tell how often a packet failed, not how long its slave
+   takes or which slave eats the scan time. modbus_trace() records every
+   transaction in a ring of ModbusTraceRecord the sketch provides: the 
+   slave id and function, the micros() the request started and how long 
+   after that the first byte of the response was read, the last byte 
+   arrived and the response had been checked, plus what went wrong if 
+   anything. The times are in steps of 4 us, the resolution of micros() 
+   on a 16 MHz AVR, up to 262 ms. It also keeps a histogram of the time 
+   from request to checked response for every slave id below the number 
+   of ModbusHistogram given. Buckets are 4 to a power of two, so a 
+   latency is known within 25% from 1 us to 2 s, and 
+   modbus_histogram_percentile() reads the median, 99th percentile and 
+   so on from it. modbus_trace_registers() copies the newest records 
+   into a register array to serve from a slave port or write to a logger 
+   with a function 16 packet, 7 registers to a record:
+   
+     id << 8 | function, status << 8 | exception, 
+     started Hi, started Lo, first byte, last byte, checked
+   
+   In addition to this when all the packets are scanned and 
+   all of them have a false connection a value is returned
+   from modbus_port() to inform you something is wrong with 
+   the port. This is most likely to happen when there is 
+   something physically wrong with the RS485 line. 
+   This is only for information. You have to explicitly set 
+   each packets connection attribute to false. 
+   Packets scanning and communication will automatically
+   revert to normal.
+   
+   All the error checking, updating and communication multitasking
+   takes place in the background!
+  
+   In general to communicate with to a slave using modbus
+   RTU you will request information using the specific
+   slave id, the function request, the starting address
+   and lastly the number of registers to request.
+   Function 1, 2, 3, 5, 15, 16 & 23 are supported. In addition to
+   this broadcasting (id = 0) is supported for function 5, 15 & 16.
+   Constants are provided for:
+   Function 1 -  READ_COIL_STATUS
+   Function 2 -  READ_INPUT_STATUS
+   Function 3 -  READ_HOLDING_REGISTERS 
+   Function 5 -  FORCE_SINGLE_COIL
+   Function 15 - FORCE_MULTIPLE_COILS
+   Function 16 - PRESET_MULTIPLE_REGISTERS 
+   Function 23 - READ_WRITE_MULTIPLE_REGISTERS 
+   
+   Coils and discrete inputs are single bits. A function 1, 2, 5 or 15 
+   packet reads or writes no_of_registers of them starting at address and
+   keeps them in bit_array, 8 to a byte with the first one in bit 0 of 
+   bit_array[0]. modbus_get_bit() and modbus_set_bit() from ModbusRegisters.h
+   access them. A function 5 packet writes bit 0 of bit_array[0]. At most 
+   984 coils or inputs can be read and 952 coils written in one packet.
+   
+   A function 23 packet writes no_of_write_registers registers from
+   write_array starting at write_address and then reads no_of_registers
+   registers starting at address into register_array, all in one
+   transaction. A controller that writes a setpoint and reads back the 
+   state every cycle saves a round trip and a frame delay this way. At 
+   most 57 registers can be written and 61 read.
+	 
+	 Note:  
+   The Arduino serial ring buffer is 128 bytes or 64 registers.
+   Most of the time you will connect the arduino to a master via serial
+   using a MAX485 or similar.
+ 
+   In a function 3 request the master will attempt to read from your
+   slave and since 5 bytes is already used for ID, FUNCTION, NO OF BYTES
+   and two BYTES CRC the master can only request 122 bytes or 61 registers.
+ 
+   In a function 16 request the master will attempt to write to your 
+   slave and since a 9 bytes is already used for ID, FUNCTION, ADDRESS, 
+   NO OF REGISTERS, NO OF BYTES and two BYTES CRC the master can only write
+   118 bytes or 59 registers.
+ 
+   Using the FTDI USB to Serial converter the maximum bytes you can send is limited 
+   to its internal buffer which is 60 bytes or 30 unsigned int registers. 
+ 
+   Thus:
+ 
+   In a function 3 request the master will attempt to read from your
+   slave and since 5 bytes is already used for ID, FUNCTION, NO OF BYTES
+   and two BYTES CRC the master can only request 54 bytes or 27 registers.
+ 
+   In a function 16 request the master will attempt to write to your 
+   slave and since a 9 bytes is already used for ID, FUNCTION, ADDRESS, 
+   NO OF REGISTERS, NO OF BYTES and two BYTES CRC the master can only write
+   50 bytes or 25 registers.
+ 
+   Since it is assumed that you will mostly use the Arduino to connect to a 
+   master without using a USB to Serial converter the internal buffer is set
+   the same as the Arduino Serial ring buffer which is 128 bytes.
+
+   When the serial port buffers writes (a HardwareSerial) requests are sent
+   in the background. modbus_update() tops up the TX buffer on each call, 
+   releases the transmit enable pin once the last byte has left the line and
+   waits for the frame delay by checking the time rather than sleeping.
+   On a SoftwareSerial port every write blocks and so does the request.
+   
+   The transmit enable pin is only released by the next modbus_update(),
+   so loop() has to come round well within the turnaround of the slowest
+   slave, 1.75ms for a SimpleModbusSlave above 19200 baud. Otherwise the
+   driver still holds the line when the response arrives and the request
+   times out. With a transmit enable pin requests therefore block as they
+   always did until modbus_background_tx(1) says loop() is short enough.
+   
+   Responses are collected without blocking too. modbus_update() returns
+   while a response is arriving and the response is complete once the line
+   has been silent for the frame delay.
+   
+   modbus_configure() and modbus_update() drive the packets on modbusSerial.
+   To poll several serial lines at once give each line a ModbusPort with its
+   own packet array and call modbus_port_update() for every port from loop():
+   
+     ModbusPort line1, line2;
+     Serial1.begin(19200);
+     Serial2.begin(19200);
+     modbus_port_configure(&line1, &Serial1, 19200, 1000, 200, 10, 2, packets1, 4);
+     modbus_port_configure(&line2, &Serial2, 19200, 1000, 200, 10, 3, packets2, 6);
+     ...
+     modbus_port_update(&line1);
+     modbus_port_update(&line2);
+   
+   Ports share no state so each one can also be driven from its own thread
+   on a Linux host. A host with many ports can also drive them all from 
+   one thread that sleeps until a byte arrives or modbus_port_idle() 
+   has passed for one of them.
+   
+   The crc calculation is shared with SimpleModbusSlave through ModbusCRC.h
+   in the ModbusCommon library, which must be installed alongside this one.
+   A host build compiled with MODBUS_CAPTURE also passes every request and
+   response to the hook set with modbus_capture() from ModbusCapture.h.
+*/
+
+#include "Arduino.h"
+#include <ModbusCRC.h>
+#include <ModbusRegisters.h>
+#include <ModbusCapture.h>
+
+#define READ_COIL_STATUS 1
+#define READ_INPUT_STATUS 2
+#define READ_HOLDING_REGISTERS 3
+#define FORCE_SINGLE_COIL 5
+#define FORCE_MULTIPLE_COILS 15
+#define	PRESET_MULTIPLE_REGISTERS 16
+#define READ_WRITE_MULTIPLE_REGISTERS 23
+
+typedef struct Packet
+{
+  // specific packet info
+  unsigned char id;
+  unsigned char function;
+  unsigned int address;
+  unsigned int no_of_registers; 
+  unsigned int* register_array;
+  
+  // registers a function 23 packet writes before reading
+  unsigned int write_address;
+  unsigned int no_of_write_registers;
+  unsigned int* write_array;
+  
+  // coils or discrete inputs of a function 1, 2, 5 or 15 packet, 8 to a byte
+  unsigned char* bit_array;
+  
+  // change detection, see modbus_port_on_change()
+  unsigned int deadband; // smallest change of a register that is reported is deadband + 1
+  unsigned char changed; // set when a response changed the packet's data, cleared by the sketch
+  
+  // polling schedule, see modbus_port_budget()
+  unsigned int interval; // milliseconds between requests, 0 as often as the line allows
+  unsigned int max_interval; // an unchanging packet is polled less often up to this, 0 never
+  unsigned int poll_interval; // interval in use
+  unsigned long next_poll; // millis() before which the packet is not requested
+  
+  // modbus information counters
+  unsigned int requests;
+  unsigned int successful_requests;
+  unsigned long total_errors;
+  unsigned int retries;
+  unsigned int timeout;
+  unsigned int incorrect_id_returned;
+  unsigned int incorrect_function_returned;
+  unsigned int incorrect_bytes_returned;
+  unsigned int checksum_failed;
+  unsigned int buffer_errors;
+  
+  // modbus specific exception counters
+  unsigned int illegal_function;
+  unsigned int illegal_data_address;
+  unsigned int illegal_data_value;
+	unsigned char misc_exceptions;
+	
+  // connection status of packet
+  unsigned char connection; 
+  
+  // re-probe schedule of a failing packet, see modbus_port_backoff()
+  unsigned int backoff; // current interval in milliseconds, 0 while healthy
+  unsigned long next_attempt; // millis() before which the packet is skipped
+  
+  // register range coalescing, see modbus_port_coalesce()
+  struct Packet* merged_into; // packet whose request reads these registers, 0 if none
+  struct Packet* next_merged; // next packet read by the same request
+  unsigned int read_address; // registers the request of this packet reads
+  unsigned int read_registers;
+  
+  // priority class, see modbus_port_priority()
+  unsigned char priority; // MODBUS_PRIORITY_..., 0 a routine packet polled in turns
+  unsigned char requested; // queued by modbus_port_request(), 2 if urgent
+  unsigned long queued; // micros() when it was queued
+  
+}Packet;
+
+typedef Packet* packetPointer;
+
+// priority classes of packets, see modbus_port_priority()
+#define MODBUS_PRIORITY_ROUTINE 0 // polled in turns
+#define MODBUS_PRIORITY_HIGH 1 // requested before routine packets
+#define MODBUS_PRIORITY_URGENT 2 // requested next, without waiting for the polling delay
+#define MODBUS_PRIORITIES 3
+
+// higher priority transactions in a row before a routine one by default
+#define MODBUS_PRIORITY_SHARE 4
+
+// what a traced transaction ended with
+#define MODBUS_TRACE_OK 0
+#define MODBUS_TRACE_TIMEOUT 1
+#define MODBUS_TRACE_EXCEPTION 2 // the code is in exception
+#define MODBUS_TRACE_CHECKSUM 3 // or a write echoed something else
+#define MODBUS_TRACE_ID 4
+#define MODBUS_TRACE_FUNCTION 5
+#define MODBUS_TRACE_BYTES 6
+#define MODBUS_TRACE_BUFFER 7
+
+// microseconds in a step of the times of a ModbusTraceRecord
+#define MODBUS_TRACE_TICK 4
+
+// one transaction, the times are steps after started, 0xFFFF never or
+// too late to count
+typedef struct
+{
+  unsigned char id;
+  unsigned char function;
+  unsigned char status;
+  unsigned char exception;
+  unsigned long started; // micros() the request was handed to the serial port
+  unsigned int first_byte; // the first byte of the response was read
+  unsigned int last_byte; // the last byte of the response arrived
+  unsigned int checked; // the response was checked or the time out expired
+} ModbusTraceRecord;
+
+// 4 buckets to a power of two, bucket 79 holds 1835008 us and more
+#define MODBUS_HISTOGRAM_BUCKETS 80
+
+typedef struct
+{
+  unsigned int counts[MODBUS_HISTOGRAM_BUCKETS]; // transactions by microseconds taken
+  unsigned long total; // transactions counted
+  unsigned long max; // the longest one in microseconds
+} ModbusHistogram;
+
+// called for every register, coil or input a response changed, previous
+// is the value it had before
+typedef void (*ModbusChangeCallback)(Packet* packet, unsigned int index, unsigned int previous);
+
+// what is left to do for the setpoints of a unit, see modbus_port_setpoints()
+#define MODBUS_SETPOINT_DONE 0 // written and verified, or written by a broadcast nothing reads back
+#define MODBUS_SETPOINT_WRITE 1 // to be written to the unit
+#define MODBUS_SETPOINT_BROADCAST 2 // to be written by the broadcast of the batch
+#define MODBUS_SETPOINT_VERIFY 3 // written, the next read of readback checks them
+#define MODBUS_SETPOINT_FAILED 4 // retry_count writes in a row failed or didn't stick
+
+// the setpoints of one slave in a ModbusSetpoints batch
+typedef struct
+{
+  unsigned char id;
+  unsigned int* values; // no_of_registers setpoints of the batch for this unit
+  Packet* readback; // a polled function 3 packet that reads them, 0 if none
+  
+  // kept by the master
+  unsigned char state; // MODBUS_SETPOINT_...
+  unsigned char first, count; // the registers still to be written
+  unsigned char failures; // in a row
+  unsigned int reads; // readback->requests when the registers were written
+} ModbusSetpointUnit;
+
+// setpoints of the same register layout on several slaves
+typedef struct ModbusSetpoints
+{
+  unsigned int address;
+  unsigned int no_of_registers; // at most 59, the registers of one request
+  ModbusSetpointUnit* units;
+  unsigned int no_of_units;
+  unsigned int* shared; // no_of_registers, the values that are broadcast
+  unsigned char broadcast; // every slave on the line that takes the broadcast is a unit
+  
+  // kept by the master
+  unsigned char broadcastPending;
+  unsigned int sending; // the unit being written, the number of units for the broadcast
+  unsigned int next_unit; // the unit written after it
+  Packet packet; // the write request, counting its errors
+  struct ModbusSetpoints* next; // the next batch of the port
+} ModbusSetpoints;
+
+// answers of a slave measured before its tuned timing is used
+#define MODBUS_TIMING_SAMPLES 8
+
+// what the tuner knows about a slave that stopped answering
+#define MODBUS_TIMING_OK 0 // it answers, the tuned time out is used
+#define MODBUS_TIMING_VERIFY 1 // a tuned time out expired, the next attempt waits the configured one
+#define MODBUS_TIMING_SILENT 2 // it didn't answer the configured time out either, tuned again
+
+// how fast a slave answers, see modbus_port_tune(), times in steps of
+// MODBUS_TRACE_TICK
+typedef struct
+{
+  unsigned int turnaround; // longest from the end of a request to the first byte of the response
+  unsigned int gap; // longest between two bytes of a response, as far as loop() sees it
+  unsigned char samples; // answers measured, up to 255
+  unsigned char state; // MODBUS_TIMING_...
+  unsigned int check; // crc of the measurements, a restored entry that doesn't match is cleared
+} ModbusTiming;
+
+// the longest modbus_port_idle() returns, microseconds
+#define MODBUS_IDLE_MAX 1000000UL
+
+// frame buffer size, the same as the Arduino Serial ring buffer
+#define MODBUS_BUFFER_SIZE 128
+
+// A ModbusPort holds everything needed to poll the packets on one serial
+// line. Only modbus_port_configure() and modbus_port_update() should
+// touch it.
+typedef struct
+{
+	// serial port and timing
+	Stream* serial;
+	unsigned char TxEnablePin;
+	unsigned int timeout, polling;
+	unsigned char retry_count;
+	unsigned int T3_5; // frame delay in microseconds
+	unsigned int charTime; // time one character occupies the line in microseconds
+	unsigned char asyncTx; // the serial port buffers writes, send without blocking
+	unsigned int min_backoff, max_backoff; // re-probe interval in milliseconds, 0 disables
+	unsigned char probing; // the current packet is a re-probe of a failing one
+	ModbusChangeCallback on_change; // 0 if nothing is to be called
+	unsigned char budget; // percent of the time the line may be busy, 0 no limit
+	long busCredit; // line time left in percent microseconds, see busAvailable()
+	unsigned long creditTime; // micros() when busCredit was last topped up
+	unsigned char dataChanged; // the current response changed a register or bit
+	
+	// transaction trace, see modbus_port_trace()
+	ModbusTraceRecord* trace; // ring of traceSize records, 0 if none
+	unsigned int traceSize, traceHead; // traceHead is the next one written
+	unsigned long traceTotal; // records written, the oldest are overwritten
+	ModbusHistogram* histograms; // by slave id, 0 if none
+	unsigned int no_of_histograms;
+	unsigned long traceStarted, traceFirstByte; // micros() of the current transaction
+	unsigned char traceReceived; // a byte of the response has been read
+	unsigned char traceStatus, traceException;
+	
+	// batched setpoint writes, see modbus_port_setpoints()
+	ModbusSetpoints* setpoints; // the first batch, 0 if none
+	ModbusSetpoints* writing; // the batch the current transaction writes, 0 if none
+	
+	// priority classes, see modbus_port_priority()
+	unsigned char share; // transactions above routine in a row before a routine one, 0 no limit
+	unsigned char preempted; // transactions above routine in a row so far
+	unsigned char urgent; // urgent packets queued
+	unsigned char requesting; // the current packet was queued, it is queued again if it fails
+	ModbusHistogram* delays; // MODBUS_PRIORITIES, queueing delay by class, 0 if none
+	
+	// timing auto-tuner, see modbus_port_tune()
+	ModbusTiming* timings; // by slave id, 0 if none
+	unsigned int no_of_timings;
+	unsigned char margin; // percent added to what was measured
+	unsigned int min_frame_delay; // microseconds every slave on the line needs between frames
+	unsigned int frameDelay; // microseconds of silence ending the current response
+	unsigned int slaveTimeout; // milliseconds the current transaction may take
+	unsigned char tuned; // the current transaction uses tuned values
+	unsigned long requestEnd; // micros() the request left the line
+	unsigned long rxGap; // longest between two bytes of the response so far
+	
+	// packet list
+	Packet* packets;
+	unsigned int total_no_of_packets;
+	unsigned int packet_index; // next packet to request
+	Packet* packet; // current packet
+	
+	// current transaction
+	unsigned char transmission_ready_Flag;
+	unsigned char messageOkFlag, messageErrFlag;
+	unsigned long previousTimeout, previousPolling;
+	// frame[] is used to recieve and transmit packages. 
+	// The maximum number of bytes in a modbus packet is 256 bytes
+	// This is limited to the serial buffer of 128 bytes
+	unsigned char frame[MODBUS_BUFFER_SIZE];
+	unsigned char rxLength; // bytes of the response received so far
+	unsigned char rxOverflow; // the response did not fit into frame[]
+	unsigned char txLength; // size of the request in frame[] being transmitted
+	unsigned char txIndex; // next byte of frame[] to hand to the serial port
+	unsigned long txDoneTime; // micros() when the last byte handed over leaves the line, with a guard
+	unsigned long lastFrameTime; // micros() when the line last carried a byte
+	
+}ModbusPort;
+
+// function definitions
+unsigned int modbus_update(Packet* packets);
+void modbus_configure(long baud, unsigned int _timeout, unsigned int _polling, 
+											unsigned char _retry_count, unsigned char _TxEnablePin,
+											Packet* packets, unsigned int _total_no_of_packets);
+
+// the same for any number of ports, the serial port must already be started
+unsigned int modbus_port_update(ModbusPort* port);
+void modbus_port_configure(ModbusPort* port, Stream* serial, long baud, 
+													 unsigned int _timeout, unsigned int _polling, 
+													 unsigned char _retry_count, unsigned char _TxEnablePin,
+													 Packet* packets, unsigned int _total_no_of_packets);
+
+// microseconds modbus_port_update() has nothing to do unless a byte
+// arrives, at most MODBUS_IDLE_MAX, for an event loop that sleeps meanwhile
+unsigned long modbus_idle();
+unsigned long modbus_port_idle(ModbusPort* port);
+
+// re-probe failing packets on an interval doubling from _min_backoff up to
+// _max_backoff milliseconds, call after configuring
+void modbus_backoff(unsigned int _min_backoff, unsigned int _max_backoff);
+void modbus_port_backoff(ModbusPort* port, unsigned int _min_backoff, unsigned int _max_backoff);
+
+// send requests in the background on a buffered port even with a transmit
+// enable pin, call after configuring, see the header comment for the loop()
+void modbus_background_tx(unsigned char _on);
+void modbus_port_background_tx(ModbusPort* port, unsigned char _on);
+
+// merge function 3 packets reading close registers of the same slave into
+// as few requests as possible, call after configuring
+void modbus_coalesce(unsigned int _max_gap);
+void modbus_port_coalesce(ModbusPort* port, unsigned int _max_gap);
+
+// keep the line busy no more than _budget percent of the time, packets
+// wait when it is used up, call after configuring
+void modbus_budget(unsigned char _budget);
+void modbus_port_budget(ModbusPort* port, unsigned char _budget);
+
+// trace every transaction in _trace[_traceSize] and count its time in
+// _histograms[id] for ids below _no_of_histograms, either may be 0, call
+// after configuring
+void modbus_trace(ModbusTraceRecord* _trace, unsigned int _traceSize, 
+									ModbusHistogram* _histograms, unsigned int _no_of_histograms);
+void modbus_port_trace(ModbusPort* port, ModbusTraceRecord* _trace, unsigned int _traceSize, 
+											 ModbusHistogram* _histograms, unsigned int _no_of_histograms);
+
+// copies as many of the newest trace records as fit into regs, oldest
+// first and 7 registers each, and returns how many
+unsigned int modbus_trace_registers(unsigned int* regs, unsigned int size);
+unsigned int modbus_port_trace_registers(ModbusPort* port, unsigned int* regs, unsigned int size);
+
+// microseconds within which permille of the transactions counted finished
+unsigned long modbus_histogram_percentile(const ModbusHistogram* histogram, unsigned int permille);
+
+// counts one transaction that took the given microseconds, the way a
+// traced port does
+void modbus_histogram_add(ModbusHistogram* histogram, unsigned long microseconds);
+
+// call _on_change for every register a response changes by more than its
+// packet's deadband, call after configuring
+void modbus_on_change(ModbusChangeCallback _on_change);
+void modbus_port_on_change(ModbusPort* port, ModbusChangeCallback _on_change);
+
+// queue _packet for one request before the routine packets, the highest
+// class first, retried up to retry_count times if it fails
+void modbus_request(Packet* _packet);
+void modbus_port_request(ModbusPort* port, Packet* _packet);
+
+// give a routine packet a turn after _share transactions above routine in
+// a row, 0 never, and count the queueing delay of every class in 
+// _delays[MODBUS_PRIORITIES], 0 if not, call after configuring
+void modbus_priority(unsigned char _share, ModbusHistogram* _delays);
+void modbus_port_priority(ModbusPort* port, unsigned char _share, ModbusHistogram* _delays);
+
+// measure how fast each slave below _no_of_timings answers and shorten its
+// time out and frame delay to that plus _margin percent, frame delays not
+// below _min_frame_delay microseconds. _timings may hold what a previous
+// run measured, restored from EEPROM, call after configuring
+void modbus_tune(ModbusTiming* _timings, unsigned int _no_of_timings, 
+								 unsigned char _margin, unsigned int _min_frame_delay);
+void modbus_port_tune(ModbusPort* port, ModbusTiming* _timings, unsigned int _no_of_timings, 
+											unsigned char _margin, unsigned int _min_frame_delay);
+
+// write the values of every unit of _batch, broadcasting what most of them
+// share, and verify them on the next read of their readback packets. Call
+// after configuring and again whenever the values change
+void modbus_setpoints(ModbusSetpoints* _batch);
+void modbus_port_setpoints(ModbusPort* port, ModbusSetpoints* _batch);
+
+// units of the batch that have neither been verified nor failed
+unsigned int modbus_setpoints_pending(const ModbusSetpoints* _batch);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,363 @@
+#ifndef MODBUS_REGISTER_MAP_H
+#define MODBUS_REGISTER_MAP_H
+
+/*
+ ModbusRegisterMap declares the holding registers of a SimpleModbusSlave
+ sketch as a list of typed registers instead of an enum of addresses:
+
+   enum { ALARM_STATE, TEMP_STATE, SETPOINT, TOTAL_ERRORS = 4 };
+
+   constexpr ModbusRegister brewRegisters[] = {
+     modbus_u16(ALARM_STATE, MODBUS_READ),
+     modbus_fixed(TEMP_STATE, MODBUS_READ, 10),           // tenths
+     modbus_float32(SETPOINT, MODBUS_READ_WRITE, setpointChanged),
+     modbus_u16(TOTAL_ERRORS, MODBUS_READ),
+   };
+   ModbusRegisterMap<brewRegisters, 4> regs;
+
+   modbus_configure_map(regs.tables());
+   regs.setFixed<TEMP_STATE>(tempF);
+   modbus_update(regs.registers);
+
+ A register is
+
+   modbus_u16     an unsigned int
+   modbus_i16     an int
+   modbus_float32 a float over two registers, the high word first
+   modbus_fixed   a float sent as an int of value * scale
+
+ with MODBUS_READ, MODBUS_WRITE or MODBUS_READ_WRITE access for the
+ master, and callbacks. onWrite(address) is called after the master has
+ written the register and onRead(address) before a request that reads
+ it is answered, to bring the value up to date. The sketch itself can
+ always read and write every register.
+
+ The list is checked when the sketch is compiled: the registers have to
+ be in order of their address without overlapping, a float32 at 65535
+ doesn't fit and a callback needs the access it is called for. The typed
+ accessors check that the register at the address has their type. Any of
+ these is a compile error instead of a wrong value on the bus.
+
+ From the list the map generates flat tables with an entry for every
+ address up to the last register, in flash on the AVR. For reads it is
+ the number of registers that can be read from that address on, for
+ writes the number of whole registers that can be written starting
+ there. modbus_update() checks a request with one lookup per table, the
+ same as the size check it does without a map: a read or write into a
+ gap, into a register without the access or into half of a float32 is
+ answered with exception 2 or 3. Registers with callbacks get a table of
+ their own, a map without callbacks costs no time for them.
+
+ The list is walked recursively by the compiler, keep it to a few hundred
+ registers. A run in the tables ends after MODBUS_MAP_RUN registers, more
+ than a request can carry.
+*/
+
+#include <stdint.h>
+
+#include "Arduino.h"
+
+#define MODBUS_U16 0
+#define MODBUS_I16 1
+#define MODBUS_FLOAT32 2
+#define MODBUS_FIXED 3
+
+#define MODBUS_READ 1
+#define MODBUS_WRITE 2
+#define MODBUS_READ_WRITE 3
+
+#define MODBUS_MAP_RUN 127 // longest run in the tables, bit 7 is a flag
+#define MODBUS_MAP_BOUNDARY 0x80 // the address starts a register or a gap
+#define MODBUS_MAP_NONE 0xFFFF
+
+typedef void (*ModbusRegisterCallback)(unsigned int address);
+
+struct ModbusRegister
+{
+  unsigned int address;
+  unsigned char type; // MODBUS_U16 ...
+  unsigned char access; // MODBUS_READ ...
+  unsigned int scale; // a MODBUS_FIXED register holds value * scale
+  ModbusRegisterCallback onWrite; // after the master wrote it
+  ModbusRegisterCallback onRead; // before the master reads it
+};
+
+// the callbacks of one register, by address
+struct ModbusMapCallback
+{
+  unsigned int address;
+  unsigned int end; // address of the next register
+  ModbusRegisterCallback onWrite;
+  ModbusRegisterCallback onRead;
+};
+
+// what modbus_update() needs of a map, see modbus_configure_map()
+typedef struct
+{
+  unsigned int *registers;
+  unsigned int size; // addresses from 0
+  const unsigned char *readable; // registers readable from each address
+  const unsigned char *writable; // whole registers writable from each address, | MODBUS_MAP_BOUNDARY
+  const ModbusMapCallback *callbacks; // in order of address
+  unsigned int no_of_callbacks;
+} ModbusMapTables;
+
+constexpr ModbusRegister modbus_u16(unsigned int address, unsigned char access,
+                                    ModbusRegisterCallback onWrite = 0, ModbusRegisterCallback onRead = 0)
+{
+  return ModbusRegister{ address, MODBUS_U16, access, 1, onWrite, onRead };
+}
+
+constexpr ModbusRegister modbus_i16(unsigned int address, unsigned char access,
+                                    ModbusRegisterCallback onWrite = 0, ModbusRegisterCallback onRead = 0)
+{
+  return ModbusRegister{ address, MODBUS_I16, access, 1, onWrite, onRead };
+}
+
+constexpr ModbusRegister modbus_float32(unsigned int address, unsigned char access,
+                                        ModbusRegisterCallback onWrite = 0, ModbusRegisterCallback onRead = 0)
+{
+  return ModbusRegister{ address, MODBUS_FLOAT32, access, 1, onWrite, onRead };
+}
+
+constexpr ModbusRegister modbus_fixed(unsigned int address, unsigned char access, unsigned int scale,
+                                      ModbusRegisterCallback onWrite = 0, ModbusRegisterCallback onRead = 0)
+{
+  return ModbusRegister{ address, MODBUS_FIXED, access, scale, onWrite, onRead };
+}
+
+// Compile time checks and tables. A C++11 constexpr function is a single
+// return statement, so the list is walked by recursion.
+
+constexpr unsigned long modbus_register_end(const ModbusRegister &r)
+{
+  return (unsigned long)r.address + (r.type == MODBUS_FLOAT32 ? 2 : 1);
+}
+
+constexpr bool modbus_map_declared(const ModbusRegister *r, unsigned int count)
+{
+  return count == 0 ||
+         (r[0].type <= MODBUS_FIXED && r[0].access >= MODBUS_READ && r[0].access <= MODBUS_READ_WRITE &&
+          r[0].scale > 0 && modbus_map_declared(r + 1, count - 1));
+}
+
+constexpr bool modbus_map_ordered(const ModbusRegister *r, unsigned int count)
+{
+  return count < 2 || (modbus_register_end(r[0]) <= r[1].address && modbus_map_ordered(r + 1, count - 1));
+}
+
+constexpr bool modbus_map_callbacks_allowed(const ModbusRegister *r, unsigned int count)
+{
+  return count == 0 ||
+         ((!r[0].onWrite || (r[0].access & MODBUS_WRITE)) && (!r[0].onRead || (r[0].access & MODBUS_READ)) &&
+          modbus_map_callbacks_allowed(r + 1, count - 1));
+}
+
+constexpr unsigned int modbus_map_no_of_callbacks(const ModbusRegister *r, unsigned int count)
+{
+  return count == 0 ? 0 : (r[0].onWrite || r[0].onRead) + modbus_map_no_of_callbacks(r + 1, count - 1);
+}
+
+// the register with callbacks after the first skip of them
+constexpr unsigned int modbus_map_callback(const ModbusRegister *r, unsigned int skip, unsigned int i = 0)
+{
+  return !(r[i].onWrite || r[i].onRead) ? modbus_map_callback(r, skip, i + 1) :
+         skip == 0 ? i : modbus_map_callback(r, skip - 1, i + 1);
+}
+
+// the register address is in, MODBUS_MAP_NONE in a gap
+constexpr unsigned int modbus_map_find(const ModbusRegister *r, unsigned int low, unsigned int high,
+                                       unsigned long address)
+{
+  return low >= high ? MODBUS_MAP_NONE :
+         address < r[(low + high) / 2].address ? modbus_map_find(r, low, (low + high) / 2, address) :
+         address >= modbus_register_end(r[(low + high) / 2]) ? modbus_map_find(r, (low + high) / 2 + 1, high, address) :
+         (low + high) / 2;
+}
+
+constexpr unsigned char modbus_map_type(const ModbusRegister *r, unsigned int count, unsigned int address)
+{
+  return modbus_map_find(r, 0, count, address) == MODBUS_MAP_NONE || r[modbus_map_find(r, 0, count, address)].address != address ?
+         0xFF : r[modbus_map_find(r, 0, count, address)].type;
+}
+
+// registers with access from address in register i on, no further than left
+constexpr unsigned int modbus_map_run(const ModbusRegister *r, unsigned int count, unsigned int i,
+                                      unsigned char access, unsigned long address, unsigned int left)
+{
+  return !(r[i].access & access) ? 0 :
+         modbus_register_end(r[i]) - address >= left ? left :
+         modbus_register_end(r[i]) - address +
+           (i + 1 < count && r[i + 1].address == modbus_register_end(r[i]) ?
+            modbus_map_run(r, count, i + 1, access, r[i + 1].address, left - (modbus_register_end(r[i]) - address)) : 0);
+}
+
+constexpr unsigned char modbus_map_readable(const ModbusRegister *r, unsigned int count, unsigned int address)
+{
+  return modbus_map_find(r, 0, count, address) == MODBUS_MAP_NONE ? 0 :
+         modbus_map_run(r, count, modbus_map_find(r, 0, count, address), MODBUS_READ, address, MODBUS_MAP_RUN);
+}
+
+// writes start at the first register of a register
+constexpr unsigned char modbus_map_writable(const ModbusRegister *r, unsigned int count, unsigned int address)
+{
+  return modbus_map_find(r, 0, count, address) == MODBUS_MAP_NONE ? MODBUS_MAP_BOUNDARY :
+         r[modbus_map_find(r, 0, count, address)].address != address ? 0 :
+         MODBUS_MAP_BOUNDARY |
+           modbus_map_run(r, count, modbus_map_find(r, 0, count, address), MODBUS_WRITE, address, MODBUS_MAP_RUN);
+}
+
+// 0, 1, ... N - 1 as a template parameter pack, built in log N steps
+template <unsigned int... I> struct ModbusIndices {};
+
+template <class A, class B> struct ModbusJoinIndices;
+
+template <unsigned int... A, unsigned int... B>
+struct ModbusJoinIndices<ModbusIndices<A...>, ModbusIndices<B...> >
+{
+  typedef ModbusIndices<A..., (sizeof...(A) + B)...> type;
+};
+
+template <unsigned int N> struct ModbusMakeIndices
+{
+  typedef typename ModbusJoinIndices<typename ModbusMakeIndices<N / 2>::type,
+                                     typename ModbusMakeIndices<N - N / 2>::type>::type type;
+};
+
+template <> struct ModbusMakeIndices<0> { typedef ModbusIndices<> type; };
+template <> struct ModbusMakeIndices<1> { typedef ModbusIndices<0> type; };
+
+template <const ModbusRegister *r, unsigned int count, class Addresses, class Callbacks>
+struct ModbusMapFlash;
+
+template <const ModbusRegister *r, unsigned int count, unsigned int... A, unsigned int... C>
+struct ModbusMapFlash<r, count, ModbusIndices<A...>, ModbusIndices<C...> >
+{
+  static const unsigned char readable[sizeof...(A)];
+  static const unsigned char writable[sizeof...(A)];
+  static const ModbusMapCallback callbacks[sizeof...(C) + 1]; // never empty
+};
+
+template <const ModbusRegister *r, unsigned int count, unsigned int... A, unsigned int... C>
+const unsigned char ModbusMapFlash<r, count, ModbusIndices<A...>, ModbusIndices<C...> >::readable[sizeof...(A)] PROGMEM =
+  { modbus_map_readable(r, count, A)... };
+
+template <const ModbusRegister *r, unsigned int count, unsigned int... A, unsigned int... C>
+const unsigned char ModbusMapFlash<r, count, ModbusIndices<A...>, ModbusIndices<C...> >::writable[sizeof...(A)] PROGMEM =
+  { modbus_map_writable(r, count, A)... };
+
+template <const ModbusRegister *r, unsigned int count, unsigned int... A, unsigned int... C>
+const ModbusMapCallback ModbusMapFlash<r, count, ModbusIndices<A...>, ModbusIndices<C...> >::callbacks[sizeof...(C) + 1] PROGMEM =
+  { { r[modbus_map_callback(r, C)].address, (unsigned int)modbus_register_end(r[modbus_map_callback(r, C)]),
+      r[modbus_map_callback(r, C)].onWrite, r[modbus_map_callback(r, C)].onRead }...,
+    { 0, 0, 0, 0 } };
+
+template <const ModbusRegister *r, unsigned int count>
+class ModbusRegisterMap
+{
+    static_assert(count > 0, "a register map needs registers");
+    static_assert(modbus_map_declared(r, count), "a register has an unknown type, no access or a scale of 0");
+    static_assert(modbus_map_ordered(r, count), "registers overlap or are out of order of their addresses");
+    static_assert(modbus_register_end(r[count - 1]) <= 65536UL, "the last register is past address 65535");
+    static_assert(modbus_map_callbacks_allowed(r, count), "a callback is on a register without the access it is called for");
+
+    static const unsigned int no_of_callbacks = modbus_map_no_of_callbacks(r, count);
+    typedef ModbusMapFlash<r, count, typename ModbusMakeIndices<modbus_register_end(r[count - 1])>::type,
+                           typename ModbusMakeIndices<no_of_callbacks>::type> Flash;
+
+  public:
+    static const unsigned int size = modbus_register_end(r[count - 1]);
+
+    ModbusRegisterMap()
+    {
+      for (unsigned int i = 0; i < size; i++)
+        registers[i] = 0;
+      map.registers = registers;
+      map.size = size;
+      map.readable = Flash::readable;
+      map.writable = Flash::writable;
+      map.callbacks = Flash::callbacks;
+      map.no_of_callbacks = no_of_callbacks;
+    }
+
+    const ModbusMapTables *tables() const
+    {
+      return &map;
+    }
+
+    template <unsigned int address> unsigned int getWord() const
+    {
+      static_assert(modbus_map_type(r, count, address) == MODBUS_U16, "no u16 register at this address");
+      return registers[address];
+    }
+
+    template <unsigned int address> void setWord(unsigned int value)
+    {
+      static_assert(modbus_map_type(r, count, address) == MODBUS_U16, "no u16 register at this address");
+      registers[address] = value;
+    }
+
+    template <unsigned int address> int getInt() const
+    {
+      static_assert(modbus_map_type(r, count, address) == MODBUS_I16, "no i16 register at this address");
+      return (int16_t)registers[address];
+    }
+
+    template <unsigned int address> void setInt(int value)
+    {
+      static_assert(modbus_map_type(r, count, address) == MODBUS_I16, "no i16 register at this address");
+      registers[address] = (uint16_t)value;
+    }
+
+    template <unsigned int address> float getFloat() const
+    {
+      static_assert(modbus_map_type(r, count, address) == MODBUS_FLOAT32, "no float32 register at this address");
+      union { uint32_t bits; float value; } word;
+      word.bits = ((uint32_t)(registers[address] & 0xFFFF) << 16) | (registers[address + 1] & 0xFFFF);
+      return word.value;
+    }
+
+    template <unsigned int address> void setFloat(float value)
+    {
+      static_assert(modbus_map_type(r, count, address) == MODBUS_FLOAT32, "no float32 register at this address");
+      union { uint32_t bits; float value; } word;
+      word.value = value;
+      registers[address] = word.bits >> 16;
+      registers[address + 1] = word.bits & 0xFFFF;
+    }
+
+    // the raw int of a fixed register is value * scale, these scale it
+    template <unsigned int address> float getFixed() const
+    {
+      static_assert(modbus_map_type(r, count, address) == MODBUS_FIXED, "no fixed register at this address");
+      return (int16_t)registers[address] / (float)r[modbus_map_find(r, 0, count, address)].scale;
+    }
+
+    template <unsigned int address> void setFixed(float value)
+    {
+      static_assert(modbus_map_type(r, count, address) == MODBUS_FIXED, "no fixed register at this address");
+      value *= r[modbus_map_find(r, 0, count, address)].scale;
+      registers[address] = (uint16_t)(int16_t)(value < 0 ? value - 0.5f : value + 0.5f);
+    }
+
+    // the raw int, already value * scale, for a value computed in fixed point
+    template <unsigned int address> int getScaled() const
+    {
+      static_assert(modbus_map_type(r, count, address) == MODBUS_FIXED, "no fixed register at this address");
+      return (int16_t)registers[address];
+    }
+
+    template <unsigned int address> void setScaled(int value)
+    {
+      static_assert(modbus_map_type(r, count, address) == MODBUS_FIXED, "no fixed register at this address");
+      registers[address] = (uint16_t)value;
+    }
+
+    // as the master sees them, the sketch can pass it to modbus_update()
+    unsigned int registers[size];
+
+  private:
+    ModbusMapTables map;
+};
+
+#endif
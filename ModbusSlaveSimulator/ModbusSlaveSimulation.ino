@@ -1,13 +1,11 @@
 #include <SimpleModbusSlave.h>
+#include <TMP36Input.h>
 #include <SoftwareSerial.h>
 
 #define  alarmPin  13 // alarm digital input  
 const int tempPin = A0; // temperature sensor input 
 
-int analogTemp;// analog temperature value 
-float voltageTemp; // analog temperature value scaled to voltage
-float tempF; // temperature in fahrenheit 
-int tempState; // current temperature in Celsius
+TMP36Input tempInput; // oversampled temperature, tenths of a degree F 
 
 SoftwareSerial modbusSerial(2,3);
 
@@ -39,11 +37,20 @@ enum
   // The first register starts at address 0
   ALARM_STATE,
   TEMP_STATE,
-  TOTAL_ERRORS,
-  TOTAL_REGS_SIZE 
+  TOTAL_ERRORS
 };
 
-unsigned int holdingRegs[TOTAL_REGS_SIZE]; // function 3 register array
+// The type of every register and what the master may do with it. The
+// compiler checks that they don't overlap and makes the register array, 
+// the master gets exception 2 for a write to any of these.
+constexpr ModbusRegister slaveRegisters[] = 
+{
+  modbus_u16(ALARM_STATE, MODBUS_READ),
+  modbus_fixed(TEMP_STATE, MODBUS_READ, 10), // tenths of a degree F
+  modbus_u16(TOTAL_ERRORS, MODBUS_READ)
+};
+
+ModbusRegisterMap<slaveRegisters, 3> holdingRegs; // function 3 register array
 
 // This is only ran once
 void setup()
@@ -63,9 +70,11 @@ void setup()
   
   // RS-485 shield will use D2 as the transmit enable pin, slave ID will 
   // start at 1 
-  modbus_configure(115200, 1, 1, TOTAL_REGS_SIZE, 0);
+  modbus_configure(115200, 1, 1, holdingRegs.size, 0);
+  modbus_configure_map(holdingRegs.tables());
   pinMode(alarmPin, INPUT);
   pinMode(tempPin, INPUT);
+  tmp36_init(&tempInput);
 }
 
 void loop()
@@ -73,7 +82,7 @@ void loop()
   // modbus_update() is the only method used in loop(). It returns the total 
   // error count since the slave started. Optional, but it's useful
   // for fault finding by the modbus master.
-  holdingRegs[TOTAL_ERRORS] = modbus_update(holdingRegs);
+  holdingRegs.setWord<TOTAL_ERRORS>(modbus_update(holdingRegs.registers));
   
   /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * 
   
@@ -87,30 +96,24 @@ void loop()
   byte alarmState = digitalRead(alarmPin); 
   
   // assign the alarm state value to the holding register
-  holdingRegs[ALARM_STATE] = alarmState; 
+  holdingRegs.setWord<ALARM_STATE>(alarmState); 
 
   /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * 
   
     TEMP INPUT
 
-    Reads analog temperature input from analog input pin, converts to 
-    temperature in fahrenheit, and updates holding register.
+    Reads analog temperature input from analog input pin and adds it to
+    the oversampled sum. Every 16th reading the sum is converted to 
+    tenths of a degree fahrenheit in integer arithmetic, see TMP36Input.h,
+    and the holding register is updated.
 
   /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 
-  // read analog temperature value 
-  analogTemp = analogRead(tempPin);
-  
-  //convert ADC reading to voltage 
-  voltageTemp = (analogTemp/1024.0)*5.0;
-
-  //convert voltage value to temperature(F)
-  //TMP36 is 25C at 750 mV, +/- 10mV for every 1C
-  //-0.5 offscale results from conversion of V to C for TMP 36
-  tempF = ((9.0/5.0)*(voltageTemp - 0.5)*100) + 32.0;
-  tempState = (int) tempF;
-
-  // assign temperature value to holding register
-  holdingRegs[TEMP_STATE] = tempState;
-
+  // read analog temperature value, TMP36 is 25C at 750 mV, +/- 10mV for 
+  // every 1C
+  if (tmp36_sample(&tempInput, analogRead(tempPin)))
+  {
+    // assign temperature value to holding register
+    holdingRegs.setScaled<TEMP_STATE>(tempInput.tenths);
+  }
 }
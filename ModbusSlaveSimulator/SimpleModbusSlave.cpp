@@ -1,356 +1,762 @@
-#include "SimpleModbusSlave.h"
-
-#define BUFFER_SIZE 128
-
-// frame[] is used to recieve and transmit packets. 
-// The maximum serial ring buffer size is 128
-unsigned char frame[BUFFER_SIZE];
-unsigned int holdingRegsSize; // size of the register array 
-unsigned char broadcastFlag;
-unsigned char slaveID;
-unsigned char function;
-unsigned char TxEnablePin;
-unsigned int errorCount;
-unsigned int T1_5; // inter character time out
-unsigned int T3_5; // frame delay
-
-// function definitions
-void exceptionResponse(unsigned char exception);
-unsigned int calculateCRC(unsigned char bufferSize); 
-void sendPacket(unsigned char bufferSize);
-
-/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * 
-  
-  MODBUS_UPDATE
-
-  Only Modbus function handled in loop. Calls all other Modbus functions to
-  handle Modbus slave activities
-
-/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */  
-unsigned int modbus_update(unsigned int *holdingRegs)
-{
-  unsigned char buffer = 0;
-  unsigned char overflow = 0;
-  
-  /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * 
-  
-    OVERFLOW CONTROL
-
-   The maximum number of bytes is limited to the serial buffer size of 128 
-   bytes. If more bytes is received than the BUFFER_SIZE the overflow flag will
-   be set and the serial buffer will be read untill all the data is cleared 
-   from the receive buffer.
-
-  /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
-
-  while (modbusSerial.available())
-  {  
-    if (overflow) 
-      modbusSerial.read();
-    else
-    {
-      if (buffer == BUFFER_SIZE) 
-      {
-        overflow = 1;
-      }
-      frame[buffer] = modbusSerial.read();
-      buffer++;
-    }
-    delayMicroseconds(T1_5); // inter character time out
-  }
-  
-  // If an overflow occurred increment the errorCount variable and return to 
-  // the main sketch without responding to the request i.e. force a timeout
-  if (overflow)
-    return errorCount++;
-
-  /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * 
-  
-    MODBUS PACKET HANDLING
-
-    At this point, the frame[] array has the received packet from the master. 
-    Each Modbus packet section indexed by the frame array will be assigned 
-    to the appropriate variables (id, crc, function, holdingRegs data)
-
-  /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
-  
-  // The minimum request packet is 8 bytes for function 3 & 16
-  if (buffer > 6) 
-  {
-    // slave ID assignment 
-    unsigned char id = frame[0];
-    
-    broadcastFlag = 0;
-    
-    if (id == 0)
-      broadcastFlag = 1;
-    
-    // if the recieved ID matches the slaveID or broadcasting id (0), continue
-    if (id == slaveID || broadcastFlag) 
-    {
-      // CRC assignment <-- combine the crc Low & High bytes
-      unsigned int crc = ((frame[buffer - 2] << 8) | frame[buffer - 1]); 
-      // if the calculated crc matches the recieved crc continue
-      if (calculateCRC(buffer - 2) == crc) 
-      {
-        // Function code assignment 
-        function = frame[1];
-
-        // combine the starting address bytes
-        unsigned int startingAddress = ((frame[2] << 8) | frame[3]); 
-        // combine the number of register bytes
-        unsigned int no_of_registers = ((frame[4] << 8) | frame[5]);   
-        unsigned int maxData = startingAddress + no_of_registers;
-        unsigned char index;
-        unsigned char address;
-        unsigned int crc16;
-
-        /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * 
-  
-         FUNCTION CODE 3: READING HOLDING REGISTERS
-
-         Create response packet using frame array.
-
-        /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
-        
-        // broadcasting is not supported for function 3 
-        if (!broadcastFlag && (function == 3))
-        {
-          if (startingAddress < holdingRegsSize) // check exception 2 ILLEGAL DATA ADDRESS
-          {
-            if (maxData <= holdingRegsSize) // check exception 3 ILLEGAL DATA VALUE
-            {
-              unsigned char noOfBytes = no_of_registers * 2;
-              unsigned char responseFrameSize = 5 + noOfBytes; // ID, function, noOfBytes, (dataLo + dataHi) * number of registers, crcLo, crcHi
-              frame[0] = slaveID;
-              frame[1] = function;
-              frame[2] = noOfBytes;
-              address = 3; // PDU starts at the 4th byte
-              unsigned int temp;
-              
-              // Assign slave holding registers data to response packet 
-              for (index = startingAddress; index < maxData; index++)
-              {
-                temp = holdingRegs[index];
-                frame[address] = temp >> 8; // split the register into 2 bytes
-                address++;
-                frame[address] = temp & 0xFF;
-                address++;
-              } 
-              
-              // Assign 16 bit (2 bytes) CRC to response packet 
-              crc16 = calculateCRC(responseFrameSize - 2);
-              frame[responseFrameSize - 2] = crc16 >> 8; // split crc into 2 bytes
-              frame[responseFrameSize - 1] = crc16 & 0xFF;
-
-              // Send finished response packet to Modbus master 
-              sendPacket(responseFrameSize);
-            }
-            else  
-              exceptionResponse(3); // exception 3 ILLEGAL DATA VALUE
-          }
-          else
-            exceptionResponse(2); // exception 2 ILLEGAL DATA ADDRESS
-        }
-        else if (function == 6)
-        {
-          if (startingAddress < holdingRegsSize) // check exception 2 ILLEGAL DATA ADDRESS
-          {
-              unsigned int startingAddress = ((frame[2] << 8) | frame[3]);
-              unsigned int regStatus = ((frame[4] << 8) | frame[5]);
-              unsigned char responseFrameSize = 8;
-              
-              holdingRegs[startingAddress] = regStatus;
-              
-              crc16 = calculateCRC(responseFrameSize - 2);
-              frame[responseFrameSize - 2] = crc16 >> 8; // split crc into 2 bytes
-              frame[responseFrameSize - 1] = crc16 & 0xFF;
-              sendPacket(responseFrameSize);
-          }
-          else
-            exceptionResponse(2); // exception 2 ILLEGAL DATA ADDRESS
-          }
-
-        /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * 
-  
-         FUNCTION CODE 16: WRITE HOLDING REGISTERS
-
-         Write new values to holding registers in slave's Modbus memory map. 
-
-        /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
-        else if (function == 16)
-        {
-          // check if the recieved number of bytes matches the calculated bytes minus the request bytes
-          // id + function + (2 * address bytes) + (2 * no of register bytes) + byte count + (2 * CRC bytes) = 9 bytes
-          if (frame[6] == (buffer - 9)) 
-          {
-            if (startingAddress < holdingRegsSize) // check exception 2 ILLEGAL DATA ADDRESS
-            {
-              if (maxData <= holdingRegsSize) // check exception 3 ILLEGAL DATA VALUE
-              {
-                address = 7; // start at the 8th byte in the frame
-                
-                for (index = startingAddress; index < maxData; index++)
-                {
-                  holdingRegs[index] = ((frame[address] << 8) | frame[address + 1]);
-                  address += 2;
-                } 
-                
-                // only the first 6 bytes are used for CRC calculation
-                crc16 = calculateCRC(6); 
-                frame[6] = crc16 >> 8; // split crc into 2 bytes
-                frame[7] = crc16 & 0xFF;
-                
-                // a function 16 response is an echo of the first 6 bytes from the request + 2 crc bytes
-                if (!broadcastFlag) // don't respond if it's a broadcast message
-                  sendPacket(8); 
-              }
-              else  
-                exceptionResponse(3); // exception 3 ILLEGAL DATA VALUE
-            }
-            else
-              exceptionResponse(2); // exception 2 ILLEGAL DATA ADDRESS
-          }
-          else 
-            errorCount++; // corrupted packet
-        }         
-        else
-          exceptionResponse(1); // exception 1 ILLEGAL FUNCTION
-      }
-      else // checksum failed
-        errorCount++;
-    } // incorrect id
-  }
-  else if (buffer > 0 && buffer < 8)
-    errorCount++; // corrupted packet
-    
-  return errorCount;
-}       
-
-void exceptionResponse(unsigned char exception)
-{
-  errorCount++; // each call to exceptionResponse() will increment the errorCount
-  if (!broadcastFlag) // don't respond if its a broadcast message
-  {
-    frame[0] = slaveID;
-    frame[1] = (function | 0x80); // set the MSB bit high, informs the master of an exception
-    frame[2] = exception;
-    unsigned int crc16 = calculateCRC(3); // ID, function + 0x80, exception code == 3 bytes
-    frame[3] = crc16 >> 8;
-    frame[4] = crc16 & 0xFF;
-    sendPacket(5); // exception response is always 5 bytes ID, function + 0x80, exception code, 2 bytes crc
-  }
-}
-
-/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * 
-  
- MODBUS_CONFIGURE
-
- parameters(long baudrate, 
-            unsigned char ID, 
-            unsigned char transmit enable pin, 
-            unsigned int holding registers size,
-            unsigned char low latency)
-                
-  The transmit enable pin is used in half duplex communication to activate 
-  a MAX485 or similar to deactivate this mode use any value < 2 because 0 &
-  1 is reserved for Rx & Tx. Low latency delays makes the implementation 
-  non-standard but practically it works with all major modbus master
-  implementations.
-
-/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
-
-void modbus_configure(long baud, unsigned char _slaveID, unsigned char _TxEnablePin, unsigned int _holdingRegsSize, unsigned char _lowLatency)
-{
-  slaveID = _slaveID;
-  modbusSerial.begin(baud);
-  
-  if (_TxEnablePin > 1) 
-  { // pin 0 & pin 1 are reserved for RX/TX. To disable set txenpin < 2
-    TxEnablePin = _TxEnablePin; 
-    pinMode(TxEnablePin, OUTPUT);
-    digitalWrite(TxEnablePin, LOW);
-  }
-  
-  // Modbus states that a baud rate higher than 19200 must use a fixed 750 us 
-  // for inter character time out and 1.75 ms for a frame delay.
-  // For baud rates below 19200 the timeing is more critical and has to be calculated.
-  // E.g. 9600 baud in a 10 bit packet is 960 characters per second
-  // In milliseconds this will be 960characters per 1000ms. So for 1 character
-  // 1000ms/960characters is 1.04167ms per character and finaly modbus states an
-  // intercharacter must be 1.5T or 1.5 times longer than a normal character and thus
-  // 1.5T = 1.04167ms * 1.5 = 1.5625ms. A frame delay is 3.5T.
-  // Added experimental low latency delays. This makes the implementation
-  // non-standard but practically it works with all major modbus master implementations.
-  
-  if (baud == 1000000 && _lowLatency)
-  {
-      T1_5 = 1; 
-      T3_5 = 10;
-  }
-  else if (baud >= 115200 && _lowLatency){
-      T1_5 = 75; 
-      T3_5 = 175; 
-  }
-  else if (baud > 19200)
-  {
-    T1_5 = 750; 
-    T3_5 = 1750;
-  }
-  else 
-  {
-    T1_5 = 15000000/baud; // 1T * 1.5 = T1.5
-    T3_5 = 35000000/baud; // 1T * 3.5 = T3.5
-  }
-  
-  holdingRegsSize = _holdingRegsSize;
-  errorCount = 0; // initialize errorCount
-}   
-
-unsigned int calculateCRC(byte bufferSize) 
-{
-  unsigned int temp, temp2, flag;
-  temp = 0xFFFF;
-  for (unsigned char i = 0; i < bufferSize; i++)
-  {
-    temp = temp ^ frame[i];
-    for (unsigned char j = 1; j <= 8; j++)
-    {
-      flag = temp & 0x0001;
-      temp >>= 1;
-      if (flag)
-        temp ^= 0xA001;
-    }
-  }
-  // Reverse byte order. 
-  temp2 = temp >> 8;
-  temp = (temp << 8) | temp2;
-  temp &= 0xFFFF;
-  return temp; // the returned value is already swopped - crcLo byte is first & crcHi byte is last
-}
-
-/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * 
-  
-  SENDPACKET
-
-  After response packet has been filled with required values, it is sent via
-  serial comm to Modbus master. 
-
-  /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
-
-void sendPacket(unsigned char bufferSize)
-{
-  if (TxEnablePin > 1)
-    digitalWrite(TxEnablePin, HIGH);
-    
-  for (unsigned char i = 0; i < bufferSize; i++)
-    modbusSerial.write(frame[i]);
-    
-  modbusSerial.flush();
-  
-  // allow a frame delay to indicate end of transmission
-  delayMicroseconds(T3_5); 
-  
-  if (TxEnablePin > 1)
-    digitalWrite(TxEnablePin, LOW);
-}
+#include "SimpleModbusSlave.h"
+
+#define BUFFER_SIZE 128
+
+// frame[] is used to recieve and transmit packets. 
+// The maximum serial ring buffer size is 128
+unsigned char frame[BUFFER_SIZE];
+unsigned int holdingRegsSize; // size of the register array 
+unsigned char broadcastFlag;
+unsigned char slaveID;
+unsigned char function;
+unsigned char TxEnablePin;
+unsigned int errorCount;
+unsigned int T3_5; // frame delay and end of frame silence in microseconds
+unsigned char rxLength; // bytes of the current frame received so far
+unsigned char rxOverflow; // the current frame did not fit into frame[]
+unsigned long lastByteTime; // micros() when the last byte was read
+unsigned char asyncTx; // the serial port buffers writes, send without blocking
+unsigned int charTime; // time one character occupies the line in microseconds
+unsigned char txLength; // size of the response in frame[] being transmitted
+unsigned char txIndex; // next byte of frame[] to hand to the serial port
+unsigned long txDoneTime; // micros() when the last byte handed over leaves the line, with a guard
+ModbusUnitLookup unitLookup; // register arrays by unit id, 0 for a single slave
+unsigned char *coils; // 8 to a byte, 0 if the slave has none
+unsigned int coilsSize; // number of coils
+unsigned char *discreteInputs; // 8 to a byte, 0 if the slave has none
+unsigned int discreteInputsSize; // number of discrete inputs
+const ModbusMapTables *registerMap; // typed registers, 0 for a plain array
+
+#ifdef __AVR__
+#define MAP_WORD(p) pgm_read_word(p)
+#define MAP_CALLBACK(p) ((ModbusRegisterCallback)pgm_read_word(p))
+#else
+#define MAP_WORD(p) (*(p))
+#define MAP_CALLBACK(p) (*(p))
+#endif
+
+// function definitions
+void readResponse(unsigned int *holdingRegs, unsigned int startingAddress, unsigned int no_of_registers);
+unsigned int readable(unsigned int address);
+unsigned char writable(unsigned int address, unsigned int no_of_registers);
+void mapCallbacks(unsigned int startingAddress, unsigned int no_of_registers, unsigned char write);
+void exceptionResponse(unsigned char exception);
+void sendPacket(unsigned char bufferSize);
+unsigned char transmit();
+void txComplete();
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * 
+  
+  MODBUS_UPDATE
+
+  Only Modbus function handled in loop. Calls all other Modbus functions to
+  handle Modbus slave activities
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */  
+unsigned int modbus_update(unsigned int *holdingRegs)
+{
+  /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * 
+  
+    FRAME RECEPTION
+
+   modbus_update() never waits for the rest of a frame. Every byte waiting
+   in the serial buffer is appended to frame[] and the time it was read is
+   remembered. A frame is only complete once the line has been silent for
+   T3.5, until then return straight away so loop() keeps running.
+
+   The maximum number of bytes is limited to the serial buffer size of 128 
+   bytes. If more bytes is received than the BUFFER_SIZE the overflow flag will
+   be set and the rest of the frame will be read and discarded.
+
+  /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+  // a response is still on its way out, nothing can be received until the
+  // transmitter has finished and released the line
+  if (txLength && !transmit())
+    return errorCount;
+
+  while (modbusSerial.available())
+  {  
+    if (rxLength == BUFFER_SIZE) 
+    {
+      rxOverflow = 1;
+      modbusSerial.read();
+    }
+    else
+    {
+      frame[rxLength] = modbusSerial.read();
+      rxLength++;
+    }
+    lastByteTime = micros();
+  }
+  
+  // nothing received yet or the frame is still arriving
+  if (rxLength == 0 || (micros() - lastByteTime) < T3_5)
+    return errorCount;
+  
+  unsigned char buffer = rxLength;
+  unsigned char overflow = rxOverflow;
+  
+  // ready to receive the next frame
+  rxLength = 0;
+  rxOverflow = 0;
+  
+  MODBUS_CAPTURE_FRAME(&modbusSerial, overflow ? MODBUS_CAPTURE_OVERFLOW : 0, lastByteTime, frame, buffer);
+  
+  // If an overflow occurred increment the errorCount variable and return to 
+  // the main sketch without responding to the request i.e. force a timeout
+  if (overflow)
+    return errorCount++;
+
+  /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * 
+  
+    MODBUS PACKET HANDLING
+
+    At this point, the frame[] array has the received packet from the master. 
+    Each Modbus packet section indexed by the frame array will be assigned 
+    to the appropriate variables (id, crc, function, holdingRegs data)
+
+  /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+  
+  // The minimum request packet is 8 bytes for function 3 & 16
+  if (buffer > 6) 
+  {
+    // slave ID assignment 
+    unsigned char id = frame[0];
+    
+    broadcastFlag = 0;
+    
+    if (id == 0)
+      broadcastFlag = 1;
+    
+    unsigned char accepted = (id == slaveID || broadcastFlag);
+    
+    // CRC assignment <-- combine the crc Low & High bytes
+    unsigned int crc = ((frame[buffer - 2] << 8) | frame[buffer - 1]); 
+    // if the calculated crc matches the recieved crc continue, noise and
+    // truncated frames never get as far as the unit lookup
+    if (modbus_crc16(frame, buffer - 2) == crc) 
+    {
+      // a sketch emulating several slaves answers for every id it has a 
+      // register array for, the broadcasting id (0) included
+      if (unitLookup)
+      {
+        holdingRegs = unitLookup(id, &holdingRegsSize);
+        accepted = (holdingRegs != 0);
+      }
+      else if (registerMap)
+        holdingRegs = registerMap->registers;
+      
+      // if the recieved ID matches the slaveID or broadcasting id (0), continue
+      if (accepted) 
+      {
+        // Function code assignment 
+        function = frame[1];
+
+        // combine the starting address bytes
+        unsigned int startingAddress = ((frame[2] << 8) | frame[3]); 
+        // combine the number of register bytes
+        unsigned int no_of_registers = ((frame[4] << 8) | frame[5]);   
+        unsigned int crc16;
+
+        /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * 
+  
+         FUNCTION CODE 3: READING HOLDING REGISTERS
+
+         Create response packet using frame array.
+
+        /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+        
+        // broadcasting is not supported for function 3 
+        if (!broadcastFlag && (function == 3))
+        {
+          unsigned int registersLeft = readable(startingAddress);
+          if (registersLeft) // check exception 2 ILLEGAL DATA ADDRESS
+          {
+            // the response has to fit into frame[] as well
+            if (no_of_registers <= registersLeft && 
+                no_of_registers <= (BUFFER_SIZE - 5) / 2) // check exception 3 ILLEGAL DATA VALUE
+            {
+              mapCallbacks(startingAddress, no_of_registers, 0);
+              readResponse(holdingRegs, startingAddress, no_of_registers);
+            }
+            else  
+              exceptionResponse(3); // exception 3 ILLEGAL DATA VALUE
+          }
+          else
+            exceptionResponse(2); // exception 2 ILLEGAL DATA ADDRESS
+        }
+        else if (function == 6)
+        {
+          if (writable(startingAddress, 1)) // check exception 2 ILLEGAL DATA ADDRESS
+          {
+              ModbusRegisterView value = { &frame[4], 1 };
+              unsigned char responseFrameSize = 8;
+              
+              holdingRegs[startingAddress] = value.get(0);
+              mapCallbacks(startingAddress, 1, 1);
+              
+              crc16 = modbus_crc16(frame, responseFrameSize - 2);
+              frame[responseFrameSize - 2] = crc16 >> 8; // split crc into 2 bytes
+              frame[responseFrameSize - 1] = crc16 & 0xFF;
+              sendPacket(responseFrameSize);
+          }
+          else
+            exceptionResponse(2); // exception 2 ILLEGAL DATA ADDRESS
+          }
+
+        /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * 
+  
+         FUNCTION CODE 16: WRITE HOLDING REGISTERS
+
+         Write new values to holding registers in slave's Modbus memory map. 
+
+        /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+        else if (function == 16)
+        {
+          // check if the recieved number of bytes matches the calculated bytes minus the request bytes
+          // id + function + (2 * address bytes) + (2 * no of register bytes) + byte count + (2 * CRC bytes) = 9 bytes
+          // and the byte count has to match the number of registers, which can't
+          // be larger than a frame holds
+          if (frame[6] == (buffer - 9) && no_of_registers <= (BUFFER_SIZE - 9) / 2 && 
+              frame[6] == no_of_registers * 2) 
+          {
+            if (writable(startingAddress, 0)) // check exception 2 ILLEGAL DATA ADDRESS
+            {
+              if (writable(startingAddress, no_of_registers)) // check exception 3 ILLEGAL DATA VALUE
+              {
+                // the values start at the 8th byte in the frame
+                ModbusRegisterView values = { &frame[7], no_of_registers };
+                values.read(&holdingRegs[startingAddress]);
+                mapCallbacks(startingAddress, no_of_registers, 1);
+                
+                // only the first 6 bytes are used for CRC calculation
+                crc16 = modbus_crc16(frame, 6); 
+                frame[6] = crc16 >> 8; // split crc into 2 bytes
+                frame[7] = crc16 & 0xFF;
+                
+                // a function 16 response is an echo of the first 6 bytes from the request + 2 crc bytes
+                if (!broadcastFlag) // don't respond if it's a broadcast message
+                  sendPacket(8); 
+              }
+              else  
+                exceptionResponse(3); // exception 3 ILLEGAL DATA VALUE
+            }
+            else
+              exceptionResponse(2); // exception 2 ILLEGAL DATA ADDRESS
+          }
+          else 
+            errorCount++; // corrupted packet
+        }         
+
+        /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * 
+  
+         FUNCTION CODE 23: READ/WRITE MULTIPLE REGISTERS
+
+         Write new values to holding registers and read holding registers
+         back in one transaction. The write is done before the read.
+
+        /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+        
+        // broadcasting is not supported for function 23 
+        else if (!broadcastFlag && (function == 23))
+        {
+          // the read range is in bytes 2 to 5, the write range follows
+          unsigned int writeAddress = ((frame[6] << 8) | frame[7]);
+          unsigned int no_of_write_registers = ((frame[8] << 8) | frame[9]);
+          
+          // id + function + (4 * address bytes) + (4 * no of register bytes) + byte count + (2 * CRC bytes) = 13 bytes
+          if (buffer > 12 && frame[10] == (buffer - 13) && no_of_write_registers <= (BUFFER_SIZE - 13) / 2 && 
+              frame[10] == no_of_write_registers * 2) 
+          {
+            unsigned int registersLeft = readable(startingAddress);
+            if (registersLeft && writable(writeAddress, 0)) // check exception 2 ILLEGAL DATA ADDRESS
+            {
+              // the response has to fit into frame[] as well
+              if (no_of_registers <= registersLeft && 
+                  writable(writeAddress, no_of_write_registers) && 
+                  no_of_registers <= (BUFFER_SIZE - 5) / 2) // check exception 3 ILLEGAL DATA VALUE
+              {
+                // the values start at the 12th byte in the frame
+                ModbusRegisterView values = { &frame[11], no_of_write_registers };
+                values.read(&holdingRegs[writeAddress]);
+                mapCallbacks(writeAddress, no_of_write_registers, 1);
+                
+                mapCallbacks(startingAddress, no_of_registers, 0);
+                readResponse(holdingRegs, startingAddress, no_of_registers);
+              }
+              else  
+                exceptionResponse(3); // exception 3 ILLEGAL DATA VALUE
+            }
+            else
+              exceptionResponse(2); // exception 2 ILLEGAL DATA ADDRESS
+          }
+          else 
+            errorCount++; // corrupted packet
+        }
+
+        /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * 
+  
+         FUNCTION CODE 1 & 2: READ COILS & READ DISCRETE INPUTS
+
+         For these functions no_of_registers is the number of coils or
+         inputs. They are stored 8 to a byte in the order the response 
+         sends them, so the table is copied into the frame as it is.
+
+        /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+        
+        // broadcasting is not supported for function 1 & 2
+        else if (!broadcastFlag && ((function == 1 && coils) || (function == 2 && discreteInputs)))
+        {
+          unsigned char *bits = (function == 1) ? coils : discreteInputs;
+          unsigned int bitsSize = (function == 1) ? coilsSize : discreteInputsSize;
+          
+          if (startingAddress < bitsSize) // check exception 2 ILLEGAL DATA ADDRESS
+          {
+            // the response has to fit into frame[] as well
+            if (no_of_registers > 0 && no_of_registers <= bitsSize - startingAddress && 
+                no_of_registers <= (BUFFER_SIZE - 5) * 8) // check exception 3 ILLEGAL DATA VALUE
+            {
+              unsigned char noOfBytes = (no_of_registers + 7) / 8;
+              unsigned char responseFrameSize = 5 + noOfBytes; // ID, function, noOfBytes, data, crcLo, crcHi
+              frame[2] = noOfBytes;
+              modbus_pack_bits(&frame[3], bits, startingAddress, no_of_registers);
+              
+              crc16 = modbus_crc16(frame, responseFrameSize - 2);
+              frame[responseFrameSize - 2] = crc16 >> 8; // split crc into 2 bytes
+              frame[responseFrameSize - 1] = crc16 & 0xFF;
+              sendPacket(responseFrameSize);
+            }
+            else  
+              exceptionResponse(3); // exception 3 ILLEGAL DATA VALUE
+          }
+          else
+            exceptionResponse(2); // exception 2 ILLEGAL DATA ADDRESS
+        }
+        
+        /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * 
+  
+         FUNCTION CODE 5: FORCE SINGLE COIL
+
+         The value 0xFF00 switches the coil on and 0x0000 off.
+
+        /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+        else if (function == 5 && coils)
+        {
+          // id + function + (2 * address bytes) + (2 * value bytes) + (2 * CRC bytes) = 8 bytes,
+          // the response echoes them so anything longer or shorter can't be answered
+          if (buffer == 8)
+          {
+            if (startingAddress < coilsSize) // check exception 2 ILLEGAL DATA ADDRESS
+            {
+              unsigned int value = no_of_registers;
+              if (value == 0xFF00 || value == 0x0000) // check exception 3 ILLEGAL DATA VALUE
+              {
+                modbus_set_bit(coils, startingAddress, value != 0);
+                
+                // a function 5 response is an echo of the request, crc included
+                if (!broadcastFlag) // don't respond if it's a broadcast message
+                  sendPacket(8);
+              }
+              else  
+                exceptionResponse(3); // exception 3 ILLEGAL DATA VALUE
+            }
+            else
+              exceptionResponse(2); // exception 2 ILLEGAL DATA ADDRESS
+          }
+          else 
+            errorCount++; // corrupted packet
+        }
+        
+        /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * 
+  
+         FUNCTION CODE 15: FORCE MULTIPLE COILS
+
+         Write a sequence of coils, packed 8 to a byte in the request. 
+
+        /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+        else if (function == 15 && coils)
+        {
+          // id + function + (2 * address bytes) + (2 * no of coils bytes) + byte count + (2 * CRC bytes) = 9 bytes
+          // and the byte count has to match the number of coils
+          if (frame[6] == (buffer - 9) && no_of_registers <= (BUFFER_SIZE - 9) * 8 && 
+              frame[6] == (no_of_registers + 7) / 8) 
+          {
+            if (startingAddress < coilsSize) // check exception 2 ILLEGAL DATA ADDRESS
+            {
+              if (no_of_registers > 0 && no_of_registers <= coilsSize - startingAddress) // check exception 3 ILLEGAL DATA VALUE
+              {
+                // the values start at the 8th byte in the frame
+                modbus_unpack_bits(coils, startingAddress, &frame[7], no_of_registers);
+                
+                // only the first 6 bytes are used for CRC calculation
+                crc16 = modbus_crc16(frame, 6); 
+                frame[6] = crc16 >> 8; // split crc into 2 bytes
+                frame[7] = crc16 & 0xFF;
+                
+                // a function 15 response is an echo of the first 6 bytes from the request + 2 crc bytes
+                if (!broadcastFlag) // don't respond if it's a broadcast message
+                  sendPacket(8); 
+              }
+              else  
+                exceptionResponse(3); // exception 3 ILLEGAL DATA VALUE
+            }
+            else
+              exceptionResponse(2); // exception 2 ILLEGAL DATA ADDRESS
+          }
+          else 
+            errorCount++; // corrupted packet
+        }
+        else
+          exceptionResponse(1); // exception 1 ILLEGAL FUNCTION
+      } // incorrect id
+    }
+    else if (accepted || unitLookup) // checksum failed
+      errorCount++;
+  }
+  else if (buffer > 0 && buffer < 8)
+    errorCount++; // corrupted packet
+    
+  return errorCount;
+}       
+
+// Builds and sends the response of a function 3 or 23 request
+void readResponse(unsigned int *holdingRegs, unsigned int startingAddress, unsigned int no_of_registers)
+{
+  unsigned char noOfBytes = no_of_registers * 2;
+  unsigned char responseFrameSize = 5 + noOfBytes; // ID, function, noOfBytes, (dataLo + dataHi) * number of registers, crcLo, crcHi
+  // frame[0] still holds the id the request was sent to
+  frame[1] = function;
+  frame[2] = noOfBytes;
+  
+  // Assign slave holding registers data to response packet, the PDU
+  // starts at the 4th byte
+  ModbusRegisterView values = { &frame[3], no_of_registers };
+  values.write(&holdingRegs[startingAddress]);
+  
+  // Assign 16 bit (2 bytes) CRC to response packet 
+  unsigned int crc16 = modbus_crc16(frame, responseFrameSize - 2);
+  frame[responseFrameSize - 2] = crc16 >> 8; // split crc into 2 bytes
+  frame[responseFrameSize - 1] = crc16 & 0xFF;
+
+  // Send finished response packet to Modbus master 
+  sendPacket(responseFrameSize);
+}
+
+// Registers that can be read from address on, 0 if address can't be read.
+// Without a map that is up to the end of the register array, compared
+// this way instead of the end address which wraps past 65535.
+unsigned int readable(unsigned int address)
+{
+  if (registerMap && !unitLookup)
+    return address < registerMap->size ? pgm_read_byte(&registerMap->readable[address]) : 0;
+  
+  return address < holdingRegsSize ? holdingRegsSize - address : 0;
+}
+
+// 1 if no_of_registers can be written from address on, with 0 if a write
+// can start at address. A map only takes whole registers it allows writes to.
+unsigned char writable(unsigned int address, unsigned int no_of_registers)
+{
+  if (!registerMap || unitLookup)
+    return address < holdingRegsSize && no_of_registers <= holdingRegsSize - address;
+  
+  if (address >= registerMap->size)
+    return 0;
+  unsigned char run = pgm_read_byte(&registerMap->writable[address]) & ~MODBUS_MAP_BOUNDARY;
+  if (no_of_registers == 0)
+    return run > 0;
+  
+  // and the write has to end where a register ends
+  unsigned int end = address + no_of_registers;
+  return no_of_registers <= run && 
+         (end == registerMap->size || (pgm_read_byte(&registerMap->writable[end]) & MODBUS_MAP_BOUNDARY));
+}
+
+// Calls the onRead or onWrite callbacks of the registers of the map in a
+// range that has been checked
+void mapCallbacks(unsigned int startingAddress, unsigned int no_of_registers, unsigned char write)
+{
+  if (!registerMap || unitLookup)
+    return;
+  
+  const ModbusMapCallback *callback = registerMap->callbacks;
+  for (unsigned int i = 0; i < registerMap->no_of_callbacks; i++, callback++)
+  {
+    unsigned int address = MAP_WORD(&callback->address);
+    if (address >= startingAddress + no_of_registers)
+      break;
+    
+    // a float32 read from its second register on counts as read
+    ModbusRegisterCallback call = write ? MAP_CALLBACK(&callback->onWrite) : MAP_CALLBACK(&callback->onRead);
+    if (call && MAP_WORD(&callback->end) > startingAddress)
+      call(address);
+  }
+}
+
+void exceptionResponse(unsigned char exception)
+{
+  errorCount++; // each call to exceptionResponse() will increment the errorCount
+  if (!broadcastFlag) // don't respond if its a broadcast message
+  {
+    // frame[0] still holds the id the request was sent to
+    frame[1] = (function | 0x80); // set the MSB bit high, informs the master of an exception
+    frame[2] = exception;
+    unsigned int crc16 = modbus_crc16(frame, 3); // ID, function + 0x80, exception code == 3 bytes
+    frame[3] = crc16 >> 8;
+    frame[4] = crc16 & 0xFF;
+    sendPacket(5); // exception response is always 5 bytes ID, function + 0x80, exception code, 2 bytes crc
+  }
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * 
+  
+ MODBUS_CONFIGURE_MAP
+
+ parameters(const ModbusMapTables *map)
+
+  Answers the master from a register map declared with ModbusRegisterMap,
+  see ModbusRegisterMap.h. Pass it tables() of the map. The registers of
+  the map are used instead of the ones passed to modbus_update() and the
+  master can only read and write them as the map allows. Callbacks of 
+  the map are called from modbus_update(). modbus_configure_map(0) goes
+  back to the plain register array. A lookup set with 
+  modbus_configure_units() wins over the map.
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+void modbus_configure_map(const ModbusMapTables *map)
+{
+  registerMap = map;
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * 
+  
+ MODBUS_CONFIGURE_UNITS
+
+ parameters(ModbusUnitLookup lookup)
+
+  Makes the sketch answer for more than one slave ID on the same line. For 
+  every frame with a valid crc lookup(id, &size) is called with the ID the
+  frame was sent to. It returns the register array of that slave and sets
+  size to the number of registers in it, or returns 0 if there is no such
+  slave and the frame is ignored. The ID and holding registers passed to 
+  modbus_configure() and modbus_update() are not used while a lookup is 
+  set. modbus_configure_units(0) goes back to a single slave, call 
+  modbus_configure() again to restore its register array size.
+  
+  The lookup is called from modbus_update() and should return quickly, the
+  response is only started once it has returned.
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+void modbus_configure_units(ModbusUnitLookup lookup)
+{
+  unitLookup = lookup;
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * 
+  
+ MODBUS_CONFIGURE_TX
+
+ parameters(unsigned char background)
+
+  With background set responses are sent in the background on a buffered
+  port even though modbus_configure() was given a transmit enable pin. The
+  pin is then released by the first modbus_update() after the last byte 
+  has left the line, so loop() has to come round well within the time the
+  master waits before its next request, or that request is lost. Call it
+  after modbus_configure(), which goes back to blocking responses.
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+void modbus_configure_tx(unsigned char background)
+{
+  asyncTx = background && modbusSerial.availableForWrite() > 0;
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * 
+  
+ MODBUS_CONFIGURE_COILS
+
+ parameters(unsigned char *coils, 
+            unsigned int number of coils,
+            unsigned char *discrete inputs,
+            unsigned int number of discrete inputs)
+
+  Gives the slave coils (read with function 1, written with 5 & 15) and 
+  discrete inputs (read with function 2). Both are packed 8 to a byte, use
+  modbus_get_bit() and modbus_set_bit() to access them from the sketch. 
+  Pass 0 for a table the slave doesn't have, its functions are then 
+  answered with exception 1. With several slave IDs (see 
+  modbus_configure_units()) all of them share these tables.
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+void modbus_configure_coils(unsigned char *_coils, unsigned int _coilsSize, unsigned char *_discreteInputs, unsigned int _discreteInputsSize)
+{
+  coils = _coils;
+  coilsSize = _coils ? _coilsSize : 0;
+  discreteInputs = _discreteInputs;
+  discreteInputsSize = _discreteInputs ? _discreteInputsSize : 0;
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * 
+  
+ MODBUS_CONFIGURE
+
+ parameters(long baudrate, 
+            unsigned char ID, 
+            unsigned char transmit enable pin, 
+            unsigned int holding registers size,
+            unsigned char low latency)
+                
+  The transmit enable pin is used in half duplex communication to activate 
+  a MAX485 or similar to deactivate this mode use any value < 2 because 0 &
+  1 is reserved for Rx & Tx. Low latency delays makes the implementation 
+  non-standard but practically it works with all major modbus master
+  implementations.
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+void modbus_configure(long baud, unsigned char _slaveID, unsigned char _TxEnablePin, unsigned int _holdingRegsSize, unsigned char _lowLatency)
+{
+  slaveID = _slaveID;
+  modbusSerial.begin(baud);
+  
+  if (_TxEnablePin > 1) 
+  { // pin 0 & pin 1 are reserved for RX/TX. To disable set txenpin < 2
+    TxEnablePin = _TxEnablePin; 
+    pinMode(TxEnablePin, OUTPUT);
+    digitalWrite(TxEnablePin, LOW);
+  }
+  
+  // Modbus states that a baud rate higher than 19200 must use a fixed 750 us 
+  // for inter character time out and 1.75 ms for a frame delay.
+  // For baud rates below 19200 the timeing is more critical and has to be calculated.
+  // E.g. 9600 baud in a 10 bit packet is 960 characters per second
+  // In milliseconds this will be 960characters per 1000ms. So for 1 character
+  // 1000ms/960characters is 1.04167ms per character and finaly modbus states an
+  // intercharacter must be 1.5T or 1.5 times longer than a normal character and thus
+  // 1.5T = 1.04167ms * 1.5 = 1.5625ms. A frame delay is 3.5T.
+  // Added experimental low latency delays. This makes the implementation
+  // non-standard but practically it works with all major modbus master implementations.
+  
+  // Only T3.5 is needed, frames are delimited by a T3.5 silence on the line.
+  
+  if (baud == 1000000 && _lowLatency)
+  {
+      T3_5 = 10;
+  }
+  else if (baud >= 115200 && _lowLatency){
+      T3_5 = 175; 
+  }
+  else if (baud > 19200)
+  {
+    T3_5 = 1750;
+  }
+  else 
+  {
+    T3_5 = 35000000/baud; // 1T * 3.5 = T3.5
+  }
+  
+  holdingRegsSize = _holdingRegsSize;
+  errorCount = 0; // initialize errorCount
+  rxLength = 0;
+  rxOverflow = 0;
+  
+  // A HardwareSerial port buffers writes and reports the free space, then 
+  // responses are sent in the background. SoftwareSerial reports no space,
+  // it sends every byte as it is written and the response blocks instead.
+  // With a transmit enable pin the pin is only released by the next update,
+  // so the response blocks as it always has unless modbus_configure_tx()
+  // says loop() is short enough.
+  asyncTx = modbusSerial.availableForWrite() > 0 && TxEnablePin < 2;
+  charTime = (10000000 + baud - 1) / baud; // 10 bits per character rounded up
+  txLength = 0;
+}   
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * 
+  
+  SENDPACKET
+
+  After response packet has been filled with required values, it is sent via
+  serial comm to Modbus master. 
+
+  With a buffered serial port sendPacket() only starts the transmission. 
+  transmit() keeps the serial TX buffer topped up from frame[] on every call
+  to modbus_update() and works out from the baud rate when the last byte will
+  have left the line. Half a character after that, a guard for the 
+  estimate which starts from a micros() read before write() in 4us steps
+  on the AVR, txComplete() releases the transmit enable pin. The frame 
+  delay after the response needs no waiting, the master has to keep T3.5
+  of silence before its next request anyway.
+
+  /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+void sendPacket(unsigned char bufferSize)
+{
+  MODBUS_CAPTURE_FRAME(&modbusSerial, MODBUS_CAPTURE_TX, micros(), frame, bufferSize);
+  
+  if (TxEnablePin > 1)
+    digitalWrite(TxEnablePin, HIGH);
+  
+  if (asyncTx)
+  {
+    txLength = bufferSize;
+    txIndex = 0;
+    txDoneTime = micros();
+    transmit();
+    return;
+  }
+    
+  for (unsigned char i = 0; i < bufferSize; i++)
+    modbusSerial.write(frame[i]);
+    
+  modbusSerial.flush();
+  
+  // allow a frame delay to indicate end of transmission
+  delayMicroseconds(T3_5); 
+  
+  if (TxEnablePin > 1)
+    digitalWrite(TxEnablePin, LOW);
+}
+
+// Hands the serial port as many bytes as it can buffer and returns 1 once
+// the whole response has been sent.
+unsigned char transmit()
+{
+  while (txIndex < txLength && modbusSerial.availableForWrite() > 0)
+  {
+    // a byte written to an idle port starts straight away, otherwise it
+    // follows the byte before it
+    unsigned long now = micros();
+    if ((long)(txDoneTime - now) < 0)
+      txDoneTime = now;
+    txDoneTime += charTime;
+    
+    modbusSerial.write(frame[txIndex]);
+    txIndex++;
+    
+    // half a character of guard, see sendPacket()
+    if (txIndex == txLength)
+      txDoneTime += charTime / 2;
+  }
+  
+  if (txIndex == txLength && (long)(micros() - txDoneTime) >= 0)
+  {
+    txComplete();
+    return 1;
+  }
+  
+  return 0;
+}
+
+// TX complete event, the stop bit of the last byte has left the line
+void txComplete()
+{
+  txLength = 0;
+  
+  if (TxEnablePin > 1)
+    digitalWrite(TxEnablePin, LOW);
+}
@@ -1,89 +1,144 @@
-#ifndef SIMPLE_MODBUS_SLAVE_H
-#define SIMPLE_MODBUS_SLAVE_H
-
-/*
- SimpleModbusSlave allows you to communicate
- to any slave using the Modbus RTU protocol.
- 
- The crc calculation is based on the work published 
- by jpmzometa at 
- http://sites.google.com/site/jpmzometa/arduino-mbrt
- 
- By Juan Bester : bester.juan@gmail.com
- 
- The functions implemented are functions 3 and 16.
- read holding registers and preset multiple registers
- of the Modbus RTU Protocol, to be used over the Arduino serial connection.
- 
- This implementation DOES NOT fully comply with the Modbus specifications.
- 
- Specifically the frame time out have not been implemented according
- to Modbus standards. The code does however combine the check for
- inter character time out and frame time out by incorporating a maximum
- time out allowable when reading from the message stream.
- 
- These library of functions are designed to enable a program send and
- receive data from a device that communicates using the Modbus protocol.
- 
- SimpleModbusSlave implements an unsigned int return value on a call to modbus_update().
- This value is the total error count since the slave started. It's useful for fault finding.
- 
- This code is for a Modbus slave implementing functions 3 and 16
- function 3: Reads the binary contents of holding registers (4X references)
- function 16: Presets values into a sequence of holding registers (4X references)
- 
- All the functions share the same register array.
- 
- Exception responses:
- 1 ILLEGAL FUNCTION
- 2 ILLEGAL DATA ADDRESS
- 3 ILLEGAL DATA VALUE
- 
- Note:  
- The Arduino serial ring buffer is 128 bytes or 64 registers.
- Most of the time you will connect the arduino to a master via serial
- using a MAX485 or similar.
- 
- In a function 3 request the master will attempt to read from your
- slave and since 5 bytes is already used for ID, FUNCTION, NO OF BYTES
- and two BYTES CRC the master can only request 122 bytes or 61 registers.
- 
- In a function 16 request the master will attempt to write to your 
- slave and since a 9 bytes is already used for ID, FUNCTION, ADDRESS, 
- NO OF REGISTERS, NO OF BYTES and two BYTES CRC the master can only write
- 118 bytes or 59 registers.
- 
- Using the FTDI converter ic the maximum bytes you can send is limited 
- to its internal buffer which is 60 bytes or 30 unsigned int registers. 
- 
- Thus:
- 
- In a function 3 request the master will attempt to read from your
- slave and since 5 bytes is already used for ID, FUNCTION, NO OF BYTES
- and two BYTES CRC the master can only request 54 bytes or 27 registers.
- 
- In a function 16 request the master will attempt to write to your 
- slave and since a 9 bytes is already used for ID, FUNCTION, ADDRESS, 
- NO OF REGISTERS, NO OF BYTES and two BYTES CRC the master can only write
- 50 bytes or 25 registers.
-  
- Since it is assumed that you will mostly use the Arduino to connect to a 
- master without using a USB to Serial converter the internal buffer is set
- the same as the Arduino Serial ring buffer which is 128 bytes.
- 
- The functions included here have been derived from the 
- Modbus Specifications and Implementation Guides
- 
- http://www.modbus.org/docs/Modbus_over_serial_line_V1_02.pdf
- http://www.modbus.org/docs/Modbus_Application_Protocol_V1_1b.pdf
- http://www.modbus.org/docs/PI_MBUS_300.pdf
-*/
-
-#include "Arduino.h"
-
-// function definitions
-void modbus_configure(long baud, byte _slaveID, byte _TxEnablePin, unsigned int _holdingRegsSize, unsigned char _lowLatency);
-unsigned int modbus_update(unsigned int *holdingRegs);
- 
-
-#endif
+#ifndef SIMPLE_MODBUS_SLAVE_H
+#define SIMPLE_MODBUS_SLAVE_H
+
+/*
+ SimpleModbusSlave allows you to communicate
+ to any slave using the Modbus RTU protocol.
+ 
+ The crc calculation is based on the work published 
+ by jpmzometa at 
+ http://sites.google.com/site/jpmzometa/arduino-mbrt
+ and is now shared with SimpleModbusMaster through ModbusCRC.h in the
+ ModbusCommon library, which must be installed alongside this one.
+ 
+ By Juan Bester : bester.juan@gmail.com
+ 
+ The functions implemented are functions 1, 2, 3, 5, 6, 15, 16 and 23.
+ read coil status, read input status, read holding registers, force single
+ coil, preset single register, force multiple coils, preset multiple 
+ registers and read/write multiple registers of the Modbus RTU Protocol, to be used over the Arduino serial connection.
+ 
+ This implementation DOES NOT fully comply with the Modbus specifications.
+ 
+ Specifically the inter character time out (T1.5) is not checked. A frame
+ ends when the line has been silent for the frame delay (T3.5), measured
+ with micros() between calls to modbus_update(). modbus_update() does not
+ block while a frame is arriving, it returns immediately and picks up the
+ remaining bytes on the next call, so keep loop() short compared to T3.5
+ for the fastest response.
+ 
+ Responses are sent the same way when the serial port buffers writes (a
+ HardwareSerial). modbus_update() tops up the TX buffer on each call and
+ releases the transmit enable pin once the last byte has left the line. 
+ On a SoftwareSerial port every write blocks and so does the response.
+ The pin is only released by the next modbus_update(), so loop() has to
+ come round well within the time the master waits before its next 
+ request. With a transmit enable pin responses therefore block as they
+ always did until modbus_configure_tx(1) says loop() is short enough.
+ 
+ These library of functions are designed to enable a program send and
+ receive data from a device that communicates using the Modbus protocol.
+ 
+ SimpleModbusSlave implements an unsigned int return value on a call to modbus_update().
+ This value is the total error count since the slave started. It's useful for fault finding.
+ 
+ This code is for a Modbus slave implementing functions 3, 6, 16 and 23
+ function 3: Reads the binary contents of holding registers (4X references)
+ function 6: Presets a value into a single holding register (4X reference)
+ function 16: Presets values into a sequence of holding registers (4X references)
+ function 23: Presets values into a sequence of holding registers and then
+ reads the binary contents of a sequence of holding registers (4X references)
+ 
+ and functions 1, 2, 5 and 15 once modbus_configure_coils() has been called
+ function 1: Reads the ON/OFF status of coils (0X references)
+ function 2: Reads the ON/OFF status of discrete inputs (1X references)
+ function 5: Forces a single coil ON or OFF (0X reference)
+ function 15: Forces a sequence of coils ON or OFF (0X references)
+ 
+ Coils and discrete inputs are bit arrays, 8 to a byte, so a digital
+ input such as an alarm takes 1 bit instead of a 16 bit register. A map of
+ 512 alarms needs 64 bytes and is read in a single request answered with
+ 64 bytes of data, where as holding registers it needs 1 KB and 9 requests.
+ 
+ A sketch can also answer for several slave IDs, each with a register
+ array of its own. modbus_configure_units() installs a function that
+ returns the register array for the ID of each request.
+ 
+ All the register functions share the same register array. It can be as large as
+ the Modbus address space, every register address from 0 to 65535 is
+ accepted. Register values are copied straight between the array and the
+ frame with ModbusRegisterView from the ModbusCommon library.
+ 
+ Exception responses:
+ 1 ILLEGAL FUNCTION
+ 2 ILLEGAL DATA ADDRESS
+ 3 ILLEGAL DATA VALUE
+ 
+ Note:  
+ The Arduino serial ring buffer is 128 bytes or 64 registers.
+ Most of the time you will connect the arduino to a master via serial
+ using a MAX485 or similar.
+ 
+ In a function 3 request the master will attempt to read from your
+ slave and since 5 bytes is already used for ID, FUNCTION, NO OF BYTES
+ and two BYTES CRC the master can only request 122 bytes or 61 registers.
+ 
+ In a function 16 request the master will attempt to write to your 
+ slave and since a 9 bytes is already used for ID, FUNCTION, ADDRESS, 
+ NO OF REGISTERS, NO OF BYTES and two BYTES CRC the master can only write
+ 118 bytes or 59 registers.
+ 
+ Using the FTDI converter ic the maximum bytes you can send is limited 
+ to its internal buffer which is 60 bytes or 30 unsigned int registers. 
+ 
+ Thus:
+ 
+ In a function 3 request the master will attempt to read from your
+ slave and since 5 bytes is already used for ID, FUNCTION, NO OF BYTES
+ and two BYTES CRC the master can only request 54 bytes or 27 registers.
+ 
+ In a function 16 request the master will attempt to write to your 
+ slave and since a 9 bytes is already used for ID, FUNCTION, ADDRESS, 
+ NO OF REGISTERS, NO OF BYTES and two BYTES CRC the master can only write
+ 50 bytes or 25 registers.
+  
+ Since it is assumed that you will mostly use the Arduino to connect to a 
+ master without using a USB to Serial converter the internal buffer is set
+ the same as the Arduino Serial ring buffer which is 128 bytes.
+ 
+ The holding registers can also be declared as a list of typed registers
+ with ModbusRegisterMap.h, checked when the sketch is compiled. 
+ modbus_configure_map() then has modbus_update() check every request
+ against the access of the registers and call their callbacks.
+ 
+ A host build compiled with MODBUS_CAPTURE passes every request received
+ and every response sent to the hook set with modbus_capture(), see
+ ModbusCapture.h in ModbusCommon.
+ 
+ The functions included here have been derived from the 
+ Modbus Specifications and Implementation Guides
+ 
+ http://www.modbus.org/docs/Modbus_over_serial_line_V1_02.pdf
+ http://www.modbus.org/docs/Modbus_Application_Protocol_V1_1b.pdf
+ http://www.modbus.org/docs/PI_MBUS_300.pdf
+*/
+
+#include "Arduino.h"
+#include <ModbusCRC.h>
+#include <ModbusRegisters.h>
+#include <ModbusCapture.h>
+#include "ModbusRegisterMap.h"
+
+// returns the register array of slave id and its size, 0 if there is none
+typedef unsigned int *(*ModbusUnitLookup)(unsigned char id, unsigned int *holdingRegsSize);
+
+// function definitions
+void modbus_configure(long baud, byte _slaveID, byte _TxEnablePin, unsigned int _holdingRegsSize, unsigned char _lowLatency);
+void modbus_configure_units(ModbusUnitLookup lookup);
+void modbus_configure_map(const ModbusMapTables *map);
+void modbus_configure_tx(unsigned char background);
+void modbus_configure_coils(unsigned char *_coils, unsigned int _coilsSize, unsigned char *_discreteInputs, unsigned int _discreteInputsSize);
+unsigned int modbus_update(unsigned int *holdingRegs);
+ 
+
+#endif
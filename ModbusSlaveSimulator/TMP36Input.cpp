@@ -0,0 +1,27 @@
+#include "TMP36Input.h"
+
+void tmp36_init(TMP36Input *input)
+{
+  input->sum = 0;
+  input->no_of_samples = 0;
+  input->tenths = 0;
+}
+
+unsigned char tmp36_sample(TMP36Input *input, unsigned int sample)
+{
+  input->sum += sample;
+  if (++input->no_of_samples < TMP36_SAMPLES)
+    return 0;
+
+  // 14 bits of sum decimated to 12, rounded
+  input->tenths = tmp36_tenths((input->sum + 2) >> 2);
+  input->sum = 0;
+  input->no_of_samples = 0;
+  return 1;
+}
+
+// tenths of a degree Fahrenheit of a TMP36_BITS reading, rounded
+int tmp36_tenths(unsigned int reading)
+{
+  return (int)(((unsigned long)reading * 1125 + 256) >> 9) - 580;
+}
@@ -0,0 +1,50 @@
+#ifndef TMP36_INPUT_H
+#define TMP36_INPUT_H
+
+/*
+ TMP36Input turns the analogRead() samples of a TMP36 on a 5 V, 10 bit
+ ADC into tenths of a degree Fahrenheit with integer arithmetic only. The
+ AVR has no FPU and every float multiply, add and conversion of the
+ original
+
+   voltageTemp = (analogTemp/1024.0)*5.0;
+   tempF = ((9.0/5.0)*(voltageTemp - 0.5)*100) + 32.0;
+
+ is a library call, run on every loop() next to modbus_update().
+
+ The samples are oversampled: TMP36_SAMPLES of them are summed, one per
+ call, and the sum is decimated to a TMP36_BITS reading. The noise of the
+ ADC and the sensor dithers the samples, every 4 times as many samples
+ give one more bit, so 16 samples resolve 1.22 mV or 0.22 F where a single
+ one resolves 4.9 mV or 0.88 F. The reading is then scaled with one 32 bit
+ multiply and a shift:
+
+   tenths = reading * 5000 / 4096 mV, - 500 mV for 0 C, * 18 / 10 + 320
+          = reading * 1125 / 512 - 580
+
+   TMP36Input temp;
+   tmp36_init(&temp);
+   ...
+   if (tmp36_sample(&temp, analogRead(tempPin))) // in loop()
+     regs.setScaled<TEMP_STATE>(temp.tenths);
+
+ tmp36_sample() returns 1 when a new value is in tenths, every
+ TMP36_SAMPLES calls.
+*/
+
+#define TMP36_SAMPLES 16 // oversampled 4^2 times
+#define TMP36_BITS 12 // 10 ADC bits + 2
+
+typedef struct
+{
+  unsigned int sum; // of the samples so far, 16 * 1023 fits
+  unsigned char no_of_samples;
+  int tenths; // the last value, tenths of a degree Fahrenheit
+} TMP36Input;
+
+// function definitions
+void tmp36_init(TMP36Input *input);
+unsigned char tmp36_sample(TMP36Input *input, unsigned int sample);
+int tmp36_tenths(unsigned int reading);
+
+#endif
@@ -4,10 +4,27 @@ MS5611-01BA.cpp - Defines all the functions used for MS561101BA_altitude.pde
 
 #include "MS561101BA.h"
 #define EXTRA_PRECISION 5 // trick to add more precision to the pressure and temp readings
-#define CONVERSION_TIME 10000l // conversion time in microseconds
+
+// conversion time in microseconds for OSR 256, 512, 1024, 2048 and 4096,
+// the maximum of the datasheet page 2
+static const unsigned long conversionTimes[] = { 600, 1170, 2280, 4540, 9040 };
 
 MS561101BA::MS561101BA() {
-  ;
+  lastPresConv = lastTempConv = 0;
+  presCache = tempCache = 0;
+  samples = dropped = errors = 0;
+  _state = MS561101BA_IDLE;
+  _osr = MS561101BA_OSR_256;
+  _tempEvery = 1;
+  _sinceTemp = 0;
+  _convStart = _convTime = 0;
+  _dT = 0;
+  _head = _count = 0;
+}
+
+unsigned long MS561101BA::conversionTime(uint8_t OSR) {
+  uint8_t index = OSR >> 1;
+  return conversionTimes[index < 4 ? index : 4];
 }
 
 void MS561101BA::init(uint8_t address) {  
@@ -35,16 +52,14 @@ float MS561101BA::getPressure(uint8_t OSR) {
   // see datasheet page 7 for formulas
   int32_t rawPress = rawPressure(OSR);
   int64_t dT   = getDeltaTemp(OSR);
-  if(dT == NULL) {
-    return NULL;
+  if(dT == 0) {
+    return 0;
   }
-  int64_t off  = (((int64_t)_C[1]) << 16) + ((_C[3] * dT) >> 7);
-  int64_t sens = (((int64_t)_C[0]) << 15) + ((_C[2] * dT) >> 8);
-  if(rawPress != NULL) {
-    return ((((rawPress * sens) >> 21) - off) >> (15-EXTRA_PRECISION)) / ((1<<EXTRA_PRECISION) * 100.0);
+  if(rawPress != 0) {
+    return pressureOf(rawPress, dT);
   }
   else {
-    return NULL;
+    return 0;
   }
 }
 
@@ -52,27 +67,37 @@ float MS561101BA::getTemperature(uint8_t OSR) {
   // see datasheet page 7 for formulas
   int64_t dT = getDeltaTemp(OSR);
   
-  if(dT != NULL) {
-    return ((1<<EXTRA_PRECISION)*2000l + ((dT * _C[5]) >> (23-EXTRA_PRECISION))) / ((1<<EXTRA_PRECISION) * 100.0);
+  if(dT != 0) {
+    return temperatureOf(dT);
   }
   else {
-    return NULL;
+    return 0;
   }
 }
 
 int64_t MS561101BA::getDeltaTemp(uint8_t OSR) {
   int32_t rawTemp = rawTemperature(OSR);
-  if(rawTemp != NULL) {
+  if(rawTemp != 0) {
     return rawTemp - (((int32_t)_C[4]) << 8);
   }
   else {
-    return NULL;
+    return 0;
   }
 }
 
+float MS561101BA::pressureOf(int32_t rawPress, int64_t dT) {
+  int64_t off  = (((int64_t)_C[1]) << 16) + ((_C[3] * dT) >> 7);
+  int64_t sens = (((int64_t)_C[0]) << 15) + ((_C[2] * dT) >> 8);
+  return ((((rawPress * sens) >> 21) - off) >> (15-EXTRA_PRECISION)) / ((1<<EXTRA_PRECISION) * 100.0);
+}
+
+float MS561101BA::temperatureOf(int64_t dT) {
+  return ((1<<EXTRA_PRECISION)*2000l + ((dT * _C[5]) >> (23-EXTRA_PRECISION))) / ((1<<EXTRA_PRECISION) * 100.0);
+}
+
 int32_t MS561101BA::rawPressure(uint8_t OSR) {
   unsigned long now = micros();
-  if(lastPresConv != 0 && (now - lastPresConv) >= CONVERSION_TIME) {
+  if(lastPresConv != 0 && (now - lastPresConv) >= conversionTime(OSR)) {
     lastPresConv = 0;
     return getConversion(MS561101BA_D1 + OSR);
   }
@@ -81,13 +106,13 @@ int32_t MS561101BA::rawPressure(uint8_t OSR) {
       startConversion(MS561101BA_D1 + OSR);
       lastPresConv = now;
     }
-    return NULL;
+    return 0;
   }
 }
 
 int32_t MS561101BA::rawTemperature(uint8_t OSR) {
   unsigned long now = micros();
-  if(lastTempConv != 0 && (now - lastTempConv) >= CONVERSION_TIME) {
+  if(lastTempConv != 0 && (now - lastTempConv) >= conversionTime(OSR)) {
     lastTempConv = 0;
     tempCache = getConversion(MS561101BA_D2 + OSR);
     return tempCache;
@@ -96,17 +121,98 @@ int32_t MS561101BA::rawTemperature(uint8_t OSR) {
     if(lastTempConv == 0 && lastPresConv == 0) {
       startConversion(MS561101BA_D2 + OSR);
       lastTempConv = now;
+      return tempCache; // the previous temperature until this one is read
     }
     else if(lastPresConv != 0) { // there is a Pressure reading in process
       return tempCache;
     }
     else {
-      return NULL;
+      return 0;
     }
   }
 }
 
 
+void MS561101BA::start(uint8_t OSR, uint8_t tempEvery) {
+  _osr = OSR;
+  _tempEvery = tempEvery ? tempEvery : 1;
+  _head = _count = 0;
+  // a pressure can't be compensated before the first temperature
+  convert(MS561101BA_CONVERTING_D2);
+}
+
+void MS561101BA::stop() {
+  // a conversion that is running finishes on its own, reset() would abort it
+  _state = MS561101BA_IDLE;
+}
+
+void MS561101BA::convert(uint8_t state) {
+  startConversion((state == MS561101BA_CONVERTING_D1 ? MS561101BA_D1 : MS561101BA_D2) + _osr);
+  _state = state;
+  _convStart = micros();
+  _convTime = conversionTime(_osr);
+}
+
+bool MS561101BA::poll() {
+  if(_state == MS561101BA_IDLE || micros() - _convStart < _convTime) {
+    return false;
+  }
+
+  uint8_t converted = _state;
+  unsigned long value = getConversion(0);
+
+  // the device answers 0 when the conversion was cut short, do it again
+  if(value == 0 || value == (unsigned long)-1) {
+    errors++;
+    convert(converted);
+    return false;
+  }
+
+  if(converted == MS561101BA_CONVERTING_D2) {
+    _dT = (int32_t)value - (((int32_t)_C[4]) << 8);
+    _sinceTemp = 0;
+    convert(MS561101BA_CONVERTING_D1);
+    return false;
+  }
+
+  // the next conversion runs while this one is compensated
+  unsigned long now = micros();
+  _sinceTemp++;
+  convert(_sinceTemp >= _tempEvery ? MS561101BA_CONVERTING_D2 : MS561101BA_CONVERTING_D1);
+
+  if(_count == MS561101BA_QUEUE_SIZE) {
+    _head = (_head + 1) % MS561101BA_QUEUE_SIZE;
+    _count--;
+    dropped++;
+  }
+  MS561101BA_Sample *sample = &_queue[(_head + _count) % MS561101BA_QUEUE_SIZE];
+  sample->pressure = pressureOf(value, _dT);
+  sample->temperature = temperatureOf(_dT);
+  sample->time = now;
+  _count++;
+  samples++;
+  return true;
+}
+
+bool MS561101BA::ready() {
+  return _count != 0;
+}
+
+uint8_t MS561101BA::available() {
+  return _count;
+}
+
+bool MS561101BA::read(MS561101BA_Sample *sample) {
+  if(_count == 0) {
+    return false;
+  }
+  *sample = _queue[_head];
+  _head = (_head + 1) % MS561101BA_QUEUE_SIZE;
+  _count--;
+  return true;
+}
+
+
 // see page 11 of the datasheet
 void MS561101BA::startConversion(uint8_t command) {
   // initialize pressure conversion
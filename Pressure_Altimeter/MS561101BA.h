@@ -43,6 +43,20 @@ along with declaring the class MS561101BA.
 #define MS561101BA_PROM_REG_COUNT 6 // number of registers in the PROM
 #define MS561101BA_PROM_REG_SIZE 2 // size in bytes of a prom registry.
 
+// states of the asynchronous conversion pipeline
+#define MS561101BA_IDLE 0
+#define MS561101BA_CONVERTING_D2 1 // temperature
+#define MS561101BA_CONVERTING_D1 2 // pressure
+
+#define MS561101BA_QUEUE_SIZE 8 // samples kept until read, the oldest is dropped when full
+
+// a compensated reading of the asynchronous driver
+struct MS561101BA_Sample {
+  float pressure; // mbar
+  float temperature; // degrees C, of the D2 conversion the pressure was compensated with
+  unsigned long time; // micros() when the D1 conversion was read
+};
+
 
 
 class MS561101BA {
@@ -57,6 +71,24 @@ class MS561101BA {
     int readPROM();
     void reset();
     unsigned long lastPresConv, lastTempConv;
+
+    // Asynchronous driver. start() begins a D2 (temperature) then D1
+    // (pressure) conversion pipeline, and poll() from loop() reads each
+    // conversion as soon as its OSR conversion time is over and starts the
+    // next one straight away. After every D1 a compensated sample is queued.
+    // With tempEvery > 1 the temperature is only converted before every
+    // tempEvery-th pressure, which comes close to doubling the sample rate.
+    // Don't mix with the get*() and raw*() calls above, they share the device.
+    void start(uint8_t OSR, uint8_t tempEvery = 1);
+    void stop();
+    bool poll(); // true when a sample was queued
+    bool ready(); // a sample is waiting
+    uint8_t available(); // samples waiting
+    bool read(MS561101BA_Sample *sample); // the oldest, false if none
+    unsigned long samples, dropped, errors; // queued, overwritten unread, ADC reads of 0
+
+    // microseconds a conversion with OSR takes, the datasheet maximum
+    static unsigned long conversionTime(uint8_t OSR);
   private:
     void startConversion(uint8_t command);
     unsigned long getConversion(uint8_t command);
@@ -64,6 +96,14 @@ class MS561101BA {
     uint16_t _C[MS561101BA_PROM_REG_COUNT];
     //unsigned long lastPresConv, lastTempConv;
     int32_t presCache, tempCache;
+    float pressureOf(int32_t rawPress, int64_t dT);
+    float temperatureOf(int64_t dT);
+    void convert(uint8_t state);
+    uint8_t _state, _osr, _tempEvery, _sinceTemp;
+    unsigned long _convStart, _convTime;
+    int64_t _dT;
+    MS561101BA_Sample _queue[MS561101BA_QUEUE_SIZE];
+    uint8_t _head, _count; // _queue[_head] is the oldest sample
 };
 
 #endif // MS561101BA_h
\ No newline at end of file